@@ -0,0 +1,73 @@
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace {
+
+// Values below this each get their own bucket; above it, each power of 2 is
+// split into SUB_BUCKETS / 2 buckets.
+constexpr uint64_t SUB_BUCKETS = uint64_t(1) << HISTOGRAM_PRECISION_BITS;
+constexpr uint64_t HALF = SUB_BUCKETS / 2;
+constexpr uint64_t MAX_VALUE = (uint64_t(1) << HISTOGRAM_MAX_BITS) - 1;
+constexpr size_t N_BUCKETS =
+    SUB_BUCKETS + (HISTOGRAM_MAX_BITS - HISTOGRAM_PRECISION_BITS) * HALF;
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram() : buckets(N_BUCKETS) {
+}
+
+size_t LatencyHistogram::bucket_of(uint64_t value) {
+  value = std::min(value, MAX_VALUE);
+  if (value < SUB_BUCKETS) return value;
+  // Keep the top HISTOGRAM_PRECISION_BITS bits of the value; shift says how
+  // many were dropped, and the rest (which start with a 1) say where in that
+  // power of 2 it is
+  int shift = std::bit_width(value) - HISTOGRAM_PRECISION_BITS;
+  return SUB_BUCKETS + (shift - 1) * HALF + ((value >> shift) - HALF);
+}
+
+uint64_t LatencyHistogram::highest_in(size_t bucket) {
+  if (bucket < SUB_BUCKETS) return bucket;
+  int shift = (bucket - SUB_BUCKETS) / HALF + 1;
+  uint64_t top = (bucket - SUB_BUCKETS) % HALF + HALF;
+  return ((top + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(nanoseconds latency) {
+  uint64_t value = std::max<int64_t>(latency.count(), 0);
+  this->buckets[bucket_of(value)]++;
+  this->n++;
+  this->largest = std::max(this->largest, value);
+  this->sum += value;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+  for (size_t i = 0; i < this->buckets.size(); i++) {
+    this->buckets[i] += other.buckets[i];
+  }
+  this->n += other.n;
+  this->largest = std::max(this->largest, other.largest);
+  this->sum += other.sum;
+}
+
+nanoseconds LatencyHistogram::mean() const {
+  if (this->n == 0) return 0ns;
+  return nanoseconds(uint64_t(this->sum / this->n));
+}
+
+nanoseconds LatencyHistogram::percentile(double percent) const {
+  if (this->n == 0) return 0ns;
+  // The rank of the value we're after, counting from 1
+  uint64_t rank = std::max<uint64_t>(
+      1, uint64_t(std::clamp(percent, 0.0, 100.0) / 100 * this->n + 0.5));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < this->buckets.size(); i++) {
+    seen += this->buckets[i];
+    if (seen >= rank) {
+      return nanoseconds(std::min(highest_in(i), this->largest));
+    }
+  }
+  return nanoseconds(this->largest);
+}
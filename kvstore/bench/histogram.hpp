@@ -0,0 +1,56 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+using namespace std::chrono;
+
+// Values are kept to within 1 / 2^(HISTOGRAM_PRECISION_BITS - 1) of their
+// true value, i.e. better than 1% at 8 bits.
+#define HISTOGRAM_PRECISION_BITS 8
+// Values from 2^HISTOGRAM_MAX_BITS ns (about 18 minutes) up are all counted
+// as the largest value below that.
+#define HISTOGRAM_MAX_BITS 40
+
+/*
+ * A latency histogram in the style of HdrHistogram: buckets are exact for
+ * small values, then double in width with each power of 2, so every value is
+ * recorded to the same relative precision in a fixed, small amount of memory
+ * (about 35KB). Recording is a couple of shifts and an increment.
+ *
+ * Not thread-safe; give each thread its own, and merge them.
+ */
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+
+  void record(nanoseconds latency);
+  // Adds other's values to ours.
+  void merge(const LatencyHistogram& other);
+
+  uint64_t count() const {
+    return this->n;
+  }
+  nanoseconds max() const {
+    return nanoseconds(this->largest);
+  }
+  nanoseconds mean() const;
+  // The value that percentile percent (in [0, 100]) of values are at or
+  // below, to the histogram's precision.
+  nanoseconds percentile(double percent) const;
+
+ private:
+  std::vector<uint64_t> buckets;
+  uint64_t n = 0;
+  // Of the values as given, before bucketing.
+  uint64_t largest = 0;
+  double sum = 0;
+
+  static size_t bucket_of(uint64_t value);
+  // The largest value that falls in bucket.
+  static uint64_t highest_in(size_t bucket);
+};
+
+#endif /* end of include guard */
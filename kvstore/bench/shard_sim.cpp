@@ -0,0 +1,371 @@
+#include "shard_sim.hpp"
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string_view>
+#include <unordered_map>
+
+#include "common/utils.hpp"
+#include "shardmaster/rebalance.hpp"
+
+std::optional<ShardPolicy> parse_policy(const std::string& name) {
+  if (name == "static") return ShardPolicy::STATIC;
+  if (name == "consistent") return ShardPolicy::CONSISTENT;
+  if (name == "load") return ShardPolicy::LOAD_AWARE;
+  return std::nullopt;
+}
+
+const char* policy_name(ShardPolicy policy) {
+  switch (policy) {
+    case ShardPolicy::STATIC:
+      return "static";
+    case ShardPolicy::CONSISTENT:
+      return "consistent";
+    case ShardPolicy::LOAD_AWARE:
+      return "load";
+    default:
+      return "?";
+  }
+}
+
+std::optional<MembershipEvent> parse_event(const std::string& line) {
+  std::istringstream words(line);
+  std::string kind, server;
+  words >> kind;
+  if (kind == "rebalance") {
+    return MembershipEvent{MembershipEvent::Kind::REBALANCE};
+  }
+  if (!(words >> server)) return std::nullopt;
+  if (kind == "join") {
+    return MembershipEvent{MembershipEvent::Kind::JOIN, server};
+  }
+  if (kind == "leave") {
+    return MembershipEvent{MembershipEvent::Kind::LEAVE, server};
+  }
+  if (kind != "move") return std::nullopt;
+
+  MembershipEvent event{MembershipEvent::Kind::MOVE, server};
+  std::string lower, upper;
+  while (words >> lower) {
+    if (!(words >> upper)) return std::nullopt;
+    lower = to_upper(lower);
+    upper = to_upper(upper);
+    if (lower.empty() || lower.size() != upper.size() ||
+        lower.size() > ROUTING_MAX_GRANULARITY || !is_valid(lower) ||
+        !is_valid(upper) || upper < lower) {
+      return std::nullopt;
+    }
+    event.shards.push_back({lower, upper});
+  }
+  if (event.shards.empty()) return std::nullopt;
+  return event;
+}
+
+std::string describe(const MembershipEvent& event) {
+  std::ostringstream out;
+  switch (event.kind) {
+    case MembershipEvent::Kind::JOIN:
+      out << "join " << event.server;
+      break;
+    case MembershipEvent::Kind::LEAVE:
+      out << "leave " << event.server;
+      break;
+    case MembershipEvent::Kind::MOVE:
+      out << "move " << event.server;
+      for (auto&& shard : event.shards) out << ' ' << shard;
+      break;
+    case MembershipEvent::Kind::REBALANCE:
+      out << "rebalance";
+      break;
+  }
+  return out.str();
+}
+
+KeyTrace synthetic_trace(KeyDistribution distribution, uint64_t records,
+                         uint64_t n_accesses, const std::string& prefix,
+                         uint64_t seed) {
+  KeyChooser chooser(distribution, records, prefix);
+  KeyTrace trace;
+  trace.keys.reserve(records);
+  for (uint64_t i = 0; i < records; i++) {
+    trace.keys.push_back(chooser.key_name(i));
+  }
+  trace.accesses.assign(records, 0);
+  std::mt19937_64 rng(seed);
+  for (uint64_t i = 0; i < n_accesses && records > 0; i++) {
+    trace.accesses[chooser.next_existing(rng)]++;
+  }
+  return trace;
+}
+
+KeyTrace read_trace(std::istream& in) {
+  KeyTrace trace;
+  std::unordered_map<std::string, size_t> index;
+  std::string key;
+  while (std::getline(in, key)) {
+    if (key.empty()) continue;
+    auto [it, added] = index.try_emplace(key, trace.keys.size());
+    if (added) {
+      trace.keys.push_back(key);
+      trace.accesses.push_back(0);
+    }
+    trace.accesses[it->second]++;
+  }
+  return trace;
+}
+
+ShardSimulator::ShardSimulator(ShardPolicy policy, const KeyTrace* trace,
+                               size_t vnodes, size_t rebalance_rounds)
+    : policy(policy),
+      trace(trace),
+      rebalance_rounds(rebalance_rounds),
+      ring(vnodes) {
+  if (policy == ShardPolicy::LOAD_AWARE) {
+    this->upper_keys.reserve(trace->keys.size());
+    for (auto&& key : trace->keys) this->upper_keys.push_back(to_upper(key));
+  }
+}
+
+bool ShardSimulator::apply(const MembershipEvent& event) {
+  if (this->policy == ShardPolicy::CONSISTENT) {
+    switch (event.kind) {
+      case MembershipEvent::Kind::JOIN:
+        this->ring_changed = true;
+        return this->ring.add(event.server);
+      case MembershipEvent::Kind::LEAVE:
+        this->ring_changed = true;
+        return this->ring.remove(event.server);
+      case MembershipEvent::Kind::MOVE:
+        return false;
+      case MembershipEvent::Kind::REBALANCE:
+        return true;
+    }
+  }
+
+  auto& servers = this->current.servers;
+  auto it = std::find_if(servers.begin(), servers.end(), [&](auto&& sc) {
+    return sc.server == event.server;
+  });
+  bool joined = it != servers.end();
+
+  switch (event.kind) {
+    case MembershipEvent::Kind::JOIN:
+      if (joined) return false;
+      servers.push_back({event.server, {}});
+      this->resplit();
+      return true;
+    case MembershipEvent::Kind::LEAVE:
+      if (!joined) return false;
+      servers.erase(it);
+      this->resplit();
+      return true;
+    case MembershipEvent::Kind::MOVE:
+      if (!joined || this->policy != ShardPolicy::STATIC) return false;
+      this->move(event.server, event.shards);
+      return true;
+    case MembershipEvent::Kind::REBALANCE:
+      if (this->policy != ShardPolicy::LOAD_AWARE) return true;
+      for (size_t round = 0; round < this->rebalance_rounds; round++) {
+        if (!this->rebalance()) break;
+      }
+      return true;
+  }
+  return false;
+}
+
+const ShardmasterConfig& ShardSimulator::config() {
+  if (this->ring_changed) {
+    this->current = this->ring.config();
+    this->ring_changed = false;
+  }
+  return this->current;
+}
+
+PlacementStats ShardSimulator::measure() {
+  auto router = std::make_unique<ShardRouter>(this->config());
+  const std::vector<std::string>& keys = this->trace->keys;
+
+  PlacementStats stats;
+  stats.servers = this->current.servers.size();
+  std::unordered_map<std::string_view, size_t> index;
+  for (auto&& sc : this->current.servers) {
+    stats.shards += sc.shards.size();
+    index.emplace(sc.server, index.size());
+  }
+
+  std::vector<uint64_t> server_keys(stats.servers), server_load(stats.servers);
+  std::vector<const std::string*> owners(keys.size());
+  uint64_t placed_load = 0;
+  for (size_t i = 0; i < keys.size(); i++) {
+    const std::string* owner = router->server_for(keys[i]);
+    owners[i] = owner;
+    if (!this->owners.empty()) {
+      const std::string* before = this->owners[i];
+      if (!owner != !before || (owner && *owner != *before)) {
+        stats.keys_moved++;
+      }
+    }
+    if (!owner) {
+      stats.keys_unplaced++;
+      continue;
+    }
+    size_t server = index.at(*owner);
+    server_keys[server]++;
+    server_load[server] += this->trace->accesses[i];
+    placed_load += this->trace->accesses[i];
+  }
+
+  if (stats.servers > 0) {
+    uint64_t placed = keys.size() - stats.keys_unplaced;
+    double mean_keys = double(placed) / stats.servers;
+    double mean_load = double(placed_load) / stats.servers;
+    if (mean_keys > 0) {
+      stats.key_imbalance =
+          *std::max_element(server_keys.begin(), server_keys.end()) /
+          mean_keys;
+    }
+    if (mean_load > 0) {
+      stats.load_imbalance =
+          *std::max_element(server_load.begin(), server_load.end()) /
+          mean_load;
+    }
+  }
+
+  // (owners point into router, so the old ones go together)
+  this->owners = std::move(owners);
+  this->router = std::move(router);
+  return stats;
+}
+
+void ShardSimulator::resplit() {
+  auto& servers = this->current.servers;
+  if (servers.empty()) return;
+  std::vector<Shard> shards = split_into(servers.size());
+  for (size_t i = 0; i < servers.size(); i++) {
+    servers[i].shards = {shards[i]};
+  }
+}
+
+void ShardSimulator::move(const std::string& server,
+                          const std::vector<Shard>& shards) {
+  // Work in buckets at the finest granularity around, where every bound is
+  // exact (a coarser bound covers all the finer buckets under it)
+  size_t granularity = 0;
+  for (auto&& shard : shards) {
+    granularity = std::max(granularity, shard.granularity());
+  }
+  for (auto&& sc : this->current.servers) {
+    for (auto&& shard : sc.shards) {
+      granularity = std::max(granularity, shard.granularity());
+    }
+  }
+  auto buckets = [granularity](const Shard& shard) {
+    size_t finer = granularity - shard.granularity();
+    return std::make_pair(
+        str_to_bucket(shard.lower + std::string(finer, VALID_CHARS.front())),
+        str_to_bucket(shard.upper + std::string(finer, VALID_CHARS.back())));
+  };
+  std::vector<std::pair<size_t, size_t>> moved;
+  for (auto&& shard : shards) moved.push_back(buckets(shard));
+
+  for (auto&& sc : this->current.servers) {
+    std::vector<Shard> kept;
+    for (auto&& shard : sc.shards) {
+      std::vector<std::pair<size_t, size_t>> pieces = {buckets(shard)};
+      for (auto [lower, upper] : moved) {
+        std::vector<std::pair<size_t, size_t>> left;
+        for (auto [piece_lower, piece_upper] : pieces) {
+          if (piece_upper < lower || upper < piece_lower) {
+            left.push_back({piece_lower, piece_upper});
+            continue;
+          }
+          if (piece_lower < lower) left.push_back({piece_lower, lower - 1});
+          if (upper < piece_upper) left.push_back({upper + 1, piece_upper});
+        }
+        pieces = std::move(left);
+      }
+      // (Untouched shards keep their bounds)
+      if (pieces.size() == 1 && pieces[0] == buckets(shard)) {
+        kept.push_back(shard);
+        continue;
+      }
+      for (auto [lower, upper] : pieces) {
+        kept.push_back({bucket_to_str(lower, granularity),
+                        bucket_to_str(upper, granularity)});
+      }
+    }
+    if (sc.server == server) {
+      kept.insert(kept.end(), shards.begin(), shards.end());
+    }
+    sort_shards(kept);
+    sc.shards = std::move(kept);
+  }
+}
+
+bool ShardSimulator::rebalance() {
+  // Every shard, sorted, so each key's is a binary search away
+  struct Placed {
+    const Shard* shard;
+    ShardLoad* load;
+  };
+  std::map<std::string, std::vector<ShardLoad>> loads;
+  std::vector<Placed> placed;
+  for (auto&& sc : this->current.servers) {
+    auto& server_loads = loads[sc.server];
+    for (auto&& shard : sc.shards) server_loads.push_back({shard, 0, 0});
+  }
+  for (auto&& sc : this->current.servers) {
+    auto& server_loads = loads[sc.server];
+    for (size_t i = 0; i < sc.shards.size(); i++) {
+      placed.push_back({&sc.shards[i], &server_loads[i]});
+    }
+  }
+  std::sort(placed.begin(), placed.end(), [](auto&& a, auto&& b) {
+    return a.shard->lower < b.shard->lower;
+  });
+
+  // The trace stands in for one interval's load reports
+  for (size_t i = 0; i < this->upper_keys.size(); i++) {
+    const std::string& key = this->upper_keys[i];
+    auto it = std::upper_bound(
+        placed.begin(), placed.end(), key,
+        [](const std::string& key, auto&& p) { return key < p.shard->lower; });
+    if (it == placed.begin()) continue;
+    --it;
+    if (!it->shard->contains(key)) continue;
+    it->load->rate += this->trace->accesses[i];
+    it->load->keys++;
+  }
+  return ::rebalance(&this->current, loads);
+}
+
+LookupCost measure_lookups(const ShardmasterConfig& config,
+                           const std::vector<std::string>& keys,
+                           size_t scan_sample) {
+  LookupCost cost{};
+  auto start = steady_clock::now();
+  ShardRouter router(config);
+  cost.build = duration_cast<microseconds>(steady_clock::now() - start);
+  if (keys.empty()) return cost;
+
+  start = steady_clock::now();
+  for (auto&& key : keys) router.server_for(key);
+  cost.router_ns =
+      duration<double, std::nano>(steady_clock::now() - start).count() /
+      keys.size();
+
+  ShardmasterConfig scanned = config;
+  size_t sample = std::min(scan_sample, keys.size());
+  size_t scans = 0;
+  start = steady_clock::now();
+  while (scans < sample && steady_clock::now() - start < SIM_SCAN_TIME) {
+    scanned.get_server(keys[scans * keys.size() / sample]);
+    scans++;
+  }
+  cost.scan_ns =
+      duration<double, std::nano>(steady_clock::now() - start).count() /
+      std::max<size_t>(scans, 1);
+  return cost;
+}
@@ -0,0 +1,156 @@
+#ifndef SHARD_SIM_HPP
+#define SHARD_SIM_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common/config.hpp"
+#include "common/shard.hpp"
+#include "shardmaster/hash_ring.hpp"
+#include "workload.hpp"
+
+using namespace std::chrono;
+
+// Most rounds of rebalancing one REBALANCE event runs (each as if after a
+// round of load reports), stopping early once the load is even enough.
+#define SIM_REBALANCE_ROUNDS 16
+// Keys routed by scanning the config (as ShardmasterConfig::get_server
+// does) when measuring lookup cost, and the most time spent on it; scans
+// are slow with many shards.
+#define SIM_SCAN_SAMPLE 10'000
+#define SIM_SCAN_TIME 1s
+
+// The ways a shardmaster can place shards.
+enum class ShardPolicy {
+  // An even split_into over the servers, in the order they joined (as
+  // StaticShardmaster does), redone on every Join and Leave; Moves as asked.
+  STATIC,
+  // A consistent-hashing ring (as ConsistentShardmaster has).
+  CONSISTENT,
+  // STATIC's split, then rebalanced by load (as DynamicShardmaster does).
+  LOAD_AWARE,
+};
+
+std::optional<ShardPolicy> parse_policy(const std::string& name);
+const char* policy_name(ShardPolicy policy);
+
+/*
+ * A change to the servers, as a shardmaster would be asked for it, or (for
+ * load-aware placement) a rebalance. Written one per line in traces:
+ *   join <server>
+ *   leave <server>
+ *   move <server> <lower> <upper> [<lower> <upper> ...]
+ *   rebalance
+ */
+struct MembershipEvent {
+  enum class Kind { JOIN, LEAVE, MOVE, REBALANCE } kind;
+  std::string server = "";
+  // The shards moved, for MOVE.
+  std::vector<Shard> shards = {};
+};
+
+// Parses a trace line, or returns nullopt if it isn't one.
+std::optional<MembershipEvent> parse_event(const std::string& line);
+std::string describe(const MembershipEvent& event);
+
+// The keys placed, and how many of the trace's accesses each got.
+struct KeyTrace {
+  std::vector<std::string> keys;
+  std::vector<uint64_t> accesses;
+};
+
+// records keys named as kvbench names them (see KeyChooser), with n_accesses
+// accesses drawn from distribution.
+KeyTrace synthetic_trace(KeyDistribution distribution, uint64_t records,
+                         uint64_t n_accesses, const std::string& prefix = "",
+                         uint64_t seed = 0);
+// A trace of one access per line (so a key on several lines is accessed
+// that many times); blank lines are skipped.
+KeyTrace read_trace(std::istream& in);
+
+// How evenly the keys sit on the servers, and what the last change moved.
+struct PlacementStats {
+  size_t servers = 0;
+  size_t shards = 0;
+  // Keys whose server changed since the last measure().
+  uint64_t keys_moved = 0;
+  // Keys (and accesses) on no server.
+  uint64_t keys_unplaced = 0;
+  // The busiest server's keys (and accesses) over the mean per server.
+  double key_imbalance = 0;
+  double load_imbalance = 0;
+};
+
+/*
+ * Places a trace's keys on servers as a shardmaster with the given policy
+ * would, offline: membership events change the config (with the same
+ * split_into, HashRing and rebalance the shardmasters use), and measure()
+ * routes every key by it (with a ShardRouter, as clients do), so policies
+ * can be compared on millions of keys and thousands of servers without
+ * starting any.
+ */
+class ShardSimulator {
+ public:
+  ShardSimulator(ShardPolicy policy, const KeyTrace* trace,
+                 size_t vnodes = RING_VNODES,
+                 size_t rebalance_rounds = SIM_REBALANCE_ROUNDS);
+
+  /*
+   * Applies event to the config, returning false if the policy's
+   * shardmaster would refuse it: a server joining twice or leaving without
+   * having joined, or a Move other than under STATIC (or to a server that
+   * hasn't joined). Rebalances only change anything under LOAD_AWARE.
+   */
+  bool apply(const MembershipEvent& event);
+  // Routes every key by the current config.
+  PlacementStats measure();
+
+  const ShardmasterConfig& config();
+
+ private:
+  ShardPolicy policy;
+  const KeyTrace* trace;
+  // The trace's keys in upper case, as shards bound them (for rebalancing).
+  std::vector<std::string> upper_keys;
+  size_t rebalance_rounds;
+  ShardmasterConfig current;
+  // Servers on the ring, for CONSISTENT, and whether current is behind it
+  // (the ring's config is only worked out when it's needed, as that's slow
+  // with thousands of servers).
+  HashRing ring;
+  bool ring_changed = false;
+
+  // The router of the last measure(), and each key's server by it (pointing
+  // into it).
+  std::unique_ptr<ShardRouter> router;
+  std::vector<const std::string*> owners;
+
+  // Splits the key space evenly between the servers again.
+  void resplit();
+  // Moves shards to server, taking them from whoever has them.
+  void move(const std::string& server, const std::vector<Shard>& shards);
+  // Rebalances by the trace's load on each shard; false if nothing moved.
+  bool rebalance();
+};
+
+// What routing keys with a config costs.
+struct LookupCost {
+  // Compiling the config into a ShardRouter.
+  microseconds build;
+  // Per key: with the router, and scanning the config.
+  double router_ns;
+  double scan_ns;
+};
+
+// Routes keys with config (scanning for up to scan_sample of them, or as
+// many as it can in SIM_SCAN_TIME).
+LookupCost measure_lookups(const ShardmasterConfig& config,
+                           const std::vector<std::string>& keys,
+                           size_t scan_sample = SIM_SCAN_SAMPLE);
+
+#endif /* end of include guard */
@@ -0,0 +1,146 @@
+#include "workload.hpp"
+
+#include <cmath>
+
+const char* op_name(OpType op) {
+  switch (op) {
+    case OpType::GET:
+      return "get";
+    case OpType::PUT:
+      return "put";
+    case OpType::APPEND:
+      return "append";
+    case OpType::MULTI_GET:
+      return "multiget";
+    default:
+      return "?";
+  }
+}
+
+std::optional<WorkloadMix> WorkloadMix::preset(char workload) {
+  switch (std::toupper(workload)) {
+    case 'A':
+      return WorkloadMix{.get = 0.5, .put = 0.5};
+    case 'B':
+      return WorkloadMix{.get = 0.95, .put = 0.05};
+    case 'C':
+      return WorkloadMix{.get = 1};
+    case 'D':
+      return WorkloadMix{.get = 0.95, .put = 0.05};
+    default:
+      return std::nullopt;
+  }
+}
+
+OpType WorkloadMix::choose(double u) const {
+  double total = this->get + this->put + this->append + this->multi_get;
+  double x = u * total;
+  if ((x -= this->get) < 0) return OpType::GET;
+  if ((x -= this->put) < 0) return OpType::PUT;
+  if ((x -= this->append) < 0) return OpType::APPEND;
+  if (this->multi_get > 0) return OpType::MULTI_GET;
+  // Only reachable through rounding; fall back to the last non-empty type
+  if (this->append > 0) return OpType::APPEND;
+  return this->put > 0 ? OpType::PUT : OpType::GET;
+}
+
+std::optional<KeyDistribution> parse_distribution(const std::string& name) {
+  if (name == "uniform") return KeyDistribution::UNIFORM;
+  if (name == "zipfian") return KeyDistribution::ZIPFIAN;
+  if (name == "latest") return KeyDistribution::LATEST;
+  return std::nullopt;
+}
+
+double uniform01(std::mt19937_64& rng) {
+  return std::uniform_real_distribution<double>(0, 1)(rng);
+}
+
+namespace {
+
+double zeta(uint64_t n, double theta) {
+  double sum = 0;
+  for (uint64_t i = 1; i <= n; i++) sum += 1 / std::pow(double(i), theta);
+  return sum;
+}
+
+// FNV-1a, over the bytes of i.
+uint64_t fnv1a(uint64_t i) {
+  uint64_t hash = 0xCBF29CE484222325ull;
+  for (int byte = 0; byte < 8; byte++, i >>= 8) {
+    hash ^= i & 0xFF;
+    hash *= 0x100000001B3ull;
+  }
+  return hash;
+}
+
+}  // namespace
+
+ZipfianGenerator::ZipfianGenerator(uint64_t n, double theta)
+    : n(std::max<uint64_t>(n, 1)), theta(theta) {
+  this->alpha = 1 / (1 - theta);
+  this->zetan = zeta(this->n, theta);
+  double zeta2 = zeta(2, theta);
+  this->eta = (1 - std::pow(2.0 / this->n, 1 - theta)) /
+              (1 - zeta2 / this->zetan);
+}
+
+uint64_t ZipfianGenerator::next(double u) const {
+  double uz = u * this->zetan;
+  if (uz < 1) return 0;
+  if (uz < 1 + std::pow(0.5, this->theta)) return std::min<uint64_t>(1, n - 1);
+  uint64_t i = uint64_t(this->n *
+                        std::pow(this->eta * u - this->eta + 1, this->alpha));
+  return std::min(i, this->n - 1);
+}
+
+KeyChooser::KeyChooser(KeyDistribution distribution, uint64_t n_records,
+                       const std::string& prefix)
+    : distribution(distribution),
+      n_records(std::max<uint64_t>(n_records, 1)),
+      prefix(prefix),
+      n_inserted(this->n_records),
+      n_acknowledged(this->n_records) {
+  if (distribution != KeyDistribution::UNIFORM) {
+    this->zipf.emplace(this->n_records);
+  }
+}
+
+uint64_t KeyChooser::next_existing(std::mt19937_64& rng) {
+  double u = uniform01(rng);
+  switch (this->distribution) {
+    case KeyDistribution::ZIPFIAN:
+      return this->zipf->next(u);
+    case KeyDistribution::LATEST: {
+      // Ranks past the first n_records are rare enough to just fold back
+      uint64_t newest = this->n_acknowledged.load() - 1;
+      return newest - std::min(this->zipf->next(u), newest);
+    }
+    default:
+      return std::min(uint64_t(u * this->n_records), this->n_records - 1);
+  }
+}
+
+uint64_t KeyChooser::next_write(std::mt19937_64& rng) {
+  if (this->distribution == KeyDistribution::LATEST) {
+    return this->n_inserted++;
+  }
+  return this->next_existing(rng);
+}
+
+void KeyChooser::acknowledge(uint64_t i) {
+  uint64_t acknowledged = this->n_acknowledged.load();
+  while (acknowledged < i + 1 &&
+         !this->n_acknowledged.compare_exchange_weak(acknowledged, i + 1)) {
+  }
+}
+
+std::string KeyChooser::key_name(uint64_t i) const {
+  // 12 base-36 digits: 62 bits of the hash, in valid key characters
+  static constexpr char DIGITS[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  std::string name = this->prefix;
+  uint64_t hash = fnv1a(i);
+  for (int digit = 0; digit < 12; digit++, hash /= 36) {
+    name += DIGITS[hash % 36];
+  }
+  return name;
+}
@@ -0,0 +1,109 @@
+#ifndef WORKLOAD_HPP
+#define WORKLOAD_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+
+// The skew of zipfian key choices, as in YCSB: a few keys get most accesses.
+#define ZIPFIAN_THETA 0.99
+
+// The kinds of operation a workload is made of.
+enum class OpType { GET, PUT, APPEND, MULTI_GET, COUNT };
+
+const char* op_name(OpType op);
+
+/*
+ * What fraction of a workload's operations are of each type. The fractions
+ * are relative to each other, so they needn't add up to 1.
+ */
+struct WorkloadMix {
+  double get = 0;
+  double put = 0;
+  double append = 0;
+  double multi_get = 0;
+
+  // The standard YCSB core workloads that fit our operations (A: update
+  // heavy, B: read mostly, C: read only, D: read latest; D's inserts are
+  // Puts of new keys).
+  static std::optional<WorkloadMix> preset(char workload);
+
+  // Picks an operation type, given a uniform random number in [0, 1).
+  OpType choose(double u) const;
+};
+
+// How the keys operated on are picked from those loaded.
+enum class KeyDistribution {
+  // Every key equally likely.
+  UNIFORM,
+  // Key i is picked with probability proportional to 1 / (i + 1)^theta.
+  ZIPFIAN,
+  // Like ZIPFIAN, but by recency: the newest key is the most likely, and so
+  // on. Puts go to new keys, so the hot set keeps moving.
+  LATEST,
+};
+
+std::optional<KeyDistribution> parse_distribution(const std::string& name);
+
+/*
+ * Draws integers in [0, n) from a zipfian distribution, using the method of
+ * Gray et al., "Quickly Generating Billion-Record Synthetic Databases" (as
+ * YCSB does): constant time per draw, after O(n) setup.
+ */
+class ZipfianGenerator {
+ public:
+  explicit ZipfianGenerator(uint64_t n, double theta = ZIPFIAN_THETA);
+
+  // Given a uniform random number in [0, 1).
+  uint64_t next(double u) const;
+
+ private:
+  uint64_t n;
+  double theta;
+  double alpha;
+  double zetan;
+  double eta;
+};
+
+/*
+ * Picks which key each operation touches, and names keys. Shared by all of a
+ * benchmark's threads (each brings its own random number generator).
+ *
+ * Key i's name is derived from a hash of i, so consecutive (or equally hot)
+ * keys are spread across the whole key space, and hence across shards, unless
+ * a prefix is given.
+ */
+class KeyChooser {
+ public:
+  KeyChooser(KeyDistribution distribution, uint64_t n_records,
+             const std::string& prefix = "");
+
+  // The key for a read (or update) of an existing record.
+  uint64_t next_existing(std::mt19937_64& rng);
+  // The key for a write: an existing record, or for LATEST, a brand new one
+  // (which should be acknowledged once it's written).
+  uint64_t next_write(std::mt19937_64& rng);
+  // Lets reads pick inserted record i.
+  void acknowledge(uint64_t i);
+
+  std::string key_name(uint64_t i) const;
+
+ private:
+  KeyDistribution distribution;
+  uint64_t n_records;
+  std::string prefix;
+  // Zipfian ranks over the records loaded (LATEST reuses them for recency).
+  std::optional<ZipfianGenerator> zipf;
+  // Records loaded or inserted so far, and the number of the first one not
+  // known to be written yet. (Inserts finishing out of order can leave a
+  // few unwritten records below it, which reads may rarely miss.)
+  std::atomic<uint64_t> n_inserted;
+  std::atomic<uint64_t> n_acknowledged;
+};
+
+// A uniform random number in [0, 1).
+double uniform01(std::mt19937_64& rng);
+
+#endif /* end of include guard */
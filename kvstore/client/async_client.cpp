@@ -0,0 +1,269 @@
+#include "async_client.hpp"
+
+void PipelinedConn::call(Request req, Callback done) {
+  std::unique_lock send_lock(this->send_mtx);
+  std::shared_ptr<ServerConn> conn;
+  {
+    std::unique_lock lock(this->mtx);
+    conn = this->conn;
+    if (conn) this->in_flight.push_back(std::move(done));
+  }
+  if (!conn) {
+    this->open(req, std::move(done), std::move(send_lock));
+    return;
+  }
+
+  if (!conn->send_request(req)) {
+    std::vector<Callback> failed;
+    {
+      std::unique_lock lock(this->mtx);
+      // Unless someone else already failed everything on this connection
+      if (conn == this->conn) failed = this->disconnect();
+    }
+    send_lock.unlock();
+    for (auto&& callback : failed) callback(std::nullopt);
+  }
+}
+
+void PipelinedConn::open(const Request& req, Callback done,
+                         std::unique_lock<std::mutex> send_lock) {
+  std::shared_ptr<ServerConn> conn = connect_to_server(this->address);
+  if (!conn || conn->shm) {
+    cerr_color(RED, "Failed to connect to KvServer at ", this->address, '.');
+    send_lock.unlock();
+    done(std::nullopt);
+    return;
+  }
+  conn->compression = this->compression;
+
+  // Nothing else can go out until the server has answered this, and said
+  // whether it speaks the compact format
+  std::optional<Response> res;
+  if (conn->send_request(req)) res = conn->recv_response();
+  if (!res) {
+    send_lock.unlock();
+    done(std::nullopt);
+    return;
+  }
+  // A server that doesn't know the compact format never agrees to it
+  if (conn->format == WireFormat::LEGACY) conn->compact = false;
+
+  {
+    std::unique_lock lock(this->mtx);
+    this->conn = conn;
+  }
+  std::weak_ptr<PipelinedConn> self = this->weak_from_this();
+  if (!this->loop->add(conn->fd, [self] {
+        if (auto pipelined = self.lock()) pipelined->on_readable();
+      })) {
+    std::unique_lock lock(this->mtx);
+    this->conn.reset();
+  }
+  send_lock.unlock();
+  done(std::move(res));
+}
+
+void PipelinedConn::close() {
+  std::vector<Callback> failed;
+  {
+    std::unique_lock lock(this->mtx);
+    failed = this->disconnect();
+  }
+  for (auto&& callback : failed) callback(std::nullopt);
+}
+
+void PipelinedConn::on_readable() {
+  std::shared_ptr<ServerConn> conn;
+  {
+    std::unique_lock lock(this->mtx);
+    conn = this->conn;
+  }
+  if (!conn) return;
+
+  // Only this thread reads, so no lock is needed. The rest of a response
+  // follows its first bytes closely, so reading it whole here doesn't hold
+  // up the loop for long.
+  std::optional<Response> res = conn->recv_response();
+
+  Callback done;
+  std::vector<Callback> failed;
+  {
+    std::unique_lock lock(this->mtx);
+    // Closed while we were reading
+    if (conn != this->conn) return;
+
+    if (!res || this->in_flight.empty()) {
+      failed = this->disconnect();
+    } else {
+      done = std::move(this->in_flight.front());
+      this->in_flight.pop_front();
+    }
+  }
+  if (done) done(std::move(res));
+  for (auto&& callback : failed) callback(std::nullopt);
+}
+
+std::vector<PipelinedConn::Callback> PipelinedConn::disconnect() {
+  std::vector<Callback> failed;
+  for (auto&& callback : this->in_flight) failed.push_back(std::move(callback));
+  this->in_flight.clear();
+
+  if (this->conn) {
+    this->loop->remove(this->conn->fd);
+    this->conn->shutdown();
+    this->conn.reset();
+  }
+  return failed;
+}
+
+namespace {
+
+// Makes the callback for a request: on a response of type Expected, done
+// gets extract(response); otherwise it gets failure, and the server's error
+// (if any) is logged.
+template <typename Expected, typename T, typename Extract>
+PipelinedConn::Callback complete(const char* what, T failure,
+                                 AsyncClient::Callback<T> done,
+                                 Extract extract) {
+  return [=, done = std::move(done)](std::optional<Response> res) {
+    if (res) {
+      if (auto* expected = std::get_if<Expected>(&*res)) {
+        done(extract(std::move(*expected)));
+        return;
+      }
+      if (auto* error_res = std::get_if<ErrorResponse>(&*res)) {
+        cerr_color(RED, "Failed to ", what, ": ", error_res->msg);
+      }
+    }
+    done(failure);
+  };
+}
+
+// Runs start with a callback that fulfills the returned future.
+template <typename T, typename Start>
+std::future<T> to_future(Start start) {
+  auto promise = std::make_shared<std::promise<T>>();
+  std::future<T> future = promise->get_future();
+  start([promise](T result) { promise->set_value(std::move(result)); });
+  return future;
+}
+
+}  // namespace
+
+void AsyncClient::GetAsync(const std::string& key,
+                           Callback<std::optional<std::string>> done) {
+  this->conn->call(
+      GetRequest{key},
+      complete<GetResponse, std::optional<std::string>>(
+          "Get value from server", std::nullopt, std::move(done),
+          [](GetResponse&& res) { return std::move(res.value); }));
+}
+
+void AsyncClient::PutAsync(const std::string& key, const std::string& value,
+                           Callback<bool> done) {
+  this->conn->call(PutRequest{key, value},
+                   complete<PutResponse, bool>("Put value to server", false,
+                                               std::move(done),
+                                               [](auto&&) { return true; }));
+}
+
+void AsyncClient::AppendAsync(const std::string& key, const std::string& value,
+                              Callback<bool> done) {
+  this->conn->call(
+      AppendRequest{key, value},
+      complete<AppendResponse, bool>("Append value to server", false,
+                                     std::move(done),
+                                     [](auto&&) { return true; }));
+}
+
+void AsyncClient::DeleteAsync(const std::string& key,
+                              Callback<std::optional<std::string>> done) {
+  this->conn->call(
+      DeleteRequest{key},
+      complete<DeleteResponse, std::optional<std::string>>(
+          "Delete value on server", std::nullopt, std::move(done),
+          [](DeleteResponse&& res) { return std::move(res.value); }));
+}
+
+void AsyncClient::MultiGetAsync(
+    const std::vector<std::string>& keys,
+    Callback<std::optional<std::vector<std::string>>> done) {
+  this->conn->call(
+      MultiGetRequest{keys},
+      complete<MultiGetResponse, std::optional<std::vector<std::string>>>(
+          "MultiGet values on server", std::nullopt, std::move(done),
+          [](MultiGetResponse&& res) { return std::move(res.values); }));
+}
+
+void AsyncClient::MultiPutAsync(const std::vector<std::string>& keys,
+                                const std::vector<std::string>& values,
+                                Callback<bool> done) {
+  this->conn->call(
+      MultiPutRequest{keys, values},
+      complete<MultiPutResponse, bool>("MultiPut values on server", false,
+                                       std::move(done),
+                                       [](auto&&) { return true; }));
+}
+
+std::future<std::optional<std::string>> AsyncClient::GetAsync(
+    const std::string& key) {
+  return to_future<std::optional<std::string>>(
+      [&](auto done) { this->GetAsync(key, std::move(done)); });
+}
+
+std::future<bool> AsyncClient::PutAsync(const std::string& key,
+                                        const std::string& value) {
+  return to_future<bool>(
+      [&](auto done) { this->PutAsync(key, value, std::move(done)); });
+}
+
+std::future<bool> AsyncClient::AppendAsync(const std::string& key,
+                                           const std::string& value) {
+  return to_future<bool>(
+      [&](auto done) { this->AppendAsync(key, value, std::move(done)); });
+}
+
+std::future<std::optional<std::string>> AsyncClient::DeleteAsync(
+    const std::string& key) {
+  return to_future<std::optional<std::string>>(
+      [&](auto done) { this->DeleteAsync(key, std::move(done)); });
+}
+
+std::future<std::optional<std::vector<std::string>>>
+AsyncClient::MultiGetAsync(const std::vector<std::string>& keys) {
+  return to_future<std::optional<std::vector<std::string>>>(
+      [&](auto done) { this->MultiGetAsync(keys, std::move(done)); });
+}
+
+std::future<bool> AsyncClient::MultiPutAsync(
+    const std::vector<std::string>& keys,
+    const std::vector<std::string>& values) {
+  return to_future<bool>(
+      [&](auto done) { this->MultiPutAsync(keys, values, std::move(done)); });
+}
+
+std::optional<std::string> AsyncClient::Get(const std::string& key) {
+  return this->GetAsync(key).get();
+}
+
+bool AsyncClient::Put(const std::string& key, const std::string& value) {
+  return this->PutAsync(key, value).get();
+}
+
+bool AsyncClient::Append(const std::string& key, const std::string& value) {
+  return this->AppendAsync(key, value).get();
+}
+
+std::optional<std::string> AsyncClient::Delete(const std::string& key) {
+  return this->DeleteAsync(key).get();
+}
+
+std::optional<std::vector<std::string>> AsyncClient::MultiGet(
+    const std::vector<std::string>& keys) {
+  return this->MultiGetAsync(keys).get();
+}
+
+bool AsyncClient::MultiPut(const std::vector<std::string>& keys,
+                           const std::vector<std::string>& values) {
+  return this->MultiPutAsync(keys, values).get();
+}
@@ -0,0 +1,154 @@
+#ifndef ASYNC_CLIENT_HPP
+#define ASYNC_CLIENT_HPP
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "client.hpp"
+#include "net/event_loop.hpp"
+#include "net/network_conn.hpp"
+#include "net/network_messages.hpp"
+
+/*
+ * A connection to a server with any number of requests in flight at once.
+ * Requests are sent from the caller's thread; responses are read on an
+ * EventLoop, and matched up with their requests in order (servers answer each
+ * connection's requests in the order they arrive).
+ *
+ * The connection is opened on the first request, and reopened on the next one
+ * after it breaks. That first request is answered synchronously, since it
+ * settles the wire format every later request has to be sent in. Only socket
+ * addresses are supported (not shm:), since the event loop needs an fd that
+ * becomes readable when a response arrives.
+ */
+class PipelinedConn : public std::enable_shared_from_this<PipelinedConn> {
+ public:
+  using Callback = std::function<void(std::optional<Response>)>;
+
+  // loop must outlive the connection.
+  PipelinedConn(const std::string& address, bool compression, EventLoop* loop)
+      : address(address), compression(compression), loop(loop) {
+  }
+  ~PipelinedConn() {
+    this->close();
+  }
+
+  /*
+   * Sends req, and calls done with its response once it arrives (on the event
+   * loop's thread, unless req opened the connection), or with std::nullopt if
+   * the connection fails first.
+   */
+  void call(Request req, Callback done);
+
+  // Closes the connection, failing any requests still in flight.
+  void close();
+
+  PipelinedConn(const PipelinedConn&) = delete;
+  PipelinedConn& operator=(const PipelinedConn&) = delete;
+
+ private:
+  std::string address;
+  bool compression;
+  EventLoop* loop;
+
+  // Serializes senders, so requests go out in the order of in_flight. Held
+  // while sending, which may block, so it's separate from mtx (which the
+  // event loop needs, to take responses off the socket).
+  std::mutex send_mtx;
+
+  std::mutex mtx;
+  std::shared_ptr<ServerConn> conn;
+  // Callbacks for the requests sent, in the order they were sent.
+  std::deque<Callback> in_flight;
+
+  // Opens a connection, with req as its first request.
+  void open(const Request& req, Callback done,
+            std::unique_lock<std::mutex> send_lock);
+  void on_readable();
+  // Drops the connection, returning the callbacks of everything pending on
+  // it. Requires mtx.
+  std::vector<Callback> disconnect();
+};
+
+/*
+ * A client for a single KvServer whose operations return immediately: each
+ * *Async method either returns a std::future, or takes a callback. Callbacks
+ * run on the event loop's thread, so they shouldn't block (they run on the
+ * caller's thread instead for requests that open a connection, or can't be
+ * sent). Any number of operations may be
+ * outstanding at once; they're pipelined over one connection.
+ *
+ * The blocking Client methods just wait on the futures. Values go over in a
+ * single message each (they aren't streamed in chunks, since chunked
+ * transfers can't interleave on one connection).
+ */
+class AsyncClient : public Client {
+ public:
+  explicit AsyncClient(const std::string& server_addr, bool compression = false,
+                       std::shared_ptr<EventLoop> loop = nullptr)
+      : loop(loop ? std::move(loop) : EventLoop::shared()),
+        conn(std::make_shared<PipelinedConn>(server_addr, compression,
+                                             this->loop.get())) {
+  }
+  ~AsyncClient() {
+    this->conn->close();
+  }
+
+  template <typename T>
+  using Callback = std::function<void(T)>;
+
+  void GetAsync(const std::string& key,
+                Callback<std::optional<std::string>> done);
+  void PutAsync(const std::string& key, const std::string& value,
+                Callback<bool> done);
+  void AppendAsync(const std::string& key, const std::string& value,
+                   Callback<bool> done);
+  void DeleteAsync(const std::string& key,
+                   Callback<std::optional<std::string>> done);
+  void MultiGetAsync(const std::vector<std::string>& keys,
+                     Callback<std::optional<std::vector<std::string>>> done);
+  void MultiPutAsync(const std::vector<std::string>& keys,
+                     const std::vector<std::string>& values,
+                     Callback<bool> done);
+
+  std::future<std::optional<std::string>> GetAsync(const std::string& key);
+  std::future<bool> PutAsync(const std::string& key, const std::string& value);
+  std::future<bool> AppendAsync(const std::string& key,
+                                const std::string& value);
+  std::future<std::optional<std::string>> DeleteAsync(const std::string& key);
+  std::future<std::optional<std::vector<std::string>>> MultiGetAsync(
+      const std::vector<std::string>& keys);
+  std::future<bool> MultiPutAsync(const std::vector<std::string>& keys,
+                                  const std::vector<std::string>& values);
+
+  // Blocking versions of the above.
+  std::optional<std::string> Get(const std::string& key) override;
+  bool Put(const std::string& key, const std::string& value) override;
+  bool Append(const std::string& key, const std::string& value) override;
+  std::optional<std::string> Delete(const std::string& key) override;
+  std::optional<std::vector<std::string>> MultiGet(
+      const std::vector<std::string>& keys) override;
+  bool MultiPut(const std::vector<std::string>& keys,
+                const std::vector<std::string>& values) override;
+  bool GDPRDelete(const std::string& user) override {
+    return false;
+  }
+
+  AsyncClient(const AsyncClient&) = delete;
+  AsyncClient& operator=(const AsyncClient&) = delete;
+
+ private:
+  // Declared first, so that it's destroyed last. (Its handler may be the last
+  // owner of conn, so conn can't be the one keeping the loop alive: the loop
+  // would end up destroying itself.)
+  std::shared_ptr<EventLoop> loop;
+  std::shared_ptr<PipelinedConn> conn;
+};
+
+#endif /* end of include guard */
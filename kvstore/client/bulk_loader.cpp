@@ -0,0 +1,226 @@
+#include "bulk_loader.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+MappedFile::~MappedFile() {
+  if (this->size > 0) munmap(const_cast<char*>(this->data), this->size);
+}
+
+bool MappedFile::open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return false;
+  }
+  // (mmap refuses empty files, which are fine to load)
+  if (st.st_size > 0) {
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    // It's read front to back
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    this->data = static_cast<const char*>(data);
+    this->size = st.st_size;
+  }
+  close(fd);
+  return true;
+}
+
+size_t parse_dump(std::string_view text, std::vector<DumpRecord>* records) {
+  constexpr std::string_view PUT = "put ";
+  size_t skipped = 0;
+  while (!text.empty()) {
+    size_t end = text.find('\n');
+    std::string_view line = text.substr(0, end);
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    if (line.empty()) continue;
+
+    size_t key_end = line.find(' ', PUT.size());
+    if (line.substr(0, PUT.size()) != PUT || key_end == PUT.size()) {
+      skipped++;
+      continue;
+    }
+    if (key_end == std::string_view::npos) {
+      // A key with an empty value
+      records->push_back({line.substr(PUT.size()), {}});
+    } else {
+      records->push_back({line.substr(PUT.size(), key_end - PUT.size()),
+                          line.substr(key_end + 1)});
+    }
+  }
+  return skipped;
+}
+
+size_t next_line(std::string_view text, size_t offset) {
+  if (offset == 0) return 0;
+  if (offset >= text.size()) return text.size();
+  if (text[offset - 1] == '\n') return offset;
+  size_t end = text.find('\n', offset);
+  return end == std::string_view::npos ? text.size() : end + 1;
+}
+
+BulkLoader::BulkLoader(const std::string& shardmaster,
+                       const std::string& server, BulkLoadOptions opts)
+    : server(server), opts(opts) {
+  this->opts.threads = std::max<size_t>(this->opts.threads, 1);
+  this->opts.batch_keys = std::max<size_t>(this->opts.batch_keys, 1);
+  this->opts.window = std::max<size_t>(this->opts.window, 1);
+  this->opts.segment_size = std::max<size_t>(this->opts.segment_size, 1);
+  if (!shardmaster.empty()) {
+    this->shardmaster =
+        std::make_unique<ShardKvClient>(shardmaster, opts.compression);
+  }
+}
+
+BulkLoadProgress BulkLoader::load(
+    std::string_view text, uint64_t offset,
+    std::function<void(const BulkLoadProgress&)> on_progress) {
+  auto start = steady_clock::now();
+  BulkLoadProgress progress;
+  progress.offset = next_line(text, offset);
+  if (this->shardmaster && !this->refresh_router()) {
+    progress.failed = progress.offset < text.size();
+    return progress;
+  }
+
+  while (progress.offset < text.size()) {
+    size_t end = next_line(text, progress.offset + this->opts.segment_size);
+    std::string_view segment =
+        text.substr(progress.offset, end - progress.offset);
+
+    uint64_t records = 0, skipped = 0;
+    bool stored = this->load_segment(segment, &records, &skipped);
+    // Retried once, in case it failed because the config changed
+    if (!stored && this->shardmaster && this->refresh_router()) {
+      records = skipped = 0;
+      stored = this->load_segment(segment, &records, &skipped);
+    }
+    progress.elapsed = steady_clock::now() - start;
+    if (!stored) {
+      progress.failed = true;
+      return progress;
+    }
+
+    progress.offset = end;
+    progress.records += records;
+    progress.skipped += skipped;
+    if (on_progress) on_progress(progress);
+  }
+  progress.elapsed = steady_clock::now() - start;
+  return progress;
+}
+
+AsyncClient& BulkLoader::client_for(const std::string& server) {
+  std::unique_lock lock(this->clients_mtx);
+  auto& client = this->clients[server];
+  if (!client) {
+    client = std::make_unique<AsyncClient>(server, this->opts.compression);
+  }
+  return *client;
+}
+
+bool BulkLoader::refresh_router() {
+  std::optional<ShardmasterConfig> config = this->shardmaster->Query();
+  if (!config) return false;
+  this->router = ShardRouter(*config);
+  return true;
+}
+
+bool BulkLoader::load_segment(std::string_view text, uint64_t* records,
+                              uint64_t* skipped) {
+  {
+    std::unique_lock lock(this->mtx);
+    this->batch_failed = false;
+  }
+
+  // Each thread takes the lines starting in its share of the segment
+  std::vector<std::thread> threads;
+  std::vector<uint64_t> thread_records(this->opts.threads);
+  std::vector<uint64_t> thread_skipped(this->opts.threads);
+  std::atomic<bool> unroutable = false;
+  size_t share = text.size() / this->opts.threads + 1;
+  for (size_t t = 0; t < this->opts.threads; t++) {
+    size_t begin = next_line(text, std::min(t * share, text.size()));
+    size_t end = next_line(text, std::min((t + 1) * share, text.size()));
+    if (begin >= end) continue;
+    threads.emplace_back([&, t, part = text.substr(begin, end - begin)] {
+      std::vector<DumpRecord> parsed;
+      thread_skipped[t] = parse_dump(part, &parsed);
+      thread_records[t] = parsed.size();
+
+      // Pairs waiting to go to each server
+      std::map<std::string_view,
+               std::pair<std::vector<std::string>, std::vector<std::string>>>
+          batches;
+      for (auto&& record : parsed) {
+        std::string key(record.key);
+        const std::string* server = &this->server;
+        if (this->shardmaster) {
+          server = this->router.server_for(key);
+          if (!server) {
+            unroutable = true;
+            return;
+          }
+        }
+        auto& [keys, values] = batches[*server];
+        keys.push_back(std::move(key));
+        values.emplace_back(record.value);
+        if (keys.size() >= this->opts.batch_keys) {
+          this->send(*server, std::move(keys), std::move(values));
+          keys.clear();
+          values.clear();
+        }
+      }
+      for (auto&& [server, batch] : batches) {
+        if (batch.first.empty()) continue;
+        this->send(std::string(server), std::move(batch.first),
+                   std::move(batch.second));
+      }
+    });
+  }
+  for (auto&& thread : threads) thread.join();
+
+  // The segment is done once everything sent has been acknowledged
+  std::unique_lock lock(this->mtx);
+  this->cv.wait(lock, [this] {
+    for (auto&& [server, n] : this->in_flight) {
+      if (n > 0) return false;
+    }
+    return true;
+  });
+  for (size_t t = 0; t < this->opts.threads; t++) {
+    *records += thread_records[t];
+    *skipped += thread_skipped[t];
+  }
+  return !this->batch_failed && !unroutable;
+}
+
+void BulkLoader::send(const std::string& server, std::vector<std::string> keys,
+                      std::vector<std::string> values) {
+  {
+    std::unique_lock lock(this->mtx);
+    this->cv.wait(lock, [&] {
+      return this->in_flight[server] < this->opts.window;
+    });
+    this->in_flight[server]++;
+  }
+  this->client_for(server).MultiPutAsync(
+      keys, values, [this, server](bool stored) {
+        std::unique_lock lock(this->mtx);
+        this->in_flight[server]--;
+        if (!stored) this->batch_failed = true;
+        this->cv.notify_all();
+      });
+}
@@ -0,0 +1,149 @@
+#ifndef BULK_LOADER_HPP
+#define BULK_LOADER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "async_client.hpp"
+#include "common/config.hpp"
+#include "shardkv_client.hpp"
+
+using namespace std::chrono;
+
+// Defaults for how many pairs go in each MultiPut, how many MultiPuts may be
+// in flight to each server, and how much of the dump is loaded (and
+// committed) at a time.
+#define LOAD_BATCH_KEYS 256
+#define LOAD_WINDOW 8
+#define LOAD_SEGMENT_SIZE (16 << 20)
+
+/*
+ * A file mapped read-only into memory, so a dump can be parsed in place
+ * (however big it is) without copying it in first.
+ */
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  // Maps the file at path, returning whether it could be.
+  bool open(const std::string& path);
+  std::string_view text() const {
+    return {this->data, this->size};
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+ private:
+  const char* data = nullptr;
+  size_t size = 0;
+};
+
+// One pair from a dump, pointing into its text.
+struct DumpRecord {
+  std::string_view key;
+  std::string_view value;
+};
+
+/*
+ * Parses the `put <key> <value>` lines of a dump (the format of
+ * gdpr/database.txt: the value is the rest of the line) in text, appending
+ * them to records. Returns how many non-empty lines weren't puts.
+ */
+size_t parse_dump(std::string_view text, std::vector<DumpRecord>* records);
+
+// The offset of the first line that starts at or after offset in text.
+size_t next_line(std::string_view text, size_t offset);
+
+struct BulkLoadOptions {
+  // Threads parsing (and sending) each segment.
+  size_t threads = 4;
+  size_t batch_keys = LOAD_BATCH_KEYS;
+  size_t window = LOAD_WINDOW;
+  size_t segment_size = LOAD_SEGMENT_SIZE;
+  bool compression = false;
+};
+
+struct BulkLoadProgress {
+  // Everything in the dump before offset has been stored.
+  uint64_t offset = 0;
+  uint64_t records = 0;
+  // Lines that weren't puts.
+  uint64_t skipped = 0;
+  // Whether the load stopped early, at offset, because pairs couldn't be
+  // stored.
+  bool failed = false;
+  duration<double> elapsed{0};
+};
+
+/*
+ * Loads a dump into a cluster (through its shardmaster), or into a single
+ * server, as fast as it'll take it.
+ *
+ * The dump goes in segments of about segment_size bytes. Each segment is
+ * split at line breaks among the threads, which parse their share in place
+ * and batch the pairs by the server that owns them; full batches go out as
+ * MultiPuts, pipelined up to window deep on one connection per server. Once
+ * every batch of a segment has been acknowledged, the segment is committed:
+ * a load that fails (or is killed) can be resumed from the last committed
+ * offset, storing at worst a segment's pairs twice.
+ *
+ * A segment with failed batches (e.g. because shards moved) is retried once
+ * with a fresh config before the load gives up.
+ */
+class BulkLoader {
+ public:
+  // With an empty shardmaster, everything goes to server.
+  BulkLoader(const std::string& shardmaster, const std::string& server,
+             BulkLoadOptions opts = {});
+
+  /*
+   * Loads text from offset (which is moved up to the start of a line, if it
+   * isn't at one) to the end, calling on_progress after each segment is
+   * committed.
+   */
+  BulkLoadProgress load(
+      std::string_view text, uint64_t offset = 0,
+      std::function<void(const BulkLoadProgress&)> on_progress = nullptr);
+
+  BulkLoader(const BulkLoader&) = delete;
+  BulkLoader& operator=(const BulkLoader&) = delete;
+
+ private:
+  std::string server;
+  BulkLoadOptions opts;
+  std::unique_ptr<ShardKvClient> shardmaster;
+  // Only replaced between segments, so it's read without a lock.
+  ShardRouter router;
+
+  // A pipelined connection to each server, opened as needed.
+  std::mutex clients_mtx;
+  std::map<std::string, std::unique_ptr<AsyncClient>> clients;
+  AsyncClient& client_for(const std::string& server);
+
+  // The MultiPuts in flight, per server, and whether any have failed.
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::map<std::string, size_t> in_flight;
+  bool batch_failed = false;
+
+  // Refetches the config from the shardmaster.
+  bool refresh_router();
+  // Sends every pair in text, returning whether all were stored.
+  bool load_segment(std::string_view text, uint64_t* records,
+                    uint64_t* skipped);
+  // Sends a batch, once server has room for another.
+  void send(const std::string& server, std::vector<std::string> keys,
+            std::vector<std::string> values);
+};
+
+#endif /* end of include guard */
@@ -0,0 +1,41 @@
+#include "read_cache.hpp"
+
+std::optional<std::string> ReadCache::get(const std::string& key) {
+  std::unique_lock lock(this->mtx);
+  auto it = this->entries.find(key);
+  if (it != this->entries.end()) {
+    if (steady_clock::now() < it->second.expires) {
+      this->n_hits++;
+      return it->second.value;
+    }
+    this->entries.erase(it);
+  }
+  this->n_misses++;
+  return std::nullopt;
+}
+
+void ReadCache::put(const std::string& key, const std::string& value,
+                    steady_clock::time_point expires) {
+  if (expires <= steady_clock::now()) return;
+
+  std::unique_lock lock(this->mtx);
+  this->entries[key] = Entry{value, expires};
+  this->order.emplace_back(key, expires);
+
+  // Evict the oldest entries; the queue can also fill up with mentions of
+  // entries that were since dropped or re-cached, so cap it too
+  while (this->entries.size() > this->capacity ||
+         this->order.size() > 2 * this->capacity) {
+    auto& [oldest, oldest_expires] = this->order.front();
+    auto it = this->entries.find(oldest);
+    if (it != this->entries.end() && it->second.expires == oldest_expires) {
+      this->entries.erase(it);
+    }
+    this->order.pop_front();
+  }
+}
+
+void ReadCache::invalidate(const std::string& key) {
+  std::unique_lock lock(this->mtx);
+  this->entries.erase(key);
+}
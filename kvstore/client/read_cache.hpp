@@ -0,0 +1,69 @@
+#ifndef READ_CACHE_HPP
+#define READ_CACHE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+using namespace std::chrono;
+
+// Default number of values a ReadCache holds.
+#define READ_CACHE_CAPACITY 10'000
+
+/*
+ * A client's cache of leased values (see LeaseGetRequest): each is served
+ * until its lease runs out, then dropped. Once full, the entries added
+ * earliest make way for new ones (leases are all about as long, so those
+ * are also the closest to expiring).
+ */
+class ReadCache {
+ public:
+  explicit ReadCache(size_t capacity = READ_CACHE_CAPACITY)
+      : capacity(std::max<size_t>(capacity, 1)) {
+  }
+
+  // key's cached value, if its lease hasn't run out.
+  std::optional<std::string> get(const std::string& key);
+  // Caches value for key until expires.
+  void put(const std::string& key, const std::string& value,
+           steady_clock::time_point expires);
+  // Forgets key's value (e.g. because we wrote it).
+  void invalidate(const std::string& key);
+
+  // Gets answered from the cache, and not.
+  size_t hits() const {
+    return this->n_hits;
+  }
+  size_t misses() const {
+    return this->n_misses;
+  }
+  double hit_rate() const {
+    size_t total = this->hits() + this->misses();
+    return total ? double(this->hits()) / total : 0;
+  }
+
+  ReadCache(const ReadCache&) = delete;
+  ReadCache& operator=(const ReadCache&) = delete;
+
+ private:
+  struct Entry {
+    std::string value;
+    steady_clock::time_point expires;
+  };
+
+  size_t capacity;
+  std::mutex mtx;
+  std::unordered_map<std::string, Entry> entries;
+  // Keys in the order they were cached, with their expiry then (a key cached
+  // again later shows up twice; the stale mention is skipped on eviction).
+  std::deque<std::pair<std::string, steady_clock::time_point>> order;
+
+  std::atomic<size_t> n_hits = 0;
+  std::atomic<size_t> n_misses = 0;
+};
+
+#endif /* end of include guard */
@@ -1,152 +1,537 @@
 #include "shardkv_client.hpp"
 
+#include <algorithm>
+
 std::optional<std::string> ShardKvClient::Get(const std::string& key) {
-  // Query shardmaster for config
-  auto config = this->Query();
-  if (!config) return std::nullopt;
+  if (this->cache) {
+    if (auto value = this->cache->get(key)) return value;
+    return this->get_leased(key);
+  }
+  if (this->replica_staleness) return this->get_replicated(key);
+  return this->routed<std::optional<std::string>>(
+      [&](const ShardRouter& router,
+          bool* misrouted) -> std::optional<std::string> {
+        // find responsible server in config
+        std::optional<std::string> server = router.get_server(key);
+        // Here (and later) we can re-use logic from the simple client! woohoo
+        // code reuse. I believe object creation here is on the stack, so it
+        // should be almost free (minus string copying cost)
+        if (!server) {
+          *misrouted = true;
+          return std::nullopt;
+        }
+
+        SimpleClient client = this->client_for(*server);
+        std::optional<std::string> value = client.Get(key);
+        this->heed_config_hint(client);
+        *misrouted = !value && ShardKvClient::misrouted(client);
+        return value;
+      });
+}
 
-  // find responsible server in config
-  std::optional<std::string> server = config->get_server(key);
-  // Here (and later) we can re-use logic from the simple client! woohoo code
-  // reuse. I believe object creation here is on the stack, so it should be
-  // almost free (minus string copying cost)
-  if (!server) return std::nullopt;
+std::optional<std::string> ShardKvClient::get_leased(const std::string& key) {
+  return this->routed<std::optional<std::string>>(
+      [&](const ShardRouter& router,
+          bool* misrouted) -> std::optional<std::string> {
+        std::optional<std::string> server = router.get_server(key);
+        if (!server) {
+          *misrouted = true;
+          return std::nullopt;
+        }
 
-  return SimpleClient{*server}.Get(key);
+        // The lease runs from when we asked, which is before the server
+        // granted it
+        auto asked = steady_clock::now();
+        microseconds lease;
+        SimpleClient client = this->client_for(*server);
+        std::optional<std::string> value = client.GetLeased(key, &lease);
+        this->heed_config_hint(client);
+        *misrouted = !value && ShardKvClient::misrouted(client);
+        if (value && lease > 0us) this->cache->put(key, *value, asked + lease);
+        return value;
+      });
+}
+
+std::optional<std::string> ShardKvClient::get_replicated(
+    const std::string& key) {
+  return this->routed<std::optional<std::string>>(
+      [&](const ShardRouter& router,
+          bool* misrouted) -> std::optional<std::string> {
+        const std::string* server = router.server_for(key);
+        if (!server) {
+          *misrouted = true;
+          return std::nullopt;
+        }
+
+        // 0 for the key's server, or one of its backups
+        const std::vector<std::string>& backups = router.backups_for(key);
+        size_t replica;
+        {
+          std::unique_lock lock(this->rng_mtx);
+          replica = std::uniform_int_distribution<size_t>(
+              0, backups.size())(this->rng);
+        }
+        // Anything but a value from a backup (a stale copy, or a key it
+        // hasn't been sent yet, say) goes on to the server
+        if (replica > 0) {
+          SimpleClient client = this->client_for(backups[replica - 1]);
+          auto value = client.GetReplica(key, *this->replica_staleness);
+          if (value) return value;
+        }
+
+        SimpleClient client = this->client_for(*server);
+        auto value = client.GetReplica(key, *this->replica_staleness);
+        *misrouted = !value && ShardKvClient::misrouted(client);
+        return value;
+      });
 }
 
 bool ShardKvClient::Put(const std::string& key, const std::string& value) {
-  // Query shardmaster for config
-  auto config = this->Query();
-  if (!config) return false;
+  // Writes drop the key from the cache once they're done, too; this is for
+  // batched Puts, which are done later
+  this->invalidate_cached(key);
+  if (this->batcher) return this->batcher->Put(key, value).get();
+  return this->put_now(key, value);
+}
+
+bool ShardKvClient::put_now(const std::string& key, const std::string& value) {
+  return this->routed<bool>([&](const ShardRouter& router, bool* misrouted) {
+    // find responsible server in config, then make Put request
+    std::optional<std::string> server = router.get_server(key);
+    if (!server) {
+      *misrouted = true;
+      return false;
+    }
 
-  // find responsible server in config, then make Put request
-  std::optional<std::string> server = config->get_server(key);
-  if (!server) return false;
-  return SimpleClient{*server}.Put(key, value);
+    SimpleClient client = this->client_for(*server);
+    bool ok = client.Put(key, value);
+    this->invalidate_cached(key);
+    this->heed_config_hint(client);
+    *misrouted = !ok && ShardKvClient::misrouted(client);
+    return ok;
+  });
 }
 
 bool ShardKvClient::Append(const std::string& key, const std::string& value) {
-  // Query shardmaster for config
-  auto config = this->Query();
-  if (!config) return false;
+  return this->routed<bool>([&](const ShardRouter& router, bool* misrouted) {
+    // find responsible server in config, then make Append request
+    std::optional<std::string> server = router.get_server(key);
+    if (!server) {
+      *misrouted = true;
+      return false;
+    }
 
-  // find responsible server in config, then make Append request
-  std::optional<std::string> server = config->get_server(key);
-  if (!server) return false;
-  return SimpleClient{*server}.Append(key, value);
+    SimpleClient client = this->client_for(*server);
+    bool ok = client.Append(key, value);
+    this->invalidate_cached(key);
+    this->heed_config_hint(client);
+    *misrouted = !ok && ShardKvClient::misrouted(client);
+    return ok;
+  });
 }
 
 std::optional<std::string> ShardKvClient::Delete(const std::string& key) {
-  // Query shardmaster for config
-  auto config = this->Query();
-  if (!config) return std::nullopt;
+  return this->routed<std::optional<std::string>>(
+      [&](const ShardRouter& router,
+          bool* misrouted) -> std::optional<std::string> {
+        // find responsible server in config, then make Delete request
+        std::optional<std::string> server = router.get_server(key);
+        if (!server) {
+          *misrouted = true;
+          return std::nullopt;
+        }
 
-  // find responsible server in config, then make Delete request
-  std::optional<std::string> server = config->get_server(key);
-  if (!server) return std::nullopt;
-  return SimpleClient{*server}.Delete(key);
+        SimpleClient client = this->client_for(*server);
+        std::optional<std::string> value = client.Delete(key);
+        this->invalidate_cached(key);
+        this->heed_config_hint(client);
+        *misrouted = !value && ShardKvClient::misrouted(client);
+        return value;
+      });
 }
 
 std::optional<std::vector<std::string>> ShardKvClient::MultiGet(
     const std::vector<std::string>& keys) {
-  // Query shardmaster for config
-  auto config = this->Query();
-  if (!config) return std::nullopt;
-
-  // Check that all config servers are valid
-  bool valid = true;
-  // for each key, find responsible servers in config
-  std::map<std::string, std::vector<std::string>> server_keys;
-  std::for_each(keys.cbegin(), keys.cend(), [&](auto&& key) {
-    std::optional<std::string> server = config->get_server(key);
-    if (!server) {
-      valid = false;
-    } else {
-      server_keys[*server].push_back(key);
+  using Values = std::optional<std::vector<std::string>>;
+  return this->routed<Values>([&](const ShardRouter& router,
+                                  bool* misrouted) -> Values {
+    // Check that all config servers are valid
+    bool valid = true;
+    // for each key, find responsible servers in config, remembering where in
+    // the result each key's value goes
+    struct Group {
+      std::string server;
+      std::vector<std::string> keys;
+      std::vector<size_t> positions;
+    };
+    std::vector<Group> groups;
+    std::map<std::string, size_t> group_of;
+    for (size_t i = 0; i < keys.size(); i++) {
+      std::optional<std::string> server = router.get_server(keys[i]);
+      if (!server) {
+        valid = false;
+        break;
+      }
+      auto [it, added] = group_of.try_emplace(*server, groups.size());
+      if (added) groups.push_back({*server, {}, {}});
+      groups[it->second].keys.push_back(keys[i]);
+      groups[it->second].positions.push_back(i);
     }
-  });
-  // If the config can't find a responsible server for at least one of the keys,
-  // return an error
-  if (!valid) return std::nullopt;
-
-  // store values associated with each key; use this to maintain order
-  std::map<std::string, std::string> key_values;
-
-  // Establish connection to each responsible server, and make MultiGet request
-  for (auto&& [server, responsible_keys] : server_keys) {
-    auto values = SimpleClient{server}.MultiGet(responsible_keys);
-    if (!values) return std::nullopt;
-    // if successful, store each key's value in the values list to maintain
-    // order
-    for (size_t i = 0; i < responsible_keys.size(); i++) {
-      key_values[responsible_keys[i]] = (*values)[i];
+    // If the config can't find a responsible server for at least one of the
+    // keys, it may be out of date
+    if (!valid) {
+      *misrouted = true;
+      return std::nullopt;
     }
-  }
 
-  // map each key to its corresponding value
-  std::vector<std::string> values;
-  values.reserve(keys.size());
-  for (auto&& key : keys) {
-    values.push_back(key_values[key]);
+    // Make a MultiGet request to each responsible server, all at once
+    auto results = parallel_map(groups, [&](const Group& group) {
+      SimpleClient client = this->client_for(group.server);
+      auto values = client.MultiGet(group.keys);
+      this->heed_config_hint(client);
+      return std::make_pair(std::move(values),
+                            ShardKvClient::misrouted(client));
+    });
+
+    // put each value back in its key's place
+    std::vector<std::string> values(keys.size());
+    for (size_t g = 0; g < groups.size(); g++) {
+      auto& [group_values, server_misrouted] = results[g];
+      if (!group_values || group_values->size() != groups[g].keys.size()) {
+        *misrouted = server_misrouted;
+        return std::nullopt;
+      }
+      for (size_t i = 0; i < group_values->size(); i++) {
+        values[groups[g].positions[i]] = std::move((*group_values)[i]);
+      }
+    }
+    // return final result!
+    return values;
+  });
+}
+
+std::optional<ShardKvClient::ServerPairs> ShardKvClient::split_pairs(
+    const ShardRouter& router, const std::vector<std::string>& keys,
+    const std::vector<std::string>& values) {
+  std::map<std::string, std::array<std::vector<std::string>, 2>>
+      server_pairs;
+  for (size_t i = 0; i < keys.size(); i++) {
+    std::optional<std::string> server = router.get_server(keys[i]);
+    if (!server) return std::nullopt;
+    server_pairs[*server][0].push_back(keys[i]);
+    server_pairs[*server][1].push_back(values[i]);
   }
-  // return final result!
-  return values;
+  return ServerPairs(std::make_move_iterator(server_pairs.begin()),
+                     std::make_move_iterator(server_pairs.end()));
 }
 
 bool ShardKvClient::MultiPut(const std::vector<std::string>& keys,
                              const std::vector<std::string>& values) {
-  // Query shardmaster for config
-  auto config = this->Query();
-  if (!config) return false;
-
-  // Check that the config is valid
-  bool valid = true;
-  // for each key, find responsible servers in config
-  // man i love cpp... explore `using std::string`, perhaps?
-  std::map<std::string, std::array<std::vector<std::string>, 2>> server_pairs;
-  for (size_t i = 0; i < keys.size(); i++) {
-    std::optional<std::string> server = config->get_server(keys[i]);
-    if (!server) {
-      valid = false;
-    } else {
-      server_pairs[*server][0].push_back(keys[i]);
-      server_pairs[*server][1].push_back(values[i]);
+  return this->routed<bool>([&](const ShardRouter& router, bool* misrouted) {
+    std::optional<ServerPairs> groups = split_pairs(router, keys, values);
+    if (!groups) {
+      *misrouted = true;
+      return false;
+    }
+    // A server applies its own MultiPuts whole
+    if (groups->size() <= 1) return this->multiput_each(*groups, misrouted);
+
+    // Transactions that ran into each other's locks back off (at random, so
+    // they don't just run into each other again) and try again
+    auto give_up = steady_clock::now() + TXN_TIMEOUT;
+    microseconds max_backoff = 100us;
+    while (true) {
+      uint64_t txid;
+      {
+        std::unique_lock lock(this->rng_mtx);
+        txid = this->rng();
+      }
+      bool locked = false;
+      if (this->multiput_transaction(txid, *groups, misrouted, &locked)) {
+        return true;
+      }
+      if (!locked || steady_clock::now() >= give_up) return false;
+      microseconds backoff;
+      {
+        std::unique_lock lock(this->rng_mtx);
+        backoff = microseconds(std::uniform_int_distribution<int64_t>(
+            0, max_backoff.count())(this->rng));
+      }
+      std::this_thread::sleep_for(backoff);
+      max_backoff = std::min<microseconds>(max_backoff * 2, TXN_MAX_BACKOFF);
+    }
+  });
+}
+
+bool ShardKvClient::MultiPutEach(const std::vector<std::string>& keys,
+                                 const std::vector<std::string>& values) {
+  return this->routed<bool>([&](const ShardRouter& router, bool* misrouted) {
+    std::optional<ServerPairs> groups = split_pairs(router, keys, values);
+    if (!groups) {
+      *misrouted = true;
+      return false;
+    }
+    return this->multiput_each(*groups, misrouted);
+  });
+}
+
+bool ShardKvClient::multiput_each(const ServerPairs& groups,
+                                  bool* misrouted) {
+  // Make a MultiPut request to each responsible server, all at once.
+  // Servers that already took their pairs just get them again on a retry,
+  // which is harmless.
+  auto results = parallel_map(groups, [&](const auto& group) {
+    SimpleClient client = this->client_for(group.first);
+    bool ok = client.MultiPut(group.second[0], group.second[1]);
+    for (auto&& key : group.second[0]) this->invalidate_cached(key);
+    this->heed_config_hint(client);
+    return std::make_pair(ok, ShardKvClient::misrouted(client));
+  });
+  for (auto&& [ok, server_misrouted] : results) {
+    if (!ok) {
+      *misrouted = server_misrouted;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool ShardKvClient::multiput_transaction(uint64_t txid,
+                                         const ServerPairs& groups,
+                                         bool* misrouted, bool* locked) {
+  struct Prepared {
+    bool ok;
+    bool misrouted;
+    bool locked;
+  };
+  auto prepared = parallel_map(groups, [&](const auto& group) {
+    SimpleClient client = this->client_for(group.first);
+    bool ok = client.Prepare(txid, group.second[0], group.second[1]);
+    this->heed_config_hint(client);
+    return Prepared{ok, ShardKvClient::misrouted(client),
+                    client.last_error() == KEY_LOCKED_ERROR};
+  });
+  bool commit = true;
+  for (auto&& res : prepared) {
+    commit = commit && res.ok;
+    *misrouted = *misrouted || res.misrouted;
+    *locked = *locked || res.locked;
+  }
+
+  // Servers hold on to prepared pairs for TXN_TIMEOUT, so a commit that
+  // doesn't get through (its server is restarting, say) has until then
+  std::vector<size_t> involved;
+  for (size_t i = 0; i < groups.size(); i++) {
+    if (prepared[i].ok) involved.push_back(i);
+  }
+  auto give_up = steady_clock::now() + TXN_TIMEOUT;
+  auto results = parallel_map(involved, [&](size_t i) {
+    SimpleClient client = this->client_for(groups[i].first);
+    microseconds backoff = 100us;
+    while (!client.Commit(txid, commit)) {
+      // (Aborts that don't get through just leave the keys to expire)
+      if (!commit || client.last_error() == TXN_UNKNOWN_ERROR ||
+          steady_clock::now() >= give_up) {
+        return false;
+      }
+      std::this_thread::sleep_for(backoff);
+      backoff = std::min<microseconds>(backoff * 2, TXN_MAX_BACKOFF);
     }
+    return true;
+  });
+  if (commit) {
+    for (auto&& group : groups) {
+      for (auto&& key : group.second[0]) this->invalidate_cached(key);
+    }
+  }
+  return commit && std::all_of(results.begin(), results.end(),
+                               [](bool ok) { return ok; });
+}
+
+void ShardKvClient::enable_write_batching(microseconds max_delay,
+                                          size_t max_keys) {
+  this->batcher = std::make_unique<WriteBatcher>(
+      [this](const std::vector<std::string>& keys,
+             const std::vector<std::string>& values) {
+        // A MultiPut doesn't promise to apply its pairs in order, so a key
+        // Put twice in one batch just gets its last value (which is where
+        // the Puts would have left it anyway). Separate Puts were never
+        // atomic together, so the batch skips the transaction.
+        std::map<std::string, size_t> last;
+        for (size_t i = 0; i < keys.size(); i++) last[keys[i]] = i;
+        if (last.size() == keys.size()) {
+          return this->MultiPutEach(keys, values);
+        }
+        std::vector<std::string> distinct_keys, distinct_values;
+        for (auto&& [key, i] : last) {
+          distinct_keys.push_back(key);
+          distinct_values.push_back(values[i]);
+        }
+        return this->MultiPutEach(distinct_keys, distinct_values);
+      },
+      max_delay, max_keys);
+}
+
+void ShardKvClient::enable_read_cache(size_t capacity) {
+  this->cache = std::make_unique<ReadCache>(capacity);
+}
+
+void ShardKvClient::enable_replica_reads(microseconds max_staleness) {
+  this->replica_staleness = max_staleness;
+}
+
+void ShardKvClient::PutAsync(const std::string& key, const std::string& value,
+                             std::function<void(bool)> done) {
+  this->invalidate_cached(key);
+  if (this->batcher) {
+    this->batcher->Put(key, value, std::move(done));
+  } else {
+    done(this->put_now(key, value));
   }
-  if (!valid) return false;
+}
+
+std::future<bool> ShardKvClient::PutAsync(const std::string& key,
+                                          const std::string& value) {
+  this->invalidate_cached(key);
+  if (this->batcher) return this->batcher->Put(key, value);
+  std::promise<bool> promise;
+  promise.set_value(this->put_now(key, value));
+  return promise.get_future();
+}
 
-  // Establish connection to each responsible server, and make MultiPut request
-  for (auto&& [server, responsible_pairs] : server_pairs) {
-    auto res = SimpleClient{server}.MultiPut(responsible_pairs[0],
-                                             responsible_pairs[1]);
-    if (!res) return false;
+std::shared_ptr<const ShardRouter> ShardKvClient::routing_config() {
+  {
+    std::unique_lock lock(this->config_mtx);
+    if (this->router && this->watched()) return this->router;
+    if (this->router && this->config_ttl > 0ms &&
+        steady_clock::now() - this->config_fetched < this->config_ttl) {
+      return this->router;
+    }
   }
+  return this->fetch_config();
+}
 
+bool ShardKvClient::enable_config_watch() {
+  if (this->watcher.joinable()) return this->watching;
+  this->watch_conn = connect_to_server(this->shardmaster_addr);
+  if (!this->watch_conn) {
+    cerr_color(YELLOW, "Failed to connect to shardmaster at ",
+               this->shardmaster_addr, " to watch it.");
+    return false;
+  }
+  this->watching = true;
+  this->watcher = std::thread(&ShardKvClient::watch_loop, this);
   return true;
 }
 
-// Shardmaster functions
-std::optional<ShardmasterConfig> ShardKvClient::Query() {
+void ShardKvClient::watch_loop() {
+  ShardmasterConfig config;
+  uint64_t version = 0;
+  while (true) {
+    WatchRequest req{version, uint64_t(milliseconds(WATCH_TIMEOUT).count())};
+    if (!this->watch_conn->send_request(req)) break;
+    std::optional<Response> res = this->watch_conn->recv_response();
+    auto* watch_res = res ? std::get_if<WatchResponse>(&*res) : nullptr;
+    if (!watch_res) break;
+    if (watch_res->version == version) continue;
+
+    if (watch_res->full) config = {};
+    apply_delta(&config, watch_res->delta);
+    version = watch_res->version;
+    auto router = std::make_shared<const ShardRouter>(config);
+    std::unique_lock lock(this->config_mtx);
+    this->router = std::move(router);
+    this->config_fetched = steady_clock::now();
+    this->config_version = version;
+    this->watch_delivered = true;
+  }
+  // Back to refetching the config when it's stale
+  this->watching = false;
+}
+
+void ShardKvClient::heed_config_hint(const SimpleClient& client) {
+  std::optional<uint64_t> version = client.config_hint();
+  if (!version) return;
+  {
+    std::unique_lock lock(this->config_mtx);
+    if (this->watched()) return;
+    if (*version > 0 && *version <= this->config_version) return;
+  }
+  std::unique_lock lock(this->refresh_mtx);
+  if (this->refreshing) return;
+  if (this->refresher.joinable()) this->refresher.join();
+  this->refreshing = true;
+  this->refresher = std::thread(&ShardKvClient::refresh_config, this);
+}
+
+void ShardKvClient::refresh_config() {
+  // A Watch from version 0 returns the whole config, with its version,
+  // straight away; shardmasters that can't be watched are Queried instead
+  std::shared_ptr<ServerConn> conn = connect_to_server(this->shardmaster_addr);
+  std::optional<Response> res;
+  if (conn && conn->send_request(WatchRequest{0, 0})) {
+    res = conn->recv_response();
+  }
+  std::optional<ShardmasterConfig> config;
+  uint64_t version = 0;
+  if (auto* watch_res = res ? std::get_if<WatchResponse>(&*res) : nullptr) {
+    config.emplace();
+    apply_delta(&*config, watch_res->delta);
+    version = watch_res->version;
+  } else if (res && conn->send_request(QueryRequest{})) {
+    res = conn->recv_response();
+    auto* query_res = res ? std::get_if<QueryResponse>(&*res) : nullptr;
+    if (query_res) config = std::move(query_res->config);
+  }
+
+  if (config) {
+    auto router = std::make_shared<const ShardRouter>(*config);
+    std::unique_lock lock(this->config_mtx);
+    this->router = std::move(router);
+    this->config_fetched = steady_clock::now();
+    this->config_version = version;
+  }
+  std::unique_lock lock(this->refresh_mtx);
+  this->refreshing = false;
+}
+
+std::shared_ptr<const ShardRouter> ShardKvClient::fetch_config(
+    ShardmasterConfig* config) {
+  std::unique_lock lock(this->config_mtx);
   QueryRequest req;
-  if (!this->shardmaster_conn->send_request(req)) return std::nullopt;
+  if (!this->shardmaster_conn->send_request(req)) return nullptr;
 
   std::optional<Response> res = this->shardmaster_conn->recv_response();
-  if (!res) return std::nullopt;
-  if (auto* query_res = std::get_if<QueryResponse>(&*res)) {
-    return query_res->config;
-  }
+  if (!res) return nullptr;
+  auto* query_res = std::get_if<QueryResponse>(&*res);
+  if (!query_res) return nullptr;
+
+  auto router = std::make_shared<const ShardRouter>(query_res->config);
+  this->router = router;
+  this->config_fetched = steady_clock::now();
+  this->config_version = 0;
+  if (config) *config = std::move(query_res->config);
+  return router;
+}
 
-  return std::nullopt;
+// Shardmaster functions
+std::optional<ShardmasterConfig> ShardKvClient::Query() {
+  ShardmasterConfig config;
+  if (!this->fetch_config(&config)) return std::nullopt;
+  return config;
 }
 
 bool ShardKvClient::Join(const std::string& server) {
+  std::unique_lock lock(this->config_mtx);
   JoinRequest req{server};
   if (!this->shardmaster_conn->send_request(req)) return false;
 
   std::optional<Response> res = this->shardmaster_conn->recv_response();
   if (!res) return false;
   if (auto* join_res = std::get_if<JoinResponse>(&*res)) {
+    // Keys are about to move
+    this->router.reset();
     return true;
   }
 
@@ -154,12 +539,15 @@ bool ShardKvClient::Join(const std::string& server) {
 }
 
 bool ShardKvClient::Leave(const std::string& server) {
+  std::unique_lock lock(this->config_mtx);
   LeaveRequest req{server};
   if (!this->shardmaster_conn->send_request(req)) return false;
 
   std::optional<Response> res = this->shardmaster_conn->recv_response();
   if (!res) return false;
   if (auto* leave_res = std::get_if<LeaveResponse>(&*res)) {
+    // Keys are about to move
+    this->router.reset();
     return true;
   }
 
@@ -168,12 +556,15 @@ bool ShardKvClient::Leave(const std::string& server) {
 
 bool ShardKvClient::Move(const std::string& server,
                          const std::vector<Shard>& shards) {
+  std::unique_lock lock(this->config_mtx);
   MoveRequest req{server, shards};
   if (!this->shardmaster_conn->send_request(req)) return false;
 
   std::optional<Response> res = this->shardmaster_conn->recv_response();
   if (!res) return false;
   if (auto* move_res = std::get_if<MoveResponse>(&*res)) {
+    // Keys are about to move
+    this->router.reset();
     return true;
   }
 
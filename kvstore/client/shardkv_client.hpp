@@ -2,21 +2,57 @@
 #define SHARDKV_CLIENT_HPP
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <random>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "client.hpp"
 #include "common/config.hpp"
+#include "net/connection_pool.hpp"
 #include "net/network_conn.hpp"
 #include "net/network_messages.hpp"
+#include "read_cache.hpp"
 #include "simple_client.hpp"
+#include "write_batcher.hpp"
 
+using namespace std::chrono;
+
+// How long ShardKvClient routes with a cached config before re-querying the
+// shardmaster (sooner, if a server says it isn't responsible for a key).
+#define CONFIG_CACHE_TTL 5s
+// How many times an operation is retried with a refreshed config.
+#define CONFIG_MAX_RETRIES 3
+
+/*
+ * A client for a sharded store. It routes keys to servers using a cached copy
+ * of the shardmaster's config, which is refreshed when it's older than
+ * config_ttl, or as soon as a server reports a key was misrouted (in which
+ * case the operation is retried transparently). A config_ttl of 0 queries the
+ * shardmaster before every operation. Servers that forward misrouted
+ * requests answer them instead, saying the config is out of date, and it's
+ * refreshed in the background.
+ *
+ * Puts can optionally be batched (see enable_write_batching), in which case
+ * they're sent to the servers as MultiPuts, and Gets can optionally be
+ * cached (see enable_read_cache) or spread over the keys' backups (see
+ * enable_replica_reads).
+ */
 class ShardKvClient : public Client {
  public:
-  explicit ShardKvClient(const std::string& sm_addr)
-      : shardmaster_addr(sm_addr) {
+  explicit ShardKvClient(const std::string& sm_addr, bool compression = false,
+                         milliseconds config_ttl = CONFIG_CACHE_TTL)
+      : shardmaster_addr(sm_addr),
+        compression(compression),
+        config_ttl(config_ttl) {
     this->shardmaster_conn = connect_to_server(this->shardmaster_addr);
     if (!this->shardmaster_conn) {
       cerr_color(RED, "Failed to connect to shardmaster at ",
@@ -28,6 +64,13 @@ class ShardKvClient : public Client {
   }
 
   ~ShardKvClient() {
+    // Writes out any buffered Puts, which may still need the shardmaster
+    this->batcher.reset();
+    if (this->watcher.joinable()) {
+      this->watch_conn->shutdown();
+      this->watcher.join();
+    }
+    if (this->refresher.joinable()) this->refresher.join();
     this->shardmaster_conn->shutdown();
   }
 
@@ -43,13 +86,73 @@ class ShardKvClient : public Client {
   std::optional<std::vector<std::string>> MultiGet(
       const std::vector<std::string>& keys);
 
+  // Takes effect on every server or none: pairs spanning servers are written
+  // as a transaction (see server/transactions.hpp), in two round trips.
   bool MultiPut(const std::vector<std::string>& keys,
                 const std::vector<std::string>& values);
+  // A MultiPut that writes each server's pairs on their own, in one round
+  // trip; if it fails, some servers may have taken theirs.
+  bool MultiPutEach(const std::vector<std::string>& keys,
+                    const std::vector<std::string>& values);
   
   bool GDPRDelete(const std::string& user) {
     assert(false);
   }
 
+  /*
+   * Makes Puts wait up to max_delay for other Puts (or until max_keys of them
+   * have built up), and sends them together: one MultiPut per server, rather
+   * than a request per key. Put then blocks for up to max_delay longer, so
+   * batching mostly pays off with PutAsync, or with Puts from many threads.
+   */
+  void enable_write_batching(microseconds max_delay = BATCH_MAX_DELAY,
+                             size_t max_keys = BATCH_MAX_KEYS);
+
+  /*
+   * Caches the values of up to capacity keys, for as long as their servers
+   * lease them out (see server/leases.hpp), so a Get may return a value up
+   * to a lease's length out of date. Our own writes are seen straight away.
+   * Only Get uses the cache.
+   */
+  void enable_read_cache(size_t capacity = READ_CACHE_CAPACITY);
+  /*
+   * Sends each Get to one of the key's replicas (its server, or one of the
+   * server's backups; see server/replication.hpp), picked at random, so
+   * reads of a key spread over all of them. A backup only answers if its
+   * copy is at most max_staleness out of date, so a Get may return a value
+   * that stale (even after our own write); otherwise, or if it can't be
+   * reached, the Get goes on to the key's server. The read cache, if
+   * enabled, comes first.
+   */
+  void enable_replica_reads(microseconds max_staleness);
+  // The read cache, if enabled (e.g. for its hit rate).
+  const ReadCache* read_cache() const {
+    return this->cache.get();
+  }
+
+  /*
+   * Keeps the cached config up to date by watching the shardmaster (over a
+   * second connection, from a background thread), so changes are picked up
+   * as soon as they're made rather than once config_ttl runs out, and an
+   * idle client costs the shardmaster one request per WATCH_TIMEOUT. Until
+   * the watch brings in a config (or if the shardmaster can't be watched,
+   * or the watch breaks), config_ttl applies. Returns whether the watch
+   * could be started.
+   */
+  bool enable_config_watch();
+
+  // Gives each request to a KvServer timeout to complete (see
+  // SimpleClient::set_timeout); retries after a misroute get their own.
+  void set_timeout(milliseconds timeout) {
+    this->timeout = timeout;
+  }
+
+  // A Put that completes in the background: done is called with its result
+  // (on another thread, if writes are batched).
+  void PutAsync(const std::string& key, const std::string& value,
+                std::function<void(bool)> done);
+  std::future<bool> PutAsync(const std::string& key, const std::string& value);
+
   // Shardmaster functions
   std::optional<ShardmasterConfig> Query();
 
@@ -61,7 +164,137 @@ class ShardKvClient : public Client {
 
  private:
   std::string shardmaster_addr;
+  // Guards shardmaster_conn and the cached config, since the batcher's
+  // thread routes writes alongside the caller's.
+  std::mutex config_mtx;
   std::shared_ptr<ServerConn> shardmaster_conn;
+  // Whether to compress large requests/responses to KvServers.
+  bool compression;
+  // Connections to KvServers, reused across requests.
+  std::shared_ptr<ConnectionPool> pool = ConnectionPool::shared();
+
+  // The config keys are routed with (compiled for lookups), and when it was
+  // fetched. Operations hold on to the router they started with, so a
+  // refetch doesn't pull it out from under them.
+  std::shared_ptr<const ShardRouter> router;
+  steady_clock::time_point config_fetched;
+  milliseconds config_ttl;
+  // The cached config's version, if it's known (0 otherwise; Queries don't
+  // say).
+  uint64_t config_version = 0;
+  // For requests to KvServers; 0 for none.
+  milliseconds timeout{0};
+
+  // When watching, the thread following the shardmaster's config (over its
+  // own connection, since watches block), and whether it still is.
+  std::shared_ptr<ServerConn> watch_conn;
+  std::thread watcher;
+  std::atomic<bool> watching = false;
+  // Whether the watch has brought in a config yet (a shardmaster that never
+  // publishes one leaves it waiting on version 0). Guarded by config_mtx.
+  bool watch_delivered = false;
+  void watch_loop();
+  // Whether the watch is keeping the cached config up to date, so config_ttl
+  // doesn't apply. Call with config_mtx held.
+  bool watched() const {
+    return this->watching && this->watch_delivered;
+  }
+
+  // The cached config, (re)fetched from the shardmaster if it's stale, or
+  // nullptr if there's none to be had.
+  std::shared_ptr<const ShardRouter> routing_config();
+  /*
+   * Queries the shardmaster and caches the config it returns (also into
+   * config, if given). Returns the router built for it, or nullptr on
+   * failure: callers route with this one rather than rereading the cache,
+   * which an invalidate_config() from another thread may have dropped.
+   */
+  std::shared_ptr<const ShardRouter> fetch_config(
+      ShardmasterConfig* config = nullptr);
+  // Drops the cached config, so the next operation fetches a fresh one.
+  void invalidate_config() {
+    std::unique_lock lock(this->config_mtx);
+    this->router.reset();
+  }
+
+  // Refetches the config in the background (over a shardmaster connection
+  // of its own, so operations go on with the old one meanwhile), one fetch
+  // at a time, when servers hint the cached one is out of date.
+  std::thread refresher;
+  std::mutex refresh_mtx;
+  bool refreshing = false;
+  void refresh_config();
+  // Starts a refresh if client's last operation came with a config hint
+  // newer than the cached config (unless the watch will bring it in).
+  void heed_config_hint(const SimpleClient& client);
+
+  // A MultiPut's pairs, split up by server.
+  using ServerPairs = std::vector<
+      std::pair<std::string, std::array<std::vector<std::string>, 2>>>;
+  // Splits up pairs under router, or returns nullopt if a key has no server.
+  static std::optional<ServerPairs> split_pairs(
+      const ShardRouter& router, const std::vector<std::string>& keys,
+      const std::vector<std::string>& values);
+  // Writes each server's pairs with a MultiPut.
+  bool multiput_each(const ServerPairs& groups, bool* misrouted);
+  // Prepares each server's pairs as transaction txid, then commits them if
+  // all of them were, and aborts them if not. Sets *locked if a server
+  // turned the prepare down for a key another transaction holds.
+  bool multiput_transaction(uint64_t txid, const ServerPairs& groups,
+                            bool* misrouted, bool* locked);
+
+  // Unbatched Put.
+  bool put_now(const std::string& key, const std::string& value);
+  // Get from the servers, leasing the value into the cache.
+  std::optional<std::string> get_leased(const std::string& key);
+  // Drops keys we're writing from the cache.
+  void invalidate_cached(const std::string& key) {
+    if (this->cache) this->cache->invalidate(key);
+  }
+
+  // Leased values, when caching is on.
+  std::unique_ptr<ReadCache> cache;
+
+  // How out of date a value Gets take from a backup, when they go to
+  // replicas, and the picks of which replica.
+  std::optional<microseconds> replica_staleness;
+  std::mutex rng_mtx;
+  std::mt19937 rng{std::random_device{}()};
+  // Get from one of key's replicas.
+  std::optional<std::string> get_replicated(const std::string& key);
+
+  /*
+   * Runs op (which routes keys with the given config, and sets *misrouted if
+   * a key had no server or its server disowned it), refreshing the config and
+   * retrying on misroutes. Returns a default Result if no config can be had.
+   */
+  template <typename Result, typename Op>
+  Result routed(Op&& op) {
+    for (int attempt = 0;; attempt++) {
+      std::shared_ptr<const ShardRouter> router = this->routing_config();
+      if (!router) return Result{};
+      bool misrouted = false;
+      Result res = op(*router, &misrouted);
+      if (!misrouted || attempt == CONFIG_MAX_RETRIES) return res;
+      this->invalidate_config();
+    }
+  }
+
+  // Whether a failed request to client failed because of our routing.
+  static bool misrouted(const SimpleClient& client) {
+    return is_not_responsible_error(client.last_error());
+  }
+
+  // A client for one KvServer, sharing our settings and connections.
+  SimpleClient client_for(const std::string& server) {
+    SimpleClient client{server, this->compression, this->pool};
+    client.set_timeout(this->timeout);
+    return client;
+  }
+
+  // Buffers Puts when batching is on. Declared last, so it's gone (and has
+  // written everything out) before the rest of the client.
+  std::unique_ptr<WriteBatcher> batcher;
 };
 
 #endif /* end of include guard */
@@ -1,16 +1,24 @@
 #ifndef SIMPLE_CLIENT_HPP
 #define SIMPLE_CLIENT_HPP
 
+#include <chrono>
 #include <optional>
 #include <string>
 
 #include "client.hpp"
+#include "net/connection_pool.hpp"
 #include "net/network_conn.hpp"
 
 class SimpleClient : public Client {
  public:
-  explicit SimpleClient(const std::string& server_addr)
-      : server_addr(server_addr) {
+  // Connections come from (and go back to) pool, or the process-wide pool if
+  // none is given.
+  explicit SimpleClient(const std::string& server_addr,
+                        bool compression = false,
+                        std::shared_ptr<ConnectionPool> pool = nullptr)
+      : server_addr(server_addr),
+        compression(compression),
+        pool(pool ? std::move(pool) : ConnectionPool::shared()) {
   }
   ~SimpleClient() = default;
 
@@ -31,8 +39,67 @@ class SimpleClient : public Client {
 
   bool GDPRDelete(const std::string& user);
 
+  // The two phases of a MultiPut spanning servers, for this server's share
+  // of its pairs (see PrepareRequest). Prepare fails with KEY_LOCKED_ERROR
+  // (see last_error()) rather than wait for another transaction.
+  bool Prepare(uint64_t txid, const std::vector<std::string>& keys,
+               const std::vector<std::string>& values);
+  bool Commit(uint64_t txid, bool commit);
+
+  // A Get that also asks the server for a read lease, setting *lease to how
+  // long (from when this was called) the value may be cached for. Servers
+  // that don't grant leases get a plain Get, and *lease is 0.
+  std::optional<std::string> GetLeased(const std::string& key,
+                                       microseconds* lease);
+  // A Get that the server may answer as one of the key's backups, if its
+  // copy is at most max_staleness out of date (see ReplicaGetRequest).
+  std::optional<std::string> GetReplica(const std::string& key,
+                                        microseconds max_staleness);
+
+  /*
+   * Gives each later operation timeout (from when it starts) to complete,
+   * after which it fails; servers are sent the deadline, and drop requests
+   * they only get to after it. 0 (the default) waits indefinitely.
+   */
+  void set_timeout(milliseconds timeout) {
+    this->timeout = timeout;
+  }
+
+  // Why the last operation failed, if the server (or connecting to it) said;
+  // empty otherwise.
+  const std::string& last_error() const {
+    return this->error;
+  }
+  // If the server passed the last operation on to the key's server (see
+  // FLAG_CONFIG_HINT), the version of the config it routed it with (0 if it
+  // doesn't know); a sign that the caller's config is out of date.
+  std::optional<uint64_t> config_hint() const {
+    return this->hint;
+  }
+
  private:
   std::string server_addr;
+  // Whether to compress large requests/responses on the wire.
+  bool compression;
+  std::shared_ptr<ConnectionPool> pool;
+  std::string error;
+  std::optional<uint64_t> hint;
+  milliseconds timeout{0};
+  // When the current operation times out, if it does.
+  std::optional<system_clock::time_point> deadline;
+
+  // Gets a connection to the server for an operation (starting its clock),
+  // printing an error on failure.
+  PooledConn connect();
+  // Makes a request over conn, within the operation's deadline. Writes
+  // refused with KEY_LOCKED_ERROR are retried until the transaction holding
+  // their keys is done.
+  std::optional<Response> call(PooledConn& conn, const Request& req);
+
+  // Sends a large value in STREAM_CHUNK_SIZE chunks (to a server that takes
+  // streamed values).
+  bool put_streamed(PooledConn& conn, const std::string& key,
+                    const std::string& value);
 };
 
 #endif /* end of include guard */
@@ -0,0 +1,77 @@
+#include "write_batcher.hpp"
+
+WriteBatcher::WriteBatcher(Writer write, microseconds max_delay,
+                           size_t max_keys)
+    : write(std::move(write)),
+      max_delay(max_delay),
+      max_keys(std::max<size_t>(max_keys, 1)) {
+  this->flusher = std::thread(&WriteBatcher::flush_loop, this);
+}
+
+WriteBatcher::~WriteBatcher() {
+  {
+    std::unique_lock lock(this->mtx);
+    this->stopping = true;
+  }
+  this->cv.notify_all();
+  this->flusher.join();
+}
+
+void WriteBatcher::Put(const std::string& key, const std::string& value,
+                       std::function<void(bool)> done) {
+  std::unique_lock lock(this->mtx);
+  if (this->keys.empty()) this->oldest = steady_clock::now();
+  this->keys.push_back(key);
+  this->values.push_back(value);
+  this->callbacks.push_back(std::move(done));
+  // The flusher only needs waking to start a timer, or to send a full batch
+  if (this->keys.size() == 1 || this->keys.size() >= this->max_keys) {
+    this->cv.notify_all();
+  }
+}
+
+std::future<bool> WriteBatcher::Put(const std::string& key,
+                                    const std::string& value) {
+  auto promise = std::make_shared<std::promise<bool>>();
+  std::future<bool> future = promise->get_future();
+  this->Put(key, value, [promise](bool ok) { promise->set_value(ok); });
+  return future;
+}
+
+void WriteBatcher::flush_loop() {
+  std::unique_lock lock(this->mtx);
+  while (true) {
+    this->cv.wait(lock,
+                  [this] { return this->stopping || !this->keys.empty(); });
+    if (this->keys.empty()) return;
+
+    // Wait for the batch to fill up, or its time to run out
+    this->cv.wait_until(lock, this->oldest + this->max_delay, [this] {
+      return this->stopping || this->keys.size() >= this->max_keys;
+    });
+
+    // Take (at most) a full batch, and write it without holding the lock, so
+    // the next one can fill up meanwhile
+    size_t n = std::min(this->keys.size(), this->max_keys);
+    std::vector<std::string> batch_keys(
+        std::make_move_iterator(this->keys.begin()),
+        std::make_move_iterator(this->keys.begin() + n));
+    std::vector<std::string> batch_values(
+        std::make_move_iterator(this->values.begin()),
+        std::make_move_iterator(this->values.begin() + n));
+    std::vector<std::function<void(bool)>> batch_callbacks(
+        std::make_move_iterator(this->callbacks.begin()),
+        std::make_move_iterator(this->callbacks.begin() + n));
+    this->keys.erase(this->keys.begin(), this->keys.begin() + n);
+    this->values.erase(this->values.begin(), this->values.begin() + n);
+    this->callbacks.erase(this->callbacks.begin(),
+                          this->callbacks.begin() + n);
+    // Leftovers have waited at least as long as the batch, so they go next
+    lock.unlock();
+
+    bool ok = this->write(batch_keys, batch_values);
+    for (auto&& done : batch_callbacks) done(ok);
+
+    lock.lock();
+  }
+}
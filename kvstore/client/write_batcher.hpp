@@ -0,0 +1,67 @@
+#ifndef WRITE_BATCHER_HPP
+#define WRITE_BATCHER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+// Defaults for how long a buffered Put may wait for company, and how many
+// Puts make a full batch.
+#define BATCH_MAX_DELAY 500us
+#define BATCH_MAX_KEYS 64
+
+/*
+ * Buffers Puts and writes them in batches, trading a bounded delay on each
+ * Put for far fewer round trips. A batch goes out once it holds max_keys Puts,
+ * or its oldest Put has waited max_delay, whichever comes first; each Put
+ * completes when its batch has been written.
+ *
+ * Batches are written one at a time, in order, by a background thread, so
+ * Puts to the same key land in the order they were made.
+ */
+class WriteBatcher {
+ public:
+  // Writes a batch (e.g. as a MultiPut), returning whether all of it made it.
+  using Writer = std::function<bool(const std::vector<std::string>& keys,
+                                    const std::vector<std::string>& values)>;
+
+  explicit WriteBatcher(Writer write, microseconds max_delay = BATCH_MAX_DELAY,
+                        size_t max_keys = BATCH_MAX_KEYS);
+  // Writes whatever is still buffered.
+  ~WriteBatcher();
+
+  // Buffers a Put; done is called (on the batcher's thread) with whether its
+  // batch was written.
+  void Put(const std::string& key, const std::string& value,
+           std::function<void(bool)> done);
+  std::future<bool> Put(const std::string& key, const std::string& value);
+
+  WriteBatcher(const WriteBatcher&) = delete;
+  WriteBatcher& operator=(const WriteBatcher&) = delete;
+
+ private:
+  Writer write;
+  microseconds max_delay;
+  size_t max_keys;
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool stopping = false;
+  // The batch being filled, and when its first Put arrived.
+  std::vector<std::string> keys;
+  std::vector<std::string> values;
+  std::vector<std::function<void(bool)>> callbacks;
+  steady_clock::time_point oldest;
+
+  std::thread flusher;
+  void flush_loop();
+};
+
+#endif /* end of include guard */
@@ -20,21 +20,24 @@
 #include "repl/repl.hpp"
 
 int main(int argc, char* argv[]) {
-  if (argc != 2) {
+  bool compression = argc == 3 && std::string(argv[2]) == "--compress";
+  if (argc != 2 && !compression) {
 #ifdef SIMPLE_CLIENT
-    cerr_color(RED, "Usage: ./simple_client <server hostname:port>");
+    cerr_color(RED,
+               "Usage: ./simple_client <server hostname:port> [--compress]");
 #else
-    cerr_color(RED, "Usage: ./client <shardmaster hostname:port>");
+    cerr_color(RED,
+               "Usage: ./client <shardmaster hostname:port> [--compress]");
 #endif
     exit(EXIT_FAILURE);
   }
 
 #ifdef SIMPLE_CLIENT
   std::shared_ptr<SimpleClient> client =
-      std::make_shared<SimpleClient>(argv[1]);
+      std::make_shared<SimpleClient>(argv[1], compression);
 #else
   std::shared_ptr<ShardKvClient> client =
-      std::make_shared<ShardKvClient>(argv[1]);
+      std::make_shared<ShardKvClient>(argv[1], compression);
 #endif
 
   Repl repl;
@@ -0,0 +1,492 @@
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/histogram.hpp"
+#include "bench/workload.hpp"
+#include "client/shardkv_client.hpp"
+#include "client/simple_client.hpp"
+#include "common/color.hpp"
+#include "common/utils.hpp"
+#include "server/server.hpp"
+#include "server/synchronized_queue.hpp"
+#include "shardmaster/static_shardmaster.hpp"
+
+// Records per MultiPut while loading.
+#define LOAD_BATCH_SIZE 100
+// Appends add at most this much to a value, so hot values don't balloon.
+#define MAX_APPEND_SIZE 16
+
+struct BenchOptions {
+  // What to run against: a shardmaster, a single KvServer, or a cluster of
+  // this many KvServers (plus a shardmaster) started in this process.
+  std::string shardmaster;
+  std::string server;
+  size_t spawn = 0;
+
+  WorkloadMix mix = *WorkloadMix::preset('B');
+  KeyDistribution distribution = KeyDistribution::ZIPFIAN;
+  std::string prefix;
+  uint64_t records = 10'000;
+  bool load = true;
+  size_t value_size = 100;
+  size_t multiget_size = 10;
+
+  size_t threads = 4;
+  // Run this many operations in all, or for this long, if set.
+  uint64_t ops = 100'000;
+  duration<double> run_time{0};
+  // Target operations per second (in all) for an open-loop run; 0 runs each
+  // thread flat out (closed loop).
+  double rate = 0;
+  bool compression = false;
+};
+
+void usage() {
+  cerr_color(
+      RED,
+      "Usage: ./kvbench (--shardmaster <addr> | --server <addr> | --spawn <n>) "
+      "[options]\n"
+      "Workload:\n"
+      "\t--workload <A|B|C|D>: a YCSB core workload mix (default B)\n"
+      "\t--mix get=<f>,put=<f>,append=<f>,multiget=<f>: a custom mix\n"
+      "\t--distribution <uniform|zipfian|latest>: key popularity (default "
+      "zipfian)\n"
+      "\t--records <n>: keys to load and pick from (default 10000)\n"
+      "\t--no-load: skip loading the records (they're already there)\n"
+      "\t--value-size <bytes>: size of values written (default 100)\n"
+      "\t--multiget-size <n>: keys per MultiGet (default 10)\n"
+      "\t--prefix <str>: prefix every key (keys are otherwise spread over "
+      "the key space)\n"
+      "Run:\n"
+      "\t--threads <n>: client threads (default 4)\n"
+      "\t--ops <n>: operations to run in all (default 100000)\n"
+      "\t--duration <seconds>: run for this long instead\n"
+      "\t--rate <ops/s>: issue operations at this rate in all (open loop); "
+      "latencies then count from when each was due\n"
+      "\t--compress: compress large requests/responses");
+}
+
+std::optional<WorkloadMix> parse_mix(const std::string& spec) {
+  WorkloadMix mix;
+  for (auto&& part : split(spec, ',')) {
+    auto kv = split(part, '=');
+    if (kv.size() != 2) return std::nullopt;
+    double fraction;
+    try {
+      fraction = std::stod(kv[1]);
+    } catch (const std::exception&) {
+      return std::nullopt;
+    }
+    if (kv[0] == "get") {
+      mix.get = fraction;
+    } else if (kv[0] == "put") {
+      mix.put = fraction;
+    } else if (kv[0] == "append") {
+      mix.append = fraction;
+    } else if (kv[0] == "multiget") {
+      mix.multi_get = fraction;
+    } else {
+      return std::nullopt;
+    }
+  }
+  if (mix.get + mix.put + mix.append + mix.multi_get <= 0) return std::nullopt;
+  return mix;
+}
+
+std::optional<BenchOptions> parse_args(int argc, char* argv[]) {
+  BenchOptions opts;
+  try {
+    for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      // Flags without a value
+      if (arg == "--no-load") {
+        opts.load = false;
+        continue;
+      } else if (arg == "--compress") {
+        opts.compression = true;
+        continue;
+      }
+
+      if (i + 1 >= argc) return std::nullopt;
+      std::string value = argv[++i];
+      if (arg == "--shardmaster") {
+        opts.shardmaster = value;
+      } else if (arg == "--server") {
+        opts.server = value;
+      } else if (arg == "--spawn") {
+        opts.spawn = std::stoul(value);
+      } else if (arg == "--workload") {
+        auto mix = WorkloadMix::preset(value.empty() ? '?' : value[0]);
+        if (!mix || value.size() != 1) return std::nullopt;
+        opts.mix = *mix;
+        if (std::toupper(value[0]) == 'D') {
+          opts.distribution = KeyDistribution::LATEST;
+        }
+      } else if (arg == "--mix") {
+        auto mix = parse_mix(value);
+        if (!mix) return std::nullopt;
+        opts.mix = *mix;
+      } else if (arg == "--distribution") {
+        auto distribution = parse_distribution(value);
+        if (!distribution) return std::nullopt;
+        opts.distribution = *distribution;
+      } else if (arg == "--records") {
+        opts.records = std::stoull(value);
+      } else if (arg == "--value-size") {
+        opts.value_size = std::stoul(value);
+      } else if (arg == "--multiget-size") {
+        opts.multiget_size = std::max<size_t>(std::stoul(value), 1);
+      } else if (arg == "--prefix") {
+        opts.prefix = value;
+      } else if (arg == "--threads") {
+        opts.threads = std::max<size_t>(std::stoul(value), 1);
+      } else if (arg == "--ops") {
+        opts.ops = std::stoull(value);
+      } else if (arg == "--duration") {
+        opts.run_time = duration<double>(std::stod(value));
+      } else if (arg == "--rate") {
+        opts.rate = std::stod(value);
+      } else {
+        return std::nullopt;
+      }
+    }
+  } catch (const std::exception&) {
+    return std::nullopt;
+  }
+
+  int targets = !opts.shardmaster.empty() + !opts.server.empty() +
+                (opts.spawn > 0);
+  if (targets != 1) return std::nullopt;
+  return opts;
+}
+
+// A port that's free right now, as picked by the kernel, or "" if none is.
+std::string free_port() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return "";
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  socklen_t len = sizeof(addr);
+  std::string port;
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+      getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) == 0) {
+    port = std::to_string(ntohs(addr.sin_port));
+  }
+  close(fd);
+  return port;
+}
+
+/*
+ * A shardmaster and n KvServers in this process, on ports the kernel picks,
+ * with every server joined. These are the real StaticShardmaster and
+ * KvServer, so this only works once they (and the KvStore underneath) are
+ * implemented; start checks that they are before the benchmark relies on
+ * them, and says what's missing if not.
+ */
+class LocalCluster {
+ public:
+  bool start(size_t n) {
+    // KvServer's workers would crash on the stencil's queue, so it's checked
+    // before any are started
+    if (!queue_works()) {
+      return unimplemented("synchronized_queue (KvServer's work queue)");
+    }
+
+    std::string sm_port = free_port();
+    if (sm_port.empty()) return false;
+    std::string sm_addr = get_host_address(sm_port.c_str());
+    this->shardmaster = std::make_unique<StaticShardmaster>(sm_addr);
+    if (this->shardmaster->start() < 0) return false;
+    this->address = sm_addr;
+
+    ShardKvClient admin(sm_addr);
+    std::vector<std::string> addrs;
+    for (size_t i = 0; i < n; i++) {
+      std::string port = free_port();
+      std::string addr = get_host_address(port.c_str());
+      this->servers.push_back(
+          std::make_unique<KvServer>(addr, sm_addr, N_WORKERS));
+      if (port.empty() || this->servers.back()->start() < 0 ||
+          !admin.Join(addr)) {
+        cerr_color(RED, "Failed to start KvServer on ", addr);
+        return false;
+      }
+      addrs.push_back(addr);
+    }
+    return this->check(&admin, addrs);
+  }
+
+  std::string address;
+
+ private:
+  std::unique_ptr<StaticShardmaster> shardmaster;
+  std::vector<std::unique_ptr<KvServer>> servers;
+
+  static bool queue_works() {
+    synchronized_queue<int> queue;
+    queue.push(1);
+    int elt = 0;
+    return !queue.pop(&elt) && elt == 1;
+  }
+
+  // Whether the shardmaster knows about every server, and a value written
+  // through them can be read back.
+  bool check(ShardKvClient* admin, const std::vector<std::string>& addrs) {
+    auto config = admin->Query();
+    size_t listed = 0;
+    if (config) {
+      for (auto&& addr : addrs) {
+        for (auto&& server : config->servers) {
+          if (server.server == addr && !server.shards.empty()) {
+            listed++;
+            break;
+          }
+        }
+      }
+    }
+    if (listed != addrs.size()) {
+      return unimplemented("StaticShardmaster (Join and Query)");
+    }
+
+    std::string probe = "kvbench-spawn-check";
+    auto value = admin->Put(probe, "ok") ? admin->Get(probe) : std::nullopt;
+    if (value != "ok") return unimplemented("the KvStore KvServer uses");
+    admin->Delete(probe);
+    return true;
+  }
+
+  static bool unimplemented(const std::string& what) {
+    cerr_color(RED, "--spawn runs the real servers, but ", what,
+               " isn't implemented yet. Start a shardmaster and servers "
+               "yourself and pass --shardmaster instead.");
+    return false;
+  }
+};
+
+// What one thread saw, per operation type.
+struct ThreadStats {
+  std::array<LatencyHistogram, size_t(OpType::COUNT)> latencies;
+  std::array<uint64_t, size_t(OpType::COUNT)> errors{};
+};
+
+class Bench {
+ public:
+  Bench(const BenchOptions& opts, const std::string& sm_addr)
+      : opts(opts),
+        shardmaster(sm_addr),
+        keys(opts.distribution, opts.records, opts.prefix) {
+    // Values are slices of one random buffer
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    this->value_pool.resize(2 * opts.value_size + 1);
+    for (auto&& c : this->value_pool) c = letter(rng);
+  }
+
+  // Writes every record, returning the records loaded per second.
+  double load() {
+    auto start = steady_clock::now();
+    std::atomic<uint64_t> failed = 0;
+    this->on_threads([&](size_t t, Client& client, std::mt19937_64& rng) {
+      auto [begin, end] = this->share_of(t, this->opts.records);
+      for (uint64_t i = begin; i < end; i += LOAD_BATCH_SIZE) {
+        std::vector<std::string> batch_keys, batch_values;
+        for (uint64_t j = i; j < std::min(end, i + LOAD_BATCH_SIZE); j++) {
+          batch_keys.push_back(this->keys.key_name(j));
+          batch_values.push_back(this->make_value(rng, this->opts.value_size));
+        }
+        if (!client.MultiPut(batch_keys, batch_values)) failed++;
+      }
+    });
+    if (failed > 0) {
+      cerr_color(YELLOW, failed.load(), " load batches failed.");
+    }
+    return this->opts.records /
+           duration<double>(steady_clock::now() - start).count();
+  }
+
+  // Runs the workload, then prints what happened.
+  void run() {
+    std::vector<ThreadStats> stats(this->opts.threads);
+    auto start = steady_clock::now();
+    this->on_threads([&](size_t t, Client& client, std::mt19937_64& rng) {
+      this->run_thread(t, client, rng, start, stats[t]);
+    });
+    double elapsed = duration<double>(steady_clock::now() - start).count();
+
+    ThreadStats total;
+    for (auto&& thread_stats : stats) {
+      for (size_t op = 0; op < size_t(OpType::COUNT); op++) {
+        total.latencies[op].merge(thread_stats.latencies[op]);
+        total.errors[op] += thread_stats.errors[op];
+      }
+    }
+    this->report(total, elapsed);
+  }
+
+ private:
+  BenchOptions opts;
+  std::string shardmaster;
+  KeyChooser keys;
+  std::string value_pool;
+
+  std::unique_ptr<Client> make_client() {
+    if (!this->opts.server.empty()) {
+      return std::make_unique<SimpleClient>(this->opts.server,
+                                            this->opts.compression);
+    }
+    return std::make_unique<ShardKvClient>(this->shardmaster,
+                                           this->opts.compression);
+  }
+
+  // Runs fn(thread number, client, rng) on each of the threads, and waits.
+  template <typename Fn>
+  void on_threads(Fn fn) {
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < this->opts.threads; t++) {
+      threads.emplace_back([this, t, &fn] {
+        std::unique_ptr<Client> client = this->make_client();
+        std::mt19937_64 rng(std::random_device{}() + t);
+        fn(t, *client, rng);
+      });
+    }
+    for (auto&& thread : threads) thread.join();
+  }
+
+  // Thread t's part of [0, n).
+  std::pair<uint64_t, uint64_t> share_of(size_t t, uint64_t n) {
+    uint64_t per_thread = n / this->opts.threads;
+    uint64_t extra = n % this->opts.threads;
+    uint64_t begin = t * per_thread + std::min<uint64_t>(t, extra);
+    return {begin, begin + per_thread + (t < extra)};
+  }
+
+  std::string make_value(std::mt19937_64& rng, size_t size) {
+    size_t offset = rng() % (this->value_pool.size() - size);
+    return this->value_pool.substr(offset, size);
+  }
+
+  void run_thread(size_t t, Client& client, std::mt19937_64& rng,
+                  steady_clock::time_point start, ThreadStats& stats) {
+    bool timed = this->opts.run_time.count() > 0;
+    auto [begin, end] = this->share_of(t, this->opts.ops);
+    uint64_t n_ops = end - begin;
+    auto deadline = start + duration_cast<nanoseconds>(this->opts.run_time);
+    // In an open-loop run, op i is due at start + i * interval, whether or
+    // not the ones before it are done
+    bool open_loop = this->opts.rate > 0;
+    auto interval = open_loop ? duration_cast<nanoseconds>(duration<double>(
+                                    this->opts.threads / this->opts.rate))
+                              : 0ns;
+
+    for (uint64_t i = 0; timed || i < n_ops; i++) {
+      auto due = start + interval * int64_t(i);
+      if (open_loop) std::this_thread::sleep_until(due);
+      auto issued = steady_clock::now();
+      if (timed && issued >= deadline) break;
+
+      OpType op = this->opts.mix.choose(uniform01(rng));
+      bool ok = this->do_op(op, client, rng);
+      auto done = steady_clock::now();
+      stats.latencies[size_t(op)].record(done - (open_loop ? due : issued));
+      if (!ok) stats.errors[size_t(op)]++;
+    }
+  }
+
+  bool do_op(OpType op, Client& client, std::mt19937_64& rng) {
+    switch (op) {
+      case OpType::GET:
+        return client.Get(this->keys.key_name(this->keys.next_existing(rng)))
+            .has_value();
+      case OpType::PUT: {
+        uint64_t i = this->keys.next_write(rng);
+        bool ok = client.Put(this->keys.key_name(i),
+                             this->make_value(rng, this->opts.value_size));
+        if (ok) this->keys.acknowledge(i);
+        return ok;
+      }
+      case OpType::APPEND:
+        return client.Append(
+            this->keys.key_name(this->keys.next_existing(rng)),
+            this->make_value(
+                rng, std::min<size_t>(this->opts.value_size, MAX_APPEND_SIZE)));
+      case OpType::MULTI_GET: {
+        std::vector<std::string> batch;
+        for (size_t k = 0; k < this->opts.multiget_size; k++) {
+          batch.push_back(this->keys.key_name(this->keys.next_existing(rng)));
+        }
+        return client.MultiGet(batch).has_value();
+      }
+      default:
+        return false;
+    }
+  }
+
+  void report(const ThreadStats& total, double elapsed) {
+    auto us = [](nanoseconds ns) { return ns.count() / 1000.0; };
+    auto row = [&](const char* name, const LatencyHistogram& latencies,
+                   uint64_t errors) {
+      std::cout << std::left << std::setw(10) << name << std::right
+                << std::setw(10) << latencies.count() << std::setw(8) << errors
+                << std::fixed << std::setprecision(0) << std::setw(10)
+                << latencies.count() / elapsed << std::setprecision(1);
+      for (double percentile : {50.0, 90.0, 99.0, 99.9}) {
+        std::cout << std::setw(10) << us(latencies.percentile(percentile));
+      }
+      std::cout << std::setw(10) << us(latencies.mean()) << std::setw(10)
+                << us(latencies.max()) << '\n';
+    };
+
+    std::cout << std::left << std::setw(10) << "op" << std::right
+              << std::setw(10) << "count" << std::setw(8) << "errors"
+              << std::setw(10) << "ops/s" << std::setw(10) << "p50"
+              << std::setw(10) << "p90" << std::setw(10) << "p99"
+              << std::setw(10) << "p99.9" << std::setw(10) << "mean"
+              << std::setw(10) << "max" << "  (latencies in us)\n";
+    LatencyHistogram all;
+    uint64_t all_errors = 0;
+    for (size_t op = 0; op < size_t(OpType::COUNT); op++) {
+      if (total.latencies[op].count() == 0) continue;
+      row(op_name(OpType(op)), total.latencies[op], total.errors[op]);
+      all.merge(total.latencies[op]);
+      all_errors += total.errors[op];
+    }
+    row("total", all, all_errors);
+  }
+};
+
+int main(int argc, char* argv[]) {
+  std::optional<BenchOptions> opts = parse_args(argc, argv);
+  if (!opts) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  LocalCluster cluster;
+  std::string sm_addr = opts->shardmaster;
+  if (opts->spawn > 0) {
+    if (!cluster.start(opts->spawn)) return EXIT_FAILURE;
+    sm_addr = cluster.address;
+  }
+
+  Bench bench(*opts, sm_addr);
+  if (opts->load) {
+    double rate = bench.load();
+    std::cout << "loaded " << opts->records << " records ("
+              << opts->value_size << " bytes each) at " << std::fixed
+              << std::setprecision(0) << rate << " records/s\n";
+  }
+  bench.run();
+  return 0;
+}
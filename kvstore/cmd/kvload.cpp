@@ -0,0 +1,161 @@
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "client/bulk_loader.hpp"
+#include "common/color.hpp"
+
+struct LoadOptions {
+  std::string shardmaster;
+  std::string server;
+  std::string path;
+  BulkLoadOptions load;
+  // Where to start in the dump; if checkpoint is set, it's read from there
+  // (when the file exists), and written there after every segment.
+  uint64_t offset = 0;
+  bool offset_given = false;
+  std::string checkpoint;
+};
+
+void usage() {
+  cerr_color(
+      RED,
+      "Usage: ./kvload (--shardmaster <addr> | --server <addr>) [options] "
+      "<dump>\n"
+      "Loads a dump of `put <key> <value>` lines (like gdpr/database.txt).\n"
+      "Options:\n"
+      "\t--threads <n>: threads parsing and sending (default 4)\n"
+      "\t--batch <n>: pairs per MultiPut (default ",
+      LOAD_BATCH_KEYS,
+      ")\n"
+      "\t--window <n>: MultiPuts in flight per server (default ",
+      LOAD_WINDOW,
+      ")\n"
+      "\t--segment-mb <n>: MB loaded between checkpoints (default ",
+      LOAD_SEGMENT_SIZE >> 20,
+      ")\n"
+      "\t--offset <bytes>: start this far into the dump\n"
+      "\t--checkpoint <file>: resume from the offset saved in <file>, and "
+      "save progress to it\n"
+      "\t--compress: compress large requests");
+}
+
+std::optional<LoadOptions> parse_args(int argc, char* argv[]) {
+  LoadOptions opts;
+  try {
+    for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      if (arg == "--compress") {
+        opts.load.compression = true;
+        continue;
+      }
+      if (arg.rfind("--", 0) != 0) {
+        if (!opts.path.empty()) return std::nullopt;
+        opts.path = arg;
+        continue;
+      }
+
+      if (i + 1 >= argc) return std::nullopt;
+      std::string value = argv[++i];
+      if (arg == "--shardmaster") {
+        opts.shardmaster = value;
+      } else if (arg == "--server") {
+        opts.server = value;
+      } else if (arg == "--threads") {
+        opts.load.threads = std::stoul(value);
+      } else if (arg == "--batch") {
+        opts.load.batch_keys = std::stoul(value);
+      } else if (arg == "--window") {
+        opts.load.window = std::stoul(value);
+      } else if (arg == "--segment-mb") {
+        opts.load.segment_size = std::stoul(value) << 20;
+      } else if (arg == "--offset") {
+        opts.offset = std::stoull(value);
+        opts.offset_given = true;
+      } else if (arg == "--checkpoint") {
+        opts.checkpoint = value;
+      } else {
+        return std::nullopt;
+      }
+    }
+  } catch (const std::exception&) {
+    return std::nullopt;
+  }
+
+  if (opts.path.empty() || opts.shardmaster.empty() == opts.server.empty()) {
+    return std::nullopt;
+  }
+  return opts;
+}
+
+// Overwrites the checkpoint file with offset, all at once (so a crash
+// mid-write can't leave a torn offset behind).
+bool save_checkpoint(const std::string& path, uint64_t offset) {
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::trunc);
+    out << offset << '\n';
+    if (!out) return false;
+  }
+  return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+void print_progress(const BulkLoadProgress& progress, uint64_t start,
+                    uint64_t size) {
+  double seconds = std::max(progress.elapsed.count(), 1e-9);
+  double mb = (progress.offset - start) / double(1 << 20);
+  std::cerr << "\r" << std::fixed << std::setprecision(1) << std::setw(5)
+            << 100.0 * progress.offset / std::max<uint64_t>(size, 1) << "%  "
+            << progress.records << " records  " << mb << " MB  "
+            << std::setprecision(0) << progress.records / seconds
+            << " records/s  " << std::setprecision(1) << mb / seconds
+            << " MB/s  offset " << progress.offset << "   " << std::flush;
+}
+
+int main(int argc, char* argv[]) {
+  std::optional<LoadOptions> opts = parse_args(argc, argv);
+  if (!opts) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  MappedFile dump;
+  if (!dump.open(opts->path)) {
+    cerr_color(RED, "Failed to open ", opts->path, '.');
+    return EXIT_FAILURE;
+  }
+  if (!opts->checkpoint.empty() && !opts->offset_given) {
+    std::ifstream in(opts->checkpoint);
+    if (in >> opts->offset) {
+      cout_color(BLUE, "Resuming from offset ", opts->offset, '.');
+    }
+  }
+
+  uint64_t size = dump.text().size();
+  BulkLoader loader(opts->shardmaster, opts->server, opts->load);
+  BulkLoadProgress progress = loader.load(
+      dump.text(), opts->offset, [&](const BulkLoadProgress& progress) {
+        print_progress(progress, opts->offset, size);
+        if (!opts->checkpoint.empty() &&
+            !save_checkpoint(opts->checkpoint, progress.offset)) {
+          cerr_color(YELLOW, "\nFailed to save checkpoint to ",
+                     opts->checkpoint, '.');
+        }
+      });
+  std::cerr << '\n';
+
+  if (progress.skipped > 0) {
+    cerr_color(YELLOW, "Skipped ", progress.skipped,
+               " lines that weren't puts.");
+  }
+  if (progress.failed) {
+    cerr_color(RED, "Load failed; everything before offset ", progress.offset,
+               " is stored. Resume with --offset ", progress.offset, '.');
+    return EXIT_FAILURE;
+  }
+  cout_color(BLUE, "Loaded ", progress.records, " records in ",
+             progress.elapsed.count(), "s.");
+  return 0;
+}
@@ -0,0 +1,267 @@
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench/shard_sim.hpp"
+#include "bench/workload.hpp"
+#include "common/color.hpp"
+#include "common/utils.hpp"
+
+struct SimOptions {
+  std::vector<ShardPolicy> policies = {
+      ShardPolicy::STATIC, ShardPolicy::CONSISTENT, ShardPolicy::LOAD_AWARE};
+
+  // Keys: read from a trace, or made up as kvbench makes them.
+  std::string keys_file;
+  uint64_t records = 1'000'000;
+  std::optional<uint64_t> accesses;
+  KeyDistribution distribution = KeyDistribution::ZIPFIAN;
+  std::string prefix;
+
+  // Servers joined up front, then changes: read from a trace, or churn
+  // (servers leaving and joining, in turn).
+  size_t servers = 16;
+  std::string events_file;
+  size_t churn = 4;
+
+  size_t vnodes = RING_VNODES;
+  size_t rebalance_rounds = SIM_REBALANCE_ROUNDS;
+  uint64_t seed = 0;
+};
+
+void usage() {
+  cerr_color(
+      RED,
+      "Usage: ./kvsim [options]\n"
+      "Placement:\n"
+      "\t--policy <static|consistent|load>[,...]: policies to compare "
+      "(default all)\n"
+      "\t--servers <n>: servers joined before the changes (default 16)\n"
+      "\t--events <file>: changes to replay, one per line (join <server>, "
+      "leave <server>, move <server> <lower> <upper> ..., rebalance)\n"
+      "\t--churn <n>: without --events, this many changes of a random "
+      "server leaving or a new one joining, in turn (default 4)\n"
+      "\t--vnodes <n>: virtual nodes per server for consistent (default "
+      "128)\n"
+      "\t--rebalance-rounds <n>: most rounds per rebalance for load "
+      "(default 16)\n"
+      "Keys:\n"
+      "\t--keys <file>: a key trace, one access per line\n"
+      "\t--records <n>: without --keys, keys to make up (default 1000000)\n"
+      "\t--accesses <n>: accesses to draw over them (default one per key)\n"
+      "\t--distribution <uniform|zipfian|latest>: key popularity (default "
+      "zipfian)\n"
+      "\t--prefix <str>: prefix every key\n"
+      "\t--seed <n>: for the accesses and churn (default 0)");
+}
+
+std::optional<SimOptions> parse_args(int argc, char* argv[]) {
+  SimOptions opts;
+  try {
+    for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      if (i + 1 >= argc) return std::nullopt;
+      std::string value = argv[++i];
+      if (arg == "--policy") {
+        opts.policies.clear();
+        for (auto&& name : split(value, ',')) {
+          auto policy = parse_policy(name);
+          if (!policy) return std::nullopt;
+          opts.policies.push_back(*policy);
+        }
+      } else if (arg == "--servers") {
+        opts.servers = std::stoul(value);
+      } else if (arg == "--events") {
+        opts.events_file = value;
+      } else if (arg == "--churn") {
+        opts.churn = std::stoul(value);
+      } else if (arg == "--vnodes") {
+        opts.vnodes = std::max<size_t>(std::stoul(value), 1);
+      } else if (arg == "--rebalance-rounds") {
+        opts.rebalance_rounds = std::stoul(value);
+      } else if (arg == "--keys") {
+        opts.keys_file = value;
+      } else if (arg == "--records") {
+        opts.records = std::stoull(value);
+      } else if (arg == "--accesses") {
+        opts.accesses = std::stoull(value);
+      } else if (arg == "--distribution") {
+        auto distribution = parse_distribution(value);
+        if (!distribution) return std::nullopt;
+        opts.distribution = *distribution;
+      } else if (arg == "--prefix") {
+        opts.prefix = value;
+      } else if (arg == "--seed") {
+        opts.seed = std::stoull(value);
+      } else {
+        return std::nullopt;
+      }
+    }
+  } catch (const std::exception&) {
+    return std::nullopt;
+  }
+  if (opts.policies.empty()) return std::nullopt;
+  return opts;
+}
+
+std::string server_name(size_t i) {
+  return "server" + std::to_string(i);
+}
+
+// The changes to replay: from the events file, or made-up churn (the same
+// for every policy, so they're compared on the same changes).
+std::optional<std::vector<MembershipEvent>> load_events(
+    const SimOptions& opts) {
+  std::vector<MembershipEvent> events;
+  if (!opts.events_file.empty()) {
+    std::ifstream in(opts.events_file);
+    if (!in) {
+      cerr_color(RED, "Couldn't open ", opts.events_file, '.');
+      return std::nullopt;
+    }
+    std::string line;
+    for (size_t n = 1; std::getline(in, line); n++) {
+      if (line.empty() || line[0] == '#') continue;
+      auto event = parse_event(line);
+      if (!event) {
+        cerr_color(RED, opts.events_file, ':', n, ": not an event: ", line);
+        return std::nullopt;
+      }
+      events.push_back(std::move(*event));
+    }
+    return events;
+  }
+
+  // Load-aware placement gets to rebalance after each change, as it would
+  // once the servers report in
+  std::mt19937_64 rng(opts.seed);
+  std::vector<std::string> joined;
+  for (size_t i = 0; i < opts.servers; i++) joined.push_back(server_name(i));
+  size_t next = opts.servers;
+  for (size_t i = 0; i < opts.churn; i++) {
+    if (i % 2 == 0 && !joined.empty()) {
+      size_t leaving =
+          std::uniform_int_distribution<size_t>(0, joined.size() - 1)(rng);
+      events.push_back({MembershipEvent::Kind::LEAVE, joined[leaving]});
+      joined.erase(joined.begin() + leaving);
+    } else {
+      joined.push_back(server_name(next++));
+      events.push_back({MembershipEvent::Kind::JOIN, joined.back()});
+    }
+    events.push_back({MembershipEvent::Kind::REBALANCE});
+  }
+  return events;
+}
+
+void print_row(const std::string& label, const PlacementStats& stats,
+               size_t n_keys) {
+  double moved = n_keys ? 100.0 * stats.keys_moved / n_keys : 0;
+  std::cout << std::left << std::setw(28) << label << std::right
+            << std::setw(7) << stats.servers << std::setw(8) << stats.shards
+            << std::fixed << std::setprecision(1) << std::setw(10)
+            << stats.keys_moved << " (" << std::setw(5) << moved << "%)"
+            << std::setw(10) << stats.keys_unplaced << std::setprecision(2)
+            << std::setw(10) << stats.key_imbalance << std::setw(10)
+            << stats.load_imbalance << '\n';
+}
+
+// What each policy came to, for the comparison at the end.
+struct Summary {
+  ShardPolicy policy;
+  uint64_t keys_moved = 0;
+  PlacementStats last;
+  LookupCost lookups;
+};
+
+Summary simulate(ShardPolicy policy, const SimOptions& opts,
+                 const KeyTrace& trace,
+                 const std::vector<MembershipEvent>& events) {
+  std::cout << "\n== " << policy_name(policy) << " ==\n"
+            << std::left << std::setw(28) << "event" << std::right
+            << std::setw(7) << "servers" << std::setw(8) << "shards"
+            << std::setw(19) << "keys moved" << std::setw(10) << "unplaced"
+            << std::setw(10) << "keys max" << std::setw(10) << "load max"
+            << '\n';
+
+  ShardSimulator sim(policy, &trace, opts.vnodes, opts.rebalance_rounds);
+  for (size_t i = 0; i < opts.servers; i++) {
+    sim.apply({MembershipEvent::Kind::JOIN, server_name(i)});
+  }
+  sim.apply({MembershipEvent::Kind::REBALANCE});
+  Summary summary{policy, 0, {}, {}};
+  summary.last = sim.measure();
+  print_row("(initial)", summary.last, trace.keys.size());
+
+  for (auto&& event : events) {
+    // (Other policies don't rebalance, so there's nothing to show)
+    if (event.kind == MembershipEvent::Kind::REBALANCE &&
+        policy != ShardPolicy::LOAD_AWARE) {
+      continue;
+    }
+    if (!sim.apply(event)) {
+      std::cout << describe(event) << ": refused\n";
+      continue;
+    }
+    summary.last = sim.measure();
+    summary.keys_moved += summary.last.keys_moved;
+    print_row(describe(event), summary.last, trace.keys.size());
+  }
+
+  summary.lookups = measure_lookups(sim.config(), trace.keys);
+  return summary;
+}
+
+int main(int argc, char* argv[]) {
+  std::optional<SimOptions> opts = parse_args(argc, argv);
+  if (!opts) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  KeyTrace trace;
+  if (!opts->keys_file.empty()) {
+    std::ifstream in(opts->keys_file);
+    if (!in) {
+      cerr_color(RED, "Couldn't open ", opts->keys_file, '.');
+      return EXIT_FAILURE;
+    }
+    trace = read_trace(in);
+  } else {
+    trace = synthetic_trace(opts->distribution, opts->records,
+                            opts->accesses.value_or(opts->records),
+                            opts->prefix, opts->seed);
+  }
+  auto events = load_events(*opts);
+  if (!events) return EXIT_FAILURE;
+  std::cout << trace.keys.size() << " keys, " << opts->servers
+            << " servers, " << events->size() << " events\n"
+            << "(keys/load max: the busiest server's keys/accesses over the "
+               "mean)\n";
+
+  std::vector<Summary> summaries;
+  for (auto policy : opts->policies) {
+    summaries.push_back(simulate(policy, *opts, trace, *events));
+  }
+
+  std::cout << "\n" << std::left << std::setw(12) << "policy" << std::right
+            << std::setw(12) << "keys moved" << std::setw(10) << "keys max"
+            << std::setw(10) << "load max" << std::setw(12) << "build (us)"
+            << std::setw(14) << "lookup (ns)" << std::setw(12) << "scan (ns)"
+            << '\n';
+  for (auto&& summary : summaries) {
+    std::cout << std::left << std::setw(12) << policy_name(summary.policy)
+              << std::right << std::setw(12) << summary.keys_moved
+              << std::fixed << std::setprecision(2) << std::setw(10)
+              << summary.last.key_imbalance << std::setw(10)
+              << summary.last.load_imbalance << std::setw(12)
+              << summary.lookups.build.count() << std::setprecision(0)
+              << std::setw(14) << summary.lookups.router_ns << std::setw(12)
+              << summary.lookups.scan_ns << '\n';
+  }
+  return 0;
+}
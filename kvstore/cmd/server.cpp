@@ -9,12 +9,39 @@
 #include "server/printcommand.hpp"
 
 int main(int argc, char* argv[]) {
+  // Pull out optional flags, leaving only the positional arguments
+  KvServerOptions options;
+  std::vector<char*> args;
+  for (int i = 0; i < argc; i++) {
+    if (std::string(argv[i]) == "--compress") {
+      options.compress_values = true;
+    } else if (std::string(argv[i]) == "--report-load") {
+      options.report_load = true;
+    } else if (std::string(argv[i]) == "--forward") {
+      options.forward_misrouted = true;
+    } else if (std::string(argv[i]) == "--local" && i + 1 < argc) {
+      options.local_address = argv[++i];
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  argc = args.size();
+  argv = args.data();
+
   if (argc < 2 || argc > 4) {
     cerr_color(RED,
                "\nIf on Concurrent Store:\n"
-               "\t./server <port> [n_workers]\n"
+               "\t./server <port> [n_workers] [options]\n"
                "If on Distributed Store:\n"
-               "\t./server <port> <shardmaster_addr:port> [n_workers]");
+               "\t./server <port> <shardmaster_addr:port> [n_workers] "
+               "[options]\n"
+               "Options:\n"
+               "\t--compress: store large values compressed\n"
+               "\t--forward: pass requests for other servers' keys on to "
+               "them\n"
+               "\t--local <unix:path|shm:name>: also listen for co-located "
+               "clients\n"
+               "\t--report-load: report shard load to the shardmaster");
     return EXIT_FAILURE;
   }
 
@@ -41,9 +68,10 @@ int main(int argc, char* argv[]) {
   // If no shardmaster address specified, Concurrent Store; otherwise,
   // Distributed Store
   if (shardmaster_addr.empty()) {
-    server = std::make_shared<KvServer>(addr, n_workers);
+    server = std::make_shared<KvServer>(addr, n_workers, options);
   } else {
-    server = std::make_shared<KvServer>(addr, shardmaster_addr, n_workers);
+    server = std::make_shared<KvServer>(addr, shardmaster_addr, n_workers,
+                                        options);
   }
 
   int ret = server->start();
@@ -52,7 +80,7 @@ int main(int argc, char* argv[]) {
   }
 
   Repl repl;
-  // - `print <store|config>` (display store/config)
+  // - `print <store|config|stats>` (display store/config/stats)
   PrintCommand pc{server};
   repl.add_command(pc);
 
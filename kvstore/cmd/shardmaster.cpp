@@ -1,21 +1,53 @@
 #include "shardmaster/shardmaster.hpp"
 
+#include <cstdlib>
 #include <iostream>
 
 #include "repl/repl.hpp"
+#include "shardmaster/consistent_shardmaster.hpp"
+#include "shardmaster/dynamic_shardmaster.hpp"
 #include "shardmaster/querycommand.hpp"
 #include "shardmaster/static_shardmaster.hpp"
 
 int main(int argc, char* argv[]) {
-  if (argc != 2) {
-    cerr_color(RED, "Usage: ./shardmaster <PORT>");
+  // With --vnodes, servers are placed by consistent hashing; with
+  // --dynamic, shards are placed by the load servers report. Either way,
+  // --backups gives each server that many backups
+  size_t vnodes = 0, backups = 0;
+  bool dynamic = false, usage = argc < 2;
+  for (int i = 2; i < argc && !usage; i++) {
+    std::string flag = argv[i];
+    if (flag == "--dynamic") {
+      dynamic = true;
+    } else if (flag == "--vnodes" && i + 1 < argc) {
+      vnodes = std::strtoul(argv[++i], nullptr, 10);
+      usage = vnodes == 0;
+    } else if (flag == "--backups" && i + 1 < argc) {
+      backups = std::strtoul(argv[++i], nullptr, 10);
+    } else {
+      usage = true;
+    }
+  }
+  if (usage || (dynamic && vnodes > 0) ||
+      (backups > 0 && !dynamic && vnodes == 0)) {
+    cerr_color(RED,
+               "Usage: ./shardmaster <PORT> [--vnodes <n> | --dynamic] "
+               "[--backups <n>]");
     exit(EXIT_FAILURE);
   }
 
   // Get shardmaster address, for servers to connect
   std::string addr = get_host_address(argv[1]);
-  std::shared_ptr<Shardmaster> shardmaster =
-      std::make_shared<StaticShardmaster>(addr);
+  std::shared_ptr<Shardmaster> shardmaster;
+  if (vnodes > 0) {
+    shardmaster =
+        std::make_shared<ConsistentShardmaster>(addr, vnodes, backups);
+  } else if (dynamic) {
+    shardmaster =
+        std::make_shared<DynamicShardmaster>(addr, REBALANCE_INTERVAL, backups);
+  } else {
+    shardmaster = std::make_shared<StaticShardmaster>(addr);
+  }
 
   int ret = shardmaster->start();
   if (ret < 0) {
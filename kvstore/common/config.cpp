@@ -1,5 +1,8 @@
 #include "config.hpp"
 
+#include <map>
+#include <string_view>
+
 std::string ShardmasterConfig::print() {
   std::stringstream ss;
   ss << "Shardmaster configuration: \n";
@@ -9,11 +12,98 @@ std::string ShardmasterConfig::print() {
       ss << s;
       if (s != sc.shards.back()) ss << ", ";
     }
+    if (!sc.backups.empty()) {
+      ss << " (backups:";
+      for (auto&& backup : sc.backups) ss << ' ' << backup;
+      ss << ')';
+    }
     ss << '\n';
   }
   return ss.str();
 }
 
+void assign_backups(ShardmasterConfig* config, size_t n) {
+  auto& servers = config->servers;
+  n = std::min(n, servers.empty() ? 0 : servers.size() - 1);
+  for (size_t i = 0; i < servers.size(); i++) {
+    servers[i].backups.clear();
+    for (size_t j = 1; j <= n; j++) {
+      servers[i].backups.push_back(servers[(i + j) % servers.size()].server);
+    }
+  }
+}
+
+ConfigDelta diff_configs(const ShardmasterConfig& from,
+                         const ShardmasterConfig& to) {
+  std::map<std::string_view, const ServerConfig*> before;
+  for (auto&& sc : from.servers) before[sc.server] = &sc;
+
+  ConfigDelta delta;
+  for (auto&& sc : to.servers) {
+    auto it = before.find(sc.server);
+    if (it == before.end() || it->second->shards != sc.shards ||
+        it->second->backups != sc.backups) {
+      delta.changed.push_back(sc);
+    }
+    if (it != before.end()) before.erase(it);
+  }
+  for (auto&& [server, shards] : before) delta.removed.emplace_back(server);
+  return delta;
+}
+
+void apply_delta(ShardmasterConfig* config, const ConfigDelta& delta) {
+  std::erase_if(config->servers, [&](const ServerConfig& sc) {
+    return std::find(delta.removed.begin(), delta.removed.end(), sc.server) !=
+           delta.removed.end();
+  });
+  for (auto&& changed : delta.changed) {
+    auto it = std::find_if(
+        config->servers.begin(), config->servers.end(),
+        [&](const ServerConfig& sc) { return sc.server == changed.server; });
+    if (it == config->servers.end()) {
+      config->servers.push_back(changed);
+    } else {
+      *it = changed;
+    }
+  }
+}
+
+namespace {
+
+/*
+ * Keys and shard bounds are compared by their first ROUTING_MAX_GRANULARITY
+ * characters, as base-257 numbers: each character present is its byte plus
+ * 1, so a key that ends early sorts before any that goes on (as with string
+ * comparison). A shard [lower, upper] is then the positions from lower
+ * (padded with 0s) to upper (padded with 256s), which are exactly the keys
+ * that Shard::contains.
+ */
+constexpr uint64_t POSITION_BASE = 257;
+
+uint64_t key_position(const std::string& key) {
+  uint64_t position = 0;
+  for (size_t i = 0; i < ROUTING_MAX_GRANULARITY; i++) {
+    position *= POSITION_BASE;
+    if (i < key.size()) position += std::toupper((unsigned char)key[i]) + 1;
+  }
+  return position;
+}
+
+uint64_t bound_position(const std::string& bound, bool upper) {
+  uint64_t position = 0;
+  for (size_t i = 0; i < ROUTING_MAX_GRANULARITY; i++) {
+    position *= POSITION_BASE;
+    if (i < bound.size()) {
+      position += (unsigned char)bound[i] + 1;
+    } else if (upper) {
+      position += POSITION_BASE - 1;
+    }
+  }
+  return position;
+}
+
+}  // namespace
+
 std::optional<std::string> ShardmasterConfig::get_server(
     const std::string& key) {
   std::string key_uppercase = to_upper(key);
@@ -33,5 +123,72 @@ std::optional<std::string> ShardmasterConfig::get_server(
   return it->server;
 }
 
+ShardRouter::ShardRouter(const ShardmasterConfig& config) {
+  for (auto&& sc : config.servers) {
+    for (auto&& s : sc.shards) {
+      if (s.granularity() > ROUTING_MAX_GRANULARITY) {
+        this->unindexed = config;
+        return;
+      }
+      this->ranges.push_back({bound_position(s.lower, false),
+                              bound_position(s.upper, true),
+                              uint32_t(this->servers.size()),
+                              uint32_t(this->ranges.size())});
+    }
+    this->servers.push_back(sc.server);
+    this->backups.push_back(sc.backups);
+  }
+
+  std::sort(this->ranges.begin(), this->ranges.end(),
+            [](const Range& a, const Range& b) { return a.lower < b.lower; });
+  // With overlaps, which server a key goes to depends on the order of the
+  // config's servers, which the ranges have lost
+  for (size_t i = 1; i < this->ranges.size(); i++) {
+    if (this->ranges[i].lower <= this->ranges[i - 1].upper) {
+      this->unindexed = config;
+      return;
+    }
+  }
+}
+
+ShardRouter::Route ShardRouter::route(const std::string& key) const {
+  if (this->unindexed) {
+    auto& servers = this->unindexed->servers;
+    std::string key_uppercase = to_upper(key);
+    size_t shard = 0;
+    for (auto&& sc : servers) {
+      for (auto&& s : sc.shards) {
+        if (s.contains(key_uppercase)) return {&sc.server, shard};
+        shard++;
+      }
+    }
+    return {};
+  }
+
+  // The last range starting at or before the key's position
+  uint64_t position = key_position(key);
+  auto it = std::upper_bound(
+      this->ranges.begin(), this->ranges.end(), position,
+      [](uint64_t position, const Range& r) { return position < r.lower; });
+  if (it == this->ranges.begin()) return {};
+  --it;
+  if (position > it->upper) return {};
+  return {&this->servers[it->server], it->shard};
+}
+
+const std::vector<std::string>& ShardRouter::backups_for(
+    const std::string& key) const {
+  static const std::vector<std::string> none;
+  const std::string* server = this->server_for(key);
+  if (!server) return none;
+  if (this->unindexed) {
+    for (auto&& sc : this->unindexed->servers) {
+      if (&sc.server == server) return sc.backups;
+    }
+    return none;
+  }
+  return this->backups[server - this->servers.data()];
+}
+
 // TODO (optional): Implement any helper functions over a shardmaster
 // configuration!
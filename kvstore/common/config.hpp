@@ -2,6 +2,7 @@
 #define SHARDMASTER_CONFIG_HPP
 
 #include <algorithm>
+#include <cstdint>
 #include <optional>
 #include <string>
 #include <vector>
@@ -12,6 +13,14 @@
 struct ServerConfig {
   std::string server;
   std::vector<Shard> shards;
+  // Servers holding copies of this server's shards, which it ships its
+  // writes to (see server/replication.hpp); empty if it has none. (backups
+  // came later, and goes out with every server in a QueryResponse or
+  // WatchResponse, so clients and servers from before it can't read configs
+  // from shardmasters after, or the other way around.)
+  std::vector<std::string> backups = {};
+
+  bool operator==(const ServerConfig&) const = default;
 };
 
 // Struct representing a Shardmaster's configuration. You may find this helpful
@@ -19,6 +28,8 @@ struct ServerConfig {
 struct ShardmasterConfig {
   std::vector<ServerConfig> servers;
 
+  bool operator==(const ShardmasterConfig&) const = default;
+
   // Pretty printing of server configuration
   std::string print();
   // Gets the server with the shard for the key.
@@ -28,4 +39,84 @@ struct ShardmasterConfig {
   // configuration!
 };
 
+// Makes each server's backups the n servers after it in config (wrapping
+// around), so each server also holds copies for n others.
+void assign_backups(ShardmasterConfig* config, size_t n);
+
+/*
+ * What changed from one config to another: the servers that joined or whose
+ * shards or backups changed (with their new ones), and the servers that left.
+ */
+struct ConfigDelta {
+  std::vector<ServerConfig> changed;
+  std::vector<std::string> removed;
+};
+
+// The delta that takes from to to.
+ConfigDelta diff_configs(const ShardmasterConfig& from,
+                         const ShardmasterConfig& to);
+/*
+ * Applies delta to config in place: changed servers get their new shards and
+ * backups (keeping their place in the list; servers that joined go on the
+ * end), and removed servers are dropped.
+ */
+void apply_delta(ShardmasterConfig* config, const ConfigDelta& delta);
+
+// Longest shard bound a ShardRouter can index (configs with longer ones are
+// routed by scanning their shards, as ShardmasterConfig::get_server does).
+#define ROUTING_MAX_GRANULARITY 7
+
+/*
+ * A config compiled for routing keys: every shard as a range of key
+ * positions, sorted, so a key's server is a binary search away (rather than
+ * a scan over every shard of every server). Built once per config fetched;
+ * answers exactly as ShardmasterConfig::get_server does.
+ */
+class ShardRouter {
+ public:
+  ShardRouter() = default;
+  explicit ShardRouter(const ShardmasterConfig& config);
+
+  /*
+   * Where key goes: the server with the shard for it (nullptr if there's
+   * none), and that shard's index among the config's shards, counting each
+   * server's in turn. The pointer lives as long as the router.
+   */
+  struct Route {
+    const std::string* server = nullptr;
+    size_t shard = 0;
+  };
+  Route route(const std::string& key) const;
+  // The server with the shard for key, or nullptr if there's none.
+  const std::string* server_for(const std::string& key) const {
+    return this->route(key).server;
+  }
+  std::optional<std::string> get_server(const std::string& key) const {
+    const std::string* server = this->server_for(key);
+    if (!server) return std::nullopt;
+    return *server;
+  }
+  // The backups of key's server (empty if it has none, or there's no
+  // server for key). The reference lives as long as the router.
+  const std::vector<std::string>& backups_for(const std::string& key) const;
+
+ private:
+  struct Range {
+    uint64_t lower;
+    uint64_t upper;
+    // Index into servers
+    uint32_t server;
+    // Index of the shard in the config (see Route)
+    uint32_t shard;
+  };
+  // Sorted by lower, and disjoint.
+  std::vector<Range> ranges;
+  std::vector<std::string> servers;
+  // Each of servers' backups.
+  std::vector<std::vector<std::string>> backups;
+  // Set if the config's shards overlap or are too fine to index, in which
+  // case lookups go through it instead.
+  std::optional<ShardmasterConfig> unindexed;
+};
+
 #endif /* end of include guard */
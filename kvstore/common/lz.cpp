@@ -0,0 +1,233 @@
+#include "lz.hpp"
+
+#include <cstring>
+
+// Format constants, straight from the LZ4 block format spec: matches are at
+// least MIN_MATCH bytes, the last LAST_LITERALS bytes are always literals, and
+// the last match must start at least MF_LIMIT bytes before the end.
+#define MIN_MATCH 4
+#define LAST_LITERALS 5
+#define MF_LIMIT 12
+#define MAX_OFFSET 65535
+// log2 of the number of entries in the compressor's hash table.
+#define HASH_LOG 12
+// Size of the original-length prefix.
+#define LEN_PREFIX 4
+
+namespace {
+
+inline uint32_t read32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t hash32(uint32_t v) {
+  // Knuth's multiplicative hash; keep the top HASH_LOG bits
+  return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// Writes a length that didn't fit in the token's 4 bits (i.e. len >= 15) as a
+// run of 255s terminated by the remainder.
+inline uint8_t* write_len(uint8_t* op, size_t len) {
+  for (; len >= 255; len -= 255) *op++ = 255;
+  *op++ = static_cast<uint8_t>(len);
+  return op;
+}
+
+// Emits one sequence: the literals in [lit, lit + n_lit), followed by a match
+// of match_len bytes at the given offset (match_len == 0 for the last
+// sequence, which is literals only).
+inline uint8_t* write_sequence(uint8_t* op, const uint8_t* lit, size_t n_lit,
+                               size_t offset, size_t match_len) {
+  uint8_t* token = op++;
+  *token = static_cast<uint8_t>((n_lit >= 15 ? 15 : n_lit) << 4);
+  if (n_lit >= 15) op = write_len(op, n_lit - 15);
+  memcpy(op, lit, n_lit);
+  op += n_lit;
+
+  if (match_len == 0) return op;
+
+  *op++ = static_cast<uint8_t>(offset);
+  *op++ = static_cast<uint8_t>(offset >> 8);
+  size_t ml = match_len - MIN_MATCH;
+  *token |= static_cast<uint8_t>(ml >= 15 ? 15 : ml);
+  if (ml >= 15) op = write_len(op, ml - 15);
+  return op;
+}
+
+// Compresses src into dst (which must hold lz_compress_bound(len) bytes, minus
+// the prefix). Returns the number of bytes written.
+size_t compress_block(const uint8_t* src, size_t len, uint8_t* dst) {
+  uint8_t* op = dst;
+  size_t anchor = 0;
+
+  if (len >= MF_LIMIT + 1) {
+    // Positions of the last occurrence of each hashed 4-byte sequence. It's
+    // only 16KB, so keep it on the stack rather than allocating every call.
+    uint32_t table[1 << HASH_LOG] = {};
+    size_t limit = len - MF_LIMIT;
+    size_t ip = 1;
+    table[hash32(read32(src))] = 0;
+
+    while (ip < limit) {
+      uint32_t seq = read32(src + ip);
+      uint32_t h = hash32(seq);
+      size_t ref = table[h];
+      table[h] = static_cast<uint32_t>(ip);
+
+      if (ref >= ip || ip - ref > MAX_OFFSET || read32(src + ref) != seq) {
+        // No match; skip ahead faster the longer we've gone without one, so
+        // incompressible data doesn't cost much.
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+
+      // Extend the match forwards (stopping before the trailing literals), and
+      // backwards over literals that also match.
+      size_t match_len = MIN_MATCH;
+      while (ip + match_len < len - LAST_LITERALS &&
+             src[ref + match_len] == src[ip + match_len]) {
+        match_len++;
+      }
+      while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+        ip--;
+        ref--;
+        match_len++;
+      }
+
+      op = write_sequence(op, src + anchor, ip - anchor, ip - ref, match_len);
+      ip += match_len;
+      anchor = ip;
+
+      // Seed the table with the position right before the match end, so runs
+      // of repeated data are picked up immediately.
+      if (ip - 2 < limit) {
+        table[hash32(read32(src + ip - 2))] = static_cast<uint32_t>(ip - 2);
+      }
+    }
+  }
+
+  // Whatever is left over goes out as literals.
+  op = write_sequence(op, src + anchor, len - anchor, 0, 0);
+  return op - dst;
+}
+
+// Decompresses src into dst, which must be exactly dst_len bytes. Returns false
+// if the input is malformed.
+bool decompress_block(const uint8_t* src, size_t len, uint8_t* dst,
+                      size_t dst_len) {
+  const uint8_t* ip = src;
+  const uint8_t* end = src + len;
+  size_t op = 0;
+
+  // Reads a run of length bytes (see write_len) onto n.
+  auto read_len = [&](size_t& n) {
+    uint8_t b;
+    do {
+      if (ip >= end) return false;
+      b = *ip++;
+      n += b;
+    } while (b == 255);
+    return true;
+  };
+
+  while (ip < end) {
+    uint8_t token = *ip++;
+
+    size_t n_lit = token >> 4;
+    if (n_lit == 15 && !read_len(n_lit)) return false;
+    if (n_lit > size_t(end - ip) || n_lit > dst_len - op) return false;
+    memcpy(dst + op, ip, n_lit);
+    ip += n_lit;
+    op += n_lit;
+
+    // The last sequence has no match
+    if (ip == end) break;
+
+    if (end - ip < 2) return false;
+    size_t offset = ip[0] | (size_t(ip[1]) << 8);
+    ip += 2;
+    if (offset == 0 || offset > op) return false;
+
+    size_t match_len = token & 15;
+    if (match_len == 15 && !read_len(match_len)) return false;
+    match_len += MIN_MATCH;
+    if (match_len > dst_len - op) return false;
+
+    // Matches may overlap the output they're producing (e.g. offset 1 is a run
+    // of one byte), so copy forwards byte by byte unless they don't.
+    uint8_t* out = dst + op;
+    const uint8_t* ref = out - offset;
+    if (offset >= match_len) {
+      memcpy(out, ref, match_len);
+    } else {
+      for (size_t i = 0; i < match_len; i++) out[i] = ref[i];
+    }
+    op += match_len;
+  }
+
+  return op == dst_len;
+}
+
+// Shared implementations for byte vectors and strings.
+template <typename Buffer>
+Buffer compress_into(const uint8_t* src, size_t len) {
+  Buffer out;
+  out.resize(lz_compress_bound(len));
+  auto* dst = reinterpret_cast<uint8_t*>(out.data());
+  uint32_t len32 = static_cast<uint32_t>(len);
+  for (int i = 0; i < LEN_PREFIX; i++) dst[i] = (len32 >> (8 * i)) & 0xFF;
+  out.resize(LEN_PREFIX + compress_block(src, len, dst + LEN_PREFIX));
+  return out;
+}
+
+template <typename Buffer>
+std::optional<Buffer> decompress_into(const uint8_t* src, size_t len,
+                                      size_t max_len = SIZE_MAX) {
+  if (len < LEN_PREFIX) return std::nullopt;
+  size_t orig_len = 0;
+  for (int i = 0; i < LEN_PREFIX; i++) orig_len |= size_t(src[i]) << (8 * i);
+  if (orig_len > max_len) return std::nullopt;
+  // Each compressed byte expands to at most 255 bytes, so anything claiming
+  // more than that is garbage; don't let it make us allocate gigabytes.
+  if (orig_len > (len - LEN_PREFIX) * 255) return std::nullopt;
+
+  Buffer out;
+  out.resize(orig_len);
+  if (!decompress_block(src + LEN_PREFIX, len - LEN_PREFIX,
+                        reinterpret_cast<uint8_t*>(out.data()), orig_len)) {
+    return std::nullopt;
+  }
+  return out;
+}
+
+}  // namespace
+
+size_t lz_compress_bound(size_t len) {
+  // Worst case is all literals: one extra length byte per 255 literals, plus
+  // the token and prefix.
+  return LEN_PREFIX + len + len / 255 + 16;
+}
+
+std::vector<std::byte> lz_compress(const std::byte* src, size_t len) {
+  return compress_into<std::vector<std::byte>>(
+      reinterpret_cast<const uint8_t*>(src), len);
+}
+
+std::optional<std::vector<std::byte>> lz_decompress(const std::byte* src,
+                                                    size_t len,
+                                                    size_t max_len) {
+  return decompress_into<std::vector<std::byte>>(
+      reinterpret_cast<const uint8_t*>(src), len, max_len);
+}
+
+std::string lz_compress(const std::string& src) {
+  return compress_into<std::string>(
+      reinterpret_cast<const uint8_t*>(src.data()), src.size());
+}
+
+std::optional<std::string> lz_decompress(const std::string& src) {
+  return decompress_into<std::string>(
+      reinterpret_cast<const uint8_t*>(src.data()), src.size());
+}
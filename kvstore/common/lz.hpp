@@ -0,0 +1,37 @@
+#ifndef LZ_HPP
+#define LZ_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// A small, self-contained LZ77 codec, using the LZ4 block format (token byte
+// of literal/match lengths, literals, 2-byte little-endian offset). It's not as
+// tuned as the real LZ4, but it's fast, greedy, and needs no external library.
+//
+// Compressed buffers are prefixed with the original length as a 4-byte
+// little-endian integer, so decompression doesn't need any out-of-band info.
+
+// Buffers smaller than this (in bytes) aren't worth the CPU time to compress;
+// callers use it as the default cutoff for compressing messages and values.
+#define COMPRESSION_THRESHOLD 1024
+
+// Worst-case size of lz_compress's output, for an input of len bytes.
+size_t lz_compress_bound(size_t len);
+
+// Compresses len bytes from src, returning the compressed buffer (including the
+// length prefix).
+std::vector<std::byte> lz_compress(const std::byte* src, size_t len);
+// Decompresses a buffer produced by lz_compress. Returns std::nullopt if the
+// buffer is malformed (never reads or writes out of bounds), or would
+// decompress to more than max_len bytes.
+std::optional<std::vector<std::byte>> lz_decompress(
+    const std::byte* src, size_t len, size_t max_len = SIZE_MAX);
+
+// Same as above, but over strings (e.g. for values in the KvStore).
+std::string lz_compress(const std::string& src);
+std::optional<std::string> lz_decompress(const std::string& src);
+
+#endif /* end of include guard */
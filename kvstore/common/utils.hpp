@@ -3,7 +3,9 @@
 
 #include <algorithm>
 #include <cctype>
+#include <future>
 #include <numeric>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -29,4 +31,37 @@ bool is_number(const std::string& s);
 std::string to_upper(const std::string& s);
 std::string to_lower(const std::string& s);
 
+// Combines lambdas into a single visitor for std::visit, e.g.
+//   std::visit(overloaded{[](const GetRequest& req) { ... },
+//                         [](const auto& other) { ... }},
+//              request);
+template <typename... Ts>
+struct overloaded : Ts... {
+  using Ts::operator()...;
+};
+template <typename... Ts>
+overloaded(Ts...) -> overloaded<Ts...>;
+
+// Calls fn on each item concurrently (the last one on the calling thread), and
+// returns the results in the items' order. Meant for fanning blocking I/O out
+// to a handful of servers, not for CPU-bound work.
+template <typename T, typename Fn>
+auto parallel_map(const std::vector<T>& items, Fn fn) {
+  using Result = decltype(fn(items.front()));
+  std::vector<std::future<Result>> pending;
+  for (size_t i = 0; i + 1 < items.size(); i++) {
+    const T& item = items[i];
+    pending.push_back(std::async(std::launch::async, [&fn, &item] {
+      return fn(item);
+    }));
+  }
+  std::vector<Result> results;
+  results.reserve(items.size());
+  std::optional<Result> last;
+  if (!items.empty()) last.emplace(fn(items.back()));
+  for (auto&& fut : pending) results.push_back(fut.get());
+  if (last) results.push_back(std::move(*last));
+  return results;
+}
+
 #endif /* end of include guard */
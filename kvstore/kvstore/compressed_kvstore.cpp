@@ -0,0 +1,116 @@
+#include "compressed_kvstore.hpp"
+
+#include <algorithm>
+#include <set>
+
+std::string CompressedKvStore::encode(const std::string& value) const {
+  if (value.size() >= this->threshold) {
+    std::string compressed = lz_compress(value);
+    if (compressed.size() < value.size()) {
+      return TAG_COMPRESSED + compressed;
+    }
+  }
+  return TAG_RAW + value;
+}
+
+std::optional<std::string> CompressedKvStore::decode(
+    const std::string& stored) const {
+  if (stored.empty()) return std::nullopt;
+  if (stored[0] == TAG_RAW) return stored.substr(1);
+  return lz_decompress(stored.substr(1));
+}
+
+std::vector<std::unique_lock<std::mutex>> CompressedKvStore::lock_keys(
+    const std::vector<std::string>& keys) {
+  // Take stripes in ascending order (and each only once) to avoid deadlock.
+  std::set<size_t> indices;
+  for (auto&& key : keys) indices.insert(hash(key) % STRIPE_COUNT);
+
+  std::vector<std::unique_lock<std::mutex>> locks;
+  locks.reserve(indices.size());
+  for (size_t i : indices) locks.emplace_back(this->stripes[i]);
+  return locks;
+}
+
+bool CompressedKvStore::Get(const GetRequest* req, GetResponse* res) {
+  GetResponse stored;
+  if (!this->inner->Get(req, &stored)) return false;
+
+  auto value = this->decode(stored.value);
+  if (!value) return false;
+  res->value = std::move(*value);
+  return true;
+}
+
+bool CompressedKvStore::Put(const PutRequest* req, PutResponse* res) {
+  PutRequest stored{req->key, this->encode(req->value)};
+  std::unique_lock lock(this->stripes[hash(req->key) % STRIPE_COUNT]);
+  return this->inner->Put(&stored, res);
+}
+
+bool CompressedKvStore::Append(const AppendRequest* req, AppendResponse*) {
+  std::unique_lock lock(this->stripes[hash(req->key) % STRIPE_COUNT]);
+
+  // Appending to a nonexistent key inserts it
+  GetRequest get_req{req->key};
+  GetResponse get_res;
+  std::string value;
+  if (this->inner->Get(&get_req, &get_res)) {
+    auto old_value = this->decode(get_res.value);
+    if (!old_value) return false;
+    value = std::move(*old_value);
+  }
+  value += req->value;
+
+  PutRequest put_req{req->key, this->encode(value)};
+  PutResponse put_res;
+  return this->inner->Put(&put_req, &put_res);
+}
+
+bool CompressedKvStore::Delete(const DeleteRequest* req, DeleteResponse* res) {
+  DeleteResponse stored;
+  {
+    std::unique_lock lock(this->stripes[hash(req->key) % STRIPE_COUNT]);
+    if (!this->inner->Delete(req, &stored)) return false;
+  }
+
+  auto value = this->decode(stored.value);
+  if (!value) return false;
+  res->value = std::move(*value);
+  return true;
+}
+
+bool CompressedKvStore::MultiGet(const MultiGetRequest* req,
+                                 MultiGetResponse* res) {
+  MultiGetResponse stored;
+  if (!this->inner->MultiGet(req, &stored)) return false;
+
+  res->values.clear();
+  res->values.reserve(stored.values.size());
+  for (auto&& s : stored.values) {
+    auto value = this->decode(s);
+    if (!value) return false;
+    res->values.push_back(std::move(*value));
+  }
+  return true;
+}
+
+bool CompressedKvStore::MultiPut(const MultiPutRequest* req,
+                                 MultiPutResponse* res) {
+  MultiPutRequest stored{req->keys, {}};
+  stored.values.reserve(req->values.size());
+  for (auto&& value : req->values) {
+    stored.values.push_back(this->encode(value));
+  }
+
+  auto locks = this->lock_keys(req->keys);
+  return this->inner->MultiPut(&stored, res);
+}
+
+std::vector<std::string> CompressedKvStore::AllKeys() {
+  return this->inner->AllKeys();
+}
+
+bool CompressedKvStore::Contains(const std::string& key) {
+  return this->inner->Contains(key);
+}
@@ -0,0 +1,68 @@
+#ifndef COMPRESSED_KVSTORE_HPP
+#define COMPRESSED_KVSTORE_HPP
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common/lz.hpp"
+#include "common/utils.hpp"
+#include "kvstore.hpp"
+#include "net/server_commands.hpp"
+
+/**
+ * A KvStore wrapper that stores values compressed in an underlying KvStore.
+ *
+ * Values of at least `threshold` bytes are LZ-compressed before being stored
+ * (if that actually shrinks them), and transparently decompressed on the way
+ * out. Every stored value is prefixed with a one-byte tag saying whether it's
+ * raw or compressed.
+ *
+ * Get/MultiGet go straight through to the underlying store. Since Append has
+ * to decompress, append, and recompress, writes to a key are serialized by a
+ * set of striped locks so that Append stays atomic relative to other writes.
+ */
+class CompressedKvStore : public KvStore {
+ public:
+  explicit CompressedKvStore(std::unique_ptr<KvStore> inner,
+                             size_t threshold = COMPRESSION_THRESHOLD)
+      : inner(std::move(inner)), threshold(threshold) {
+  }
+  ~CompressedKvStore() = default;
+
+  bool Get(const GetRequest* req, GetResponse* res) override;
+  bool Put(const PutRequest* req, PutResponse*) override;
+  bool Append(const AppendRequest* req, AppendResponse*) override;
+  bool Delete(const DeleteRequest* req, DeleteResponse* res) override;
+  bool MultiGet(const MultiGetRequest* req, MultiGetResponse* res) override;
+  bool MultiPut(const MultiPutRequest* req, MultiPutResponse*) override;
+
+  std::vector<std::string> AllKeys() override;
+  bool Contains(const std::string& key) override;
+
+ private:
+  static constexpr size_t STRIPE_COUNT = 64;
+  static constexpr char TAG_RAW = '\0';
+  static constexpr char TAG_COMPRESSED = '\1';
+
+  std::unique_ptr<KvStore> inner;
+  // Values smaller than this are stored uncompressed.
+  size_t threshold;
+
+  // Locks serializing writers of keys that hash to the same stripe.
+  std::array<std::mutex, STRIPE_COUNT> stripes;
+
+  // Encodes a value for storage, or decodes a stored value (std::nullopt if
+  // it's corrupt).
+  std::string encode(const std::string& value) const;
+  std::optional<std::string> decode(const std::string& stored) const;
+
+  // Locks the stripes for all of the keys, in a consistent order.
+  std::vector<std::unique_lock<std::mutex>> lock_keys(
+      const std::vector<std::string>& keys);
+};
+
+#endif /* end of include guard */
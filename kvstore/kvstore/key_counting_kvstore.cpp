@@ -0,0 +1,75 @@
+#include "key_counting_kvstore.hpp"
+
+#include <algorithm>
+#include <set>
+
+std::vector<std::unique_lock<std::mutex>> KeyCountingKvStore::lock_keys(
+    const std::vector<std::string>& keys) {
+  // Take stripes in ascending order (and each only once) to avoid deadlock.
+  std::set<size_t> indices;
+  for (auto&& key : keys) indices.insert(hash(key) % STRIPE_COUNT);
+
+  std::vector<std::unique_lock<std::mutex>> locks;
+  locks.reserve(indices.size());
+  for (size_t i : indices) locks.emplace_back(this->stripes[i]);
+  return locks;
+}
+
+bool KeyCountingKvStore::Get(const GetRequest* req, GetResponse* res) {
+  return this->inner->Get(req, res);
+}
+
+bool KeyCountingKvStore::Put(const PutRequest* req, PutResponse* res) {
+  std::unique_lock lock(this->stripes[hash(req->key) % STRIPE_COUNT]);
+  bool added = !this->inner->Contains(req->key);
+  if (!this->inner->Put(req, res)) return false;
+  if (added) this->on_change(req->key, 1);
+  return true;
+}
+
+bool KeyCountingKvStore::Append(const AppendRequest* req,
+                                AppendResponse* res) {
+  // Appending to a nonexistent key inserts it
+  std::unique_lock lock(this->stripes[hash(req->key) % STRIPE_COUNT]);
+  bool added = !this->inner->Contains(req->key);
+  if (!this->inner->Append(req, res)) return false;
+  if (added) this->on_change(req->key, 1);
+  return true;
+}
+
+bool KeyCountingKvStore::Delete(const DeleteRequest* req,
+                                DeleteResponse* res) {
+  std::unique_lock lock(this->stripes[hash(req->key) % STRIPE_COUNT]);
+  if (!this->inner->Delete(req, res)) return false;
+  this->on_change(req->key, -1);
+  return true;
+}
+
+bool KeyCountingKvStore::MultiGet(const MultiGetRequest* req,
+                                  MultiGetResponse* res) {
+  return this->inner->MultiGet(req, res);
+}
+
+bool KeyCountingKvStore::MultiPut(const MultiPutRequest* req,
+                                  MultiPutResponse* res) {
+  auto locks = this->lock_keys(req->keys);
+  // (A key can come up more than once)
+  std::vector<std::string> added;
+  for (auto&& key : req->keys) {
+    if (!this->inner->Contains(key) &&
+        std::find(added.begin(), added.end(), key) == added.end()) {
+      added.push_back(key);
+    }
+  }
+  if (!this->inner->MultiPut(req, res)) return false;
+  for (auto&& key : added) this->on_change(key, 1);
+  return true;
+}
+
+std::vector<std::string> KeyCountingKvStore::AllKeys() {
+  return this->inner->AllKeys();
+}
+
+bool KeyCountingKvStore::Contains(const std::string& key) {
+  return this->inner->Contains(key);
+}
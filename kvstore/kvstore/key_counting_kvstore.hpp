@@ -0,0 +1,59 @@
+#ifndef KEY_COUNTING_KVSTORE_HPP
+#define KEY_COUNTING_KVSTORE_HPP
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common/utils.hpp"
+#include "kvstore.hpp"
+#include "net/server_commands.hpp"
+
+/**
+ * A KvStore wrapper that tells its owner whenever a write adds a key to the
+ * underlying store or takes one out, so that it can keep counts of the keys
+ * (per shard, say) without going over all of them.
+ *
+ * Whether a write adds a key is checked just before it's made, so writes to
+ * a key are serialized by a set of striped locks (as in CompressedKvStore)
+ * to keep the two together. Reads go straight through.
+ */
+class KeyCountingKvStore : public KvStore {
+ public:
+  // Called with a key just added to the store (change is 1) or taken out of
+  // it (-1).
+  using OnChange = std::function<void(const std::string& key, int change)>;
+
+  KeyCountingKvStore(std::unique_ptr<KvStore> inner, OnChange on_change)
+      : inner(std::move(inner)), on_change(std::move(on_change)) {
+  }
+  ~KeyCountingKvStore() = default;
+
+  bool Get(const GetRequest* req, GetResponse* res) override;
+  bool Put(const PutRequest* req, PutResponse*) override;
+  bool Append(const AppendRequest* req, AppendResponse*) override;
+  bool Delete(const DeleteRequest* req, DeleteResponse* res) override;
+  bool MultiGet(const MultiGetRequest* req, MultiGetResponse* res) override;
+  bool MultiPut(const MultiPutRequest* req, MultiPutResponse*) override;
+
+  std::vector<std::string> AllKeys() override;
+  bool Contains(const std::string& key) override;
+
+ private:
+  static constexpr size_t STRIPE_COUNT = 64;
+
+  std::unique_ptr<KvStore> inner;
+  OnChange on_change;
+
+  // Locks serializing writers of keys that hash to the same stripe.
+  std::array<std::mutex, STRIPE_COUNT> stripes;
+
+  // Locks the stripes for all of the keys, in a consistent order.
+  std::vector<std::unique_lock<std::mutex>> lock_keys(
+      const std::vector<std::string>& keys);
+};
+
+#endif /* end of include guard */
@@ -19,6 +19,14 @@ class KvStore {
   virtual bool MultiPut(const MultiPutRequest* req, MultiPutResponse*) = 0;
 
   virtual std::vector<std::string> AllKeys() = 0;
+
+  // Whether key is stored. By default this is a Get, which copies the value
+  // out; stores that can check for a key on its own override it.
+  virtual bool Contains(const std::string& key) {
+    GetRequest req{key};
+    GetResponse res;
+    return this->Get(&req, &res);
+  }
 };
 
 #endif /* end of include guard */
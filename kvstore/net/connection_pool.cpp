@@ -0,0 +1,88 @@
+#include "connection_pool.hpp"
+
+#include <poll.h>
+
+std::shared_ptr<ConnectionPool> ConnectionPool::shared() {
+  static auto pool = std::make_shared<ConnectionPool>();
+  return pool;
+}
+
+PooledConn ConnectionPool::acquire(const std::string& address) {
+  {
+    std::unique_lock lock(this->mtx);
+    auto it = this->idle.find(address);
+    if (it != this->idle.end()) {
+      auto& conns = it->second;
+      auto now = steady_clock::now();
+      // Take the most recently used connection, if it's still good; if it
+      // isn't, the ones released before it aren't likely to be either.
+      while (!conns.empty()) {
+        IdleConn idle_conn = std::move(conns.back());
+        conns.pop_back();
+        if (now - idle_conn.since <= this->max_idle_time &&
+            is_healthy(*idle_conn.conn)) {
+          return PooledConn(this->shared_from_this(), idle_conn.conn);
+        }
+        idle_conn.conn->shutdown();
+        if (now - idle_conn.since > this->max_idle_time) {
+          for (auto& older : conns) older.conn->shutdown();
+          conns.clear();
+        }
+      }
+    }
+  }
+
+  std::shared_ptr<ServerConn> conn = connect_to_server(address);
+  if (!conn) return PooledConn();
+  if (!conn->shm) {
+    int yes = 1;
+    setsockopt(conn->fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes));
+  }
+  return PooledConn(this->shared_from_this(), conn);
+}
+
+void ConnectionPool::release(std::shared_ptr<ServerConn> conn) {
+  std::unique_lock lock(this->mtx);
+  auto& conns = this->idle[conn->address];
+  if (conns.size() >= this->max_idle_per_address) {
+    // Full; close this one (outside the lock would be nicer, but shutdown
+    // doesn't block)
+    conn->shutdown();
+    return;
+  }
+  conns.push_back({std::move(conn), steady_clock::now()});
+}
+
+void ConnectionPool::clear() {
+  std::unique_lock lock(this->mtx);
+  for (auto& [address, conns] : this->idle) {
+    for (auto& idle_conn : conns) idle_conn.conn->shutdown();
+  }
+  this->idle.clear();
+}
+
+bool ConnectionPool::is_healthy(const ServerConn& conn) {
+  // Between requests, the server has nothing to say, so a readable socket
+  // means it hung up (or sent something we'd mistake for the next response).
+  // For shm connections, fd is the control socket, which works the same way.
+  struct pollfd pfd = {conn.fd, POLLIN | POLLRDHUP, 0};
+  return poll(&pfd, 1, 0) == 0;
+}
+
+std::optional<Response> PooledConn::call(
+    const Request& req, std::optional<system_clock::time_point> deadline) {
+  if (!this->conn->send_request(req, deadline)) {
+    this->broken = true;
+    return std::nullopt;
+  }
+  if (deadline && !this->conn->shm) {
+    auto left = ceil<milliseconds>(*deadline - system_clock::now());
+    if (!wait_readable(this->conn->fd, std::max(left, 0ms))) {
+      this->broken = true;
+      return std::nullopt;
+    }
+  }
+  std::optional<Response> res = this->conn->recv_response();
+  if (!res) this->broken = true;
+  return res;
+}
@@ -0,0 +1,136 @@
+#ifndef CONNECTION_POOL_HPP
+#define CONNECTION_POOL_HPP
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "network_conn.hpp"
+#include "network_messages.hpp"
+
+using namespace std::chrono;
+
+// How many idle connections the pool keeps per address; past that, released
+// connections are closed.
+#define POOL_MAX_IDLE_PER_ADDRESS 8
+// How long a connection may sit idle in the pool before it's closed.
+#define POOL_MAX_IDLE_TIME 30s
+
+class PooledConn;
+
+/*
+ * A thread-safe pool of idle connections to servers, keyed by address, so
+ * that clients don't pay for a connect (and leave a TIME_WAIT socket behind)
+ * on every request.
+ *
+ * A connection taken from the pool is checked before it's handed out: one
+ * that has sat idle too long, or that has been closed by the server (or has
+ * unexpected data waiting on it), is discarded instead. Pooled TCP connections
+ * also have keep-alive enabled, so dead peers are eventually noticed even
+ * without traffic.
+ *
+ * Handles to pooled connections keep the pool alive, so pools must be created
+ * with std::make_shared.
+ */
+class ConnectionPool : public std::enable_shared_from_this<ConnectionPool> {
+ public:
+  explicit ConnectionPool(
+      size_t max_idle_per_address = POOL_MAX_IDLE_PER_ADDRESS,
+      milliseconds max_idle_time = POOL_MAX_IDLE_TIME)
+      : max_idle_per_address(max_idle_per_address),
+        max_idle_time(max_idle_time) {
+  }
+
+  // The pool shared by all clients in the process (unless they're given their
+  // own).
+  static std::shared_ptr<ConnectionPool> shared();
+
+  /*
+   * Gets a connection to the server at address: a healthy idle one if there is
+   * one, or a new one otherwise. The connection goes back to the pool when the
+   * returned handle is destroyed, unless a request over it failed. On failure
+   * to connect, the handle is empty.
+   */
+  PooledConn acquire(const std::string& address);
+
+  // Closes all idle connections.
+  void clear();
+
+  ConnectionPool(const ConnectionPool&) = delete;
+  ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+ private:
+  friend class PooledConn;
+
+  struct IdleConn {
+    std::shared_ptr<ServerConn> conn;
+    steady_clock::time_point since;
+  };
+
+  size_t max_idle_per_address;
+  milliseconds max_idle_time;
+
+  std::mutex mtx;
+  // Most recently released connections are at the back.
+  std::unordered_map<std::string, std::deque<IdleConn>> idle;
+
+  void release(std::shared_ptr<ServerConn> conn);
+  // Whether an idle connection still looks usable.
+  static bool is_healthy(const ServerConn& conn);
+};
+
+/*
+ * A connection borrowed from a ConnectionPool, returned to it on destruction.
+ */
+class PooledConn {
+ public:
+  PooledConn() = default;
+  PooledConn(std::shared_ptr<ConnectionPool> pool,
+             std::shared_ptr<ServerConn> conn)
+      : pool(std::move(pool)), conn(std::move(conn)) {
+  }
+  ~PooledConn() {
+    if (this->pool && this->conn && !this->broken) {
+      this->pool->release(std::move(this->conn));
+    }
+  }
+
+  PooledConn(PooledConn&& other) = default;
+  PooledConn& operator=(PooledConn&& other) = delete;
+  PooledConn(const PooledConn&) = delete;
+  PooledConn& operator=(const PooledConn&) = delete;
+
+  explicit operator bool() const {
+    return bool(this->conn);
+  }
+  ServerConn* operator->() const {
+    return this->conn.get();
+  }
+
+  /*
+   * Sends a request and waits for its response, until deadline at the
+   * latest, if one is given (the server is told it, too). If either fails,
+   * or the deadline passes first, the connection is in an unknown state, so
+   * it's closed rather than pooled.
+   */
+  std::optional<Response> call(
+      const Request& req,
+      std::optional<system_clock::time_point> deadline = std::nullopt);
+
+  // Closes the connection instead of pooling it, e.g. when the server may be
+  // holding state for an exchange that was abandoned halfway.
+  void discard() {
+    this->broken = true;
+  }
+
+ private:
+  std::shared_ptr<ConnectionPool> pool;
+  std::shared_ptr<ServerConn> conn;
+  bool broken = false;
+};
+
+#endif /* end of include guard */
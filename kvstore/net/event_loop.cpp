@@ -0,0 +1,102 @@
+#include "event_loop.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "common/color.hpp"
+
+std::shared_ptr<EventLoop> EventLoop::shared() {
+  static std::shared_ptr<EventLoop> loop = [] {
+    auto loop = std::make_shared<EventLoop>();
+    if (!loop->start()) cerr_color(RED, "Failed to start the event loop.");
+    return loop;
+  }();
+  return loop;
+}
+
+bool EventLoop::start() {
+  this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  this->wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (this->epoll_fd < 0 || this->wake_fd < 0) {
+    perror_color(RED, "EventLoop");
+    this->stop();
+    return false;
+  }
+
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = this->wake_fd;
+  epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->wake_fd, &ev);
+
+  this->thread = std::thread(&EventLoop::run, this);
+  return true;
+}
+
+void EventLoop::stop() {
+  if (this->thread.joinable()) {
+    uint64_t one = 1;
+    if (write(this->wake_fd, &one, sizeof(one)) < 0) {
+      perror_color(RED, "write");
+    }
+    this->thread.join();
+  }
+
+  std::unique_lock lock(this->mtx);
+  if (this->epoll_fd >= 0) close(this->epoll_fd);
+  if (this->wake_fd >= 0) close(this->wake_fd);
+  this->epoll_fd = this->wake_fd = -1;
+  this->handlers.clear();
+}
+
+bool EventLoop::add(int fd, std::function<void()> on_readable) {
+  std::unique_lock lock(this->mtx);
+  if (this->epoll_fd < 0) return false;
+  this->handlers[fd] =
+      std::make_shared<std::function<void()>>(std::move(on_readable));
+
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.fd = fd;
+  if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    perror_color(RED, "epoll_ctl");
+    this->handlers.erase(fd);
+    return false;
+  }
+  return true;
+}
+
+void EventLoop::remove(int fd) {
+  std::unique_lock lock(this->mtx);
+  if (this->handlers.erase(fd) && this->epoll_fd >= 0) {
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+  }
+}
+
+void EventLoop::run() {
+  constexpr int MAX_EVENTS = 64;
+  struct epoll_event events[MAX_EVENTS];
+  while (true) {
+    int n = epoll_wait(this->epoll_fd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror_color(RED, "epoll_wait");
+      return;
+    }
+
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == this->wake_fd) return;
+
+      // Hold on to the handler, so it survives being removed while it runs
+      std::shared_ptr<std::function<void()>> handler;
+      {
+        std::unique_lock lock(this->mtx);
+        auto it = this->handlers.find(fd);
+        if (it == this->handlers.end()) continue;
+        handler = it->second;
+      }
+      (*handler)();
+    }
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef EVENT_LOOP_HPP
+#define EVENT_LOOP_HPP
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+/*
+ * A single background thread that waits (with epoll) on any number of file
+ * descriptors, and calls each one's handler whenever it's readable. Handlers
+ * run on the loop's thread, one at a time, so they should be quick; a handler
+ * that blocks holds up every other fd on the loop.
+ *
+ * Watching is level-triggered: a handler that leaves data unread is called
+ * again.
+ */
+class EventLoop {
+ public:
+  EventLoop() = default;
+  ~EventLoop() {
+    this->stop();
+  }
+
+  // The loop shared by everything in the process that doesn't need its own,
+  // started on first use.
+  static std::shared_ptr<EventLoop> shared();
+
+  // Starts the loop thread. Returns false on failure.
+  bool start();
+  // Stops the loop thread, dropping all handlers. Must not be called from a
+  // handler.
+  void stop();
+
+  // Calls on_readable whenever fd is readable (or hung up), until removed.
+  // Returns false on failure.
+  bool add(int fd, std::function<void()> on_readable);
+  // Stops watching fd. Its handler may still be running (on the loop thread)
+  // when this returns, but won't be called again. Safe to call from a handler.
+  void remove(int fd);
+
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+ private:
+  int epoll_fd = -1;
+  // Written to by stop() to wake the loop.
+  int wake_fd = -1;
+  std::thread thread;
+
+  std::mutex mtx;
+  std::unordered_map<int, std::shared_ptr<std::function<void()>>> handlers;
+
+  void run();
+};
+
+#endif /* end of include guard */
@@ -0,0 +1,93 @@
+#include "idle_connections.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "common/color.hpp"
+
+bool IdleConnections::start() {
+  this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  this->wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (this->epoll_fd < 0 || this->wake_fd < 0) {
+    perror_color(RED, "IdleConnections");
+    this->stop();
+    return false;
+  }
+
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = this->wake_fd;
+  epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->wake_fd, &ev);
+
+  this->watcher = std::thread(&IdleConnections::watch_loop, this);
+  return true;
+}
+
+std::vector<std::shared_ptr<ClientConn>> IdleConnections::stop() {
+  if (this->watcher.joinable()) {
+    uint64_t one = 1;
+    if (write(this->wake_fd, &one, sizeof(one)) < 0) {
+      perror_color(RED, "write");
+    }
+    this->watcher.join();
+  }
+
+  std::unique_lock lock(this->mtx);
+  if (this->epoll_fd >= 0) close(this->epoll_fd);
+  if (this->wake_fd >= 0) close(this->wake_fd);
+  this->epoll_fd = this->wake_fd = -1;
+
+  std::vector<std::shared_ptr<ClientConn>> clients;
+  for (auto& [fd, client] : this->parked) clients.push_back(std::move(client));
+  this->parked.clear();
+  return clients;
+}
+
+bool IdleConnections::park(std::shared_ptr<ClientConn> client) {
+  if (client->shm) return false;
+
+  // Register before arming, so the watcher always finds the connection
+  std::unique_lock lock(this->mtx);
+  if (this->epoll_fd < 0) return false;
+  this->parked[client->fd] = client;
+
+  // One-shot, since the connection goes back to a worker once it's readable
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+  ev.data.fd = client->fd;
+  if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, client->fd, &ev) < 0) {
+    this->parked.erase(client->fd);
+    return false;
+  }
+  return true;
+}
+
+void IdleConnections::watch_loop() {
+  constexpr int MAX_EVENTS = 64;
+  struct epoll_event events[MAX_EVENTS];
+  while (true) {
+    int n = epoll_wait(this->epoll_fd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror_color(RED, "epoll_wait");
+      return;
+    }
+
+    std::vector<std::shared_ptr<ClientConn>> ready;
+    {
+      std::unique_lock lock(this->mtx);
+      for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == this->wake_fd) return;
+        auto it = this->parked.find(fd);
+        if (it == this->parked.end()) continue;
+        // Unregister while we still own the fd; a worker may close it soon
+        epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        ready.push_back(std::move(it->second));
+        this->parked.erase(it);
+      }
+    }
+    for (auto& client : ready) this->on_ready(std::move(client));
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef IDLE_CONNECTIONS_HPP
+#define IDLE_CONNECTIONS_HPP
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "network_conn.hpp"
+
+using namespace std::chrono;
+
+// How long a worker waits for the next request on a connection before parking
+// it (see IdleConnections).
+#define IDLE_PARK_TIMEOUT 10ms
+
+/*
+ * Connections that are open but have no request pending, watched by a single
+ * thread so they don't each tie up a worker. Clients that pool connections
+ * keep many of these around.
+ *
+ * Once a parked connection becomes readable (a new request, or the client
+ * hanging up), it's handed to on_ready and forgotten. Only socket connections
+ * can be parked: shm connections have no fd to watch for data.
+ */
+class IdleConnections {
+ public:
+  explicit IdleConnections(
+      std::function<void(std::shared_ptr<ClientConn>)> on_ready)
+      : on_ready(std::move(on_ready)) {
+  }
+  ~IdleConnections() {
+    this->stop();
+  }
+
+  // Starts the watcher thread. Returns false on failure.
+  bool start();
+  // Stops the watcher thread, and returns the connections still parked.
+  std::vector<std::shared_ptr<ClientConn>> stop();
+
+  // Watches client until it becomes readable. Returns false if it can't be
+  // watched (the caller keeps it).
+  bool park(std::shared_ptr<ClientConn> client);
+
+  IdleConnections(const IdleConnections&) = delete;
+  IdleConnections& operator=(const IdleConnections&) = delete;
+
+ private:
+  std::function<void(std::shared_ptr<ClientConn>)> on_ready;
+
+  int epoll_fd = -1;
+  // Written to by stop() to wake the watcher.
+  int wake_fd = -1;
+  std::thread watcher;
+
+  std::mutex mtx;
+  std::unordered_map<int, std::shared_ptr<ClientConn>> parked;
+
+  void watch_loop();
+};
+
+#endif /* end of include guard */
@@ -9,6 +9,8 @@ bool ClientConn::close() {
 }
 
 bool ClientConn::shutdown() {
+  // Wake up a worker blocked on the channel; it won't see the socket shut down
+  if (this->shm) this->shm->close();
   if (this->is_connected) {
     this->is_connected = false;
     ::shutdown(this->fd, SHUT_RDWR);
@@ -18,7 +20,29 @@ bool ClientConn::shutdown() {
 
 std::optional<Request> ClientConn::recv_request() {
   Message msg{};
-  if (!recv_message(fd, &msg)) {
+  msg.format = this->format;
+  bool received =
+      this->shm ? recv_message(this->shm.get(), &msg) : recv_message(fd, &msg);
+  if (!received) {
+    return std::nullopt;
+  }
+
+  this->accepts_compression = msg.flags & FLAG_ACCEPTS_COMPRESSED;
+  if (this->format == WireFormat::LEGACY &&
+      msg.flags & FLAG_ACCEPTS_COMPACT) {
+    this->switching_to_compact = true;
+  }
+  this->offered_deadlines = msg.flags & FLAG_ACCEPTS_DEADLINES;
+  if (msg.flags & FLAG_ACCEPTS_CONFIG_HINTS) this->accepts_config_hints = true;
+  if (msg.flags & FLAG_ACCEPTS_VALUE_STREAMS) {
+    this->accepts_value_streams = true;
+  }
+  if (!decompress_message(&msg)) {
+    cerr_color(RED, "Error decompressing request.");
+    return std::nullopt;
+  }
+  if (!detach_deadline(&msg, &this->deadline)) {
+    cerr_color(RED, "Error reading request deadline.");
     return std::nullopt;
   }
 
@@ -30,38 +54,105 @@ std::optional<Request> ClientConn::recv_request() {
 }
 
 bool ClientConn::send_response(Response response) {
-  std::optional<Message> msg = serialize_response(response);
+  std::optional<Message> msg = serialize_response(response, this->format);
   if (!msg) {
     perror_color(RED, "Error serializing response.");
     return false;
   }
+  if (this->config_hint) {
+    attach_config_hint(&*msg, *this->config_hint);
+    this->config_hint.reset();
+  }
+  if (this->accepts_compression) {
+    compress_message(&*msg);
+  }
+
+  if (this->offered_deadlines) msg->flags |= FLAG_ACCEPTS_DEADLINES;
+  if (this->accepts_value_streams && this->format == WireFormat::LEGACY) {
+    msg->flags |= FLAG_ACCEPTS_VALUE_STREAMS;
+  }
+  // Agree to the compact format; the client's next request will use it
+  if (this->switching_to_compact) {
+    msg->flags |= FLAG_ACCEPTS_COMPACT;
+    this->switching_to_compact = false;
+    this->format = WireFormat::COMPACT;
+  }
 
+  if (this->shm) return send_message(this->shm.get(), &*msg);
   return send_message(fd, &*msg);
 }
 
 bool ServerConn::close() {
-  ::close(this->fd);
+  if (this->fd >= 0) {
+    ::close(this->fd);
+    this->fd = -1;
+  }
   return true;
 }
 
 bool ServerConn::shutdown() {
+  if (this->shm) this->shm->close();
   ::shutdown(this->fd, SHUT_RDWR);
   return true;
 }
 
-bool ServerConn::send_request(Request req) {
-  std::optional<Message> msg = serialize_request(req);
+bool ServerConn::send_request(Request req,
+                              std::optional<system_clock::time_point> deadline) {
+  std::optional<Message> msg = serialize_request(req, this->format);
   if (!msg) {
     perror_color(RED, "Error serializing request.");
     return false;
   }
+  // In the legacy format, servers that don't take deadlines skip over them,
+  // so they can go out before the server has agreed to them
+  if (deadline &&
+      (this->deadlines || this->format == WireFormat::LEGACY)) {
+    attach_deadline(&*msg, *deadline);
+  }
+  if (this->compression) {
+    msg->flags |= FLAG_ACCEPTS_COMPRESSED;
+    compress_message(&*msg);
+  }
+  if (this->compact && this->format == WireFormat::LEGACY) {
+    msg->flags |= FLAG_ACCEPTS_COMPACT;
+  }
+  if (!this->deadlines) msg->flags |= FLAG_ACCEPTS_DEADLINES;
+  if (this->config_hints && this->format == WireFormat::LEGACY) {
+    msg->flags |= FLAG_ACCEPTS_CONFIG_HINTS;
+  }
+  if (this->value_streams && this->format == WireFormat::LEGACY) {
+    msg->flags |= FLAG_ACCEPTS_VALUE_STREAMS;
+  }
 
+  if (this->shm) return send_message(this->shm.get(), &*msg);
   return send_message(fd, &*msg);
 }
 
 std::optional<Response> ServerConn::recv_response() {
   Message msg{};
-  if (!recv_message(fd, &msg)) {
+  msg.format = this->format;
+  bool received =
+      this->shm ? recv_message(this->shm.get(), &msg) : recv_message(fd, &msg);
+  if (!received) {
+    return std::nullopt;
+  }
+
+  // The server agreed to the compact format, and expects it from now on
+  if (this->format == WireFormat::LEGACY &&
+      msg.flags & FLAG_ACCEPTS_COMPACT) {
+    this->format = WireFormat::COMPACT;
+  }
+  if (msg.flags & FLAG_ACCEPTS_DEADLINES) this->deadlines = true;
+  if (msg.flags & FLAG_ACCEPTS_VALUE_STREAMS) this->streams_values = true;
+  // (In the compact format, a response's hint comes in as a deadline)
+  if (msg.flags & FLAG_DEADLINE) msg.flags ^= FLAG_DEADLINE | FLAG_CONFIG_HINT;
+
+  if (!decompress_message(&msg)) {
+    cerr_color(RED, "Error decompressing response.");
+    return std::nullopt;
+  }
+  if (!detach_config_hint(&msg, &this->config_hint)) {
+    cerr_color(RED, "Error reading response config hint.");
     return std::nullopt;
   }
 
@@ -73,9 +164,9 @@ std::optional<Response> ServerConn::recv_response() {
 }
 
 std::shared_ptr<ClientConn> accept_client(int listener_fd) {
-  // NOTE: ideally, we should use a sockaddr_storage and handle INET vs INET6,
-  // but since we're only supporting IPv4 here, this should be fine.
-  struct sockaddr_in client_addr;
+  // NOTE: ideally, we should handle INET vs INET6, but since we're only
+  // supporting IPv4 (and Unix domain sockets) here, this should be fine.
+  struct sockaddr_storage client_addr;
   socklen_t sin_size = sizeof(client_addr);
   int cfd = accept(listener_fd, (struct sockaddr*)&client_addr, &sin_size);
   if (cfd < 0) {
@@ -83,6 +174,18 @@ std::shared_ptr<ClientConn> accept_client(int listener_fd) {
     return nullptr;
   }
 
+  // Unix domain socket clients are usually unnamed, so there's no address to
+  // present; just identify them by socket.
+  if (client_addr.ss_family == AF_UNIX) {
+    return std::make_shared<ClientConn>(
+        cfd, UNIX_ADDRESS_PREFIX + std::to_string(cfd));
+  }
+
+  // Requests and responses are small and written in pieces (header, size,
+  // body), so don't let Nagle hold the later pieces back for an ACK
+  int yes = 1;
+  setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
   // get hostname:port for presentability.
   char hostbuf[NI_MAXHOST], servbuf[NI_MAXSERV];
   if (getnameinfo((struct sockaddr*)&client_addr, sin_size, hostbuf,
@@ -97,7 +200,54 @@ std::shared_ptr<ClientConn> accept_client(int listener_fd) {
   return std::make_shared<ClientConn>(cfd, std::string(s));
 }
 
+std::shared_ptr<ClientConn> accept_shm_client(int listener_fd) {
+  std::shared_ptr<ClientConn> client = accept_client(listener_fd);
+  if (!client || !attach_shm_segment(client.get())) {
+    return nullptr;
+  }
+  return client;
+}
+
+bool attach_shm_segment(ClientConn* client) {
+  // Don't let a client that never sends its segment hang the caller
+  struct timeval tv = {1, 0};
+  setsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  int memfd = recv_fd(client->fd);
+  if (memfd < 0) {
+    return false;
+  }
+  client->shm = ShmChannel::attach(memfd);
+  if (!client->shm) {
+    return false;
+  }
+  client->shm->set_control_fd(client->fd);
+  client->address = SHM_ADDRESS_PREFIX + std::to_string(client->fd);
+  client->awaiting_shm_segment = false;
+  return true;
+}
+
 std::shared_ptr<ServerConn> connect_to_server(const std::string& server_addr) {
+  if (is_shm_address(server_addr)) {
+    // Create the segment, then hand it to the server over the control socket
+    std::shared_ptr<ShmChannel> shm = ShmChannel::create();
+    if (!shm) {
+      return nullptr;
+    }
+    int sfd = connect_to_address(shm_control_address(server_addr));
+    if (sfd < 0) {
+      return nullptr;
+    }
+    if (!send_fd(sfd, shm->memfd())) {
+      ::close(sfd);
+      return nullptr;
+    }
+    shm->set_control_fd(sfd);
+
+    auto conn = std::make_shared<ServerConn>(sfd, server_addr);
+    conn->shm = shm;
+    return conn;
+  }
+
   int sfd = connect_to_address(server_addr);
   if (sfd < 0) {
     return nullptr;
@@ -5,6 +5,7 @@
 #include <sys/socket.h>
 
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <optional>
 #include <string>
@@ -12,6 +13,7 @@
 #include "network_messages.hpp"
 #include "server_commands.hpp"
 #include "shardmaster_commands.hpp"
+#include "shm_channel.hpp"
 
 /*
  * A wrapper class for a connection with a client, for use by a server
@@ -39,6 +41,49 @@ struct ClientConn {
   // Whether the client is still connected
   std::atomic<bool> is_connected = true;
 
+  // Whether the client said (in its last request) that it can decompress
+  // responses; if so, large responses are sent compressed.
+  bool accepts_compression = false;
+
+  // The format messages are exchanged in. Switches to COMPACT right after the
+  // response to a request advertising FLAG_ACCEPTS_COMPACT.
+  WireFormat format = WireFormat::LEGACY;
+  bool switching_to_compact = false;
+
+  // Whether the client offered (in its last request) to send deadlines, which
+  // the response then agrees to; and the deadline of the last request, if it
+  // had one.
+  bool offered_deadlines = false;
+  std::optional<system_clock::time_point> deadline;
+  // Whether the last request's deadline has passed.
+  bool expired() const {
+    return this->deadline && system_clock::now() > *this->deadline;
+  }
+
+  // Whether the client has offered to take config hints (see
+  // FLAG_CONFIG_HINT), and the hint to send with the next response, if any.
+  bool accepts_config_hints = false;
+  std::optional<uint64_t> config_hint;
+
+  // For shared-memory clients, the channel that messages go over; fd is then
+  // only the control socket. Until the client's segment has been received
+  // (see attach_shm_segment), awaiting_shm_segment is set and shm is null.
+  std::shared_ptr<ShmChannel> shm;
+  bool awaiting_shm_segment = false;
+
+  // Whether the client has offered to take streamed values (see
+  // FLAG_ACCEPTS_VALUE_STREAMS).
+  bool accepts_value_streams = false;
+
+  // Values being streamed over this connection (see PutChunkRequest and
+  // GetChunkRequest): the part of a value uploaded so far (and the size it
+  // was said to be), and the snapshot of a value being downloaded.
+  std::string upload_key;
+  std::string upload_value;
+  uint64_t upload_size = 0;
+  std::string download_key;
+  std::string download_value;
+
   /*
    * Shuts down communication over the socket associated with the connection and
    * destroys it.
@@ -71,7 +116,10 @@ struct ServerConn {
   ~ServerConn() {
     // cerr_color(YELLOW, "in ServerConn destructor");  // in case if there's a
     // spurious error
-    ::shutdown(this->fd, SHUT_RDWR);
+    if (this->fd >= 0) {
+      ::shutdown(this->fd, SHUT_RDWR);
+      ::close(this->fd);
+    }
   }
 
   // The file descriptor for the socket associated with the connection
@@ -79,6 +127,36 @@ struct ServerConn {
   // The address (hostname:port) server-client communication occurs over
   std::string address;
 
+  // Whether to compress large requests, and advertise to the server that we
+  // accept compressed responses.
+  bool compression = false;
+
+  // Whether to offer the server WireFormat::COMPACT, and the format messages
+  // are currently exchanged in (COMPACT once the server has agreed to it).
+  bool compact = true;
+  WireFormat format = WireFormat::LEGACY;
+
+  // Whether the server has agreed to take request deadlines. Until it has,
+  // they're only sent in the legacy format (which older servers can skip
+  // them in), and left off in the compact one.
+  bool deadlines = false;
+
+  // Whether to offer to take config hints (see FLAG_CONFIG_HINT), and the
+  // one on the last response, if it had one.
+  bool config_hints = true;
+  std::optional<uint64_t> config_hint;
+
+  // Whether to offer to take streamed values (see FLAG_ACCEPTS_VALUE_STREAMS),
+  // and whether the server has agreed to stream them (so it takes PutChunk and
+  // GetChunk requests). Only offered by callers that handle a Get being
+  // answered in chunks.
+  bool value_streams = false;
+  bool streams_values = false;
+
+  // For shm:<name> servers, the channel that messages go over; fd is then only
+  // the control socket.
+  std::shared_ptr<ShmChannel> shm;
+
   /*
    * Shuts down communication over the socket associated with the connection and
    * destroys it.
@@ -90,9 +168,13 @@ struct ServerConn {
   bool shutdown();
 
   /*
-   * Sends a given request to the server, returning true on success.
+   * Sends a given request to the server, returning true on success. If a
+   * deadline is given (and the server takes them), the server drops the
+   * request rather than start on it after then.
    */
-  bool send_request(Request request);
+  bool send_request(
+      Request request,
+      std::optional<system_clock::time_point> deadline = std::nullopt);
   /*
    * Receives a response from the server, if one has been sent. Otherwise, if
    * the server has disconnected, no request has been sent, or an error occurs,
@@ -107,9 +189,23 @@ struct ServerConn {
  * ClientConn wrapper of the client connection, and a null pointer otherwise.
  */
 std::shared_ptr<ClientConn> accept_client(int listener_fd);
+/*
+ * Same as above, for a listener on a shm:<name> control socket: also receives
+ * the client's shared-memory segment, and sets up the connection's channel.
+ * Waits up to a second for the segment, so servers with other clients to
+ * accept should accept_client and attach_shm_segment once it's readable.
+ */
+std::shared_ptr<ClientConn> accept_shm_client(int listener_fd);
+/*
+ * Receives the shared-memory segment a client accepted on a shm:<name>
+ * control socket sends, and sets up the connection's channel. Returns false if
+ * the segment doesn't arrive within a second, or is invalid.
+ */
+bool attach_shm_segment(ClientConn* client);
 
 /*
- * Establishes a connection to a server at the specified address.
+ * Establishes a connection to a server at the specified address, using the
+ * transport the address names (hostname:port, unix:<path>, or shm:<name>).
  * On success, returns a shared pointer to a ServerConn wrapper of the server
  * connection, and a null pointer otherwise.
  */
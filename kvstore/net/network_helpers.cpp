@@ -1,5 +1,7 @@
 #include "network_helpers.hpp"
 
+#include <poll.h>
+
 int sendall(int fd, void* buf, size_t len, int flags, milliseconds timeout) {
   size_t n_sent = 0, n_to_send = len;
   char* data = (char*)buf;
@@ -16,15 +18,10 @@ int sendall(int fd, void* buf, size_t len, int flags, milliseconds timeout) {
       return curr;
     }
 
-    // update bytes sent; if not completed, network is likely saturated, so wait
+    // update bytes sent. If not completed, the socket buffer is full, and the
+    // next send blocks until there's room, so there's no need to wait here
+    // (that would just stall large messages until they time out).
     n_sent += curr;
-    if (n_sent < n_to_send) {
-      // There might be a better way to do this; sleeping feels un-optimal, but
-      // I'm pretty sure setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, ...) is
-      // functionally the same as blocking on the thread. Investigate more
-      // later.
-      if (timeout > 0ms) std::this_thread::sleep_for(timeout / 10);
-    }
   }
   return n_sent;
 }
@@ -45,16 +42,101 @@ int recvall(int fd, void* buf, size_t len, int flags, milliseconds timeout) {
       return curr;
     }
 
-    // update bytes sent; if not completed, network is likely saturated, so wait
+    // update bytes received; as above, the next recv blocks for more
     n_recvd += curr;
-    if (n_recvd < n_to_recv) {
-      if (timeout > 0ms) std::this_thread::sleep_for(timeout / 10);
-    }
   }
   return n_recvd;
 }
 
+bool wait_readable(int fd, milliseconds timeout) {
+  struct pollfd pfd = {fd, POLLIN | POLLRDHUP, 0};
+  int n;
+  do {
+    n = poll(&pfd, 1, timeout.count());
+  } while (n < 0 && errno == EINTR);
+  return n != 0;
+}
+
+bool is_unix_address(const std::string& address) {
+  return address.rfind(UNIX_ADDRESS_PREFIX, 0) == 0;
+}
+
+bool is_shm_address(const std::string& address) {
+  return address.rfind(SHM_ADDRESS_PREFIX, 0) == 0;
+}
+
+std::string shm_control_address(const std::string& address) {
+  std::string name = address.substr(strlen(SHM_ADDRESS_PREFIX));
+  return UNIX_ADDRESS_PREFIX + std::string("@kvstore-shm-") + name;
+}
+
+// Fills in a sockaddr_un for a unix:<path> address, returning its length (or 0
+// if the path is too long).
+static socklen_t make_unix_sockaddr(const std::string& address,
+                                    struct sockaddr_un* sun) {
+  std::string path = address.substr(strlen(UNIX_ADDRESS_PREFIX));
+  memset(sun, 0, sizeof(*sun));
+  sun->sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(sun->sun_path)) {
+    cerr_color(RED, "Invalid address: ", address);
+    return 0;
+  }
+  memcpy(sun->sun_path, path.data(), path.size());
+  // Abstract socket names start with a NUL byte, and aren't NUL-terminated
+  if (path[0] == '@') sun->sun_path[0] = '\0';
+  return offsetof(struct sockaddr_un, sun_path) + path.size() +
+         (path[0] != '@');
+}
+
+static int open_unix_listener_socket(const std::string& address) {
+  struct sockaddr_un sun;
+  socklen_t len = make_unix_sockaddr(address, &sun);
+  if (len == 0) return -1;
+
+  int listener_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener_fd == -1) {
+    perror_color(RED, "socket");
+    return -1;
+  }
+
+  // Like SO_REUSEADDR for TCP: remove a socket file left over from a previous
+  // run, so we can bind right away.
+  if (sun.sun_path[0] != '\0') unlink(sun.sun_path);
+
+  if (bind(listener_fd, (struct sockaddr*)&sun, len) == -1) {
+    close(listener_fd);
+    perror_color(RED, "bind");
+    return -1;
+  }
+  if (listen(listener_fd, BACKLOG) < 0) {
+    close(listener_fd);
+    perror_color(RED, "listen");
+    return -1;
+  }
+  return listener_fd;
+}
+
+static int connect_to_unix_address(const std::string& address) {
+  struct sockaddr_un sun;
+  socklen_t len = make_unix_sockaddr(address, &sun);
+  if (len == 0) return -1;
+
+  int cfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (cfd == -1) {
+    perror_color(YELLOW, "socket");
+    return -1;
+  }
+  if (connect(cfd, (struct sockaddr*)&sun, len) == -1) {
+    close(cfd);
+    perror_color(YELLOW, "connect");
+    return -1;
+  }
+  return cfd;
+}
+
 int open_listener_socket(const std::string& address) {
+  if (is_unix_address(address)) return open_unix_listener_socket(address);
+
   size_t splitIdx = address.find(':');
   if (splitIdx == std::string::npos) {
     cerr_color(RED, "Invalid address: ", address);
@@ -127,6 +209,8 @@ int open_listener_socket(const std::string& address) {
 };
 
 int connect_to_address(const std::string& address) {
+  if (is_unix_address(address)) return connect_to_unix_address(address);
+
   size_t splitIdx = address.find(':');
   if (splitIdx == std::string::npos) {
     cerr_color(RED, "Invalid address: ", address);
@@ -159,9 +243,13 @@ int connect_to_address(const std::string& address) {
       perror_color(YELLOW, "connect");
       continue;
     }
+    // See accept_client: messages go out in several small writes
+    int yes = 1;
+    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
     break;
   }
 
+  freeaddrinfo(res);
   if (!cur) {
     return -1;
   }
@@ -169,6 +257,58 @@ int connect_to_address(const std::string& address) {
   return cfd;
 }
 
+bool send_fd(int sock, int fd) {
+  char byte = 0;
+  struct iovec iov = {&byte, 1};
+  char control[CMSG_SPACE(sizeof(int))] = {0};
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1) {
+    perror_color(RED, "sendmsg");
+    return false;
+  }
+  return true;
+}
+
+int recv_fd(int sock) {
+  char byte;
+  struct iovec iov = {&byte, 1};
+  char control[CMSG_SPACE(sizeof(int))] = {0};
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) {
+    perror_color(RED, "recvmsg");
+    return -1;
+  }
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS) {
+    cerr_color(RED, "No file descriptor received.");
+    return -1;
+  }
+  int fd;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  return fd;
+}
+
 std::string get_host_address(const char* port) {
   // Get our hostname for readability
   char hostnamebuf[256] = {0};
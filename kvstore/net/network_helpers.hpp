@@ -3,10 +3,12 @@
 
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include <chrono>
@@ -23,6 +25,21 @@ using namespace std::chrono;
 
 #define ETIMEOUT -2
 
+// Address prefixes for transports to co-located servers; any other address is
+// a TCP hostname:port.
+//
+// - unix:<path> is a Unix domain socket. A path starting with '@' is in the
+//   abstract namespace (so there's no socket file to clean up).
+// - shm:<name> is a shared-memory ring pair (see shm_channel.hpp), set up over
+//   a Unix domain control socket derived from the name.
+#define UNIX_ADDRESS_PREFIX "unix:"
+#define SHM_ADDRESS_PREFIX "shm:"
+
+bool is_unix_address(const std::string& address);
+bool is_shm_address(const std::string& address);
+// Gets the address of the control socket for a shm:<name> address.
+std::string shm_control_address(const std::string& address);
+
 /*
  * Sends/receives all of the bytes in buf, according to len. Times out after the
  * specified amount if timeout > 0 (in this case, returns ETIMEOUT. Otherwise,
@@ -34,19 +51,34 @@ int recvall(int fd, void* buf, size_t len, int flags,
             milliseconds timeout = 0ms);
 
 /*
- * Opens a listener socket on the specified address (hostname:port).
+ * Waits up to timeout for fd to become readable (or hung up, or in error).
+ * Returns false if it didn't.
+ */
+bool wait_readable(int fd, milliseconds timeout);
+
+/*
+ * Opens a listener socket on the specified address (hostname:port, or
+ * unix:<path>).
  * On success, a file descriptor for the new socket is returned.  On error, -1
  * is returned.
  */
 int open_listener_socket(const std::string& address);
 
 /*
- * Establishes a connection to the specified address.
+ * Establishes a connection to the specified address (hostname:port, or
+ * unix:<path>).
  * On success, a file descriptor for the new socket is returned.  On error, -1
  * is returned.
  */
 int connect_to_address(const std::string& address);
 
+/*
+ * Sends/receives a file descriptor over a Unix domain socket, along with a
+ * single byte of data. Returns false (or -1) on failure.
+ */
+bool send_fd(int sock, int fd);
+int recv_fd(int sock);
+
 /*
  * Creates an address string of hostname:port, from the current host and given
  * port.
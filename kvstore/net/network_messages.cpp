@@ -1,30 +1,61 @@
 #include "network_messages.hpp"
 
-bool send_message(int fd, Message* msg, milliseconds timeout) {
-  // must specify non-zero timeout
-  assert(timeout > 0ms);
-  assert(msg->sz == msg->buf.size());
+#include <array>
+#include <bit>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// Adapters giving sockets and shared-memory channels the same interface, so
+// the message framing code below can run over either. fd is just for logging.
+struct SocketStream {
+  int fd;
 
-  // First, send message type
-  int curr = sendall(fd, &msg->type, sizeof(msg->type), MSG_NOSIGNAL);
+  int sendall(void* buf, size_t len, int flags, milliseconds timeout = 0ms) {
+    return ::sendall(this->fd, buf, len, flags, timeout);
+  }
+  int recvall(void* buf, size_t len, int flags, milliseconds timeout = 0ms) {
+    return ::recvall(this->fd, buf, len, flags, timeout);
+  }
+};
+
+struct ShmStream {
+  ShmChannel* ch;
+  int fd;
+
+  int sendall(void* buf, size_t len, int, milliseconds timeout = 0ms) {
+    return this->ch->sendall(buf, len, timeout);
+  }
+  int recvall(void* buf, size_t len, int, milliseconds timeout = 0ms) {
+    return this->ch->recvall(buf, len, timeout);
+  }
+};
+
+template <typename Stream>
+bool send_legacy_over(Stream s, Message* msg, milliseconds timeout) {
+
+  // First, send message type (with any flags in its upper bits)
+  uint32_t header = static_cast<uint32_t>(msg->type) | msg->flags;
+  int curr = s.sendall(&header, sizeof(header), MSG_NOSIGNAL);
   if (curr < 0) {
     if (curr == ETIMEOUT) {
       // Print if timed out
-      cerr_color(RED, "Send on ", fd, " timed out.");
+      cerr_color(RED, "Send on ", s.fd, " timed out.");
     } else if (errno != EBADF && errno != EPIPE) {
       // Only emit errors if it wasn't the result of the socket closing
       perror_color(RED, "send");
     }
     return false;
   }
-  assert(curr == sizeof(msg->type));
+  assert(curr == sizeof(header));
 
   // Convert size to network order, then send
   size_t size_nbo = htonl(msg->sz);
-  curr = sendall(fd, &size_nbo, sizeof(size_nbo), MSG_NOSIGNAL);
+  curr = s.sendall(&size_nbo, sizeof(size_nbo), MSG_NOSIGNAL);
   if (curr < 0) {
     if (curr == ETIMEOUT) {
-      cerr_color(RED, "Send on ", fd, " timed out.");
+      cerr_color(RED, "Send on ", s.fd, " timed out.");
     } else if (errno != EBADF && errno != EPIPE) {
       perror_color(RED, "send");
     }
@@ -34,10 +65,10 @@ bool send_message(int fd, Message* msg, milliseconds timeout) {
 
   if (msg->sz > 0) {
     std::byte* data = &msg->buf[0];
-    curr = sendall(fd, data, msg->sz, 0, timeout);
+    curr = s.sendall(data, msg->sz, 0, timeout);
     if (curr < 0) {
       if (curr == ETIMEOUT) {
-        cerr_color(RED, "Send on ", fd, " timed out.");
+        cerr_color(RED, "Send on ", s.fd, " timed out.");
       } else if (errno != EBADF && errno != EPIPE) {
         perror_color(RED, "send");
       }
@@ -49,7 +80,8 @@ bool send_message(int fd, Message* msg, milliseconds timeout) {
   return true;
 }
 
-bool recv_message(int fd, Message* msg, milliseconds timeout) {
+template <typename Stream>
+bool recv_legacy_over(Stream s, Message* msg, milliseconds timeout) {
   // NOTE: Re-visit this later.
   //
   // I think it'd be okay if we re-use the structure from send, but it would
@@ -59,33 +91,33 @@ bool recv_message(int fd, Message* msg, milliseconds timeout) {
   // block until we receive a response, rather than "failing" the recv_message
   // call.
 
-  // must specify non-zero timeout
-  assert(timeout > 0ms);
-
-  // get message type
-  int curr = recvall(fd, &msg->type, sizeof(msg->type), 0);
+  // get message type, and split off its flags
+  uint32_t header;
+  int curr = s.recvall(&header, sizeof(header), 0);
   if (curr == 0) {
     // In this case, recv got an EOF, so other end closed the connection.
     return false;
   } else if (curr < 0) {
     if (curr == ETIMEOUT) {
       // Print if timed out
-      cerr_color(RED, "Recv on ", fd, " timed out.");
+      cerr_color(RED, "Recv on ", s.fd, " timed out.");
     } else if (errno != EBADF) {
       // Only emit errors if it wasn't the result of the socket closing
       perror_color(RED, "recv");
     }
     return false;
   }
-  assert(curr == sizeof(msg->type));
+  assert(curr == sizeof(header));
+  msg->type = static_cast<MessageType>(header & MESSAGE_TYPE_MASK);
+  msg->flags = header & ~MESSAGE_TYPE_MASK;
 
   // get size; need this to inform how much to read into the vector
-  curr = recvall(fd, &msg->sz, sizeof(msg->sz), 0);
+  curr = s.recvall(&msg->sz, sizeof(msg->sz), 0);
   if (curr == 0) {
     return false;
   } else if (curr < 0) {
     if (curr == ETIMEOUT) {
-      cerr_color(RED, "Recv on ", fd, " timed out.");
+      cerr_color(RED, "Recv on ", s.fd, " timed out.");
     } else if (errno != EBADF) {
       perror_color(RED, "recv");
     }
@@ -94,18 +126,22 @@ bool recv_message(int fd, Message* msg, milliseconds timeout) {
   // Convert to host order
   msg->sz = ntohl(msg->sz);
   assert(curr == sizeof(msg->sz));
+  if (msg->sz > MAX_MESSAGE_SIZE) {
+    cerr_color(RED, "Message of ", msg->sz, " bytes on ", s.fd, " too large.");
+    return false;
+  }
 
   if (msg->sz > 0) {
     msg->buf.resize(msg->sz);
     std::byte* data = &msg->buf[0];
     // Later, let's explore MSG_DONTWAIT (need to check if errno != EAGAIN or
     // EWOULDBLOCK)
-    curr = recvall(fd, data, msg->sz, 0, timeout);
+    curr = s.recvall(data, msg->sz, 0, timeout);
     if (curr == 0) {
       return false;
     } else if (curr < 0) {
       if (curr == ETIMEOUT) {
-        cerr_color(RED, "Recv on ", fd, " timed out.");
+        cerr_color(RED, "Recv on ", s.fd, " timed out.");
       } else if (errno != EBADF) {
         perror_color(RED, "recv");
       }
@@ -117,171 +153,276 @@ bool recv_message(int fd, Message* msg, milliseconds timeout) {
   return true;
 }
 
-std::optional<Message> serialize_request(Request request) {
-  Message msg{};
 
-  // Serialize into message, depending on type
-  auto out = zpp::bits::output(msg.buf);
-  if (auto* req = std::get_if<JoinRequest>(&request)) {
-    msg.type = MessageType::JOIN;
-    if (!success(out(*req))) return std::nullopt;
-  } else if (auto* req = std::get_if<LeaveRequest>(&request)) {
-    msg.type = MessageType::LEAVE;
-    if (!success(out(*req))) return std::nullopt;
-  } else if (auto* req = std::get_if<MoveRequest>(&request)) {
-    msg.type = MessageType::MOVE;
-    if (!success(out(*req))) return std::nullopt;
-  } else if (auto* req = std::get_if<QueryRequest>(&request)) {
-    msg.type = MessageType::QUERY;
-    if (!success(out(*req))) return std::nullopt;
-  } else if (auto* req = std::get_if<GetRequest>(&request)) {
-    msg.type = MessageType::GET;
-    if (!success(out(*req))) return std::nullopt;
-  } else if (auto* req = std::get_if<PutRequest>(&request)) {
-    msg.type = MessageType::PUT;
-    if (!success(out(*req))) return std::nullopt;
-  } else if (auto* req = std::get_if<AppendRequest>(&request)) {
-    msg.type = MessageType::APPEND;
-    if (!success(out(*req))) return std::nullopt;
-  } else if (auto* req = std::get_if<DeleteRequest>(&request)) {
-    msg.type = MessageType::DELETE;
-    if (!success(out(*req))) return std::nullopt;
-  } else if (auto* req = std::get_if<MultiGetRequest>(&request)) {
-    msg.type = MessageType::MULTI_GET;
-    if (!success(out(*req))) return std::nullopt;
-  } else if (auto* req = std::get_if<MultiPutRequest>(&request)) {
-    msg.type = MessageType::MULTI_PUT;
-    if (!success(out(*req))) return std::nullopt;
-  } else {
-    throw std::logic_error{
-        "Invalid request variant! Please post privately on Edstem if this "
-        "occurs."};
-  }
+// In the compact format, the type and the flags that matter per message share
+// one byte.
+#define COMPACT_TYPE_MASK 0x1Fu
+#define COMPACT_DEADLINE 0x20u
+#define COMPACT_ACCEPTS_COMPRESSED 0x40u
+#define COMPACT_COMPRESSED 0x80u
+static_assert(size_t(MessageType::COUNT) <= COMPACT_TYPE_MASK + 1);
 
-  // Set size, for easier network parsing
-  msg.sz = msg.buf.size();
+// Longest varint encoding of a 64-bit size
+#define MAX_VARINT_SIZE 10
 
-  return msg;
-}
+template <typename Stream>
+bool send_compact_over(Stream s, Message* msg, milliseconds timeout) {
+  // Header byte and varint size go out together
+  uint8_t header[1 + MAX_VARINT_SIZE];
+  header[0] = static_cast<uint8_t>(msg->type);
+  if (msg->flags & FLAG_ACCEPTS_COMPRESSED) {
+    header[0] |= COMPACT_ACCEPTS_COMPRESSED;
+  }
+  if (msg->flags & FLAG_COMPRESSED) header[0] |= COMPACT_COMPRESSED;
+  // (Only requests have deadlines, and only responses config hints)
+  if (msg->flags & (FLAG_DEADLINE | FLAG_CONFIG_HINT)) {
+    header[0] |= COMPACT_DEADLINE;
+  }
+  size_t header_size = 1;
+  uint64_t sz = msg->sz;
+  do {
+    header[header_size++] = (sz & 0x7F) | (sz > 0x7F ? 0x80 : 0);
+    sz >>= 7;
+  } while (sz > 0);
 
-std::optional<Request> deserialize_request(Message message) {
-  Request request;
-  // Deserialize from message, depending on type
-  auto in = zpp::bits::input(message.buf);
-  switch (message.type) {
-    case MessageType::JOIN: {
-      JoinRequest req{};
-      if (!success(in(req))) return std::nullopt;
-      request = req;
-      break;
-    }
-    case MessageType::LEAVE: {
-      LeaveRequest req{};
-      if (!success(in(req))) return std::nullopt;
-      request = req;
-      break;
-    }
-    case MessageType::MOVE: {
-      MoveRequest req{};
-      if (!success(in(req))) return std::nullopt;
-      request = req;
-      break;
-    }
-    case MessageType::QUERY: {
-      QueryRequest req{};
-      if (!success(in(req))) return std::nullopt;
-      request = req;
-      break;
-    }
-    case MessageType::GET: {
-      GetRequest req{};
-      if (!success(in(req))) return std::nullopt;
-      request = req;
-      break;
-    }
-    case MessageType::PUT: {
-      PutRequest req{};
-      if (!success(in(req))) return std::nullopt;
-      request = req;
-      break;
-    }
-    case MessageType::APPEND: {
-      AppendRequest req{};
-      if (!success(in(req))) return std::nullopt;
-      request = req;
-      break;
+  int curr = s.sendall(header, header_size, MSG_NOSIGNAL);
+  if (curr >= 0 && msg->sz > 0) {
+    curr = s.sendall(&msg->buf[0], msg->sz, MSG_NOSIGNAL, timeout);
+  }
+  if (curr < 0) {
+    if (curr == ETIMEOUT) {
+      cerr_color(RED, "Send on ", s.fd, " timed out.");
+    } else if (errno != EBADF && errno != EPIPE) {
+      perror_color(RED, "send");
     }
-    case MessageType::DELETE: {
-      DeleteRequest req{};
-      if (!success(in(req))) return std::nullopt;
-      request = req;
-      break;
+    return false;
+  }
+  return true;
+}
+
+template <typename Stream>
+bool recv_compact_over(Stream s, Message* msg, milliseconds timeout) {
+  // The size is at least one byte, so read it along with the header byte, then
+  // any more of it one byte at a time.
+  uint8_t header[2];
+  int curr = s.recvall(header, sizeof(header), 0);
+  uint64_t sz = header[1] & 0x7F;
+  for (int shift = 7, more = header[1] & 0x80; curr > 0 && more; shift += 7) {
+    uint8_t byte;
+    if (shift >= 7 * MAX_VARINT_SIZE) {
+      cerr_color(RED, "Malformed message size on ", s.fd, ".");
+      return false;
     }
-    case MessageType::MULTI_GET: {
-      MultiGetRequest req{};
-      if (!success(in(req))) return std::nullopt;
-      request = req;
-      break;
+    curr = s.recvall(&byte, 1, 0);
+    sz |= uint64_t(byte & 0x7F) << shift;
+    more = byte & 0x80;
+  }
+  if (curr == 0) {
+    return false;
+  } else if (curr < 0) {
+    if (curr == ETIMEOUT) {
+      cerr_color(RED, "Recv on ", s.fd, " timed out.");
+    } else if (errno != EBADF) {
+      perror_color(RED, "recv");
     }
-    case MessageType::MULTI_PUT: {
-      MultiPutRequest req{};
-      if (!success(in(req))) return std::nullopt;
-      request = req;
-      break;
+    return false;
+  }
+
+  msg->type = static_cast<MessageType>(header[0] & COMPACT_TYPE_MASK);
+  msg->flags = 0;
+  if (header[0] & COMPACT_ACCEPTS_COMPRESSED) {
+    msg->flags |= FLAG_ACCEPTS_COMPRESSED;
+  }
+  if (header[0] & COMPACT_COMPRESSED) msg->flags |= FLAG_COMPRESSED;
+  if (header[0] & COMPACT_DEADLINE) msg->flags |= FLAG_DEADLINE;
+  if (sz > MAX_MESSAGE_SIZE) {
+    cerr_color(RED, "Message of ", sz, " bytes on ", s.fd, " too large.");
+    return false;
+  }
+  msg->sz = sz;
+
+  if (msg->sz > 0) {
+    msg->buf.resize(msg->sz);
+    curr = s.recvall(&msg->buf[0], msg->sz, 0, timeout);
+    if (curr == 0) {
+      return false;
+    } else if (curr < 0) {
+      if (curr == ETIMEOUT) {
+        cerr_color(RED, "Recv on ", s.fd, " timed out.");
+      } else if (errno != EBADF) {
+        perror_color(RED, "recv");
+      }
+      return false;
     }
-    default:
-      throw std::logic_error{
-          "Invalid message type! Please post privately on Edstem if this "
-          "occurs."};
-      break;
-  };
-
-  return request;
+    assert(size_t(curr) == msg->sz);
+  }
+
+  return true;
 }
 
-std::optional<Message> serialize_response(Response response) {
-  Message msg{};
+template <typename Stream>
+bool send_message_over(Stream s, Message* msg, milliseconds timeout) {
+  // must specify non-zero timeout
+  assert(timeout > 0ms);
+  assert(msg->sz == msg->buf.size());
+  // The peer would refuse it anyway
+  if (msg->sz > MAX_MESSAGE_SIZE) {
+    cerr_color(RED, "Message of ", msg->sz, " bytes too large to send.");
+    return false;
+  }
 
-  // Serialize into message, depending on type
-  auto out = zpp::bits::output(msg.buf);
-  if (auto* res = std::get_if<JoinResponse>(&response)) {
-    msg.type = MessageType::JOIN;
-    if (!success(out(*res))) return std::nullopt;
-  } else if (auto* res = std::get_if<LeaveResponse>(&response)) {
-    msg.type = MessageType::LEAVE;
-    if (!success(out(*res))) return std::nullopt;
-  } else if (auto* res = std::get_if<MoveResponse>(&response)) {
-    msg.type = MessageType::MOVE;
-    if (!success(out(*res))) return std::nullopt;
-  } else if (auto* res = std::get_if<QueryResponse>(&response)) {
-    msg.type = MessageType::QUERY;
-    if (!success(out(*res))) return std::nullopt;
-  } else if (auto* res = std::get_if<GetResponse>(&response)) {
-    msg.type = MessageType::GET;
-    if (!success(out(*res))) return std::nullopt;
-  } else if (auto* res = std::get_if<PutResponse>(&response)) {
-    msg.type = MessageType::PUT;
-    if (!success(out(*res))) return std::nullopt;
-  } else if (auto* res = std::get_if<AppendResponse>(&response)) {
-    msg.type = MessageType::APPEND;
-    if (!success(out(*res))) return std::nullopt;
-  } else if (auto* res = std::get_if<DeleteResponse>(&response)) {
-    msg.type = MessageType::DELETE;
-    if (!success(out(*res))) return std::nullopt;
-  } else if (auto* res = std::get_if<MultiGetResponse>(&response)) {
-    msg.type = MessageType::MULTI_GET;
-    if (!success(out(*res))) return std::nullopt;
-  } else if (auto* res = std::get_if<MultiPutResponse>(&response)) {
-    msg.type = MessageType::MULTI_PUT;
-    if (!success(out(*res))) return std::nullopt;
-  } else if (auto* res = std::get_if<ErrorResponse>(&response)) {
-    msg.type = MessageType::ERROR;
-    if (!success(out(*res))) return std::nullopt;
-  } else {
-    throw std::logic_error{
-        "Invalid response variant! Please post privately on Edstem if this "
-        "occurs."};
+  if (msg->format == WireFormat::COMPACT) {
+    return send_compact_over(s, msg, timeout);
   }
+  return send_legacy_over(s, msg, timeout);
+}
+
+template <typename Stream>
+bool recv_message_over(Stream s, Message* msg, milliseconds timeout) {
+  // must specify non-zero timeout
+  assert(timeout > 0ms);
+
+  if (msg->format == WireFormat::COMPACT) {
+    return recv_compact_over(s, msg, timeout);
+  }
+  return recv_legacy_over(s, msg, timeout);
+}
+
+}  // namespace
+
+bool send_message(int fd, Message* msg, milliseconds timeout) {
+  return send_message_over(SocketStream{fd}, msg, timeout);
+}
+
+bool recv_message(int fd, Message* msg, milliseconds timeout) {
+  return recv_message_over(SocketStream{fd}, msg, timeout);
+}
+
+bool send_message(ShmChannel* ch, Message* msg, milliseconds timeout) {
+  return send_message_over(ShmStream{ch, ch->control_fd()}, msg, timeout);
+}
+
+bool recv_message(ShmChannel* ch, Message* msg, milliseconds timeout) {
+  return recv_message_over(ShmStream{ch, ch->control_fd()}, msg, timeout);
+}
+
+void compress_message(Message* msg) {
+  if (msg->flags & FLAG_COMPRESSED || msg->sz < COMPRESSION_THRESHOLD) return;
+
+  std::vector<std::byte> compressed = lz_compress(msg->buf.data(), msg->sz);
+  // Incompressible bodies (e.g. already-compressed values) go out as-is
+  if (compressed.size() >= msg->sz) return;
+
+  msg->buf = std::move(compressed);
+  msg->sz = msg->buf.size();
+  msg->flags |= FLAG_COMPRESSED;
+}
+
+bool decompress_message(Message* msg) {
+  if (!(msg->flags & FLAG_COMPRESSED)) return true;
+
+  auto decompressed =
+      lz_decompress(msg->buf.data(), msg->sz, MAX_MESSAGE_SIZE);
+  if (!decompressed) return false;
+
+  msg->buf = std::move(*decompressed);
+  msg->sz = msg->buf.size();
+  msg->flags &= ~FLAG_COMPRESSED;
+  return true;
+}
+
+namespace {
+
+// Appends value to the (uncompressed) message body, setting flag.
+template <typename T>
+void attach_trailer(Message* msg, T value, uint32_t flag) {
+  auto bytes = std::bit_cast<std::array<std::byte, sizeof(value)>>(value);
+  msg->buf.resize(msg->sz);
+  msg->buf.insert(msg->buf.end(), bytes.begin(), bytes.end());
+  msg->sz = msg->buf.size();
+  msg->flags |= flag;
+}
+
+// Takes a value appended with attach_trailer off the end of the body, if
+// flag is set. Returns false if the body is too short to have one.
+template <typename T>
+bool detach_trailer(Message* msg, uint32_t flag, std::optional<T>* value) {
+  value->reset();
+  if (!(msg->flags & flag)) return true;
+
+  T trailer;
+  if (msg->sz < sizeof(trailer)) return false;
+  msg->sz -= sizeof(trailer);
+  std::memcpy(&trailer, msg->buf.data() + msg->sz, sizeof(trailer));
+  msg->buf.resize(msg->sz);
+  msg->flags &= ~flag;
+  *value = trailer;
+  return true;
+}
+
+}  // namespace
+
+void attach_deadline(Message* msg, system_clock::time_point deadline) {
+  int64_t us = duration_cast<microseconds>(deadline.time_since_epoch()).count();
+  attach_trailer(msg, us, FLAG_DEADLINE);
+}
+
+bool detach_deadline(Message* msg,
+                     std::optional<system_clock::time_point>* deadline) {
+  deadline->reset();
+  std::optional<int64_t> us;
+  if (!detach_trailer(msg, FLAG_DEADLINE, &us)) return false;
+  if (us) *deadline = system_clock::time_point(microseconds(*us));
+  return true;
+}
+
+void attach_config_hint(Message* msg, uint64_t version) {
+  attach_trailer(msg, version, FLAG_CONFIG_HINT);
+}
+
+bool detach_config_hint(Message* msg, std::optional<uint64_t>* version) {
+  return detach_trailer(msg, FLAG_CONFIG_HINT, version);
+}
+
+namespace {
+
+// Run f on a zpp_bits output/input archive over buf, using the length prefixes
+// of the given wire format.
+template <typename F>
+bool with_output(std::vector<std::byte>& buf, WireFormat format, F&& f) {
+  if (format == WireFormat::COMPACT) {
+    zpp::bits::out out(buf, zpp::bits::size_varint{});
+    return f(out);
+  }
+  zpp::bits::out out(buf);
+  return f(out);
+}
+
+template <typename F>
+bool with_input(const std::vector<std::byte>& buf, WireFormat format, F&& f) {
+  if (format == WireFormat::COMPACT) {
+    zpp::bits::in in(buf, zpp::bits::size_varint{});
+    return f(in);
+  }
+  zpp::bits::in in(buf);
+  return f(in);
+}
+
+// Serializes whichever message the variant holds, tagging it with the
+// message's registered type.
+template <typename Variant>
+std::optional<Message> serialize_message(const Variant& message,
+                                         WireFormat format) {
+  Message msg{};
+  msg.format = format;
+  bool ok = std::visit(
+      [&](const auto& m) {
+        msg.type = message_type_v<decltype(m)>;
+        return with_output(msg.buf, format,
+                           [&](auto& out) { return success(out(m)); });
+      },
+      message);
+  if (!ok) return std::nullopt;
 
   // Set size, for easier network parsing
   msg.sz = msg.buf.size();
@@ -289,83 +430,61 @@ std::optional<Message> serialize_response(Response response) {
   return msg;
 }
 
+template <typename Variant>
+using Decoder = std::optional<Variant> (*)(const Message&);
+
+// Deserializes a message body as the I'th alternative of the variant.
+template <typename Variant, size_t I>
+std::optional<Variant> decode_as(const Message& message) {
+  std::variant_alternative_t<I, Variant> m{};
+  bool ok = with_input(message.buf, message.format,
+                       [&](auto& in) { return success(in(m)); });
+  if (!ok) return std::nullopt;
+  return Variant{std::in_place_index<I>, std::move(m)};
+}
+
+// Builds a table from MessageType to the decoder for the variant's alternative
+// with that type (nullptr if the variant has none).
+template <typename Variant, size_t... Is>
+constexpr auto make_decoders(std::index_sequence<Is...>) {
+  std::array<Decoder<Variant>, size_t(MessageType::COUNT)> decoders{};
+  ((decoders[size_t(message_type_v<std::variant_alternative_t<Is, Variant>>)] =
+        &decode_as<Variant, Is>),
+   ...);
+  return decoders;
+}
+
+template <typename Variant>
+constexpr auto decoders = make_decoders<Variant>(
+    std::make_index_sequence<std::variant_size_v<Variant>>{});
+
+template <typename Variant>
+std::optional<Variant> deserialize_message(const Message& message) {
+  size_t type = size_t(message.type);
+  // Unknown types come from a confused (or malicious) peer, so they're just a
+  // failed receive.
+  if (type >= decoders<Variant>.size() || !decoders<Variant>[type]) {
+    cerr_color(RED, "Invalid message type: ", type);
+    return std::nullopt;
+  }
+  return decoders<Variant>[type](message);
+}
+
+}  // namespace
+
+std::optional<Message> serialize_request(Request request, WireFormat format) {
+  return serialize_message(request, format);
+}
+
+std::optional<Request> deserialize_request(Message message) {
+  return deserialize_message<Request>(message);
+}
+
+std::optional<Message> serialize_response(Response response,
+                                          WireFormat format) {
+  return serialize_message(response, format);
+}
+
 std::optional<Response> deserialize_response(Message message) {
-  Response response;
-  // Deserialize from message, depending on type
-  auto in = zpp::bits::input(message.buf);
-  switch (message.type) {
-    case MessageType::JOIN: {
-      JoinResponse res{};
-      if (!success(in(res))) return std::nullopt;
-      response = res;
-      break;
-    }
-    case MessageType::LEAVE: {
-      LeaveResponse res{};
-      if (!success(in(res))) return std::nullopt;
-      response = res;
-      break;
-    }
-    case MessageType::MOVE: {
-      MoveResponse res{};
-      if (!success(in(res))) return std::nullopt;
-      response = res;
-      break;
-    }
-    case MessageType::QUERY: {
-      QueryResponse res{};
-      if (!success(in(res))) return std::nullopt;
-      response = res;
-      break;
-    }
-    case MessageType::GET: {
-      GetResponse res{};
-      if (!success(in(res))) return std::nullopt;
-      response = res;
-      break;
-    }
-    case MessageType::PUT: {
-      PutResponse res{};
-      if (!success(in(res))) return std::nullopt;
-      response = res;
-      break;
-    }
-    case MessageType::APPEND: {
-      AppendResponse res{};
-      if (!success(in(res))) return std::nullopt;
-      response = res;
-      break;
-    }
-    case MessageType::DELETE: {
-      DeleteResponse res{};
-      if (!success(in(res))) return std::nullopt;
-      response = res;
-      break;
-    }
-    case MessageType::MULTI_GET: {
-      MultiGetResponse res{};
-      if (!success(in(res))) return std::nullopt;
-      response = res;
-      break;
-    }
-    case MessageType::MULTI_PUT: {
-      MultiPutResponse res{};
-      if (!success(in(res))) return std::nullopt;
-      response = res;
-      break;
-    }
-    case MessageType::ERROR: {
-      ErrorResponse res{};
-      if (!success(in(res))) return std::nullopt;
-      response = res;
-      break;
-    }
-    default:
-      throw std::logic_error{
-          "Invalid message type! Please post privately on Edstem if this "
-          "occurs."};
-      break;
-  };
-
-  return response;
+  return deserialize_message<Response>(message);
 }
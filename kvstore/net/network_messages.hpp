@@ -17,9 +17,11 @@
 #include <vector>
 
 #include "common/color.hpp"
+#include "common/lz.hpp"
 #include "common/zpp_bits.hpp"
 #include "network_helpers.hpp"
 #include "server_commands.hpp"
+#include "shm_channel.hpp"
 #include "shardmaster_commands.hpp"
 
 // ... cpp chrono is so annoying
@@ -39,49 +41,257 @@ enum class MessageType {
   MOVE,
   QUERY,
   // Error
-  ERROR
+  ERROR,
+  // Streamed KvServer messages
+  PUT_CHUNK,
+  GET_CHUNK,
+  // Leased KvServer reads
+  LEASE_GET,
+  // Shardmaster config long-polls
+  WATCH,
+  // KvServer load reports to the shardmaster
+  REPORT_LOAD,
+  // Pairs moving between KvServers
+  MIGRATE,
+  // Primary-backup replication
+  REPLICATE,
+  REPLICA_GET,
+  // Cross-server MultiPuts
+  PREPARE,
+  COMMIT,
+  // Number of message types; keep last
+  COUNT
 };
 
+// Header flags. On the wire, these are packed into the upper bits of the
+// message type, so a peer that never sets any of them sees the same format as
+// before.
+enum MessageFlags : uint32_t {
+  // The message body is compressed (see common/lz.hpp).
+  FLAG_COMPRESSED = 1u << 16,
+  // The sender can decompress message bodies, so replies to it may be
+  // compressed.
+  FLAG_ACCEPTS_COMPRESSED = 1u << 17,
+  // The sender can speak WireFormat::COMPACT. A server that can too echoes it
+  // in its response, after which both ends switch to the compact format.
+  FLAG_ACCEPTS_COMPACT = 1u << 18,
+  // The request carries a deadline: the last 8 bytes of its (uncompressed)
+  // body are when it stops being worth answering, in microseconds since the
+  // Unix epoch. (Absolute, so time spent queued at the server counts; clocks
+  // are assumed to agree to well within the timeouts in use.) Servers that
+  // predate deadlines ignore both the flag and the trailing bytes.
+  FLAG_DEADLINE = 1u << 19,
+  // The sender understands FLAG_DEADLINE. Clients offer it, and servers that
+  // do too echo it; only then may deadlines go out in WireFormat::COMPACT
+  // (whose header an older server would misread).
+  FLAG_ACCEPTS_DEADLINES = 1u << 20,
+  // The response comes from another server, which the request was forwarded
+  // to as the key's server (see KvServerOptions::forward_misrouted): the
+  // last 8 bytes of its (uncompressed) body are the version of the config it
+  // was routed with (0 if the forwarding server doesn't know it), so the
+  // client knows to refresh its own. Only sent to clients that have offered
+  // FLAG_ACCEPTS_CONFIG_HINTS.
+  FLAG_CONFIG_HINT = 1u << 21,
+  // The sender can take FLAG_CONFIG_HINT responses. Servers remember the
+  // offer for the rest of the connection (the compact format has no room
+  // for it).
+  FLAG_ACCEPTS_CONFIG_HINTS = 1u << 22,
+  // The sender takes values streamed in chunks (see PutChunkRequest and
+  // GetChunkRequest). A client offering it may have a Get of a value larger
+  // than STREAM_CHUNK_SIZE answered with the value's first GetChunkResponse,
+  // and fetches the rest with GetChunkRequests; servers that stream values
+  // echo it. Both ends remember it for the rest of the connection (the
+  // compact format has no room for it).
+  FLAG_ACCEPTS_VALUE_STREAMS = 1u << 23,
+};
+#define MESSAGE_TYPE_MASK 0xFFFFu
+
+// How messages are framed and encoded on a connection. Every connection starts
+// out LEGACY, so peers that predate COMPACT keep working.
+enum class WireFormat {
+  // 4-byte type and flags, 8-byte body size, and fixed 4-byte length prefixes
+  // on strings/vectors in the body.
+  LEGACY,
+  // 1-byte type and flags, varint body size, and varint length prefixes.
+  COMPACT,
+};
+
+// Largest message body (in bytes, before and after decompression) that's sent
+// or accepted. The size comes from the peer, so without a cap one header could
+// make the receiver allocate gigabytes; values bigger than this are streamed
+// in chunks instead (see PutChunkRequest).
+#define MAX_MESSAGE_SIZE (256ull << 20)
+
 struct Message {
   MessageType type;
+  uint32_t flags = 0;
   size_t sz = 0;
   // NOTE: ideally, we wouldn't want memory allocation for every message, but it
   // might be unavoidable due to the variable sizes of strings/vectors :(
   std::vector<std::byte> buf;
+  // How the message is (to be) framed and encoded. recv_message expects it to
+  // be set to the connection's format beforehand.
+  WireFormat format = WireFormat::LEGACY;
 
+  // Size of the message on the wire
   size_t size() {
-    return sizeof(type) + sizeof(sz) + buf.size();
+    if (format == WireFormat::COMPACT) {
+      size_t varint_size = 1;
+      for (size_t n = buf.size(); n > 0x7F; n >>= 7) varint_size++;
+      return 1 + varint_size + buf.size();
+    }
+    return sizeof(uint32_t) + sizeof(sz) + buf.size();
   }
 };
 
 // Generic send/receive message helper functions.
 bool send_message(int fd, Message* msg, milliseconds timeout = 100ms);
 bool recv_message(int fd, Message* msg, milliseconds timeout = 100ms);
+// Same as above, over a shared-memory channel.
+bool send_message(ShmChannel* ch, Message* msg, milliseconds timeout = 100ms);
+bool recv_message(ShmChannel* ch, Message* msg, milliseconds timeout = 100ms);
+
+// Compresses the message body in place if it's at least COMPRESSION_THRESHOLD
+// bytes and compressing actually shrinks it, setting FLAG_COMPRESSED if so.
+void compress_message(Message* msg);
+// Decompresses the message body in place if FLAG_COMPRESSED is set. Returns
+// false if the body is malformed.
+bool decompress_message(Message* msg);
+
+// Appends deadline to the (uncompressed) message body, setting FLAG_DEADLINE.
+void attach_deadline(Message* msg, system_clock::time_point deadline);
+// Takes the deadline off the end of the (decompressed) message body, if
+// FLAG_DEADLINE is set. Returns false if the body is too short to have one.
+bool detach_deadline(Message* msg,
+                     std::optional<system_clock::time_point>* deadline);
+// Same as above, for the config version of FLAG_CONFIG_HINT.
+void attach_config_hint(Message* msg, uint64_t version);
+bool detach_config_hint(Message* msg, std::optional<uint64_t>* version);
 
 // define a generic Error response message.
 struct ErrorResponse {
   std::string msg;
 };
 
+// What a KvServer answers (possibly followed by "(s)") for keys it isn't
+// responsible for. Clients routing with a stale config should refresh it.
+#define NOT_RESPONSIBLE_ERROR "server not responsible for key"
+inline bool is_not_responsible_error(const std::string& msg) {
+  return msg.rfind(NOT_RESPONSIBLE_ERROR, 0) == 0;
+}
+
+// What a KvServer answers, without doing the work, to requests whose deadline
+// had passed by the time it got to them.
+#define DEADLINE_EXCEEDED_ERROR "deadline exceeded"
+
+// What a backup answers to a ReplicaGetRequest when its copy of the key may
+// be older than the request allows. Clients should ask the key's server.
+#define REPLICA_TOO_STALE_ERROR "replica too stale"
+
+// What a KvServer answers to writes (and PrepareRequests) for keys a
+// transaction has locked (see PrepareRequest), or that it's handing over to
+// another server. Clients should try again once it's done, which is within
+// TXN_TIMEOUT.
+#define KEY_LOCKED_ERROR "key locked by a transaction"
+// What a KvServer answers to a CommitRequest for a transaction it doesn't
+// have prepared (it never was, or it was given up on).
+#define TXN_UNKNOWN_ERROR "unknown transaction"
+// How long a KvServer holds a prepared transaction's keys locked, waiting for
+// its commit, before it gives up on it.
+#define TXN_TIMEOUT 5s
+// The longest a client backs off for before retrying a write refused with
+// KEY_LOCKED_ERROR.
+#define TXN_MAX_BACKOFF 5ms
+
 using Request = std::variant<
     // Shardmaster requests
     JoinRequest, LeaveRequest, MoveRequest, QueryRequest,
     // KvServer requests
     GetRequest, PutRequest, AppendRequest, DeleteRequest, MultiGetRequest,
-    MultiPutRequest>;
+    MultiPutRequest, PutChunkRequest, GetChunkRequest, LeaseGetRequest,
+    // Shardmaster requests, continued
+    WatchRequest, ReportLoadRequest,
+    // KvServer requests, continued
+    MigrateRequest, ReplicateRequest, ReplicaGetRequest, PrepareRequest,
+    CommitRequest>;
 using Response = std::variant<
     // Shardmaster responses
     JoinResponse, LeaveResponse, MoveResponse, QueryResponse,
     // KvServer responses
     GetResponse, PutResponse, AppendResponse, DeleteResponse, MultiGetResponse,
-    MultiPutResponse,
+    MultiPutResponse, PutChunkResponse, GetChunkResponse, LeaseGetResponse,
+    // Shardmaster responses, continued
+    WatchResponse, ReportLoadResponse,
+    // KvServer responses, continued
+    MigrateResponse, ReplicateResponse, ReplicaGetResponse, PrepareResponse,
+    CommitResponse,
     // Error response
     ErrorResponse>;
 
-std::optional<Message> serialize_request(Request request);
+/*
+ * Registry mapping each message struct to its MessageType, which is what goes
+ * on the wire. The codec (and anything else that needs to know a message's
+ * type) looks types up here, so a new message needs its MessageType, its
+ * Request/Response alternatives, and one REGISTER_MESSAGE line below
+ * (forgetting the last is a compile error).
+ */
+template <typename T>
+struct MessageTraits;  // undefined for unregistered types
+
+#define REGISTER_MESSAGE(TYPE, REQUEST, RESPONSE)                            \
+  template <>                                                                \
+  struct MessageTraits<REQUEST> {                                            \
+    static constexpr MessageType type = MessageType::TYPE;                   \
+  };                                                                         \
+  template <>                                                                \
+  struct MessageTraits<RESPONSE> {                                           \
+    static constexpr MessageType type = MessageType::TYPE;                   \
+  }
+
+REGISTER_MESSAGE(JOIN, JoinRequest, JoinResponse);
+REGISTER_MESSAGE(LEAVE, LeaveRequest, LeaveResponse);
+REGISTER_MESSAGE(MOVE, MoveRequest, MoveResponse);
+REGISTER_MESSAGE(QUERY, QueryRequest, QueryResponse);
+REGISTER_MESSAGE(GET, GetRequest, GetResponse);
+REGISTER_MESSAGE(PUT, PutRequest, PutResponse);
+REGISTER_MESSAGE(APPEND, AppendRequest, AppendResponse);
+REGISTER_MESSAGE(DELETE, DeleteRequest, DeleteResponse);
+REGISTER_MESSAGE(MULTI_GET, MultiGetRequest, MultiGetResponse);
+REGISTER_MESSAGE(MULTI_PUT, MultiPutRequest, MultiPutResponse);
+REGISTER_MESSAGE(PUT_CHUNK, PutChunkRequest, PutChunkResponse);
+REGISTER_MESSAGE(GET_CHUNK, GetChunkRequest, GetChunkResponse);
+REGISTER_MESSAGE(LEASE_GET, LeaseGetRequest, LeaseGetResponse);
+REGISTER_MESSAGE(WATCH, WatchRequest, WatchResponse);
+REGISTER_MESSAGE(REPORT_LOAD, ReportLoadRequest, ReportLoadResponse);
+REGISTER_MESSAGE(MIGRATE, MigrateRequest, MigrateResponse);
+REGISTER_MESSAGE(REPLICATE, ReplicateRequest, ReplicateResponse);
+REGISTER_MESSAGE(REPLICA_GET, ReplicaGetRequest, ReplicaGetResponse);
+REGISTER_MESSAGE(PREPARE, PrepareRequest, PrepareResponse);
+REGISTER_MESSAGE(COMMIT, CommitRequest, CommitResponse);
+
+template <>
+struct MessageTraits<ErrorResponse> {
+  static constexpr MessageType type = MessageType::ERROR;
+};
+
+template <typename T>
+inline constexpr MessageType message_type_v =
+    MessageTraits<std::decay_t<T>>::type;
+
+// Gets the MessageType of whichever message a Request/Response holds.
+template <typename Variant>
+MessageType message_type_of(const Variant& message) {
+  return std::visit([](const auto& m) { return message_type_v<decltype(m)>; },
+                    message);
+}
+
+std::optional<Message> serialize_request(
+    Request request, WireFormat format = WireFormat::LEGACY);
+// Deserialization uses the format recorded in the message.
 std::optional<Request> deserialize_request(Message message);
 
-std::optional<Message> serialize_response(Response response);
+std::optional<Message> serialize_response(
+    Response response, WireFormat format = WireFormat::LEGACY);
 std::optional<Response> deserialize_response(Message message);
 
 #endif /* end of include guard */
@@ -1,10 +1,15 @@
 #ifndef SERVER_COMMANDS_HPP
 #define SERVER_COMMANDS_HPP
 
+#include <cstdint>
 #include <string>
 #include <variant>
 #include <vector>
 
+// Values larger than this are streamed in chunks of (at most) this size, with
+// PutChunk/GetChunk requests, rather than in a single Put/Get message.
+#define STREAM_CHUNK_SIZE (256 * 1024)
+
 // Requests
 struct GetRequest {
   std::string key;
@@ -33,6 +38,86 @@ struct MultiPutRequest {
   std::vector<std::string> values;
 };
 
+// One chunk of a streamed Put. Chunks must be sent in order over a single
+// connection, starting at offset 0; the value is stored once the last chunk
+// (the one ending at total_size) arrives.
+struct PutChunkRequest {
+  std::string key;
+  uint64_t offset;
+  std::string data;
+  uint64_t total_size;
+};
+
+// Reads the chunk of a value starting at offset. The server snapshots the
+// value when offset is 0, and serves the rest of the chunks from the snapshot.
+struct GetChunkRequest {
+  std::string key;
+  uint64_t offset;
+};
+
+// A Get that also asks for a read lease: permission to serve the value from a
+// cache for lease_us microseconds (see server/leases.hpp). The value comes
+// back whole, rather than in chunks.
+struct LeaseGetRequest {
+  std::string key;
+};
+
+// Pairs handed from one KvServer, source, to another as shards move between
+// them (see server/shard_migration.hpp): stored, then the deleted keys are
+// removed, if the receiving server's config has them moving to it from
+// source. done is set on the last request of a handover. (source and done
+// came later, so servers from before them can't migrate to or from ones
+// after.)
+struct MigrateRequest {
+  std::string source;
+  std::vector<std::string> keys;
+  std::vector<std::string> values;
+  std::vector<std::string> deleted;
+  bool done = false;
+};
+
+// A primary's writes, shipped to one of its backups (see
+// server/replication.hpp): pairs to store whatever the backup's config says,
+// then keys to delete. If caught_up is set, the backup then has every write
+// the primary acknowledged up to age_us microseconds before the request was
+// sent (an empty request may be sent just to say so).
+struct ReplicateRequest {
+  std::string primary;
+  std::vector<std::string> keys;
+  std::vector<std::string> values;
+  std::vector<std::string> deleted;
+  bool caught_up;
+  uint64_t age_us;
+};
+
+// A Get that any of the key's replicas may answer (its server, or one of the
+// server's backups), so long as its copy is at most max_staleness_us
+// microseconds out of date.
+struct ReplicaGetRequest {
+  std::string key;
+  uint64_t max_staleness_us;
+};
+
+// The first phase of a MultiPut whose keys span servers (see
+// server/transactions.hpp): the server locks the keys for transaction txid
+// and holds on to the pairs, until a CommitRequest for txid comes (or
+// TXN_TIMEOUT passes). Meanwhile, other writes to the keys are refused with
+// KEY_LOCKED_ERROR, as is a prepare that would lock a key that's already
+// locked.
+struct PrepareRequest {
+  uint64_t txid;
+  std::vector<std::string> keys;
+  std::vector<std::string> values;
+};
+
+// The second phase: stores transaction txid's pairs if commit is set, or
+// drops them if not, then unlocks their keys. Committing a transaction
+// that's just been committed does nothing, so commits can be retried.
+struct CommitRequest {
+  uint64_t txid;
+  bool commit;
+};
+
 // Responses
 struct GetResponse {
   std::string value;
@@ -47,5 +132,26 @@ struct MultiGetResponse {
   std::vector<std::string> values;
 };
 struct MultiPutResponse {};
+struct PutChunkResponse {};
+struct GetChunkResponse {
+  std::string data;
+  // Size of the whole value
+  uint64_t total_size;
+};
+struct LeaseGetResponse {
+  std::string value;
+  // How long the value may be cached for, from when the request was sent; 0
+  // if it shouldn't be.
+  uint64_t lease_us;
+};
+struct MigrateResponse {};
+struct ReplicateResponse {};
+struct ReplicaGetResponse {
+  std::string value;
+  // How out of date the value may be (0 from the key's server).
+  uint64_t staleness_us;
+};
+struct PrepareResponse {};
+struct CommitResponse {};
 
 #endif /* end of include guard */
@@ -9,6 +9,21 @@
 #include "common/config.hpp"
 #include "network_helpers.hpp"
 
+// How long watchers ask the shardmaster to hold a WatchRequest for, if the
+// config doesn't change before then.
+#define WATCH_TIMEOUT 30s
+// How often KvServers that report their load send a ReportLoadRequest.
+#define LOAD_REPORT_INTERVAL 1s
+
+// The load on one of a server's shards, over its last report interval.
+struct ShardLoad {
+  Shard shard;
+  // Requests per second for keys in the shard.
+  double rate;
+  // Keys stored in the shard.
+  uint64_t keys;
+};
+
 // Requests
 struct JoinRequest {
   std::string server;
@@ -21,6 +36,23 @@ struct MoveRequest {
   std::vector<Shard> shards;
 };
 struct QueryRequest {};
+/*
+ * Waits (up to timeout_ms, which the shardmaster may cap) for the config to
+ * move past version, which is the last one the watcher has seen (0 for none).
+ */
+struct WatchRequest {
+  uint64_t version;
+  uint64_t timeout_ms;
+};
+/*
+ * A server's load, for shardmasters that place shards by it: one entry for
+ * each of the server's shards, as the server last heard them from the
+ * shardmaster.
+ */
+struct ReportLoadRequest {
+  std::string server;
+  std::vector<ShardLoad> shards;
+};
 
 // Responses
 struct JoinResponse {};
@@ -29,6 +61,18 @@ struct MoveResponse {};
 struct QueryResponse {
   ShardmasterConfig config;
 };
+/*
+ * The current config version, and what changed since the watcher's version.
+ * If full, the delta is from an empty config (the watcher's version was too
+ * old, or unknown); if the wait timed out, version is the watcher's, and the
+ * delta is empty.
+ */
+struct WatchResponse {
+  uint64_t version;
+  bool full;
+  ConfigDelta delta;
+};
+struct ReportLoadResponse {};
 
 // using SmRequest = std::variant<JoinRequest, LeaveRequest, MoveRequest,
 // QueryRequest>; using SmResponse = std::variant<JoinResponse, LeaveResponse,
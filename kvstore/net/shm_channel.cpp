@@ -0,0 +1,291 @@
+#include "shm_channel.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "common/color.hpp"
+#include "network_helpers.hpp"
+
+// Identifies a segment as one of ours, so the server doesn't map garbage.
+#define SHM_MAGIC 0x6B767368  // "kvsh"
+// How many times a reader re-checks an empty ring before sleeping (on
+// multi-core machines; with one core, spinning just delays the writer).
+#define SHM_SPIN_ITERS 2000
+// How long a blocked side sleeps before re-checking whether the peer is alive.
+#define SHM_WAIT_SLICE 50ms
+// Seals every segment must carry, so neither side can resize the mapping out
+// from under the other (touching pages past a shrunk end raises SIGBUS).
+#define SHM_REQUIRED_SEALS (F_SEAL_SHRINK | F_SEAL_GROW)
+
+namespace {
+
+// Layout of the start of the segment; the two rings' data follows it.
+struct ShmSegment {
+  uint32_t magic;
+  uint32_t capacity;
+  std::atomic<uint32_t> closed;
+  ShmRing to_server;
+  ShmRing to_client;
+};
+
+size_t segment_size(size_t capacity) {
+  return sizeof(ShmSegment) + 2 * capacity;
+}
+
+int spin_iters() {
+  static const int iters =
+      std::thread::hardware_concurrency() > 1 ? SHM_SPIN_ITERS : 0;
+  return iters;
+}
+
+}  // namespace
+
+ShmChannel::~ShmChannel() {
+  if (this->base) munmap(this->base, this->mapped_size);
+  if (this->fd >= 0) ::close(this->fd);
+}
+
+std::shared_ptr<ShmChannel> ShmChannel::create(size_t capacity) {
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+    cerr_color(RED, "Shared-memory ring capacity must be a power of two.");
+    return nullptr;
+  }
+
+  int memfd = memfd_create("kvstore-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (memfd < 0) {
+    perror_color(RED, "memfd_create");
+    return nullptr;
+  }
+  if (ftruncate(memfd, segment_size(capacity)) < 0) {
+    perror_color(RED, "ftruncate");
+    ::close(memfd);
+    return nullptr;
+  }
+
+  // ftruncate zero-fills, so the rings start out empty and open
+  void* base = mmap(nullptr, sizeof(ShmSegment), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, memfd, 0);
+  if (base == MAP_FAILED) {
+    perror_color(RED, "mmap");
+    ::close(memfd);
+    return nullptr;
+  }
+  auto* seg = static_cast<ShmSegment*>(base);
+  seg->magic = SHM_MAGIC;
+  seg->capacity = capacity;
+  munmap(base, sizeof(ShmSegment));
+
+  if (fcntl(memfd, F_ADD_SEALS, SHM_REQUIRED_SEALS | F_SEAL_SEAL) < 0) {
+    perror_color(RED, "fcntl");
+    ::close(memfd);
+    return nullptr;
+  }
+
+  std::shared_ptr<ShmChannel> ch(new ShmChannel());
+  if (!ch->map(memfd, true)) return nullptr;
+  return ch;
+}
+
+std::shared_ptr<ShmChannel> ShmChannel::attach(int memfd) {
+  std::shared_ptr<ShmChannel> ch(new ShmChannel());
+  if (!ch->map(memfd, false)) return nullptr;
+  return ch;
+}
+
+bool ShmChannel::map(int memfd, bool is_client) {
+  this->fd = memfd;
+
+  // Check the seals before the size, so the size can't change after
+  int seals = fcntl(memfd, F_GET_SEALS);
+  if (seals < 0 || (seals & SHM_REQUIRED_SEALS) != SHM_REQUIRED_SEALS) {
+    cerr_color(RED, "Shared-memory segment isn't sealed against resizing.");
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(memfd, &st) < 0) {
+    perror_color(RED, "fstat");
+    return false;
+  }
+  if (size_t(st.st_size) < sizeof(ShmSegment)) {
+    cerr_color(RED, "Shared-memory segment is too small.");
+    return false;
+  }
+
+  this->base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    memfd, 0);
+  if (this->base == MAP_FAILED) {
+    this->base = nullptr;
+    perror_color(RED, "mmap");
+    return false;
+  }
+  this->mapped_size = st.st_size;
+
+  auto* seg = static_cast<ShmSegment*>(this->base);
+  uint32_t cap = seg->capacity;
+  if (seg->magic != SHM_MAGIC || cap == 0 || (cap & (cap - 1)) != 0 ||
+      segment_size(cap) != this->mapped_size) {
+    cerr_color(RED, "Invalid shared-memory segment.");
+    return false;
+  }
+  this->capacity = cap;
+  this->closed = &seg->closed;
+
+  std::byte* to_server_data = reinterpret_cast<std::byte*>(seg + 1);
+  std::byte* to_client_data = to_server_data + cap;
+  if (is_client) {
+    this->tx = &seg->to_server;
+    this->tx_data = to_server_data;
+    this->rx = &seg->to_client;
+    this->rx_data = to_client_data;
+  } else {
+    this->tx = &seg->to_client;
+    this->tx_data = to_client_data;
+    this->rx = &seg->to_server;
+    this->rx_data = to_server_data;
+  }
+  return true;
+}
+
+bool ShmChannel::is_closed() {
+  if (this->closed->load()) return true;
+
+  // The control socket never carries data, so it becoming readable (or hung
+  // up) means the peer closed it, or died.
+  if (this->ctl_fd >= 0) {
+    struct pollfd pfd = {this->ctl_fd, POLLIN | POLLRDHUP, 0};
+    if (poll(&pfd, 1, 0) != 0) {
+      this->close();
+      return true;
+    }
+  }
+  return false;
+}
+
+int ShmChannel::corrupted() {
+  cerr_color(RED, "Shared-memory ring indices are out of bounds.");
+  this->close();
+  errno = EPROTO;
+  return -1;
+}
+
+void ShmChannel::close() {
+  if (!this->closed) return;
+  this->closed->store(1);
+  // Wake both directions; nobody will write to these rings again
+  this->wake(&this->tx->head);
+  this->wake(&this->tx->tail);
+  this->wake(&this->rx->head);
+  this->wake(&this->rx->tail);
+}
+
+void ShmChannel::wait(std::atomic<uint32_t>* word, uint32_t expected) {
+  // std::atomic<uint32_t> is a plain 32-bit word, so it can be used as a futex.
+  // Not FUTEX_PRIVATE_FLAG, since the other side is in another process.
+  struct timespec ts = {0, duration_cast<nanoseconds>(SHM_WAIT_SLICE).count()};
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected,
+          &ts, nullptr, 0);
+}
+
+void ShmChannel::wake(std::atomic<uint32_t>* word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT32_MAX,
+          nullptr, nullptr, 0);
+}
+
+int ShmChannel::sendall(const void* buf, size_t len, milliseconds timeout) {
+  const std::byte* data = static_cast<const std::byte*>(buf);
+  size_t n_sent = 0;
+  auto begin = system_clock::now();
+  while (n_sent < len) {
+    if (this->closed->load()) {
+      errno = EPIPE;
+      return -1;
+    }
+
+    uint32_t head = this->tx->head.load(std::memory_order_relaxed);
+    uint32_t tail = this->tx->tail.load();
+    // The peer can write anything to the indices, so don't trust them to
+    // describe a ring of this capacity
+    if (head - tail > this->capacity) return this->corrupted();
+    uint32_t free = this->capacity - (head - tail);
+    if (free == 0) {
+      if (this->is_closed()) {
+        errno = EPIPE;
+        return -1;
+      }
+      if (timeout > 0ms &&
+          duration_cast<milliseconds>(system_clock::now() - begin) > timeout) {
+        return ETIMEOUT;
+      }
+      // Announce that we're waiting before re-checking, so the reader either
+      // sees the flag or we see its progress (see ShmRing).
+      this->tx->writer_waiting.store(1);
+      if (this->tx->tail.load() == tail) this->wait(&this->tx->tail, tail);
+      this->tx->writer_waiting.store(0);
+      continue;
+    }
+
+    // Copy in, wrapping around the end of the ring if needed
+    size_t n = std::min<size_t>(free, len - n_sent);
+    size_t pos = head & (this->capacity - 1);
+    size_t first = std::min(n, this->capacity - pos);
+    memcpy(this->tx_data + pos, data + n_sent, first);
+    memcpy(this->tx_data, data + n_sent + first, n - first);
+
+    this->tx->head.store(head + n);
+    if (this->tx->reader_waiting.load()) this->wake(&this->tx->head);
+    n_sent += n;
+  }
+  return n_sent;
+}
+
+int ShmChannel::recvall(void* buf, size_t len, milliseconds timeout) {
+  std::byte* data = static_cast<std::byte*>(buf);
+  size_t n_recvd = 0;
+  auto begin = system_clock::now();
+  while (n_recvd < len) {
+    uint32_t tail = this->rx->tail.load(std::memory_order_relaxed);
+    uint32_t head = this->rx->head.load();
+    // Replies usually show up within microseconds, so spin briefly before
+    // going to sleep
+    for (int i = 0; i < spin_iters() && head == tail; i++) {
+      head = this->rx->head.load();
+    }
+    uint32_t avail = head - tail;
+    if (avail > this->capacity) return this->corrupted();
+    if (avail == 0) {
+      // Like a socket, a closed channel reads as EOF
+      if (this->is_closed()) return 0;
+      if (timeout > 0ms &&
+          duration_cast<milliseconds>(system_clock::now() - begin) > timeout) {
+        return ETIMEOUT;
+      }
+      this->rx->reader_waiting.store(1);
+      if (this->rx->head.load() == head) this->wait(&this->rx->head, head);
+      this->rx->reader_waiting.store(0);
+      continue;
+    }
+
+    size_t n = std::min<size_t>(avail, len - n_recvd);
+    size_t pos = tail & (this->capacity - 1);
+    size_t first = std::min(n, this->capacity - pos);
+    memcpy(data + n_recvd, this->rx_data + pos, first);
+    memcpy(data + n_recvd + first, this->rx_data, n - first);
+
+    this->rx->tail.store(tail + n);
+    if (this->rx->writer_waiting.load()) this->wake(&this->rx->tail);
+    n_recvd += n;
+  }
+  return n_recvd;
+}
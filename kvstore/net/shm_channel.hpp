@@ -0,0 +1,101 @@
+#ifndef SHM_CHANNEL_HPP
+#define SHM_CHANNEL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+using namespace std::chrono;
+
+// Default capacity (in bytes) of each direction of a shared-memory channel.
+// Must be a power of two.
+#define SHM_RING_CAPACITY (1 << 20)
+
+/*
+ * Header of a single-producer, single-consumer byte ring living in shared
+ * memory. head/tail count the total bytes written/read (mod 2^32), so the
+ * ring's capacity must be a power of two. head and tail double as futex words:
+ * an empty reader sleeps on head, a full writer sleeps on tail, and the
+ * *_waiting flags let the other side skip the wake syscall when nobody sleeps.
+ */
+struct ShmRing {
+  alignas(64) std::atomic<uint32_t> head;
+  std::atomic<uint32_t> reader_waiting;
+  alignas(64) std::atomic<uint32_t> tail;
+  std::atomic<uint32_t> writer_waiting;
+};
+
+/*
+ * A bidirectional byte stream between a co-located client and server, built
+ * from a pair of shared-memory SPSC rings (one per direction).
+ *
+ * The client creates the (anonymous, memfd-backed) segment, sealed against
+ * resizing, and hands the fd to the server over a Unix domain control socket
+ * (see connect_to_server and attach_shm_segment). After that, the control socket carries no data; it's
+ * only used to notice that the peer has gone away.
+ *
+ * sendall/recvall have the same return conventions as their socket versions in
+ * network_helpers.hpp, so the message framing code can run over either.
+ */
+class ShmChannel {
+ public:
+  ~ShmChannel();
+
+  // Creates a new segment (as the client side). Returns nullptr on failure.
+  static std::shared_ptr<ShmChannel> create(
+      size_t capacity = SHM_RING_CAPACITY);
+  // Maps a segment created by a client (as the server side), taking ownership
+  // of memfd. Returns nullptr on failure.
+  static std::shared_ptr<ShmChannel> attach(int memfd);
+
+  // The fd backing the segment, to send to the server.
+  int memfd() const {
+    return this->fd;
+  }
+  // The control socket used to check whether the peer is still alive.
+  int control_fd() const {
+    return this->ctl_fd;
+  }
+  void set_control_fd(int fd) {
+    this->ctl_fd = fd;
+  }
+
+  int sendall(const void* buf, size_t len, milliseconds timeout = 0ms);
+  int recvall(void* buf, size_t len, milliseconds timeout = 0ms);
+
+  // Marks the channel closed (for both sides), waking anyone blocked on it.
+  void close();
+
+  ShmChannel(const ShmChannel&) = delete;
+  ShmChannel& operator=(const ShmChannel&) = delete;
+
+ private:
+  ShmChannel() = default;
+
+  int fd = -1;
+  int ctl_fd = -1;
+  void* base = nullptr;
+  size_t mapped_size = 0;
+  uint32_t capacity = 0;
+
+  // The segment header's closed flag, and the rings we send/receive on.
+  std::atomic<uint32_t>* closed = nullptr;
+  ShmRing* tx = nullptr;
+  ShmRing* rx = nullptr;
+  std::byte* tx_data = nullptr;
+  std::byte* rx_data = nullptr;
+
+  bool map(int memfd, bool is_client);
+  // Whether the channel has been closed, or the peer has hung up.
+  bool is_closed();
+  // Closes the channel after finding its ring indices out of bounds, and
+  // fails the call (-1, with errno set to EPROTO).
+  int corrupted();
+  // Sleeps on word until it changes from expected, or a short slice passes.
+  void wait(std::atomic<uint32_t>* word, uint32_t expected);
+  void wake(std::atomic<uint32_t>* word);
+};
+
+#endif /* end of include guard */
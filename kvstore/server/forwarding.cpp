@@ -0,0 +1,74 @@
+#include "forwarding.hpp"
+
+#include "common/utils.hpp"
+#include "value_streams.hpp"
+
+std::optional<Response> forward_request(ConnectionPool* pool,
+                                        const ShardRouter& router,
+                                        uint64_t version,
+                                        const std::string& self,
+                                        const Request& req,
+                                        ClientConn* client) {
+  std::vector<std::string> keys;
+  Request forwarded = req;
+  const GetChunkRequest* download = nullptr;
+  std::visit(
+      overloaded{
+          [&](const GetRequest& get_req) { keys = {get_req.key}; },
+          [&](const PutRequest& put_req) { keys = {put_req.key}; },
+          [&](const AppendRequest& append_req) { keys = {append_req.key}; },
+          [&](const DeleteRequest& delete_req) { keys = {delete_req.key}; },
+          [&](const LeaseGetRequest& lease_req) { keys = {lease_req.key}; },
+          [&](const MultiGetRequest& multiget_req) {
+            keys = multiget_req.keys;
+          },
+          [&](const MultiPutRequest& multiput_req) {
+            keys = multiput_req.keys;
+          },
+          [&](const GetChunkRequest& chunk_req) {
+            download = &chunk_req;
+            if (chunk_req.offset > 0) return;
+            keys = {chunk_req.key};
+            forwarded = GetRequest{chunk_req.key};
+          },
+          [](const auto&) {},
+      },
+      req);
+
+  // The rest of a download started here comes from its snapshot (as it
+  // would if the config had changed partway through one)
+  if (download && download->offset > 0) {
+    if (download->key != client->download_key) return std::nullopt;
+    return get_value_chunk(nullptr, client, *download);
+  }
+
+  const std::string* server = nullptr;
+  for (auto&& key : keys) {
+    const std::string* owner = router.server_for(key);
+    if (!owner || *owner == self || (server && *owner != *server)) {
+      return std::nullopt;
+    }
+    server = owner;
+  }
+  if (!server) return std::nullopt;
+
+  PooledConn conn = pool->acquire(*server);
+  if (!conn) return std::nullopt;
+  conn->config_hints = false;
+  std::optional<Response> res = conn.call(forwarded, client->deadline);
+  if (!res) return std::nullopt;
+
+  // If the key's server disowns them too, the client is told so, and
+  // refreshes its config that way
+  auto* error_res = std::get_if<ErrorResponse>(&*res);
+  if (error_res && is_not_responsible_error(error_res->msg)) return res;
+  client->config_hint = version;
+  if (auto* get_res = std::get_if<GetResponse>(&*res)) {
+    if (download) {
+      return start_value_download(client, download->key,
+                                  std::move(get_res->value));
+    }
+    return get_value_response(client, keys[0], std::move(get_res->value));
+  }
+  return res;
+}
@@ -0,0 +1,39 @@
+#ifndef FORWARDING_HPP
+#define FORWARDING_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "common/config.hpp"
+#include "net/connection_pool.hpp"
+#include "net/network_conn.hpp"
+#include "net/network_messages.hpp"
+
+/*
+ * Passes on a request that client sent to self, a server that isn't
+ * responsible for its keys, to the server that is under router (compiled
+ * from the config with the given version), over a connection from pool,
+ * and tells the client (with the response) that its config is out of date.
+ * This saves a client routing with a stale config the round trips to refuse
+ * the request, refresh the config, and retry it.
+ *
+ * Gets, Puts, Appends, Deletes, LeaseGets and Multi requests whose keys all
+ * belong to the same server go on; a chunked Get goes on as a whole Get, so
+ * its later chunks come from self. Anything else, or a request for keys
+ * self (or no server) owns, or whose server can't be reached, gets nullopt,
+ * to be refused as before.
+ *
+ * Only forward for clients that take config hints, so they don't go on
+ * routing to the wrong server. Forwarded requests don't offer hints, so the
+ * server they reach refuses them rather than forward them again, if the two
+ * disagree on the config.
+ */
+std::optional<Response> forward_request(ConnectionPool* pool,
+                                        const ShardRouter& router,
+                                        uint64_t version,
+                                        const std::string& self,
+                                        const Request& req,
+                                        ClientConn* client);
+
+#endif /* end of include guard */
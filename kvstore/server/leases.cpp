@@ -0,0 +1,40 @@
+#include "leases.hpp"
+
+// How many operations on a stripe between sweeps of its expired entries.
+#define LEASE_SWEEP_INTERVAL 1024
+
+microseconds LeaseTable::grant(const std::string& key) {
+  if (this->duration <= 0us) return 0us;
+
+  Stripe& stripe = this->stripe_for(key);
+  auto now = steady_clock::now();
+  std::unique_lock lock(stripe.mtx);
+  maybe_sweep(stripe, now);
+
+  Entry& entry = stripe.entries[key];
+  if (now < entry.held_until) return 0us;
+  entry.leased_until = std::max(entry.leased_until, now + this->duration);
+  return this->duration;
+}
+
+void LeaseTable::written(const std::string& key) {
+  if (this->duration <= 0us) return;
+
+  Stripe& stripe = this->stripe_for(key);
+  auto now = steady_clock::now();
+  std::unique_lock lock(stripe.mtx);
+  maybe_sweep(stripe, now);
+
+  // Unleased keys are the common case, and need no bookkeeping
+  auto it = stripe.entries.find(key);
+  if (it == stripe.entries.end() || it->second.leased_until <= now) return;
+  it->second.held_until = now + this->duration;
+}
+
+void LeaseTable::maybe_sweep(Stripe& stripe, steady_clock::time_point now) {
+  if (++stripe.ops < LEASE_SWEEP_INTERVAL) return;
+  stripe.ops = 0;
+  std::erase_if(stripe.entries, [now](const auto& pair) {
+    return pair.second.leased_until <= now && pair.second.held_until <= now;
+  });
+}
@@ -0,0 +1,69 @@
+#ifndef LEASES_HPP
+#define LEASES_HPP
+
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std::chrono;
+
+// How long a client may serve a leased value from its cache.
+#define LEASE_DURATION 100ms
+// Number of independently locked parts of a LeaseTable.
+#define LEASE_TABLE_STRIPES 16
+
+/*
+ * Tracks the read leases a server has handed out (see LeaseGetRequest). A
+ * lease lets a client answer Gets for a key from its cache for the lease's
+ * duration, so cached values are never more than that stale.
+ *
+ * Leases can't be called back, so a write to a leased key can't make the
+ * cached copies fresh; instead, the key isn't leased again until the leases
+ * already out have had time to expire. Keys that are written as often as
+ * they're read thus mostly go uncached. Only keys with leases out (or just
+ * written) take up space.
+ */
+class LeaseTable {
+ public:
+  explicit LeaseTable(microseconds duration = LEASE_DURATION)
+      : duration(duration) {
+  }
+
+  // The lease to grant a reader of key, starting now: the table's duration,
+  // or 0 if key was written too recently (or leasing is off).
+  microseconds grant(const std::string& key);
+
+  // Notes that key was (or is about to be) written.
+  void written(const std::string& key);
+
+  LeaseTable(const LeaseTable&) = delete;
+  LeaseTable& operator=(const LeaseTable&) = delete;
+
+ private:
+  struct Entry {
+    // When the last lease granted on the key runs out.
+    steady_clock::time_point leased_until;
+    // No new leases on the key before this.
+    steady_clock::time_point held_until;
+  };
+  struct Stripe {
+    std::mutex mtx;
+    std::unordered_map<std::string, Entry> entries;
+    // Operations since expired entries were last swept out.
+    size_t ops = 0;
+  };
+
+  microseconds duration;
+  std::array<Stripe, LEASE_TABLE_STRIPES> stripes;
+
+  Stripe& stripe_for(const std::string& key) {
+    return this->stripes[std::hash<std::string>{}(key) % this->stripes.size()];
+  }
+  // Drops stripe's entries that no longer hold anything back, every so often.
+  // Requires stripe.mtx.
+  static void maybe_sweep(Stripe& stripe, steady_clock::time_point now);
+};
+
+#endif /* end of include guard */
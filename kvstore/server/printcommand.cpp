@@ -14,8 +14,17 @@ void PrintCommand::handle(const std::string& s) {
   } else if (to_lower(tokens[0]) == "config") {
     auto res = this->server->get_config();
     res.print();
+  } else if (to_lower(tokens[0]) == "stats") {
+    KvServerStats stats = this->server->stats();
+    std::cout << "Requests: " << stats.requests << std::endl
+              << "Dropped past their deadline: " << stats.expired << std::endl
+              << "Migrated to other servers: " << stats.migrated << std::endl
+              << "Forwarded to other servers: " << stats.forwarded
+              << std::endl;
   } else {
-    cerr_color(RED, "Print type must be either \"store\" or \"config\".");
+    cerr_color(RED,
+               "Print type must be one of \"store\", \"config\" or "
+               "\"stats\".");
   }
 }
 
@@ -24,10 +33,10 @@ std::string PrintCommand::name() const {
 }
 
 std::string PrintCommand::params() const {
-  return "<store|config>";
+  return "<store|config|stats>";
 }
 
 std::string PrintCommand::description() const {
-  return "Prints either the internal store contents, or the shardmaster "
-         "configuration.";
+  return "Prints the internal store contents, the shardmaster "
+         "configuration, or request stats.";
 }
@@ -0,0 +1,190 @@
+#include "replication.hpp"
+
+#include "common/color.hpp"
+#include "shard_migration.hpp"
+
+void BackupStream::start() {
+  this->sender = std::thread(&BackupStream::send_loop, this);
+}
+
+void BackupStream::stop() {
+  {
+    std::unique_lock lock(this->mtx);
+    this->stopped = true;
+    // (In case it's waiting on the backup)
+    if (this->conn) this->conn->shutdown();
+    this->cv.notify_all();
+  }
+  if (this->sender.joinable()) this->sender.join();
+}
+
+void BackupStream::written(const std::string& key) {
+  std::unique_lock lock(this->mtx);
+  this->pending.insert(key);
+  this->cv.notify_one();
+}
+
+void BackupStream::send_loop() {
+  // The copy: the keys as of now (writes from here on are passed on)
+  std::vector<std::string> keys;
+  for (auto&& key : this->store->AllKeys()) {
+    if (this->covers(key)) keys.push_back(key);
+  }
+  size_t next = 0;
+  bool reachable = true;
+
+  std::unique_lock lock(this->mtx);
+  while (!this->stopped) {
+    if (this->pending.empty() && next == keys.size()) {
+      this->cv.wait_for(lock, REPLICATION_HEARTBEAT, [this] {
+        return this->stopped || !this->pending.empty();
+      });
+      if (this->stopped) break;
+    }
+
+    ReplicateRequest req{this->primary, {}, {}, {}, false, 0};
+    size_t bytes = 0;
+    // Writes first, so they don't wait behind the rest of the copy
+    while (!this->pending.empty() && bytes < REPLICATION_BATCH_BYTES) {
+      auto key = this->pending.extract(this->pending.begin());
+      bytes += read_pair(this->store, key.value(), &req);
+    }
+    while (next < keys.size() && bytes < REPLICATION_BATCH_BYTES) {
+      bytes += read_pair(this->store, keys[next++], &req);
+    }
+    // If that's everything, the backup will be caught up to now
+    std::optional<steady_clock::time_point> caught_up_at = this->caught_up_at;
+    if (this->pending.empty() && next == keys.size()) {
+      caught_up_at = steady_clock::now();
+    }
+    lock.unlock();
+
+    if (caught_up_at) {
+      req.caught_up = true;
+      req.age_us =
+          duration_cast<microseconds>(steady_clock::now() - *caught_up_at)
+              .count();
+    }
+    bool sent = this->send(req);
+
+    lock.lock();
+    if (sent) {
+      this->caught_up_at = caught_up_at;
+      if (!reachable) cout_color(BLUE, "Reached backup ", this->backup, '.');
+      reachable = true;
+      continue;
+    }
+    if (this->stopped) break;
+    if (reachable) {
+      cerr_color(YELLOW, "Couldn't reach backup ", this->backup,
+                 "; retrying.");
+    }
+    reachable = false;
+    // What didn't make it goes with the next try
+    this->pending.insert(req.keys.begin(), req.keys.end());
+    this->pending.insert(req.deleted.begin(), req.deleted.end());
+    this->conn.reset();
+    this->cv.wait_for(lock, REPLICATION_RETRY,
+                      [this] { return this->stopped; });
+  }
+}
+
+bool BackupStream::send(const ReplicateRequest& req) {
+  // Only this thread sets conn (under the lock, as stop() reads it), so it
+  // can be read here without it
+  if (!this->conn) {
+    std::shared_ptr<ServerConn> conn = connect_to_server(this->backup);
+    if (!conn) return false;
+    std::unique_lock lock(this->mtx);
+    if (this->stopped) return false;
+    this->conn = std::move(conn);
+  }
+  if (!this->conn->send_request(req)) return false;
+  std::optional<Response> res = this->conn->recv_response();
+  return res && std::holds_alternative<ReplicateResponse>(*res);
+}
+
+std::shared_ptr<KvStore> Replicas::store_for(const std::string& primary) {
+  std::unique_lock lock(this->mtx);
+  Copies& copies = this->copies[primary];
+  if (!copies.store) copies.store = this->make_store();
+  return copies.store;
+}
+
+std::shared_ptr<KvStore> Replicas::find(const std::string& primary) {
+  std::unique_lock lock(this->mtx);
+  auto it = this->copies.find(primary);
+  return it == this->copies.end() ? nullptr : it->second.store;
+}
+
+void Replicas::caught_up(const std::string& primary, microseconds age) {
+  auto at = steady_clock::now() - age;
+  std::unique_lock lock(this->mtx);
+  auto it = this->copies.find(primary);
+  if (it == this->copies.end()) return;
+  auto& synced = it->second.synced;
+  synced = synced ? std::max(*synced, at) : at;
+}
+
+std::optional<microseconds> Replicas::staleness(const std::string& primary) {
+  std::unique_lock lock(this->mtx);
+  auto it = this->copies.find(primary);
+  if (it == this->copies.end() || !it->second.synced) return std::nullopt;
+  return duration_cast<microseconds>(steady_clock::now() -
+                                     *it->second.synced);
+}
+
+void Replicas::keep_only(const std::set<std::string>& primaries) {
+  std::vector<std::shared_ptr<KvStore>> dropped;
+  {
+    std::unique_lock lock(this->mtx);
+    for (auto it = this->copies.begin(); it != this->copies.end();) {
+      if (primaries.count(it->first)) {
+        ++it;
+        continue;
+      }
+      cout_color(BLUE, "Dropping copies of ", it->first, "'s keys.");
+      dropped.push_back(std::move(it->second.store));
+      it = this->copies.erase(it);
+    }
+  }
+  // (Freed here, outside the lock, unless a request is still reading them)
+}
+
+Response apply_replication(Replicas* replicas, const ReplicateRequest& req) {
+  if (req.keys.size() != req.values.size()) {
+    return ErrorResponse{"replicated keys and values don't match up"};
+  }
+  // (Copies aren't leased out, so there are no leases to revoke)
+  std::shared_ptr<KvStore> store = replicas->store_for(req.primary);
+  if (!store_pairs(store.get(), nullptr, req)) {
+    return ErrorResponse{"internal KVStore error"};
+  }
+  if (req.caught_up) {
+    replicas->caught_up(req.primary, microseconds(req.age_us));
+  }
+  return ReplicateResponse{};
+}
+
+Response replica_get(KvStore* store, Replicas* replicas,
+                     const std::string* primary,
+                     const ReplicaGetRequest& req) {
+  uint64_t staleness_us = 0;
+  std::shared_ptr<KvStore> copies;
+  if (primary) {
+    std::optional<microseconds> staleness = replicas->staleness(*primary);
+    copies = replicas->find(*primary);
+    if (!staleness || !copies ||
+        uint64_t(staleness->count()) > req.max_staleness_us) {
+      return ErrorResponse{REPLICA_TOO_STALE_ERROR};
+    }
+    staleness_us = staleness->count();
+    store = copies.get();
+  }
+  GetRequest get_req{req.key};
+  GetResponse get_res;
+  if (!store->Get(&get_req, &get_res)) {
+    return ErrorResponse{"key does not exist in the KVStore"};
+  }
+  return ReplicaGetResponse{std::move(get_res.value), staleness_us};
+}
@@ -0,0 +1,143 @@
+#ifndef REPLICATION_HPP
+#define REPLICATION_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kvstore/kvstore.hpp"
+#include "leases.hpp"
+#include "net/network_conn.hpp"
+#include "net/network_messages.hpp"
+
+using namespace std::chrono;
+
+// Bytes of pairs sent per ReplicateRequest.
+#define REPLICATION_BATCH_BYTES (1 << 20)
+// How long a primary goes without sending to a backup before it sends an
+// empty ReplicateRequest anyway, so the backup knows it's still current.
+// Bounded-staleness reads from a backup need bounds longer than this.
+#define REPLICATION_HEARTBEAT 10ms
+// How long a primary waits to try a backup again after failing to reach it.
+#define REPLICATION_RETRY 100ms
+
+/*
+ * Ships a primary's writes to one of its backups (see ServerConfig), on a
+ * thread of its own: first a copy of the keys covers() picks out (the ones
+ * the primary serves), then each key passed to written(), as the store has
+ * it when it's sent. As with ShardMigration, a key written many times
+ * between sends goes once, and the store is only read for the stream under
+ * its lock, so the backup always ends up with the latest value.
+ *
+ * Each request tells the backup how current it is (see ReplicateRequest),
+ * and when there's nothing to send, an empty one goes every
+ * REPLICATION_HEARTBEAT. If the backup can't be reached, the stream keeps
+ * trying, and what it couldn't send goes with the next attempt.
+ */
+class BackupStream {
+ public:
+  BackupStream(KvStore* store, std::string primary, std::string backup,
+               std::function<bool(const std::string&)> covers)
+      : backup(std::move(backup)),
+        store(store),
+        primary(std::move(primary)),
+        covers(std::move(covers)) {
+  }
+  ~BackupStream() {
+    this->stop();
+  }
+
+  const std::string backup;
+
+  // Starts the stream. Writes passed on before then go out with the copy.
+  void start();
+  void stop();
+  // Passes on a write to key, which the caller has just made (and not yet
+  // answered).
+  void written(const std::string& key);
+
+  BackupStream(const BackupStream&) = delete;
+  BackupStream& operator=(const BackupStream&) = delete;
+
+ private:
+  KvStore* store;
+  std::string primary;
+  std::function<bool(const std::string&)> covers;
+  std::shared_ptr<ServerConn> conn;
+  std::thread sender;
+
+  // Guards the store's reads for the stream, and everything below.
+  std::mutex mtx;
+  std::condition_variable cv;
+  // Keys written since they were last sent.
+  std::set<std::string> pending;
+  // When the backup last had every write acknowledged before then, if it
+  // ever has.
+  std::optional<steady_clock::time_point> caught_up_at;
+  bool stopped = false;
+
+  void send_loop();
+  bool send(const ReplicateRequest& req);
+};
+
+/*
+ * A backup's copies of its primaries' keys, kept apart from the keys it
+ * serves itself: a store of them per primary (made with make_store when the
+ * primary's first writes come in), and how current each is, as the time (on
+ * the backup's clock) that it has every write the primary acknowledged up
+ * to. The time a ReplicateRequest spends on the wire isn't counted, so on a
+ * loaded network, the copies may be that much staler than they seem.
+ */
+class Replicas {
+ public:
+  explicit Replicas(std::function<std::unique_ptr<KvStore>()> make_store)
+      : make_store(std::move(make_store)) {
+  }
+
+  // The store of the copies from primary, made (empty) if there isn't one.
+  std::shared_ptr<KvStore> store_for(const std::string& primary);
+  // The store of the copies from primary, or nullptr if there isn't one.
+  // (It stays usable if the copies are dropped meanwhile.)
+  std::shared_ptr<KvStore> find(const std::string& primary);
+  // Notes that the copies from primary are caught up to age ago.
+  void caught_up(const std::string& primary, microseconds age);
+  // How out of date the copies from primary may be, or nullopt if they've
+  // never been caught up.
+  std::optional<microseconds> staleness(const std::string& primary);
+  // Drops the copies from every primary not in primaries (once this server
+  // is no longer their backup).
+  void keep_only(const std::set<std::string>& primaries);
+
+  Replicas(const Replicas&) = delete;
+  Replicas& operator=(const Replicas&) = delete;
+
+ private:
+  struct Copies {
+    std::shared_ptr<KvStore> store;
+    std::optional<steady_clock::time_point> synced;
+  };
+
+  std::function<std::unique_ptr<KvStore>()> make_store;
+  std::mutex mtx;
+  std::map<std::string, Copies> copies;
+};
+
+// Stores the pairs in a ReplicateRequest (see there) in replicas, for a
+// backup of the server that sent it, and notes how current they are.
+Response apply_replication(Replicas* replicas, const ReplicateRequest& req);
+
+// Answers a ReplicaGetRequest: from store as the key's server if primary is
+// nullptr, or else from replicas as a backup of primary, if its copies from
+// primary are current enough.
+Response replica_get(KvStore* store, Replicas* replicas,
+                     const std::string* primary, const ReplicaGetRequest& req);
+
+#endif /* end of include guard */
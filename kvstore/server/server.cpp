@@ -4,19 +4,48 @@ int KvServer::start() {
   this->is_stopped = false;
 
   // Initialize KvStore
-  // TODO (Part A, Step 4): Change your underlying KvStore to the
-  // ConcurrentKvStore!
-  this->store = std::make_unique<SimpleKvStore>();
+  this->store = this->make_store();
+  if (this->options.report_load) {
+    this->store = std::make_unique<KeyCountingKvStore>(
+        std::move(this->store),
+        [this](const std::string& key, int change) {
+          this->count_key(key, change);
+        });
+  }
+  this->leases = std::make_unique<LeaseTable>(this->options.lease_duration);
+  this->replicas =
+      std::make_unique<Replicas>([this] { return this->make_store(); });
 
   // Create listener socket, and start client listener
   this->listener_fd = open_listener_socket(address);
   if (this->listener_fd < 0) {
     return -1;
   }
-  this->client_listener = std::thread(&KvServer::accept_clients_loop, this);
+  this->client_listener = std::thread(&KvServer::accept_clients_loop, this,
+                                      this->listener_fd, false);
   cout_color(BLUE, "Listening on: ", this->address);
 
-  // Initialize worker threads
+  // If requested, also listen for co-located clients
+  if (!this->options.local_address.empty()) {
+    bool shm = is_shm_address(this->options.local_address);
+    this->local_listener_fd = open_listener_socket(
+        shm ? shm_control_address(this->options.local_address)
+            : this->options.local_address);
+    if (this->local_listener_fd < 0) {
+      shutdown(this->listener_fd, SHUT_RDWR);
+      this->client_listener.join();
+      close(this->listener_fd);
+      return -1;
+    }
+    this->local_listener = std::thread(&KvServer::accept_clients_loop, this,
+                                       this->local_listener_fd, shm);
+    cout_color(BLUE, "Listening on: ", this->options.local_address);
+  }
+
+  // Initialize worker threads, and the watcher for their idle connections
+  if (!this->idle_conns.start()) {
+    cerr_color(YELLOW, "Idle connections will hold on to workers.");
+  }
   this->workers.resize(this->n_workers);
   for (auto&& worker : this->workers) {
     worker = std::thread(&KvServer::work_loop, this);
@@ -31,9 +60,19 @@ int KvServer::start() {
       return -1;
     }
 
+    this->installer = std::thread(&KvServer::install_loop, this);
     this->shardmaster_querier =
         std::thread(&KvServer::query_shardmaster_loop, this);
     cout_color(BLUE, "Shardmaster on: ", this->shardmaster_address);
+
+    if (this->options.report_load) {
+      this->load_report_conn = connect_to_server(this->shardmaster_address);
+      if (this->load_report_conn) {
+        this->load_reporter = std::thread(&KvServer::report_load_loop, this);
+      } else {
+        cerr_color(YELLOW, "Couldn't connect to report load; not reporting.");
+      }
+    }
   }
 
   return 0;
@@ -46,8 +85,15 @@ void KvServer::stop() {
   shutdown(this->listener_fd, SHUT_RDWR);
   cout_color(BLUE, "Joining client listener thread...");
   this->client_listener.join();
+  if (this->local_listener_fd >= 0) {
+    shutdown(this->local_listener_fd, SHUT_RDWR);
+    this->local_listener.join();
+    close(this->local_listener_fd);
+  }
 
-  // Stop connection queue, and close & join workers
+  // Close idle connections, then stop connection queue, and close & join
+  // workers
+  for (auto&& client : this->idle_conns.stop()) client->close();
   this->conn_queue.stop();
   for (auto&& client : this->conn_queue.flush()) {
     cout_color(BLUE, "Closing connection from ", client->address);
@@ -55,12 +101,36 @@ void KvServer::stop() {
   }
   for (auto&& thr : this->workers) thr.join();
 
+  // Cut short any migration in progress (its keys stay here)
+  {
+    std::shared_lock lock(this->migrations_mtx);
+    for (auto&& migration : this->migrations) migration->cancel();
+  }
+
   // If shardmaster exists, join shardmaster querier thread, and close
   // shardmaster connection
   if (!this->shardmaster_address.empty()) {
+    // (Shut down first, to cut short a watch in progress)
+    this->shardmaster_conn->shutdown();
     cout_color(BLUE, "Joining query shardmaster thread...");
     this->shardmaster_querier.join();
-    this->shardmaster_conn->shutdown();
+  }
+  if (this->installer.joinable()) {
+    {
+      std::unique_lock lock(this->pending_mtx);
+      this->pending_cv.notify_all();
+    }
+    this->installer.join();
+  }
+  for (auto&& stream : this->backup_streams) stream->stop();
+  if (this->load_reporter.joinable()) {
+    // (Shut down first, in case it's waiting on the shardmaster)
+    this->load_report_conn->shutdown();
+    {
+      std::unique_lock lock(this->reporter_mtx);
+      this->reporter_cv.notify_all();
+    }
+    this->load_reporter.join();
   }
 }
 
@@ -80,17 +150,21 @@ std::map<std::string, std::string> KvServer::all_kvpairs() {
 }
 
 ShardmasterConfig KvServer::get_config() {
-  return this->config;
+  std::shared_lock lock(this->migrations_mtx);
+  return this->current_config().config;
 }
 
-void KvServer::accept_clients_loop() {
+void KvServer::accept_clients_loop(int listener_fd, bool shm) {
   // While the server is not stopped, accept clients from the listener socket,
   // then add them to the work queue.
   while (!this->is_stopped.load()) {
-    std::shared_ptr<ClientConn> client = accept_client(this->listener_fd);
+    std::shared_ptr<ClientConn> client = accept_client(listener_fd);
     if (!client) {
       return;
     }
+    // A worker takes the shm client's segment once it's been sent, so a slow
+    // client doesn't hold up accepting others
+    client->awaiting_shm_segment = shm;
     cout_color(BLUE, "Received client connection from ", client->address,
                " on socket ", client->fd);
 
@@ -110,14 +184,46 @@ void KvServer::work_loop() {
     }
 
     while (true) {
+      // Give the connection back if the client isn't using it (e.g. it's
+      // sitting in a connection pool), rather than blocking a worker on it
+      if (!client->shm && !this->await_request(client)) break;
+      if (client->awaiting_shm_segment) {
+        if (!attach_shm_segment(client.get())) {
+          client->close();
+          break;
+        }
+        continue;
+      }
+
       std::optional<Request> req = client->recv_request();
       if (!req) {
         client->close();
         break;
       }
-      Response res = this->process_request(*req);
-      if (auto* error_res = std::get_if<ErrorResponse>(&res)) {
-        cerr_color(RED, "Request failed: ", error_res->msg);
+      this->n_requests++;
+      Response res;
+      if (client->expired()) {
+        // The client has given up on it (and may have retried it), so doing
+        // it now would only add to the load. (Not logged, as it happens most
+        // when the server is already struggling.)
+        this->n_expired++;
+        res = ErrorResponse{DEADLINE_EXCEEDED_ERROR};
+      } else {
+        {
+          std::shared_lock migration_lock(this->migrations_mtx);
+          res = this->process_request(*req, client.get());
+        }
+        auto* refused = std::get_if<ErrorResponse>(&res);
+        if (refused && is_not_responsible_error(refused->msg) &&
+            this->options.forward_misrouted && client->accepts_config_hints) {
+          if (auto forwarded = this->forward_misrouted(*req, client.get())) {
+            this->n_forwarded++;
+            res = std::move(*forwarded);
+          }
+        }
+        if (auto* error_res = std::get_if<ErrorResponse>(&res)) {
+          cerr_color(RED, "Request failed: ", error_res->msg);
+        }
       }
       if (!client->send_response(res)) {
         client->close();
@@ -127,105 +233,699 @@ void KvServer::work_loop() {
   }
 }
 
+bool KvServer::await_request(std::shared_ptr<ClientConn> client) {
+  while (!wait_readable(client->fd, IDLE_PARK_TIMEOUT)) {
+    if (this->is_stopped) {
+      client->close();
+      return false;
+    }
+    if (this->idle_conns.park(client)) return false;
+  }
+  return true;
+}
+
 bool KvServer::responsible_for(const std::string& key) {
   // For Concurrent Store, no shardmaster exists, so no-op
   if (this->shardmaster_address.empty()) return true;
 
-  // TODO(Part B, Step 2): IMPLEMENT
-
-  return true;
+  const ConfigSnapshot& config = this->current_config();
+  ShardRouter::Route route = config.router.route(key);
+  bool responsible = route.server && *route.server == this->address;
+  if (responsible && config.shard_requests) {
+    this->count_request(config, route.shard);
+  }
+  return responsible || this->migration_for(config, key);
 }
 
 bool KvServer::responsible_for(const std::vector<std::string>& keys) {
   // For Concurrent Store, no shardmaster exists, so no-op
   if (this->shardmaster_address.empty()) return true;
 
-  // TODO(Part B, Step 2): IMPLEMENT
+  const ConfigSnapshot& config = this->current_config();
+  bool responsible = std::all_of(keys.begin(), keys.end(), [&](auto&& key) {
+    const std::string* server = config.router.server_for(key);
+    return (server && *server == this->address) ||
+           this->migration_for(config, key);
+  });
+  if (responsible && config.shard_requests) {
+    for (auto&& key : keys) {
+      ShardRouter::Route route = config.router.route(key);
+      if (route.server && *route.server == this->address) {
+        this->count_request(config, route.shard);
+      }
+    }
+  }
+  return responsible;
+}
+
+ShardMigration* KvServer::migration_for(const ConfigSnapshot& config,
+                                        const std::string& key) {
+  if (this->migrations.empty()) return nullptr;
+  const std::string* server = config.router.server_for(key);
+  if (!server || *server == this->address) return nullptr;
+  for (auto&& migration : this->migrations) {
+    if (migration->dest == *server) {
+      return migration->covers(key) ? migration.get() : nullptr;
+    }
+  }
+  return nullptr;
+}
 
-  return true;
+bool KvServer::arriving(const std::string& key) {
+  for (auto&& migration : this->incoming) {
+    if (migration->arriving() && migration->covers(key)) return true;
+  }
+  return false;
+}
+
+bool KvServer::arriving(const std::vector<std::string>& keys) {
+  if (this->incoming.empty()) return false;
+  return std::any_of(keys.begin(), keys.end(),
+                     [this](auto&& key) { return this->arriving(key); });
+}
+
+bool KvServer::write_locked(const std::string& key) {
+  if (this->transactions.locked(key) || this->arriving(key)) return true;
+  if (this->migrations.empty()) return false;
+  ShardMigration* migration = this->migration_for(this->current_config(), key);
+  return migration && migration->is_sealed();
+}
+
+bool KvServer::write_locked(const std::vector<std::string>& keys) {
+  if (this->transactions.locked(keys) || this->arriving(keys)) return true;
+  if (this->migrations.empty()) return false;
+  const ConfigSnapshot& config = this->current_config();
+  return std::any_of(keys.begin(), keys.end(), [&](auto&& key) {
+    ShardMigration* migration = this->migration_for(config, key);
+    return migration && migration->is_sealed();
+  });
+}
+
+void KvServer::forward_write(const std::string& key) {
+  for (auto&& stream : this->backup_streams) stream->written(key);
+  if (this->migrations.empty()) return;
+  if (ShardMigration* migration =
+          this->migration_for(this->current_config(), key)) {
+    migration->forward(key);
+  }
+}
+
+std::optional<Response> KvServer::forward_misrouted(const Request& req,
+                                                    ClientConn* client) {
+  std::shared_ptr<const ConfigSnapshot> config;
+  {
+    std::shared_lock lock(this->migrations_mtx);
+    config = this->installed;
+  }
+  return forward_request(this->forward_pool.get(), config->router,
+                         config->version, this->address, req, client);
 }
 
 bool KvServer::query_shardmaster() {
-  // TODO(Part B, Step 2): IMPLEMENT
+  if (!this->shardmaster_conn->send_request(QueryRequest{})) return false;
+  std::optional<QueryResponse> res =
+      this->get_query_response(this->shardmaster_conn);
+  if (!res) return false;
+  // (Queried configs come without a version)
+  this->config_version = 0;
+  this->latest_config = std::move(res->config);
+  this->queue_config(this->latest_config, 0);
+  return true;
+}
+
+bool KvServer::watch_shardmaster() {
+  // Until the shardmaster has published a config, there may never be a
+  // change to wait for, so this only checks for one
+  uint64_t timeout_ms =
+      this->config_version > 0 ? milliseconds(WATCH_TIMEOUT).count() : 0;
+  WatchRequest req{this->config_version, timeout_ms};
+  if (!this->shardmaster_conn->send_request(req)) return false;
+  std::optional<Response> res = this->shardmaster_conn->recv_response();
+  if (!res) return false;
+  auto* watch_res = std::get_if<WatchResponse>(&*res);
+  if (!watch_res) {
+    cerr_color(YELLOW, "Shardmaster can't be watched; polling it instead.");
+    this->shardmaster_watches = false;
+    return true;
+  }
+  if (watch_res->version == this->config_version) return true;
 
+  if (watch_res->full) this->latest_config = {};
+  apply_delta(&this->latest_config, watch_res->delta);
+  this->config_version = watch_res->version;
+  this->queue_config(this->latest_config, this->config_version);
   return true;
 }
 
+void KvServer::queue_config(ShardmasterConfig config, uint64_t version) {
+  std::unique_lock lock(this->pending_mtx);
+  this->pending_config.emplace(std::move(config), version);
+  this->pending_cv.notify_one();
+}
+
+void KvServer::install_loop() {
+  while (true) {
+    std::pair<ShardmasterConfig, uint64_t> next;
+    {
+      std::unique_lock lock(this->pending_mtx);
+      this->pending_cv.wait(lock, [this] {
+        return this->pending_config || this->is_stopped;
+      });
+      if (this->is_stopped) return;
+      next = std::move(*this->pending_config);
+      this->pending_config.reset();
+    }
+    // One change at a time: the last one's keys are handed over before any
+    // more move
+    auto moves = this->install_config(std::move(next.first), next.second);
+    if (!moves.empty()) this->migrate(std::move(moves));
+  }
+}
+
+std::vector<std::shared_ptr<ShardMigration>> KvServer::install_config(
+    ShardmasterConfig config, uint64_t version) {
+  // Only this thread publishes configs, so it can read them without the
+  // lock. Polling brings the same one again and again.
+  std::shared_ptr<const ConfigSnapshot> before = this->installed;
+  if (config == before->config && version == before->version) return {};
+
+  // Built up front, so requests aren't held up by it, and published whole
+  auto next = std::make_shared<ConfigSnapshot>();
+  next->router = ShardRouter(config);
+  next->config = std::move(config);
+  next->version = version;
+  for (auto&& sc : next->config.servers) {
+    auto& backups = sc.backups;
+    if (std::find(backups.begin(), backups.end(), this->address) !=
+        backups.end()) {
+      next->primaries.insert(sc.server);
+    }
+  }
+  if (this->options.report_load) {
+    // Request counts so far go unreported; they're for the shards being
+    // replaced
+    size_t first_shard = 0;
+    for (auto&& sc : next->config.servers) {
+      if (sc.server == this->address) {
+        next->own_shards = sc.shards;
+        next->first_shard = first_shard;
+        break;
+      }
+      first_shard += sc.shards.size();
+    }
+    next->shard_requests =
+        std::make_unique<std::atomic<uint64_t>[]>(next->own_shards.size());
+    // Key counts start over from the keys here now, and the store keeps
+    // them up from there (though writes before the switch below count
+    // against the old config)
+    next->shard_keys =
+        std::make_unique<std::atomic<int64_t>[]>(next->own_shards.size());
+    for (auto&& key : this->store->AllKeys()) {
+      ShardRouter::Route route = next->router.route(key);
+      size_t i = route.shard - next->first_shard;
+      if (route.server && *route.server == this->address &&
+          i < next->own_shards.size()) {
+        next->shard_keys[i]++;
+      }
+    }
+  }
+  std::shared_ptr<const ConfigSnapshot> after = next;
+
+  // Keys this server owned under the old config that belong to another
+  // server under the new one go to that server
+  std::vector<std::shared_ptr<ShardMigration>> moves;
+  if (!before->config.servers.empty()) {
+    for (auto&& sc : after->config.servers) {
+      if (sc.server == this->address) continue;
+      auto covers = [before, after, self = this->address,
+                     dest = sc.server](const std::string& key) {
+        const std::string* from = before->router.server_for(key);
+        const std::string* to = after->router.server_for(key);
+        return from && *from == self && to && *to == dest;
+      };
+      moves.push_back(std::make_shared<ShardMigration>(
+          this->store.get(), this->address, sc.server, covers,
+          this->options.migration_rate));
+    }
+  }
+  // and keys other servers owned that belong to this one now come from them
+  std::vector<std::shared_ptr<IncomingMigration>> arrivals;
+  if (!before->config.servers.empty()) {
+    for (auto&& sc : before->config.servers) {
+      if (sc.server == this->address) continue;
+      auto covers = [before, after, self = this->address,
+                     source = sc.server](const std::string& key) {
+        const std::string* from = before->router.server_for(key);
+        const std::string* to = after->router.server_for(key);
+        return from && *from == source && to && *to == self;
+      };
+      arrivals.push_back(
+          std::make_shared<IncomingMigration>(sc.server, covers));
+    }
+  }
+
+  // If this server's shards or backups change, its backups get a fresh copy
+  ServerConfig self_before{this->address, {}}, self_after{this->address, {}};
+  for (auto&& sc : before->config.servers) {
+    if (sc.server == this->address) self_before = sc;
+  }
+  for (auto&& sc : after->config.servers) {
+    if (sc.server == this->address) self_after = sc;
+  }
+  bool restream = self_before.shards != self_after.shards ||
+                  self_before.backups != self_after.backups;
+  std::vector<std::unique_ptr<BackupStream>> streams;
+  if (restream && !self_after.backups.empty()) {
+    auto covers = [after, self = this->address](const std::string& key) {
+      const std::string* server = after->router.server_for(key);
+      return server && *server == self;
+    };
+    for (auto&& backup : self_after.backups) {
+      streams.push_back(std::make_unique<BackupStream>(
+          this->store.get(), this->address, backup, covers));
+    }
+  }
+
+  // No request is in progress while the config and migrations switch over
+  // (keys still arriving for the last one go on arriving)
+  std::unique_lock migrations_lock(this->migrations_mtx);
+  this->migrations = moves;
+  std::erase_if(this->incoming, [](auto&& m) { return !m->arriving(); });
+  this->incoming.insert(this->incoming.end(), arrivals.begin(),
+                        arrivals.end());
+  if (restream) std::swap(this->backup_streams, streams);
+  this->installed = after;
+  migrations_lock.unlock();
+
+  // Copies from servers this one no longer backs up go (no request can be
+  // adding to them now)
+  this->replicas->keep_only(after->primaries);
+
+  if (restream) {
+    // (streams now holds the old ones)
+    for (auto&& stream : streams) stream->stop();
+    for (auto&& stream : this->backup_streams) stream->start();
+  }
+  return moves;
+}
+
+void KvServer::migrate(std::vector<std::shared_ptr<ShardMigration>> moves) {
+  // Sort the keys out once for all of the migrations; from here on, writes
+  // to them are forwarded
+  std::vector<std::vector<std::string>> keys(moves.size());
+  for (auto&& key : this->store->AllKeys()) {
+    for (size_t i = 0; i < moves.size(); i++) {
+      if (moves[i]->covers(key)) {
+        keys[i].push_back(key);
+        break;
+      }
+    }
+  }
+
+  // All at once, so no server's keys wait on another's (they're held off
+  // there until they're in), sharing the rate between those with any
+  size_t sending = std::count_if(keys.begin(), keys.end(),
+                                 [](auto&& k) { return !k.empty(); });
+  std::vector<std::thread> handovers;
+  for (size_t i = 0; i < moves.size(); i++) {
+    if (sending > 1) {
+      moves[i]->set_rate(this->options.migration_rate / sending);
+    }
+    handovers.emplace_back(&KvServer::hand_over, this, moves[i],
+                           std::move(keys[i]));
+  }
+  for (auto&& handover : handovers) handover.join();
+}
+
+void KvServer::hand_over(std::shared_ptr<ShardMigration> migration,
+                         std::vector<std::string> keys) {
+  if (this->is_stopped) migration->cancel();
+  bool handed_over = migration->run(std::move(keys));
+  // Prepared transactions on the keys commit (or expire) here first; new
+  // ones aren't let in while the keys move
+  this->transactions.await_released(
+      [&](const std::string& key) { return migration->covers(key); });
+  {
+    // Hold off writes to the keys for the last of the forwarded ones (no
+    // request is making one once this has the lock)
+    std::unique_lock lock(this->migrations_mtx);
+    migration->seal();
+  }
+  // Other requests go on while they're sent
+  handed_over =
+      handed_over &&
+      migration->finish(system_clock::now() + MIGRATION_HANDOVER_TIMEOUT);
+  {
+    std::unique_lock lock(this->migrations_mtx);
+    std::erase(this->migrations, migration);
+  }
+  if (!handed_over) {
+    if (!this->is_stopped) {
+      cerr_color(RED, "Couldn't migrate keys to ", migration->dest,
+                 "; they're stuck here.");
+    }
+    return;
+  }
+
+  MigrationStats stats = migration->stats();
+  if (stats.keys == 0) return;
+  this->n_migrated += stats.keys;
+  for (auto&& key : this->store->AllKeys()) {
+    if (!migration->covers(key)) continue;
+    DeleteRequest delete_req{key};
+    DeleteResponse delete_res;
+    // (The store counts the key out, under the config)
+    std::shared_lock lock(this->migrations_mtx);
+    this->store->Delete(&delete_req, &delete_res);
+  }
+  cout_color(BLUE, "Migrated ", stats.keys, " keys (", stats.bytes,
+             " bytes) to ", migration->dest, " in ",
+             duration_cast<milliseconds>(stats.elapsed).count(), "ms");
+}
+
+std::unique_ptr<KvStore> KvServer::make_store() {
+  // TODO (Part A, Step 4): Change your underlying KvStore to the
+  // ConcurrentKvStore!
+  std::unique_ptr<KvStore> store = std::make_unique<SimpleKvStore>();
+  if (this->options.compress_values) {
+    store = std::make_unique<CompressedKvStore>(std::move(store));
+  }
+  return store;
+}
+
+void KvServer::count_request(const ConfigSnapshot& config, size_t shard) {
+  // (A server listed twice in config only has its first shards counted)
+  size_t i = shard - config.first_shard;
+  if (i < config.own_shards.size()) {
+    config.shard_requests[i].fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void KvServer::count_key(const std::string& key, int change) {
+  const ConfigSnapshot& config = this->current_config();
+  if (!config.shard_keys) return;
+  ShardRouter::Route route = config.router.route(key);
+  if (!route.server || *route.server != this->address) return;
+  size_t i = route.shard - config.first_shard;
+  if (i < config.own_shards.size()) {
+    config.shard_keys[i].fetch_add(change, std::memory_order_relaxed);
+  }
+}
+
+void KvServer::report_load_loop() {
+  auto last_report = steady_clock::now();
+  std::unique_lock lock(this->reporter_mtx);
+  while (!this->reporter_cv.wait_for(lock, LOAD_REPORT_INTERVAL, [this] {
+    return this->is_stopped.load();
+  })) {
+    auto now = steady_clock::now();
+    double seconds = duration<double>(now - last_report).count();
+    last_report = now;
+
+    ReportLoadRequest req{this->address, {}};
+    {
+      std::shared_lock migrations_lock(this->migrations_mtx);
+      const ConfigSnapshot& config = this->current_config();
+      if (!config.shard_requests) continue;
+      for (size_t i = 0; i < config.own_shards.size(); i++) {
+        uint64_t requests = config.shard_requests[i].exchange(0);
+        int64_t keys = config.shard_keys[i].load(std::memory_order_relaxed);
+        req.shards.push_back({config.own_shards[i], requests / seconds,
+                              uint64_t(std::max<int64_t>(keys, 0))});
+      }
+    }
+
+    if (!this->load_report_conn->send_request(req)) break;
+    std::optional<Response> res = this->load_report_conn->recv_response();
+    if (!res) break;
+    if (!std::holds_alternative<ReportLoadResponse>(*res)) {
+      cerr_color(YELLOW, "Shardmaster doesn't take load reports; stopping.");
+      break;
+    }
+  }
+}
+
 /* ==================================================*/
 /* === INTERNALS: DO NOT MODIFY BELOW THIS LINE ===  */
 /* ==================================================*/
 
-Response KvServer::process_request(Request req) {
-  Response res;
-  if (auto* get_req = std::get_if<GetRequest>(&req)) {
-    bool responsible = this->responsible_for(get_req->key);
-    GetResponse get_res;
-    if (responsible && this->store->Get(get_req, &get_res)) {
-      res = get_res;
-    } else {
-      res = ErrorResponse{
-          !responsible ? std::string("server not responsible for key")
-                       : std::string("key does not exist in the KVStore")};
-    }
-  } else if (auto* put_req = std::get_if<PutRequest>(&req)) {
-    bool responsible = this->responsible_for(put_req->key);
-    PutResponse put_res;
-    if (responsible && this->store->Put(put_req, &put_res)) {
-      res = put_res;
-    } else {
-      // Put should never fail
-      res = ErrorResponse{!responsible
-                              ? std::string("server not responsible for key")
-                              : std::string("internal KVStore error")};
-    }
-  } else if (auto* append_req = std::get_if<AppendRequest>(&req)) {
-    bool responsible = this->responsible_for(append_req->key);
-    AppendResponse append_res;
-    if (responsible && this->store->Append(append_req, &append_res)) {
-      res = append_res;
-    } else {
-      res = ErrorResponse{!responsible
-                              ? std::string("server not responsible for key")
-                              : std::string("internal KVStore error")};
-    }
-  } else if (auto* delete_req = std::get_if<DeleteRequest>(&req)) {
-    bool responsible = this->responsible_for(delete_req->key);
-    DeleteResponse delete_res;
-    if (responsible && this->store->Delete(delete_req, &delete_res)) {
-      res = delete_res;
-    } else {
-      res = ErrorResponse{
-          !responsible ? std::string("server not responsible for key")
-                       : std::string("key does not exist in the KVStore")};
-    }
-  } else if (auto* multiget_req = std::get_if<MultiGetRequest>(&req)) {
-    bool responsible = this->responsible_for(multiget_req->keys);
-    MultiGetResponse multiget_res;
-    if (responsible && this->store->MultiGet(multiget_req, &multiget_res)) {
-      res = multiget_res;
-    } else {
-      res = ErrorResponse{
-          !responsible ? std::string("server not responsible for key(s)")
-                       : std::string("key(s) do not exist in the KVStore")};
-    }
-  } else if (auto* multiput_req = std::get_if<MultiPutRequest>(&req)) {
-    bool responsible = this->responsible_for(multiput_req->keys);
-    MultiPutResponse multiput_res;
-    if (responsible && this->store->MultiPut(multiput_req, &multiput_res)) {
-      res = multiput_res;
-    } else {
-      res = ErrorResponse{!responsible
-                              ? std::string("server not responsible for key(s)")
-                              : std::string("internal KVStore error")};
-    }
-  } else {
-    throw std::logic_error{"invalid variant!"};
-  }
-  return res;
+Response KvServer::process_request(Request req, ClientConn* client) {
+  return std::visit(
+      overloaded{
+          [&](const GetRequest& get_req) -> Response {
+            bool responsible = this->responsible_for(get_req.key);
+            if (responsible && this->arriving(get_req.key)) {
+              return ErrorResponse{KEY_LOCKED_ERROR};
+            }
+            GetResponse get_res;
+            if (responsible && this->store->Get(&get_req, &get_res)) {
+              return get_value_response(client, get_req.key,
+                                        std::move(get_res.value));
+            }
+            return ErrorResponse{
+                !responsible
+                    ? std::string(NOT_RESPONSIBLE_ERROR)
+                    : std::string("key does not exist in the KVStore")};
+          },
+          [&](const PutRequest& put_req) -> Response {
+            bool responsible = this->responsible_for(put_req.key);
+            if (responsible && this->write_locked(put_req.key)) {
+              return ErrorResponse{KEY_LOCKED_ERROR};
+            }
+            PutResponse put_res;
+            if (responsible && this->store->Put(&put_req, &put_res)) {
+              this->leases->written(put_req.key);
+              this->forward_write(put_req.key);
+              return put_res;
+            }
+            // Put should never fail
+            return ErrorResponse{
+                !responsible ? std::string(NOT_RESPONSIBLE_ERROR)
+                             : std::string("internal KVStore error")};
+          },
+          [&](const AppendRequest& append_req) -> Response {
+            bool responsible = this->responsible_for(append_req.key);
+            if (responsible && this->write_locked(append_req.key)) {
+              return ErrorResponse{KEY_LOCKED_ERROR};
+            }
+            AppendResponse append_res;
+            if (responsible &&
+                this->store->Append(&append_req, &append_res)) {
+              this->leases->written(append_req.key);
+              this->forward_write(append_req.key);
+              return append_res;
+            }
+            return ErrorResponse{
+                !responsible ? std::string(NOT_RESPONSIBLE_ERROR)
+                             : std::string("internal KVStore error")};
+          },
+          [&](const DeleteRequest& delete_req) -> Response {
+            bool responsible = this->responsible_for(delete_req.key);
+            if (responsible && this->write_locked(delete_req.key)) {
+              return ErrorResponse{KEY_LOCKED_ERROR};
+            }
+            DeleteResponse delete_res;
+            if (responsible &&
+                this->store->Delete(&delete_req, &delete_res)) {
+              this->leases->written(delete_req.key);
+              this->forward_write(delete_req.key);
+              return delete_res;
+            }
+            return ErrorResponse{
+                !responsible
+                    ? std::string(NOT_RESPONSIBLE_ERROR)
+                    : std::string("key does not exist in the KVStore")};
+          },
+          [&](const MultiGetRequest& multiget_req) -> Response {
+            bool responsible = this->responsible_for(multiget_req.keys);
+            if (responsible && this->arriving(multiget_req.keys)) {
+              return ErrorResponse{KEY_LOCKED_ERROR};
+            }
+            MultiGetResponse multiget_res;
+            if (responsible &&
+                this->store->MultiGet(&multiget_req, &multiget_res)) {
+              return multiget_res;
+            }
+            return ErrorResponse{
+                !responsible
+                    ? std::string(NOT_RESPONSIBLE_ERROR "(s)")
+                    : std::string("key(s) do not exist in the KVStore")};
+          },
+          [&](const MultiPutRequest& multiput_req) -> Response {
+            bool responsible = this->responsible_for(multiput_req.keys);
+            if (responsible && this->write_locked(multiput_req.keys)) {
+              return ErrorResponse{KEY_LOCKED_ERROR};
+            }
+            MultiPutResponse multiput_res;
+            if (responsible &&
+                this->store->MultiPut(&multiput_req, &multiput_res)) {
+              for (auto&& key : multiput_req.keys) {
+                this->leases->written(key);
+                this->forward_write(key);
+              }
+              return multiput_res;
+            }
+            return ErrorResponse{
+                !responsible
+                    ? std::string(NOT_RESPONSIBLE_ERROR "(s)")
+                    : std::string("internal KVStore error")};
+          },
+          [&](const PutChunkRequest& chunk_req) -> Response {
+            if (!this->responsible_for(chunk_req.key)) {
+              return ErrorResponse{NOT_RESPONSIBLE_ERROR};
+            }
+            if (this->write_locked(chunk_req.key)) {
+              return ErrorResponse{KEY_LOCKED_ERROR};
+            }
+            this->leases->written(chunk_req.key);
+            Response res =
+                put_value_chunk(this->store.get(), client, chunk_req);
+            if (std::holds_alternative<PutChunkResponse>(res)) {
+              this->forward_write(chunk_req.key);
+            }
+            return res;
+          },
+          [&](const GetChunkRequest& chunk_req) -> Response {
+            if (!this->responsible_for(chunk_req.key)) {
+              return ErrorResponse{NOT_RESPONSIBLE_ERROR};
+            }
+            if (this->arriving(chunk_req.key)) {
+              return ErrorResponse{KEY_LOCKED_ERROR};
+            }
+            return get_value_chunk(this->store.get(), client, chunk_req);
+          },
+          [&](const LeaseGetRequest& lease_req) -> Response {
+            if (!this->responsible_for(lease_req.key)) {
+              return ErrorResponse{NOT_RESPONSIBLE_ERROR};
+            }
+            if (this->arriving(lease_req.key)) {
+              return ErrorResponse{KEY_LOCKED_ERROR};
+            }
+            // Lease before reading, so that any write the value read misses
+            // sees the lease (and holds off the next one)
+            uint64_t lease_us = this->leases->grant(lease_req.key).count();
+            GetRequest get_req{lease_req.key};
+            GetResponse get_res;
+            if (!this->store->Get(&get_req, &get_res)) {
+              return ErrorResponse{"key does not exist in the KVStore"};
+            }
+            return LeaseGetResponse{std::move(get_res.value), lease_us};
+          },
+          [&](const MigrateRequest& migrate_req) -> Response {
+            // Pairs are only taken from the server they're arriving from
+            auto from_source = [&](auto&& migration) {
+              auto covered = [&](auto&& key) {
+                return migration->covers(key);
+              };
+              return migration->source == migrate_req.source &&
+                     migration->arriving() &&
+                     std::all_of(migrate_req.keys.begin(),
+                                 migrate_req.keys.end(), covered) &&
+                     std::all_of(migrate_req.deleted.begin(),
+                                 migrate_req.deleted.end(), covered);
+            };
+            auto it = std::find_if(this->incoming.begin(),
+                                   this->incoming.end(), from_source);
+            if (it == this->incoming.end()) {
+              return ErrorResponse{MIGRATION_REFUSED_ERROR};
+            }
+            Response res = apply_migration(this->store.get(),
+                                           this->leases.get(), migrate_req);
+            if (std::holds_alternative<MigrateResponse>(res)) {
+              (*it)->received(migrate_req);
+              // Keys moving here are this server's to replicate
+              for (auto&& key : migrate_req.keys) this->forward_write(key);
+              for (auto&& key : migrate_req.deleted) this->forward_write(key);
+            }
+            return res;
+          },
+          [&](const ReplicateRequest& replicate_req) -> Response {
+            // (The primary keeps trying till the configs agree)
+            if (!this->current_config().primaries.count(
+                    replicate_req.primary)) {
+              return ErrorResponse{"not a backup of " +
+                                   replicate_req.primary};
+            }
+            return apply_replication(this->replicas.get(), replicate_req);
+          },
+          [&](const PrepareRequest& prepare_req) -> Response {
+            if (prepare_req.keys.size() != prepare_req.values.size()) {
+              return ErrorResponse{"mismatched keys and values"};
+            }
+            if (!this->responsible_for(prepare_req.keys)) {
+              return ErrorResponse{NOT_RESPONSIBLE_ERROR "(s)"};
+            }
+            // Keys on their way to or from another server can't wait on a
+            // commit (see migrate)
+            const ConfigSnapshot& config = this->current_config();
+            for (auto&& key : prepare_req.keys) {
+              if (this->migration_for(config, key) || this->arriving(key)) {
+                return ErrorResponse{KEY_LOCKED_ERROR};
+              }
+            }
+            if (!this->transactions.prepare(prepare_req.txid, prepare_req.keys,
+                                            prepare_req.values)) {
+              return ErrorResponse{KEY_LOCKED_ERROR};
+            }
+            return PrepareResponse{};
+          },
+          [&](const CommitRequest& commit_req) -> Response {
+            if (!commit_req.commit) {
+              this->transactions.abort(commit_req.txid);
+              return CommitResponse{};
+            }
+            bool committed = this->transactions.commit(
+                commit_req.txid, [&](const MultiPutRequest& multiput_req) {
+                  MultiPutResponse multiput_res;
+                  if (!this->store->MultiPut(&multiput_req, &multiput_res)) {
+                    return false;
+                  }
+                  for (auto&& key : multiput_req.keys) {
+                    this->leases->written(key);
+                    this->forward_write(key);
+                  }
+                  return true;
+                });
+            if (!committed) return ErrorResponse{TXN_UNKNOWN_ERROR};
+            return CommitResponse{};
+          },
+          [&](const ReplicaGetRequest& replica_req) -> Response {
+            // The key's server answers from its store as usual; its backups
+            // answer if their copies are current enough
+            if (this->responsible_for(replica_req.key)) {
+              if (this->arriving(replica_req.key)) {
+                return ErrorResponse{KEY_LOCKED_ERROR};
+              }
+              return replica_get(this->store.get(), this->replicas.get(),
+                                 nullptr, replica_req);
+            }
+            const ConfigSnapshot& config = this->current_config();
+            const std::string* primary =
+                config.router.server_for(replica_req.key);
+            const auto& backups = config.router.backups_for(replica_req.key);
+            if (!primary || std::find(backups.begin(), backups.end(),
+                                      this->address) == backups.end()) {
+              return ErrorResponse{NOT_RESPONSIBLE_ERROR};
+            }
+            return replica_get(this->store.get(), this->replicas.get(),
+                               primary, replica_req);
+          },
+          // Shardmaster requests don't belong here
+          [](const auto&) -> Response {
+            return ErrorResponse{"unsupported request"};
+          },
+      },
+      req);
 }
 
 void KvServer::query_shardmaster_loop() {
   while (!this->is_stopped) {
+    // Watches return as soon as the config changes, once the shardmaster
+    // has published one to watch; until then, it's polled too
+    if (this->shardmaster_watches) {
+      if (!this->watch_shardmaster()) break;
+      if (this->config_version > 0) continue;
+    }
     if (!this->query_shardmaster()) {
       // NOTE: we really should add more logic here, e.g. tolerate a few
       // failures
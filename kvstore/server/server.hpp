@@ -2,38 +2,118 @@
 #define KVSERVER_HPP
 
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <set>
 #include <shared_mutex>
 #include <string>
 #include <thread>
 #include <utility>
 
+#include "common/config.hpp"
+#include "common/utils.hpp"
+#include "kvstore/compressed_kvstore.hpp"
 #include "kvstore/concurrent_kvstore.hpp"
+#include "kvstore/key_counting_kvstore.hpp"
 #include "kvstore/kvstore.hpp"
 #include "kvstore/simple_kvstore.hpp"
+#include "net/connection_pool.hpp"
+#include "net/idle_connections.hpp"
 #include "net/network_conn.hpp"
 #include "net/network_helpers.hpp"
 #include "net/network_messages.hpp"
+#include "forwarding.hpp"
+#include "leases.hpp"
+#include "replication.hpp"
+#include "shard_migration.hpp"
 #include "synchronized_queue.hpp"
+#include "transactions.hpp"
+#include "value_streams.hpp"
 
 #define N_WORKERS 5
 
 using namespace std::chrono;
 
+// Optional KvServer features; everything is off by default.
+struct KvServerOptions {
+  // Store values of at least COMPRESSION_THRESHOLD bytes compressed.
+  bool compress_values = false;
+  // If set, also listen for co-located clients on this address: either
+  // unix:<path> (a Unix domain socket) or shm:<name> (shared-memory rings).
+  std::string local_address;
+  // How long clients may cache values read with LeaseGet requests; 0 grants
+  // no leases.
+  microseconds lease_duration = LEASE_DURATION;
+  // Report each shard's load to the shardmaster every LOAD_REPORT_INTERVAL,
+  // for shardmasters that place shards by it.
+  bool report_load = false;
+  // How fast to stream keys out to their new servers when shards move, in
+  // bytes per second (0 for as fast as possible).
+  uint64_t migration_rate = MIGRATION_RATE;
+  // Pass requests for keys this server isn't responsible for on to the
+  // server that is, for clients that can be told their config is out of date
+  // (see server/forwarding.hpp), rather than refusing them.
+  bool forward_misrouted = false;
+};
+
+/*
+ * A shardmaster config as a KvServer uses it: compiled for routing, along
+ * with this server's part in it. Published whole, and never changed after
+ * (but for the load counts), so the next one is built without holding up
+ * requests (see KvServer::installed).
+ */
+struct ConfigSnapshot {
+  ShardmasterConfig config;
+  // Its version, as far as the shardmaster's watches go (0 if unknown).
+  uint64_t version = 0;
+  // The config, compiled for looking up which server a key belongs to.
+  ShardRouter router;
+  // The servers this one is a backup of in config.
+  std::set<std::string> primaries;
+  // If options.report_load is set: this server's shards in config, which
+  // are the router's shards first_shard on, and how many requests each has
+  // had since the last report and how many keys it has.
+  std::vector<Shard> own_shards;
+  size_t first_shard = 0;
+  std::unique_ptr<std::atomic<uint64_t>[]> shard_requests;
+  std::unique_ptr<std::atomic<int64_t>[]> shard_keys;
+};
+
+// What a KvServer has done since it started.
+struct KvServerStats {
+  uint64_t requests = 0;
+  // Requests dropped, without touching the store, because their deadline had
+  // passed by the time a worker got to them.
+  uint64_t expired = 0;
+  // Keys handed over to other servers as shards moved.
+  uint64_t migrated = 0;
+  // Requests passed on to their keys' servers, if options.forward_misrouted
+  // is set.
+  uint64_t forwarded = 0;
+};
+
 class KvServer {
  public:
-  explicit KvServer(const std::string& address, uint64_t n_workers)
-      : address(address), shardmaster_address(), n_workers(n_workers) {
+  explicit KvServer(const std::string& address, uint64_t n_workers,
+                    const KvServerOptions& options = {})
+      : address(address),
+        shardmaster_address(),
+        n_workers(n_workers),
+        options(options) {
   }
   explicit KvServer(const std::string& address,
-                    const std::string& shardmaster_addr, uint64_t n_workers)
+                    const std::string& shardmaster_addr, uint64_t n_workers,
+                    const KvServerOptions& options = {})
       : address(address),
         shardmaster_address(shardmaster_addr),
-        n_workers(n_workers) {
+        n_workers(n_workers),
+        options(options) {
   }
   ~KvServer() {
     if (!this->is_stopped) {
@@ -53,6 +133,11 @@ class KvServer {
   // For debugging purposes, get the shardmaster config from the server.
   ShardmasterConfig get_config();
 
+  KvServerStats stats() const {
+    return {this->n_requests.load(), this->n_expired.load(),
+            this->n_migrated.load(), this->n_forwarded.load()};
+  }
+
   KvServer(const KvServer&) = delete;
   KvServer& operator=(const KvServer&) = delete;
 
@@ -79,6 +164,11 @@ class KvServer {
   // Thread that listens for client connections and accepts them.
   std::thread client_listener;
 
+  // Listener socket and thread for co-located clients, if
+  // options.local_address is set (otherwise, local_listener_fd is -1).
+  int local_listener_fd = -1;
+  std::thread local_listener;
+
   // Vector of worker threads.
   std::vector<std::thread> workers;
   // Number of worker threads.
@@ -87,25 +177,52 @@ class KvServer {
   // Thread-safe work queue of current client connections.
   synchronized_queue<std::shared_ptr<ClientConn>> conn_queue;
 
+  // Connections waiting for their next request; they rejoin the work queue
+  // once it arrives.
+  IdleConnections idle_conns{[this](std::shared_ptr<ClientConn> client) {
+    this->conn_queue.push(std::move(client));
+  }};
+
   // Internal key-value store.
   std::unique_ptr<KvStore> store;
+  // Read leases handed out on the store's keys.
+  std::unique_ptr<LeaseTable> leases;
+  // Cross-server MultiPuts prepared here, and the keys they hold locked.
+  TransactionTable transactions;
+  // Counters for stats().
+  std::atomic<uint64_t> n_requests = 0;
+  std::atomic<uint64_t> n_expired = 0;
+  std::atomic<uint64_t> n_migrated = 0;
+  std::atomic<uint64_t> n_forwarded = 0;
+
+  // Optional features this server was started with.
+  KvServerOptions options;
 
   /**
    * In a loop, accept client connections, then pass each connection into the
-   * work queue of client connections to process.
+   * work queue of client connections to process. If shm is set, the listener
+   * is a shared-memory control socket (see attach_shm_segment).
    *
    * Exits when the server has been stopped.
    */
-  void accept_clients_loop();
+  void accept_clients_loop(int listener_fd, bool shm);
 
   /**
-   * In a loop, pop a client connection from the work queue and process a
-   * request from it.
+   * In a loop, pop a client connection from the work queue and process
+   * requests from it, until it closes or goes idle (then it's parked in
+   * idle_conns).
    *
    * Exits when the server has been stopped.
    */
   void work_loop();
 
+  /**
+   * Waits for the next request on client, parking the connection if none
+   * comes within IDLE_PARK_TIMEOUT. Returns whether the worker should go on
+   * to read the request.
+   */
+  bool await_request(std::shared_ptr<ClientConn> client);
+
   /* =========================================================================*/
   /* === NOTE: You will need these fields for Part B: Distributed Store! ===  */
   /* =========================================================================*/
@@ -120,40 +237,163 @@ class KvServer {
   // Thread that periodically queries the shardmaster for the current
   // configuration.
   std::thread shardmaster_querier;  // bro this name goofy
-  // Shardmaster configuration.
-  ShardmasterConfig config;
+  /*
+   * Shardmaster configuration. Snapshots never change once published; the
+   * installer builds the next one without any lock, then swaps it in under
+   * the unique migrations_mtx. Requests hold migrations_mtx shared
+   * throughout (see work_loop), as they must for migrations anyway, so the
+   * config takes no lock of its own; but it isn't lock-free, as each
+   * request still takes that shared lock. Once the installer has the
+   * unique lock, no request can still be reading the old snapshot, and
+   * installed lets go of it (whatever else shares it, like migrations,
+   * keeps it). Readers outside of requests hold migrations_mtx shared, too.
+   */
+  std::shared_ptr<const ConfigSnapshot> installed =
+      std::make_shared<const ConfigSnapshot>();
+  // The installed snapshot. Call with migrations_mtx held.
+  const ConfigSnapshot& current_config() const {
+    return *this->installed;
+  }
+  // The latest config the querier has had from the shardmaster (which
+  // watches apply their changes to), its version as far as the watches go,
+  // and whether the shardmaster takes them (if not, the querier polls with
+  // Query instead). Only the querier uses these.
+  ShardmasterConfig latest_config;
+  uint64_t config_version = 0;
+  bool shardmaster_watches = true;
+  // The latest config (and version) from the querier that the installer has
+  // yet to get to; any it skips were out of date by then anyway. Guarded by
+  // pending_mtx.
+  std::optional<std::pair<ShardmasterConfig, uint64_t>> pending_config;
+  std::mutex pending_mtx;
+  std::condition_variable pending_cv;
+  // Switches over to each config the querier has, then runs the migrations
+  // it calls for before moving on to the next, so the querier never waits
+  // on them.
+  std::thread installer;
+
+  // Sends load reports, on a shardmaster connection of its own (the
+  // querier's is mostly tied up in watches). Woken by stop().
+  std::thread load_reporter;
+  std::shared_ptr<ServerConn> load_report_conn;
+  std::mutex reporter_mtx;
+  std::condition_variable reporter_cv;
+
+  // Keys moving to other servers since the last config change, one
+  // migration per server. This server goes on serving them, passing writes
+  // on, until each migration hands its keys over. Requests hold
+  // migrations_mtx shared, so a handover (or a config change; see installed)
+  // never lands in the middle of one.
+  std::vector<std::shared_ptr<ShardMigration>> migrations;
+  std::shared_mutex migrations_mtx;
+  // Keys moving here from other servers, one migration per server per config
+  // change, while any may still be arriving; requests for them are held off
+  // till then. Guarded by migrations_mtx.
+  std::vector<std::shared_ptr<IncomingMigration>> incoming;
 
-  // TODO (Part B, Step 2): Add any fields that you will need to synchronize
-  // access to the ShardmasterConfig!
+  // Ship writes to this server's backups in config, one stream per backup.
+  // Replaced (with a fresh copy) whenever this server's shards or backups
+  // change; guarded by migrations_mtx, like migrations.
+  std::vector<std::unique_ptr<BackupStream>> backup_streams;
+  // This server's copies of other servers' keys, as their backup, apart
+  // from store.
+  std::unique_ptr<Replicas> replicas;
+
+  // Connections to other servers, for requests passed on to them.
+  std::shared_ptr<ConnectionPool> forward_pool =
+      std::make_shared<ConnectionPool>();
 
   /**
-   * Check whether this server is responsible for a key (or list of keys).
+   * Check whether this server is responsible for a key (or list of keys),
+   * including keys still on their way to another server.
    */
   bool responsible_for(const std::string& key);
   bool responsible_for(const std::vector<std::string>& keys);
+  // The migration moving key (under config), or nullptr if it isn't moving.
+  // Call with migrations_mtx held.
+  ShardMigration* migration_for(const ConfigSnapshot& config,
+                                const std::string& key);
+  // Whether key (or any of keys) may still be arriving here from another
+  // server. Call with migrations_mtx held.
+  bool arriving(const std::string& key);
+  bool arriving(const std::vector<std::string>& keys);
+  // Whether writes to key (or any of keys) are held off, by a transaction,
+  // a migration's handover, or the key still arriving; they're refused with
+  // KEY_LOCKED_ERROR, which clients retry (reads of arriving keys are held
+  // off the same way). Call with migrations_mtx held.
+  bool write_locked(const std::string& key);
+  bool write_locked(const std::vector<std::string>& keys);
+  // Passes a write just made to key on to this server's backups, and to its
+  // migration, if it's moving. Call with migrations_mtx held.
+  void forward_write(const std::string& key);
+  // Passes a request this server refused as not responsible on to its keys'
+  // server, if it can (see forward_request). Call without migrations_mtx
+  // held, so config changes aren't held up by it.
+  std::optional<Response> forward_misrouted(const Request& req,
+                                            ClientConn* client);
 
   /**
-   * Query the shardmaster, then update the config with new values and move
+   * Query the shardmaster, then hand the config to the installer, to move
    * outdated pairs to updated servers.
    */
   bool query_shardmaster();
+  /**
+   * Wait for the shardmaster's config to change (or the watch to time out),
+   * then hand the config, with the changes, to the installer; before it's
+   * published any (config_version is 0), just check for one. Returns false
+   * if the shardmaster can't be reached; if it doesn't take watches, clears
+   * shardmaster_watches.
+   */
+  bool watch_shardmaster();
+  // Hands config (with version) to the installer.
+  void queue_config(ShardmasterConfig config, uint64_t version);
+  // The installer's loop: installs each config queued, and migrates pairs
+  // for it, until the server stops.
+  void install_loop();
+  // Switch over to config, returning the migrations of pairs this server no
+  // longer owns (for migrate). Call from the installer.
+  std::vector<std::shared_ptr<ShardMigration>> install_config(
+      ShardmasterConfig config, uint64_t version);
+  // Streams the keys each migration covers to its server, then hands them
+  // over and drops them here.
+  void migrate(std::vector<std::shared_ptr<ShardMigration>> moves);
+  // One of migrate's migrations, from streaming keys (the ones it covers)
+  // out through to dropping them here.
+  void hand_over(std::shared_ptr<ShardMigration> migration,
+                 std::vector<std::string> keys);
+  // Counts a request against shard (as the router numbers them), one of
+  // this server's under config.
+  void count_request(const ConfigSnapshot& config, size_t shard);
+  // An empty store of the kind options call for (for store, which start()
+  // also has count keys if need be, and for replicas).
+  std::unique_ptr<KvStore> make_store();
+  // Counts key as added to (change is 1) or taken out of (-1) the store,
+  // if it's in one of this server's shards. The store calls it on every
+  // write, if options.report_load is set. Call with migrations_mtx held.
+  void count_key(const std::string& key, int change);
+  // Every LOAD_REPORT_INTERVAL, reports each shard's load to the
+  // shardmaster, until the server stops (or the shardmaster turns reports
+  // down).
+  void report_load_loop();
 
   /* ==================================================*/
   /* === INTERNALS: DO NOT MODIFY BELOW THIS LINE ===  */
   /* ==================================================*/
 
   /**
-   * Process an incoming request: parse its request type, call its appropriate
-   * handler (Get, Put, etc.), then get a response.
+   * Process an incoming request from a client: parse its request type, call
+   * its appropriate handler (Get, Put, etc.), then get a response.
    */
-  Response process_request(Request req);
+  Response process_request(Request req, ClientConn* client);
 
   // Extracts a query response from a connection, or an std::nullopt if one
   // doesn't exist. You might need this when implementing query_shardmaster!
   std::optional<QueryResponse> get_query_response(
       std::shared_ptr<ServerConn> conn);
 
-  // Wrapper function that calls query_shardmaster periodically.
+  // Wrapper function that follows the shardmaster's config, watching it (or
+  // calling query_shardmaster periodically, if it can't be watched or hasn't
+  // published a config yet).
   void query_shardmaster_loop();
 };
 
@@ -0,0 +1,155 @@
+#include "shard_migration.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#include "common/color.hpp"
+#include "net/network_helpers.hpp"
+
+void ShardMigration::forward(const std::string& key) {
+  std::unique_lock lock(this->mtx);
+  this->forwarded.insert(key);
+}
+
+bool ShardMigration::run(std::vector<std::string> keys) {
+  {
+    std::unique_lock lock(this->mtx);
+    this->started = steady_clock::now();
+  }
+  this->send_at = steady_clock::now();
+  size_t next = 0;
+  while (!this->cancelled) {
+    MigrateRequest req;
+    {
+      std::unique_lock lock(this->mtx);
+      size_t bytes = 0;
+      // Writes first, so they don't wait behind the rest of the keys
+      while (!this->forwarded.empty() && bytes < MIGRATION_BATCH_BYTES) {
+        auto key = this->forwarded.extract(this->forwarded.begin());
+        bytes += read_pair(this->store, key.value(), &req);
+      }
+      while (next < keys.size() && bytes < MIGRATION_BATCH_BYTES) {
+        bytes += read_pair(this->store, keys[next++], &req);
+      }
+      if (bytes == 0) return true;
+    }
+    if (!this->send(std::move(req), true)) return false;
+  }
+  return false;
+}
+
+bool ShardMigration::finish(system_clock::time_point deadline) {
+  bool done = false;
+  while (!done) {
+    MigrateRequest req;
+    {
+      std::unique_lock lock(this->mtx);
+      size_t bytes = 0;
+      while (!this->forwarded.empty() && bytes < MIGRATION_BATCH_BYTES) {
+        auto key = this->forwarded.extract(this->forwarded.begin());
+        bytes += read_pair(this->store, key.value(), &req);
+      }
+      // (Sealed, there are no more to come)
+      done = req.done = this->forwarded.empty();
+    }
+    if (!this->send(std::move(req), false, deadline)) return false;
+  }
+  return true;
+}
+
+void ShardMigration::cancel() {
+  this->cancelled = true;
+}
+
+MigrationStats ShardMigration::stats() {
+  std::unique_lock lock(this->mtx);
+  return this->sent;
+}
+
+bool ShardMigration::send(MigrateRequest req, bool paced,
+                          std::optional<system_clock::time_point> deadline) {
+  if (!this->conn) {
+    this->conn = connect_to_server(this->dest);
+    if (!this->conn) {
+      cerr_color(RED, "Couldn't connect to ", this->dest, " to migrate keys.");
+      return false;
+    }
+  }
+  uint64_t keys = req.keys.size() + req.deleted.size(), bytes = 0;
+  for (auto&& key : req.keys) bytes += key.size();
+  for (auto&& value : req.values) bytes += value.size();
+  for (auto&& key : req.deleted) bytes += key.size();
+
+  paced = paced && this->rate > 0;
+  if (paced) {
+    // In slices, so a slow migration is quick to cancel
+    while (!this->cancelled && steady_clock::now() < this->send_at) {
+      std::this_thread::sleep_until(
+          std::min(this->send_at, steady_clock::now() + 50ms));
+    }
+  }
+  req.source = this->self;
+  auto now = steady_clock::now();
+  auto give_up = now + MIGRATION_IDLE_TIMEOUT;
+  std::optional<Response> res;
+  while (true) {
+    if (this->cancelled || !this->conn->send_request(req, deadline)) {
+      return false;
+    }
+    if (deadline && !this->conn->shm) {
+      auto left = ceil<milliseconds>(*deadline - system_clock::now());
+      if (!wait_readable(this->conn->fd, std::max(left, 0ms))) return false;
+    }
+    res = this->conn->recv_response();
+    // Refused if dest hasn't caught up with the config yet
+    auto* error_res = res ? std::get_if<ErrorResponse>(&*res) : nullptr;
+    if (!error_res || error_res->msg != MIGRATION_REFUSED_ERROR ||
+        steady_clock::now() >= give_up ||
+        (deadline && system_clock::now() >= *deadline)) {
+      break;
+    }
+    std::this_thread::sleep_for(50ms);
+  }
+  if (!res || !std::holds_alternative<MigrateResponse>(*res)) return false;
+  if (paced) {
+    this->send_at = std::max(this->send_at, now) +
+                    duration_cast<nanoseconds>(
+                        duration<double>(double(bytes) / this->rate));
+  }
+
+  std::unique_lock lock(this->mtx);
+  this->sent.keys += keys;
+  this->sent.bytes += bytes;
+  this->sent.elapsed = steady_clock::now() - this->started;
+  return true;
+}
+
+bool IncomingMigration::arriving() {
+  if (this->closed) return false;
+  if (steady_clock::now().time_since_epoch().count() < this->give_up_at) {
+    return true;
+  }
+  if (!this->closed.exchange(true)) {
+    cerr_color(YELLOW, "Gave up waiting on keys from ", this->source, '.');
+  }
+  return false;
+}
+
+void IncomingMigration::received(const MigrateRequest& req) {
+  if (req.done) {
+    this->closed = true;
+  } else {
+    this->give_up_at = idle_deadline();
+  }
+}
+
+Response apply_migration(KvStore* store, LeaseTable* leases,
+                         const MigrateRequest& req) {
+  if (req.keys.size() != req.values.size()) {
+    return ErrorResponse{"migrated keys and values don't match up"};
+  }
+  if (!store_pairs(store, leases, req)) {
+    return ErrorResponse{"internal KVStore error"};
+  }
+  return MigrateResponse{};
+}
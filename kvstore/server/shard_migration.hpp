@@ -0,0 +1,227 @@
+#ifndef SHARD_MIGRATION_HPP
+#define SHARD_MIGRATION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "kvstore/kvstore.hpp"
+#include "leases.hpp"
+#include "net/network_conn.hpp"
+#include "net/network_messages.hpp"
+
+using namespace std::chrono;
+
+// Bytes of pairs sent per MigrateRequest.
+#define MIGRATION_BATCH_BYTES (1 << 20)
+// How fast KvServers stream pairs out by default, in bytes per second (0 for
+// as fast as they can), so a migration doesn't crowd out client requests.
+#define MIGRATION_RATE (32ull << 20)
+// The longest a handover holds off writes to the keys for (clients retry
+// them meanwhile, for up to TXN_TIMEOUT); past it, the keys stay put.
+#define MIGRATION_HANDOVER_TIMEOUT 1s
+// How long a server waits on keys moving to it from another that's gone
+// quiet before giving up on them (see IncomingMigration), and how long a
+// server sending keys retries ones refused with MIGRATION_REFUSED_ERROR.
+#define MIGRATION_IDLE_TIMEOUT 10s
+// What a KvServer answers to a MigrateRequest for keys it doesn't have
+// arriving from the request's source. The source may be ahead of it on the
+// config, so it tries again for a while.
+#define MIGRATION_REFUSED_ERROR "not expecting those keys from that server"
+
+// What a migration has sent so far.
+struct MigrationStats {
+  uint64_t keys = 0;
+  uint64_t bytes = 0;
+  nanoseconds elapsed{0};
+};
+
+/*
+ * Hands the keys covers() picks out over from the KvServer at self to the
+ * one at dest, after a config change gives dest their shards. Self keeps
+ * serving the keys until the handover: run() streams them from the store in
+ * batches of MIGRATION_BATCH_BYTES, paced to rate bytes per second, while
+ * writes to them are passed on with forward(). Then the server seals it,
+ * refusing writes to the keys from then on, finish() sends the last of the
+ * forwarded writes, and dest has everything (and is told so; see
+ * IncomingMigration).
+ *
+ * A forwarded key is sent as the store has it when it's sent, not as it was
+ * written, and the store is only read for the migration under its lock, so
+ * dest always ends up with the latest value (and a key written many times
+ * in a row is only sent once).
+ */
+class ShardMigration {
+ public:
+  ShardMigration(KvStore* store, std::string self, std::string dest,
+                 std::function<bool(const std::string&)> covers,
+                 uint64_t rate = MIGRATION_RATE)
+      : dest(std::move(dest)),
+        store(store),
+        self(std::move(self)),
+        covers_key(std::move(covers)),
+        rate(rate) {
+  }
+
+  const std::string dest;
+
+  // Whether key is one of the keys being moved.
+  bool covers(const std::string& key) const {
+    return this->covers_key(key);
+  }
+  // Passes on a write to key, which the caller has just made (and not yet
+  // answered).
+  void forward(const std::string& key);
+
+  /*
+   * Sends keys (the store's keys that this migration covers, as of when it
+   * started taking forwarded writes), and the forwarded writes that come in
+   * meanwhile, until there's nothing left to send or cancel() is called.
+   * Returns false if dest couldn't be reached, or the migration was
+   * cancelled. rate may be changed before it starts.
+   */
+  bool run(std::vector<std::string> keys);
+  void set_rate(uint64_t rate) {
+    this->rate = rate;
+  }
+  // Marks the keys' writes as held off for the handover, which the server
+  // checks for before making one.
+  void seal() {
+    this->sealed = true;
+  }
+  bool is_sealed() const {
+    return this->sealed;
+  }
+  /*
+   * Sends whatever forwarded writes are left, unpaced, and tells dest that
+   * was the last of them. Call once sealed, after run(); dest then has every
+   * key. Returns false if dest doesn't take them all by deadline.
+   */
+  bool finish(system_clock::time_point deadline);
+  void cancel();
+
+  MigrationStats stats();
+
+  ShardMigration(const ShardMigration&) = delete;
+  ShardMigration& operator=(const ShardMigration&) = delete;
+
+ private:
+  KvStore* store;
+  std::string self;
+  std::function<bool(const std::string&)> covers_key;
+  uint64_t rate;
+  std::shared_ptr<ServerConn> conn;
+  std::atomic<bool> cancelled = false;
+  std::atomic<bool> sealed = false;
+  // When the next batch may go, to keep to rate.
+  steady_clock::time_point send_at;
+
+  // Guards the store's reads for the migration, and everything below.
+  std::mutex mtx;
+  // Keys written since they were last sent.
+  std::set<std::string> forwarded;
+  MigrationStats sent;
+  steady_clock::time_point started;
+
+  bool send(MigrateRequest req, bool paced,
+            std::optional<system_clock::time_point> deadline = std::nullopt);
+};
+
+/*
+ * Keys moving to this server from the one at source (those covers() picks
+ * out), from this end. They're arriving until source says it's handed them
+ * all over, or goes MIGRATION_IDLE_TIMEOUT without sending any (it may be
+ * down, or see the config differently). Until then, the server holds off
+ * requests for them, so none is answered before it's here (or written here,
+ * only to be overwritten by the pair on its way), and takes pairs for them
+ * only from source.
+ */
+class IncomingMigration {
+ public:
+  IncomingMigration(std::string source,
+                    std::function<bool(const std::string&)> covers)
+      : source(std::move(source)),
+        covers_key(std::move(covers)),
+        give_up_at(idle_deadline()) {
+  }
+
+  const std::string source;
+
+  // Whether key is one of the keys moving here.
+  bool covers(const std::string& key) const {
+    return this->covers_key(key);
+  }
+  // Whether more of the keys may still arrive.
+  bool arriving();
+  // Notes that req, from source, has been stored.
+  void received(const MigrateRequest& req);
+
+  IncomingMigration(const IncomingMigration&) = delete;
+  IncomingMigration& operator=(const IncomingMigration&) = delete;
+
+ private:
+  std::function<bool(const std::string&)> covers_key;
+  std::atomic<bool> closed = false;
+  // When to give up on source (as steady_clock ticks); put off by each
+  // request from it.
+  std::atomic<steady_clock::rep> give_up_at;
+
+  static steady_clock::rep idle_deadline() {
+    return (steady_clock::now() + MIGRATION_IDLE_TIMEOUT)
+        .time_since_epoch()
+        .count();
+  }
+};
+
+// Reads key from store into req's pairs (or its deleted keys, if it's gone),
+// returning the bytes it adds. For requests that carry pairs between servers
+// (MigrateRequest, ReplicateRequest).
+template <typename PairsRequest>
+size_t read_pair(KvStore* store, const std::string& key, PairsRequest* req) {
+  GetRequest get_req{key};
+  GetResponse get_res;
+  if (!store->Get(&get_req, &get_res)) {
+    req->deleted.push_back(key);
+    return key.size();
+  }
+  req->keys.push_back(key);
+  req->values.push_back(std::move(get_res.value));
+  return key.size() + req->values.back().size();
+}
+
+// Stores the pairs read_pair read into req, then deletes its deleted keys,
+// revoking their leases in leases (if given). Returns false if the store
+// fails.
+template <typename PairsRequest>
+bool store_pairs(KvStore* store, LeaseTable* leases, const PairsRequest& req) {
+  if (leases) {
+    for (auto&& key : req.keys) leases->written(key);
+    for (auto&& key : req.deleted) leases->written(key);
+  }
+  if (!req.keys.empty()) {
+    MultiPutRequest put_req{req.keys, req.values};
+    MultiPutResponse put_res;
+    if (!store->MultiPut(&put_req, &put_res)) return false;
+  }
+  for (auto&& key : req.deleted) {
+    // (It may never have made it here)
+    DeleteRequest delete_req{key};
+    DeleteResponse delete_res;
+    store->Delete(&delete_req, &delete_res);
+  }
+  return true;
+}
+
+// Stores the pairs in a MigrateRequest (see there), for a server they're
+// being handed to.
+Response apply_migration(KvStore* store, LeaseTable* leases,
+                         const MigrateRequest& req);
+
+#endif /* end of include guard */
@@ -0,0 +1,117 @@
+#include "transactions.hpp"
+
+// How often await_released checks for transactions that have expired.
+#define TXN_EXPIRY_CHECK 10ms
+
+bool TransactionTable::prepare(uint64_t txid,
+                               const std::vector<std::string>& keys,
+                               const std::vector<std::string>& values) {
+  auto now = steady_clock::now();
+  std::unique_lock lock(this->mtx);
+  while (!this->committed_order.empty() &&
+         this->committed_order.front().first <= now) {
+    this->committed.erase(this->committed_order.front().second);
+    this->committed_order.pop_front();
+  }
+  if (this->prepared.contains(txid)) return false;
+  for (auto&& key : keys) {
+    if (this->held(key, now)) return false;
+  }
+
+  // (A key repeated in the pairs is locked once)
+  for (auto&& key : keys) {
+    if (this->locks.try_emplace(key, txid).second) this->n_locked++;
+  }
+  this->prepared[txid] = {{keys, values}, now + this->timeout};
+  return true;
+}
+
+bool TransactionTable::commit(
+    uint64_t txid, const std::function<bool(const MultiPutRequest&)>& write) {
+  MultiPutRequest pairs;
+  {
+    std::unique_lock lock(this->mtx);
+    if (this->committed.contains(txid)) return true;
+    auto it = this->prepared.find(txid);
+    if (it == this->prepared.end() || it->second.committing) return false;
+    it->second.committing = true;
+    pairs = std::move(it->second.pairs);
+  }
+
+  // Written outside the lock (the keys stay locked, so nothing else can
+  // write them meanwhile)
+  bool written = write(pairs);
+  std::unique_lock lock(this->mtx);
+  // (Locks are released by key, and the pairs have been moved out)
+  this->prepared[txid].pairs.keys = std::move(pairs.keys);
+  this->release(txid);
+  if (written) {
+    this->committed.insert(txid);
+    this->committed_order.emplace_back(steady_clock::now() + this->timeout,
+                                       txid);
+  }
+  return written;
+}
+
+void TransactionTable::abort(uint64_t txid) {
+  std::unique_lock lock(this->mtx);
+  auto it = this->prepared.find(txid);
+  if (it == this->prepared.end() || it->second.committing) return;
+  this->release(txid);
+}
+
+bool TransactionTable::locked(const std::string& key) {
+  if (this->n_locked == 0) return false;
+  std::unique_lock lock(this->mtx);
+  return this->held(key, steady_clock::now());
+}
+
+bool TransactionTable::locked(const std::vector<std::string>& keys) {
+  if (this->n_locked == 0) return false;
+  auto now = steady_clock::now();
+  std::unique_lock lock(this->mtx);
+  for (auto&& key : keys) {
+    if (this->held(key, now)) return true;
+  }
+  return false;
+}
+
+void TransactionTable::await_released(
+    const std::function<bool(const std::string&)>& covers) {
+  std::unique_lock lock(this->mtx);
+  while (true) {
+    auto now = steady_clock::now();
+    bool any = false;
+    // (Copied, as held() may give up on transactions, unlocking their keys)
+    std::vector<std::string> keys;
+    for (auto&& [key, txid] : this->locks) keys.push_back(key);
+    for (auto&& key : keys) {
+      if (covers(key) && this->held(key, now)) any = true;
+    }
+    if (!any) return;
+    this->released.wait_for(lock, TXN_EXPIRY_CHECK);
+  }
+}
+
+bool TransactionTable::held(const std::string& key,
+                            steady_clock::time_point now) {
+  auto it = this->locks.find(key);
+  if (it == this->locks.end()) return false;
+  Prepared& txn = this->prepared.at(it->second);
+  if (txn.committing || now < txn.expires) return true;
+  this->release(it->second);
+  return false;
+}
+
+void TransactionTable::release(uint64_t txid) {
+  auto it = this->prepared.find(txid);
+  for (auto&& key : it->second.pairs.keys) {
+    auto lock_it = this->locks.find(key);
+    if (lock_it != this->locks.end() && lock_it->second == txid) {
+      this->locks.erase(lock_it);
+      this->n_locked--;
+    }
+  }
+  this->prepared.erase(it);
+  this->released.notify_all();
+}
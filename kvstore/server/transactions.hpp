@@ -0,0 +1,96 @@
+#ifndef TRANSACTIONS_HPP
+#define TRANSACTIONS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "net/network_messages.hpp"
+
+using namespace std::chrono;
+
+/*
+ * The transactions a server has prepared for cross-server MultiPuts (see
+ * PrepareRequest), and the keys they hold locked. The client is the
+ * coordinator: it prepares the pairs on every server involved, and commits
+ * them only once they all have, or else aborts them, so the MultiPut takes
+ * effect everywhere or nowhere.
+ *
+ * Locks are taken without waiting: a prepare that runs into another
+ * transaction's lock fails (the client backs off and tries again), so
+ * transactions can't deadlock. Reads don't take locks, and see each server's
+ * pairs as it commits them.
+ *
+ * Nothing is written to disk, so a transaction whose commit doesn't come
+ * within timeout (its client is gone, say) is given up on, and its keys
+ * unlocked. A client stalled that long between its commits could leave a
+ * MultiPut half done.
+ */
+class TransactionTable {
+ public:
+  explicit TransactionTable(microseconds timeout = TXN_TIMEOUT)
+      : timeout(timeout) {
+  }
+
+  // Locks keys for txid, holding on to its pairs. Returns false, locking
+  // nothing, if any of them is locked already.
+  bool prepare(uint64_t txid, const std::vector<std::string>& keys,
+               const std::vector<std::string>& values);
+  /*
+   * Stores txid's pairs with write, then unlocks its keys. Returns false if
+   * txid isn't prepared (it never was, or it's been given up on or aborted)
+   * or write fails; true if txid was just committed.
+   */
+  bool commit(uint64_t txid,
+              const std::function<bool(const MultiPutRequest&)>& write);
+  // Drops txid's pairs, if it's prepared, and unlocks its keys.
+  void abort(uint64_t txid);
+
+  // Whether a transaction holds any of keys locked. Cheap while none are.
+  bool locked(const std::string& key);
+  bool locked(const std::vector<std::string>& keys);
+  // Waits until no transaction holds a key covers() picks out.
+  void await_released(const std::function<bool(const std::string&)>& covers);
+
+  TransactionTable(const TransactionTable&) = delete;
+  TransactionTable& operator=(const TransactionTable&) = delete;
+
+ private:
+  struct Prepared {
+    MultiPutRequest pairs;
+    steady_clock::time_point expires;
+    // Whether its commit is writing its pairs (it's no longer given up on).
+    bool committing = false;
+  };
+
+  microseconds timeout;
+  // Guards everything below.
+  std::mutex mtx;
+  std::condition_variable released;
+  std::unordered_map<uint64_t, Prepared> prepared;
+  // Which transaction holds each locked key.
+  std::unordered_map<std::string, uint64_t> locks;
+  // Lets writes skip the lock while no keys are locked.
+  std::atomic<size_t> n_locked = 0;
+  // Transactions committed within timeout, oldest first, so a repeated
+  // commit can be told it's done.
+  std::unordered_set<uint64_t> committed;
+  std::deque<std::pair<steady_clock::time_point, uint64_t>> committed_order;
+
+  // Whether key is locked, giving up on its holder if it's expired.
+  // Requires mtx.
+  bool held(const std::string& key, steady_clock::time_point now);
+  // Unlocks txid's keys and forgets it. Requires mtx.
+  void release(uint64_t txid);
+};
+
+#endif /* end of include guard */
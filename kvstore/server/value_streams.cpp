@@ -0,0 +1,86 @@
+#include "value_streams.hpp"
+
+Response put_value_chunk(KvStore* store, ClientConn* client,
+                         const PutChunkRequest& req) {
+  if (req.total_size > MAX_STREAMED_VALUE_SIZE) {
+    return ErrorResponse{"streamed value too large"};
+  }
+  // A chunk at offset 0 starts a new upload, dropping any unfinished one. The
+  // buffer grows as chunks arrive, rather than up front to whatever size the
+  // client claims, so holding it costs no more than the client has sent.
+  if (req.offset == 0) {
+    client->upload_key = req.key;
+    std::string().swap(client->upload_value);
+    client->upload_size = req.total_size;
+  } else if (req.key != client->upload_key ||
+             req.offset != client->upload_value.size() ||
+             req.total_size != client->upload_size) {
+    return ErrorResponse{"out-of-order value chunk"};
+  }
+  if (req.offset + req.data.size() > req.total_size) {
+    return ErrorResponse{"value chunk past the end of the value"};
+  }
+  client->upload_value += req.data;
+  if (client->upload_value.size() < req.total_size) return PutChunkResponse{};
+
+  // Hand the assembled value to the store without another copy, then release
+  // it, so an idle connection doesn't hold on to it.
+  PutRequest put_req{std::move(client->upload_key),
+                     std::move(client->upload_value)};
+  client->upload_key.clear();
+  std::string().swap(client->upload_value);
+  client->upload_size = 0;
+  PutResponse put_res;
+  if (!store->Put(&put_req, &put_res)) {
+    return ErrorResponse{"internal KVStore error"};
+  }
+  return PutChunkResponse{};
+}
+
+namespace {
+
+// The chunk at offset of the value being downloaded over client.
+GetChunkResponse download_chunk(ClientConn* client, uint64_t offset) {
+  const std::string& value = client->download_value;
+  GetChunkResponse res{value.substr(offset, STREAM_CHUNK_SIZE), value.size()};
+  if (offset + res.data.size() == value.size()) {
+    client->download_key.clear();
+    std::string().swap(client->download_value);
+  }
+  return res;
+}
+
+}  // namespace
+
+Response get_value_chunk(KvStore* store, ClientConn* client,
+                         const GetChunkRequest& req) {
+  // Snapshot the value at the start of a download, so all of its chunks come
+  // from the same version of it
+  if (req.offset == 0) {
+    GetRequest get_req{req.key};
+    GetResponse get_res;
+    if (!store->Get(&get_req, &get_res)) {
+      return ErrorResponse{"key does not exist in the KVStore"};
+    }
+    return start_value_download(client, req.key, std::move(get_res.value));
+  } else if (req.key != client->download_key ||
+             req.offset > client->download_value.size()) {
+    return ErrorResponse{"out-of-order value chunk"};
+  }
+  return download_chunk(client, req.offset);
+}
+
+Response get_value_response(ClientConn* client, const std::string& key,
+                            std::string value) {
+  if (value.size() > STREAM_CHUNK_SIZE && client->accepts_value_streams) {
+    return start_value_download(client, key, std::move(value));
+  }
+  return GetResponse{std::move(value)};
+}
+
+Response start_value_download(ClientConn* client, const std::string& key,
+                              std::string value) {
+  client->download_key = key;
+  client->download_value = std::move(value);
+  return download_chunk(client, 0);
+}
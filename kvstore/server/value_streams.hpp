@@ -0,0 +1,34 @@
+#ifndef VALUE_STREAMS_HPP
+#define VALUE_STREAMS_HPP
+
+#include "kvstore/kvstore.hpp"
+#include "net/network_conn.hpp"
+#include "net/network_messages.hpp"
+
+// Largest value a client may stream in with PutChunk requests. A connection
+// buffers at most one upload at a time, and only as much of it as has
+// arrived, so this also caps what one connection's upload can hold.
+#define MAX_STREAMED_VALUE_SIZE (1ull << 30)
+
+/*
+ * Handlers for values streamed in or out in chunks over a client connection
+ * (see PutChunkRequest and GetChunkRequest). The state of each stream lives in
+ * the ClientConn, so a connection holds at most one value in each direction,
+ * and only while it's being streamed; the store sees a single Put or Get per
+ * value.
+ */
+Response put_value_chunk(KvStore* store, ClientConn* client,
+                         const PutChunkRequest& req);
+Response get_value_chunk(KvStore* store, ClientConn* client,
+                         const GetChunkRequest& req);
+// Answers a Get of key with value: whole, or, if it's larger than
+// STREAM_CHUNK_SIZE and the client takes streamed values (see
+// FLAG_ACCEPTS_VALUE_STREAMS), as the first chunk of a download.
+Response get_value_response(ClientConn* client, const std::string& key,
+                            std::string value);
+// Answers the first GetChunkRequest for key with value, read from elsewhere
+// (e.g. the key's server), which the rest of the download then comes from.
+Response start_value_download(ClientConn* client, const std::string& key,
+                              std::string value);
+
+#endif /* end of include guard */
@@ -0,0 +1,56 @@
+#include "config_history.hpp"
+
+uint64_t ConfigHistory::publish(ShardmasterConfig config) {
+  std::unique_lock lock(this->mtx);
+  auto& [version, current] = this->configs.back();
+  ConfigDelta delta = diff_configs(current, config);
+  if (delta.changed.empty() && delta.removed.empty()) return version;
+
+  this->configs.emplace_back(version + 1, std::move(config));
+  if (this->configs.size() > CONFIG_HISTORY_LENGTH) this->configs.pop_front();
+  this->cv.notify_all();
+  return this->configs.back().first;
+}
+
+uint64_t ConfigHistory::version() {
+  std::unique_lock lock(this->mtx);
+  return this->configs.back().first;
+}
+
+ShardmasterConfig ConfigHistory::current() {
+  std::unique_lock lock(this->mtx);
+  return this->configs.back().second;
+}
+
+bool ConfigHistory::watch(uint64_t since, milliseconds timeout,
+                          WatchResponse* res) {
+  std::unique_lock lock(this->mtx);
+  this->cv.wait_for(lock, std::min<milliseconds>(timeout, WATCH_MAX_TIMEOUT),
+                    [&] {
+                      return this->closed ||
+                             this->configs.back().first != since;
+                    });
+  if (this->closed) return false;
+
+  auto& [version, current] = this->configs.back();
+  res->version = version;
+  res->full = false;
+  res->delta = {};
+  if (version == since) return true;
+
+  for (auto&& [past_version, past] : this->configs) {
+    if (past_version == since) {
+      res->delta = diff_configs(past, current);
+      return true;
+    }
+  }
+  res->full = true;
+  res->delta.changed = current.servers;
+  return true;
+}
+
+void ConfigHistory::close() {
+  std::unique_lock lock(this->mtx);
+  this->closed = true;
+  this->cv.notify_all();
+}
@@ -0,0 +1,66 @@
+#ifndef CONFIG_HISTORY_HPP
+#define CONFIG_HISTORY_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include "common/config.hpp"
+#include "net/shardmaster_commands.hpp"
+
+using namespace std::chrono;
+
+// How many past configs are kept to compute deltas from; watchers further
+// behind than that get the whole config.
+#define CONFIG_HISTORY_LENGTH 64
+// The longest a Watch is held open, whatever the watcher asked for.
+#define WATCH_MAX_TIMEOUT 60s
+
+/*
+ * A shardmaster's config, numbered: each change published gets the next
+ * version (the empty config it starts with is version 0). Watchers wait for
+ * the version to move past the last one they saw, and get back only what
+ * changed since then, so an idle watcher costs one request per timeout
+ * rather than a full config per poll, and hears of changes as they happen.
+ */
+class ConfigHistory {
+ public:
+  ConfigHistory() {
+    this->configs.emplace_back(0, ShardmasterConfig{});
+  }
+
+  // Makes config the current one, waking watchers, and returns its version
+  // (unchanged if config is the same as the current one).
+  uint64_t publish(ShardmasterConfig config);
+
+  uint64_t version();
+  ShardmasterConfig current();
+
+  /*
+   * Waits for up to timeout (capped at WATCH_MAX_TIMEOUT) for a version
+   * after since, then answers with what changed (see WatchResponse). A
+   * since ahead of the current version (e.g. from before the shardmaster
+   * restarted) gets the whole config straight away. Returns false if the
+   * history was closed while waiting.
+   */
+  bool watch(uint64_t since, milliseconds timeout, WatchResponse* res);
+
+  // Wakes and fails every watch, now and later (e.g. when shutting down).
+  void close();
+
+  ConfigHistory(const ConfigHistory&) = delete;
+  ConfigHistory& operator=(const ConfigHistory&) = delete;
+
+ private:
+  std::mutex mtx;
+  std::condition_variable cv;
+  // The last CONFIG_HISTORY_LENGTH configs with their versions, oldest
+  // first; the back is the current one.
+  std::deque<std::pair<uint64_t, ShardmasterConfig>> configs;
+  bool closed = false;
+};
+
+#endif /* end of include guard */
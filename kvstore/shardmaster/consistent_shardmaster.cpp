@@ -0,0 +1,31 @@
+#include "consistent_shardmaster.hpp"
+
+bool ConsistentShardmaster::Join(const JoinRequest* req, JoinResponse*) {
+  std::unique_lock lock(this->mtx);
+  if (!this->ring.add(req->server)) return false;
+  this->publish();
+  return true;
+}
+
+bool ConsistentShardmaster::Leave(const LeaveRequest* req, LeaveResponse*) {
+  std::unique_lock lock(this->mtx);
+  if (!this->ring.remove(req->server)) return false;
+  this->publish();
+  return true;
+}
+
+bool ConsistentShardmaster::Move(const MoveRequest*, MoveResponse*) {
+  cerr_color(YELLOW, "Shards are placed by consistent hashing; not moving.");
+  return false;
+}
+
+bool ConsistentShardmaster::Query(const QueryRequest*, QueryResponse* res) {
+  res->config = this->history.current();
+  return true;
+}
+
+void ConsistentShardmaster::publish() {
+  ShardmasterConfig config = this->ring.config();
+  assign_backups(&config, this->backups);
+  this->history.publish(std::move(config));
+}
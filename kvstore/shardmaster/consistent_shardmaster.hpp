@@ -0,0 +1,42 @@
+#ifndef CONSISTENT_SHARDMASTER_HPP
+#define CONSISTENT_SHARDMASTER_HPP
+
+#include <mutex>
+#include <string>
+
+#include "hash_ring.hpp"
+#include "static_shardmaster.hpp"
+
+/*
+ * A shardmaster that places servers on a consistent-hashing ring (see
+ * HashRing) with vnodes virtual nodes each, so a Join or Leave moves only
+ * about 1/N of the keys. Each server gets the backups next to it in the
+ * config (see assign_backups). Otherwise serves clients as
+ * StaticShardmaster does.
+ *
+ * Where shards go is up to the ring, so Move isn't supported.
+ */
+class ConsistentShardmaster : public StaticShardmaster {
+ public:
+  explicit ConsistentShardmaster(const std::string& addr,
+                                 size_t vnodes = RING_VNODES,
+                                 size_t backups = 0)
+      : StaticShardmaster(addr), ring(vnodes), backups(backups) {
+  }
+
+  bool Join(const JoinRequest* req, JoinResponse*) override;
+  bool Leave(const LeaveRequest* req, LeaveResponse*) override;
+  bool Move(const MoveRequest* req, MoveResponse*) override;
+  bool Query(const QueryRequest*, QueryResponse* res) override;
+
+ private:
+  // Guards ring, and the order configs are published to history in.
+  std::mutex mtx;
+  HashRing ring;
+  size_t backups;
+
+  // Publishes the ring's config, with backups assigned.
+  void publish();
+};
+
+#endif /* end of include guard */
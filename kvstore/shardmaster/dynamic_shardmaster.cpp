@@ -0,0 +1,81 @@
+#include "dynamic_shardmaster.hpp"
+
+#include <algorithm>
+
+bool DynamicShardmaster::Join(const JoinRequest* req, JoinResponse*) {
+  std::unique_lock lock(this->mtx);
+  auto& servers = this->config.servers;
+  if (std::any_of(servers.begin(), servers.end(),
+                  [&](auto&& sc) { return sc.server == req->server; })) {
+    return false;
+  }
+  servers.push_back({req->server, {}});
+  this->resplit();
+  return true;
+}
+
+bool DynamicShardmaster::Leave(const LeaveRequest* req, LeaveResponse*) {
+  std::unique_lock lock(this->mtx);
+  auto& servers = this->config.servers;
+  auto it = std::find_if(servers.begin(), servers.end(),
+                         [&](auto&& sc) { return sc.server == req->server; });
+  if (it == servers.end()) return false;
+  servers.erase(it);
+  this->resplit();
+  return true;
+}
+
+bool DynamicShardmaster::Move(const MoveRequest*, MoveResponse*) {
+  cerr_color(YELLOW, "Shards are placed by load; not moving.");
+  return false;
+}
+
+bool DynamicShardmaster::Query(const QueryRequest*, QueryResponse* res) {
+  res->config = this->history.current();
+  return true;
+}
+
+bool DynamicShardmaster::ReportLoad(const ReportLoadRequest* req,
+                                    ReportLoadResponse*) {
+  std::unique_lock lock(this->mtx);
+  auto& servers = this->config.servers;
+  auto it = std::find_if(servers.begin(), servers.end(),
+                         [&](auto&& sc) { return sc.server == req->server; });
+  if (it == servers.end()) return false;
+
+  // A report on other shards than the server's is from before the config
+  // last changed (the server hasn't caught up yet), so it's no use
+  std::vector<Shard> reported;
+  for (auto&& load : req->shards) reported.push_back(load.shard);
+  sort_shards(reported);
+  if (reported != it->shards) return true;
+  this->loads[req->server] = req->shards;
+
+  if (this->loads.size() < servers.size() ||
+      steady_clock::now() - this->last_change < this->interval) {
+    return true;
+  }
+  if (rebalance(&this->config, this->loads)) {
+    cout_color(BLUE, "Rebalanced shards by load");
+    this->publish();
+  }
+  return true;
+}
+
+void DynamicShardmaster::publish() {
+  this->history.publish(this->config);
+  this->loads.clear();
+  this->last_change = steady_clock::now();
+}
+
+void DynamicShardmaster::resplit() {
+  auto& servers = this->config.servers;
+  if (!servers.empty()) {
+    std::vector<Shard> shards = split_into(servers.size());
+    for (size_t i = 0; i < servers.size(); i++) {
+      servers[i].shards = {shards[i]};
+    }
+  }
+  assign_backups(&this->config, this->backups);
+  this->publish();
+}
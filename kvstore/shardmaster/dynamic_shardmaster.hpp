@@ -0,0 +1,62 @@
+#ifndef DYNAMIC_SHARDMASTER_HPP
+#define DYNAMIC_SHARDMASTER_HPP
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rebalance.hpp"
+#include "static_shardmaster.hpp"
+
+using namespace std::chrono;
+
+// The least time between rebalances, so each one's effect shows up in load
+// reports before the next is planned.
+#define REBALANCE_INTERVAL 5s
+
+/*
+ * A shardmaster that places shards by load. Servers that join or leave get
+ * the key space split evenly between them, as with split_into; after that,
+ * KvServers report each shard's load (see ReportLoadRequest), and once every
+ * server has reported on its current shards, hot shards are split and moved
+ * to idle servers (see rebalance), at most once per interval. Each server
+ * gets the backups next to it in the config (see assign_backups).
+ *
+ * Where shards go is up to their load, so Move isn't supported.
+ */
+class DynamicShardmaster : public StaticShardmaster {
+ public:
+  explicit DynamicShardmaster(const std::string& addr,
+                              milliseconds interval = REBALANCE_INTERVAL,
+                              size_t backups = 0)
+      : StaticShardmaster(addr), interval(interval), backups(backups) {
+  }
+
+  bool Join(const JoinRequest* req, JoinResponse*) override;
+  bool Leave(const LeaveRequest* req, LeaveResponse*) override;
+  bool Move(const MoveRequest* req, MoveResponse*) override;
+  bool Query(const QueryRequest*, QueryResponse* res) override;
+  bool ReportLoad(const ReportLoadRequest* req, ReportLoadResponse*) override;
+
+ private:
+  // Guards everything below, and the order configs are published in.
+  std::mutex mtx;
+  ShardmasterConfig config;
+  // Each server's last report on its current shards. Cleared whenever the
+  // config changes, as reports from before then may be on other shards.
+  std::map<std::string, std::vector<ShardLoad>> loads;
+  milliseconds interval;
+  steady_clock::time_point last_change;
+  // Backups per server (see assign_backups).
+  size_t backups;
+
+  // Publishes config, starting afresh on loads.
+  void publish();
+  // Splits the key space evenly between the servers, in the order they
+  // joined, and assigns their backups, then publishes.
+  void resplit();
+};
+
+#endif /* end of include guard */
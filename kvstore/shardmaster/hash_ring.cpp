@@ -0,0 +1,92 @@
+#include "hash_ring.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <tuple>
+
+namespace {
+
+// Buckets on the ring.
+constexpr size_t RING_SIZE = GRANULARITY_OPTS[MAX_GRANULARITY];
+
+// FNV-1a, so points land in the same place whichever standard library built
+// the shardmaster (std::hash makes no such promise), with a final mix: names
+// differing only in their last few characters (as vnode names do) otherwise
+// hash to clustered points.
+uint64_t hash_name(const std::string& s) {
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : s) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+}  // namespace
+
+bool HashRing::add(const std::string& server) {
+  if (std::find(this->servers.begin(), this->servers.end(), server) !=
+      this->servers.end()) {
+    return false;
+  }
+  this->servers.push_back(server);
+  for (size_t i = 0; i < std::max<size_t>(this->vnodes, 1); i++) {
+    size_t bucket = hash_name(server + '#' + std::to_string(i)) % RING_SIZE;
+    // On the rare collision, take the next free bucket
+    while (this->points.contains(bucket)) bucket = (bucket + 1) % RING_SIZE;
+    this->points.emplace(bucket, server);
+  }
+  return true;
+}
+
+bool HashRing::remove(const std::string& server) {
+  auto it = std::find(this->servers.begin(), this->servers.end(), server);
+  if (it == this->servers.end()) return false;
+  this->servers.erase(it);
+  std::erase_if(this->points,
+                [&](const auto& point) { return point.second == server; });
+  return true;
+}
+
+ShardmasterConfig HashRing::config() const {
+  ShardmasterConfig config;
+  if (this->points.empty()) return config;
+
+  // The arcs, in order, as [lower, upper] bucket ranges with their owner:
+  // each point owns the buckets after the previous point, up to itself. The
+  // first point's arc wraps around, so it's split in two.
+  std::vector<std::tuple<size_t, size_t, const std::string*>> arcs;
+  auto add_arc = [&](size_t lower, size_t upper, const std::string* server) {
+    if (!arcs.empty() && *std::get<2>(arcs.back()) == *server) {
+      std::get<1>(arcs.back()) = upper;
+    } else {
+      arcs.emplace_back(lower, upper, server);
+    }
+  };
+  size_t next = 0;
+  for (auto&& [bucket, server] : this->points) {
+    add_arc(next, bucket, &server);
+    next = bucket + 1;
+  }
+  if (next < RING_SIZE) {
+    add_arc(next, RING_SIZE - 1, &this->points.begin()->second);
+  }
+
+  std::map<std::string_view, size_t> index;
+  for (auto&& server : this->servers) {
+    index[server] = config.servers.size();
+    config.servers.push_back({server, {}});
+  }
+  for (auto&& [lower, upper, server] : arcs) {
+    config.servers[index.at(*server)].shards.push_back(
+        {bucket_to_str(lower, MAX_GRANULARITY),
+         bucket_to_str(upper, MAX_GRANULARITY)});
+  }
+  return config;
+}
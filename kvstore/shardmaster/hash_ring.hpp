@@ -0,0 +1,55 @@
+#ifndef HASH_RING_HPP
+#define HASH_RING_HPP
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common/config.hpp"
+#include "common/shard.hpp"
+
+// Default number of virtual nodes each server gets on a HashRing.
+#define RING_VNODES 128
+
+/*
+ * A consistent-hashing ring over the key space: the buckets of the shard
+ * alphabet at MAX_GRANULARITY (see common/shard.hpp), wrapping around at the
+ * end. Each server gets vnodes points on the ring, at hashes of its name, and
+ * owns the arc of buckets leading up to each of its points.
+ *
+ * Adding a server only takes over the arcs just before its points, and
+ * removing one only hands its arcs to the points after them, so either moves
+ * about 1/N of the keys (where split_into moves most of them); more virtual
+ * nodes spread each server's share more evenly.
+ *
+ * The ring is handed out as an ordinary config of shards, so KvServers and
+ * clients route by it as they do any other (e.g. with a ShardRouter). Like
+ * any config at MAX_GRANULARITY, keys shorter than that don't fall in a shard.
+ */
+class HashRing {
+ public:
+  explicit HashRing(size_t vnodes = RING_VNODES) : vnodes(vnodes) {
+  }
+
+  // Adds server, returning false if it's already on the ring.
+  bool add(const std::string& server);
+  // Removes server, returning false if it isn't on the ring.
+  bool remove(const std::string& server);
+
+  size_t size() const {
+    return this->servers.size();
+  }
+
+  // The ring as a config: every server, in the order they were added, with
+  // the arcs it owns (adjacent ones merged) as shards.
+  ShardmasterConfig config() const;
+
+ private:
+  size_t vnodes;
+  std::vector<std::string> servers;
+  // Each bucket with a point on it, and the server it belongs to.
+  std::map<size_t, std::string> points;
+};
+
+#endif /* end of include guard */
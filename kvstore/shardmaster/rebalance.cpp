@@ -0,0 +1,121 @@
+#include "rebalance.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+// Bounds the splits one rebalance makes, however hot a single key is.
+constexpr size_t MAX_SPLITS = 64;
+
+struct ServerLoad {
+  ServerConfig* config;
+  std::vector<ShardLoad> shards;
+  double load = 0;
+};
+
+// Splits shard in two, going a character deeper if it's a single bucket.
+// Returns false if it's a single bucket at MAX_GRANULARITY already.
+bool split_in_two(const Shard& shard, std::pair<Shard, Shard>* halves) {
+  if (shard.lower != shard.upper) {
+    *halves = split_shard(shard);
+    return true;
+  }
+  if (shard.granularity() >= MAX_GRANULARITY) return false;
+  *halves = split_shard(
+      {shard.lower + VALID_CHARS.front(), shard.upper + VALID_CHARS.back()});
+  return true;
+}
+
+}  // namespace
+
+bool rebalance(ShardmasterConfig* config,
+               const std::map<std::string, std::vector<ShardLoad>>& loads) {
+  if (config->servers.size() < 2) return false;
+
+  std::vector<ServerLoad> servers;
+  double total = 0;
+  for (auto&& sc : config->servers) {
+    ServerLoad& server = servers.emplace_back(ServerLoad{&sc, {}});
+    auto it = loads.find(sc.server);
+    for (auto&& shard : sc.shards) {
+      ShardLoad load{shard, 0, 0};
+      if (it != loads.end()) {
+        auto reported = std::find_if(
+            it->second.begin(), it->second.end(),
+            [&](const ShardLoad& l) { return l.shard == shard; });
+        if (reported != it->second.end()) load = *reported;
+      }
+      server.load += load.rate;
+      server.shards.push_back(load);
+    }
+    total += server.load;
+  }
+  double mean = total / servers.size();
+  auto by_load = [](const ServerLoad& a, const ServerLoad& b) {
+    return a.load < b.load;
+  };
+  auto by_rate = [](const ShardLoad& a, const ShardLoad& b) {
+    return a.rate < b.rate;
+  };
+  if (total <= 0 ||
+      std::max_element(servers.begin(), servers.end(), by_load)->load <=
+          REBALANCE_HIGH_WATER * mean) {
+    return false;
+  }
+
+  bool changed = false;
+  size_t moves = 0, splits = 0;
+  while (moves < REBALANCE_MAX_MOVES) {
+    auto [cold, hot] = std::minmax_element(servers.begin(), servers.end(),
+                                           by_load);
+    if (hot->load <= REBALANCE_LOW_WATER * mean) break;
+    // Moving want over would even the two out
+    double want = (hot->load - cold->load) / 2;
+
+    // The hot server's shard that comes closest to want without going over,
+    // as moving more than that leaves the pair further apart
+    auto best = hot->shards.end();
+    for (auto it = hot->shards.begin(); it != hot->shards.end(); ++it) {
+      if (it->rate > 0 && it->rate <= want &&
+          (best == hot->shards.end() || it->rate > best->rate)) {
+        best = it;
+      }
+    }
+    // Nothing that close; split the hottest shard for finer pieces
+    if (best == hot->shards.end() || best->rate < want / 2) {
+      auto hottest =
+          std::max_element(hot->shards.begin(), hot->shards.end(), by_rate);
+      std::pair<Shard, Shard> halves;
+      if (hottest->rate > want && splits < MAX_SPLITS &&
+          split_in_two(hottest->shard, &halves)) {
+        ShardLoad upper{halves.second, hottest->rate / 2, hottest->keys / 2};
+        *hottest = {halves.first, hottest->rate - upper.rate,
+                    hottest->keys - upper.keys};
+        hot->shards.push_back(upper);
+        splits++;
+        changed = true;
+        continue;
+      }
+    }
+    if (best == hot->shards.end()) break;
+
+    ShardLoad moved = *best;
+    hot->shards.erase(best);
+    hot->load -= moved.rate;
+    cold->shards.push_back(moved);
+    cold->load += moved.rate;
+    moves++;
+    changed = true;
+  }
+
+  if (!changed) return false;
+  for (auto&& server : servers) {
+    server.config->shards.clear();
+    for (auto&& load : server.shards) {
+      server.config->shards.push_back(load.shard);
+    }
+    sort_shards(server.config->shards);
+  }
+  return true;
+}
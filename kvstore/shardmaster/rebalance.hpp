@@ -0,0 +1,33 @@
+#ifndef REBALANCE_HPP
+#define REBALANCE_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common/config.hpp"
+#include "common/shard.hpp"
+#include "net/shardmaster_commands.hpp"
+
+// Rebalancing starts once the busiest server has more than
+// REBALANCE_HIGH_WATER times the mean load, and goes on until it's under
+// REBALANCE_LOW_WATER times. Loads in between are left alone, so a roughly
+// balanced cluster doesn't have shards shuffled around with every wobble.
+#define REBALANCE_HIGH_WATER 1.5
+#define REBALANCE_LOW_WATER 1.2
+// Most shards moved by one rebalance (splits aren't counted).
+#define REBALANCE_MAX_MOVES 8
+
+/*
+ * Evens out the load on config's servers, given each server's last load
+ * report (shards missing from them count as idle): moves shards from the
+ * busiest server to the idlest, splitting a shard (with split_shard) when
+ * it's too hot to move whole. A split shard's load is taken to be halved
+ * between its halves; the next reports show how it really splits.
+ *
+ * Returns whether config changed.
+ */
+bool rebalance(ShardmasterConfig* config,
+               const std::map<std::string, std::vector<ShardLoad>>& loads);
+
+#endif /* end of include guard */
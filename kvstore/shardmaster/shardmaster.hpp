@@ -15,6 +15,17 @@ class Shardmaster {
   virtual bool Leave(const LeaveRequest* req, LeaveResponse* res) = 0;
   virtual bool Move(const MoveRequest* req, MoveResponse* res) = 0;
   virtual bool Query(const QueryRequest* req, QueryResponse* res) = 0;
+  // Long-polls for config changes (see WatchRequest). Shardmasters that don't
+  // version their configs leave this as is, and watchers fall back to Query.
+  virtual bool Watch(const WatchRequest* req, WatchResponse* res) {
+    return false;
+  }
+  // Takes in a server's load (see ReportLoadRequest). Shardmasters that
+  // don't place shards by load leave this as is, refusing reports.
+  virtual bool ReportLoad(const ReportLoadRequest* req,
+                          ReportLoadResponse* res) {
+    return false;
+  }
 
   virtual int start() = 0;
   virtual void stop() = 0;
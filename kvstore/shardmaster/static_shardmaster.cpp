@@ -24,6 +24,10 @@ bool StaticShardmaster::Query(const QueryRequest*, QueryResponse* res) {
   return true;
 }
 
+bool StaticShardmaster::Watch(const WatchRequest* req, WatchResponse* res) {
+  return this->history.watch(req->version, milliseconds(req->timeout_ms), res);
+}
+
 /* ==================================================*/
 /* === INTERNALS: DO NOT MODIFY BELOW THIS LINE ===  */
 /* ==================================================*/
@@ -36,6 +40,17 @@ int StaticShardmaster::start() {
   if (this->listener_fd < 0) {
     return -1;
   }
+
+  // Start the workers, and the watchers for idle connections and Watches
+  if (!this->idle_conns.start()) {
+    cerr_color(YELLOW, "Idle connections will hold on to workers.");
+  }
+  this->workers.resize(SHARDMASTER_WORKERS);
+  for (auto&& worker : this->workers) {
+    worker = std::thread(&StaticShardmaster::work_loop, this);
+  }
+  this->watch_waker = std::thread(&StaticShardmaster::watch_loop, this);
+
   this->client_listener =
       std::thread(&StaticShardmaster::accept_clients_loop, this);
 
@@ -50,18 +65,32 @@ void StaticShardmaster::stop() {
   shutdown(this->listener_fd, SHUT_RDWR);
   cout_color(BLUE, "Joining listener thread...");
   this->client_listener.join();
+  // Don't keep watchers waiting for a change that won't come
+  this->history.close();
+  this->watch_waker.join();
 
-  // Close all connections
+  // Close all connections, waking any worker blocked on one
   cout_color(BLUE, "Closing all connections...");
-  std::unique_lock lock(this->conns_mtx);
-  for (auto&& c : this->current_conns) {
-    cout_color(BLUE, "Closing connection from ", c->address);
-    c->shutdown();
+  {
+    std::unique_lock lock(this->conns_mtx);
+    for (auto&& c : this->current_conns) {
+      cout_color(BLUE, "Closing connection from ", c->address);
+      c->shutdown();
+    }
+  }
+  {
+    std::unique_lock lock(this->ready_mtx);
+    this->ready_cv.notify_all();
   }
-  // Wait for all connections to close (since we've detached threads)
-  conns_cv.wait(lock, [this] { return this->current_conns.empty(); });
+  for (auto&& worker : this->workers) worker.join();
+  this->workers.clear();
+  this->idle_conns.stop();
 
   // ... and we're done!
+  this->ready.clear();
+  this->watches.clear();
+  std::unique_lock lock(this->conns_mtx);
+  this->current_conns.clear();
 }
 
 void StaticShardmaster::accept_clients_loop() {
@@ -70,88 +99,158 @@ void StaticShardmaster::accept_clients_loop() {
     if (!conn) {
       return;
     }
-
-    // NOTE: for now, let's just spawn a thread to handle each client for
-    // simplicity.
-    std::unique_lock lock(this->conns_mtx);
-    std::thread conn_thread(&StaticShardmaster::handle_client, this, conn);
-    conn_thread.detach();
-    this->current_conns.push_back(conn);
-
+    {
+      std::unique_lock lock(this->conns_mtx);
+      this->current_conns.insert(conn);
+    }
     cout_color(BLUE, "Received client connection from ", conn->address,
                " on socket ", conn->fd);
+
+    this->make_ready(std::move(conn));
   }
 }
 
-void StaticShardmaster::handle_client(std::shared_ptr<ClientConn> client) {
-  while (!is_stopped && client->is_connected) {
-    std::optional<Request> req = client->recv_request();
-    if (!req) {
-      break;
-    }
+void StaticShardmaster::make_ready(std::shared_ptr<ClientConn> client,
+                                   std::optional<WatchRequest> due_watch) {
+  std::unique_lock lock(this->ready_mtx);
+  this->ready.push_back({std::move(client), std::move(due_watch)});
+  this->ready_cv.notify_one();
+}
 
-    Response res = this->process_request(*req);
-    if (!client->send_response(res)) {
-      break;
+void StaticShardmaster::work_loop() {
+  while (true) {
+    ReadyConn conn;
+    {
+      std::unique_lock lock(this->ready_mtx);
+      this->ready_cv.wait(lock, [this] {
+        return this->is_stopped || !this->ready.empty();
+      });
+      if (this->is_stopped) return;
+      conn = std::move(this->ready.front());
+      this->ready.pop_front();
     }
+    if (conn.due_watch) {
+      // Answered straight away, now that there's an answer
+      conn.due_watch->timeout_ms = 0;
+      Response res = this->process_request(*conn.due_watch);
+      if (!conn.client->send_response(res)) {
+        this->drop(conn.client);
+        continue;
+      }
+    }
+    this->serve(conn.client);
   }
-  // Regardless of whether the shardmaster is stopped or a message failed to be
-  // sent/received, clean up client (should be automatically freed once it goes
-  // out of scope)
+}
 
-  client->shutdown();
+void StaticShardmaster::serve(const std::shared_ptr<ClientConn>& client) {
+  while (true) {
+    // Shardmaster clients rarely send requests back to back, so connections
+    // are parked as soon as they've nothing waiting (unless they can't be,
+    // in which case the worker waits on them)
+    if (!wait_readable(client->fd, 0ms)) {
+      if (this->idle_conns.park(client)) return;
+      if (!wait_readable(client->fd, IDLE_PARK_TIMEOUT)) {
+        if (this->is_stopped) return this->drop(client);
+        continue;
+      }
+    }
 
-  // remove from existing connections
-  std::unique_lock lock(this->conns_mtx);
-  if (auto it = std::find(this->current_conns.begin(),
-                          this->current_conns.end(), client);
-      it != this->current_conns.end()) {
-    this->current_conns.erase(it);
-  } else {
-    cerr_color(YELLOW,
-               "Connection should not already be removed; please post "
-               "privately on Edstem if "
-               "you receieve this error!");
+    std::optional<Request> req = client->recv_request();
+    if (!req) return this->drop(client);
+    auto* watch_req = std::get_if<WatchRequest>(&*req);
+    if (watch_req && this->park_watch(client, *watch_req)) return;
+
+    Response res = this->process_request(*req);
+    if (!client->send_response(res)) return this->drop(client);
   }
+}
 
-  // notify waiting cv if last connection
-  if (this->current_conns.empty()) {
-    this->conns_cv.notify_all();
+void StaticShardmaster::drop(const std::shared_ptr<ClientConn>& client) {
+  {
+    std::unique_lock lock(this->conns_mtx);
+    this->current_conns.erase(client);
   }
+  client->close();
 }
 
-Response StaticShardmaster::process_request(Request req) {
-  Response res;
-  if (auto* join_req = std::get_if<JoinRequest>(&req)) {
-    JoinResponse join_res{};
-    if (this->Join(join_req, &join_res)) {
-      res = join_res;
-    } else {
-      res = ErrorResponse{"Failed to process Join request."};
-    }
-  } else if (auto* leave_req = std::get_if<LeaveRequest>(&req)) {
-    LeaveResponse leave_res{};
-    if (this->Leave(leave_req, &leave_res)) {
-      res = leave_res;
-    } else {
-      res = ErrorResponse{"Failed to process Leave request."};
+bool StaticShardmaster::park_watch(const std::shared_ptr<ClientConn>& client,
+                                   const WatchRequest& req) {
+  if (req.timeout_ms == 0) return false;
+  // Checked under the lock, so watch_loop can't look over the watches
+  // between a change and this one going in
+  std::unique_lock lock(this->watches_mtx);
+  if (this->history.version() != req.version) return false;
+  auto timeout = std::min<milliseconds>(milliseconds(req.timeout_ms),
+                                        WATCH_MAX_TIMEOUT);
+  this->watches.push_back({client, req, steady_clock::now() + timeout});
+  return true;
+}
+
+void StaticShardmaster::watch_loop() {
+  uint64_t seen = this->history.version();
+  while (true) {
+    // Until the next change (or a while, to time watches out)
+    WatchResponse change;
+    if (!this->history.watch(seen, WATCH_TIMEOUT_GRANULARITY, &change)) {
+      return;
     }
-  } else if (auto* move_req = std::get_if<MoveRequest>(&req)) {
-    MoveResponse move_res{};
-    if (this->Move(move_req, &move_res)) {
-      res = move_res;
-    } else {
-      res = ErrorResponse{"Failed to process Move request."};
+    seen = change.version;
+
+    std::vector<ParkedWatch> due;
+    {
+      std::unique_lock lock(this->watches_mtx);
+      auto now = steady_clock::now();
+      std::erase_if(this->watches, [&](ParkedWatch& watch) {
+        if (watch.req.version == seen && watch.deadline > now) return false;
+        due.push_back(std::move(watch));
+        return true;
+      });
     }
-  } else if (auto* query_req = std::get_if<QueryRequest>(&req)) {
-    QueryResponse query_res{};
-    if (this->Query(query_req, &query_res)) {
-      res = query_res;
-    } else {
-      res = ErrorResponse{"Failed to process Query request."};
+    // The workers send the answers, so one slow watcher doesn't hold up the
+    // rest (or the next change)
+    for (auto&& watch : due) {
+      this->make_ready(std::move(watch.client), watch.req);
     }
-  } else {
-    throw std::logic_error{"invalid request variant!"};
   }
-  return res;
+}
+
+Response StaticShardmaster::process_request(Request req) {
+  return std::visit(
+      overloaded{
+          [&](const JoinRequest& join_req) -> Response {
+            JoinResponse join_res{};
+            if (this->Join(&join_req, &join_res)) return join_res;
+            return ErrorResponse{"Failed to process Join request."};
+          },
+          [&](const LeaveRequest& leave_req) -> Response {
+            LeaveResponse leave_res{};
+            if (this->Leave(&leave_req, &leave_res)) return leave_res;
+            return ErrorResponse{"Failed to process Leave request."};
+          },
+          [&](const MoveRequest& move_req) -> Response {
+            MoveResponse move_res{};
+            if (this->Move(&move_req, &move_res)) return move_res;
+            return ErrorResponse{"Failed to process Move request."};
+          },
+          [&](const QueryRequest& query_req) -> Response {
+            QueryResponse query_res{};
+            if (this->Query(&query_req, &query_res)) return query_res;
+            return ErrorResponse{"Failed to process Query request."};
+          },
+          [&](const WatchRequest& watch_req) -> Response {
+            WatchResponse watch_res{};
+            if (this->Watch(&watch_req, &watch_res)) return watch_res;
+            return ErrorResponse{"Failed to process Watch request."};
+          },
+          [&](const ReportLoadRequest& report_req) -> Response {
+            ReportLoadResponse report_res{};
+            if (this->ReportLoad(&report_req, &report_res)) return report_res;
+            return ErrorResponse{"Failed to process ReportLoad request."};
+          },
+          // KvServer requests don't belong here
+          [](const auto&) -> Response {
+            return ErrorResponse{"unsupported request"};
+          },
+      },
+      req);
 }
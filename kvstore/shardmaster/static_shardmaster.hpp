@@ -2,18 +2,30 @@
 #define STATIC_SHARDMASTER_HPP
 
 #include <condition_variable>
+#include <deque>
 #include <memory>
+#include <optional>
 #include <shared_mutex>
 #include <thread>
+#include <unordered_set>
 #include <vector>
 
 #include "common/config.hpp"
 #include "common/shard.hpp"
+#include "common/utils.hpp"
+#include "config_history.hpp"
+#include "net/idle_connections.hpp"
 #include "net/network_conn.hpp"
 #include "net/network_helpers.hpp"
 #include "net/network_messages.hpp"
 #include "shardmaster.hpp"
 
+// Threads serving shardmaster clients' requests.
+#define SHARDMASTER_WORKERS 4
+// How often parked Watches are checked for timeouts (config changes answer
+// them straight away).
+#define WATCH_TIMEOUT_GRANULARITY 100ms
+
 class StaticShardmaster : public Shardmaster {
  public:
   explicit StaticShardmaster(const std::string& addr) : address(addr) {
@@ -28,10 +40,16 @@ class StaticShardmaster : public Shardmaster {
   bool Leave(const LeaveRequest* req, LeaveResponse*) override;
   bool Move(const MoveRequest* req, MoveResponse*) override;
   bool Query(const QueryRequest*, QueryResponse* res) override;
+  bool Watch(const WatchRequest* req, WatchResponse* res) override;
 
   int start() override;
   void stop() override;
 
+ protected:
+  // Versions of the configuration, for watchers. Publish each new
+  // configuration here once Join, Leave or Move has made it.
+  ConfigHistory history;
+
  private:
   // TODO: store the current shard configuration. You will need to add fields!
 
@@ -54,10 +72,42 @@ class StaticShardmaster : public Shardmaster {
   std::thread client_listener;
 
   // Collection of current client connections.
-  std::vector<std::shared_ptr<ClientConn>> current_conns;
-  // Synchronization primitives for client connections.
+  std::unordered_set<std::shared_ptr<ClientConn>> current_conns;
   std::mutex conns_mtx;
-  std::condition_variable conns_cv;
+
+  /*
+   * Clients are served as KvServer serves them: a fixed pool of workers
+   * takes connections with a request waiting off the ready queue, and
+   * connections with none are parked in idle_conns (every KvServer and
+   * client holds one open, mostly idle), so thousands of clients cost a
+   * handful of threads. Watches are parked too, until the config changes or
+   * they time out, so they don't tie up workers either.
+   */
+  std::vector<std::thread> workers;
+  // A connection for a worker, with the parked Watch it's to answer first,
+  // if that's what it's ready for.
+  struct ReadyConn {
+    std::shared_ptr<ClientConn> client;
+    std::optional<WatchRequest> due_watch;
+  };
+  std::deque<ReadyConn> ready;
+  std::mutex ready_mtx;
+  std::condition_variable ready_cv;
+  IdleConnections idle_conns{[this](std::shared_ptr<ClientConn> client) {
+    this->make_ready(std::move(client));
+  }};
+
+  // A Watch waiting for a config change, and when it times out.
+  struct ParkedWatch {
+    std::shared_ptr<ClientConn> client;
+    WatchRequest req;
+    steady_clock::time_point deadline;
+  };
+  std::vector<ParkedWatch> watches;
+  std::mutex watches_mtx;
+  // Hands parked Watches to the workers to answer as the config changes or
+  // they time out.
+  std::thread watch_waker;
 
   /**
    * In a loop, accept client connections, then pass each connection into the
@@ -67,10 +117,25 @@ class StaticShardmaster : public Shardmaster {
    */
   void accept_clients_loop();
 
-  /**
-   * Handle the associated client for the duration that it's connected.
-   */
-  void handle_client(std::shared_ptr<ClientConn> client);
+  // Queues client for a worker, which answers due_watch (a Watch that was
+  // parked) first, if given.
+  void make_ready(std::shared_ptr<ClientConn> client,
+                  std::optional<WatchRequest> due_watch = std::nullopt);
+  // In a loop, takes a connection off the ready queue and serves it until
+  // it's idle (then it's parked) or closed. Exits when the shardmaster has
+  // been stopped.
+  void work_loop();
+  // Serves requests on client until it has none waiting (then it's parked)
+  // or it closes.
+  void serve(const std::shared_ptr<ClientConn>& client);
+  // Closes client, forgetting it.
+  void drop(const std::shared_ptr<ClientConn>& client);
+
+  // Parks client's Watch until the config moves past the version it's seen
+  // (or it times out). Returns false if it should be answered now.
+  bool park_watch(const std::shared_ptr<ClientConn>& client,
+                  const WatchRequest& req);
+  void watch_loop();
 
   /**
    * Process an incoming request: parse its request type, call its appropriate
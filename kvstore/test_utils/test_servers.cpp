@@ -0,0 +1,302 @@
+#include "test_servers.hpp"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "net/network_helpers.hpp"
+#include "server/shard_migration.hpp"
+#include "server/transactions.hpp"
+#include "server/value_streams.hpp"
+#include "test_utils.hpp"
+
+bool MapKvStore::Get(const GetRequest* req, GetResponse* res) {
+  std::unique_lock lock(this->mtx);
+  auto it = this->map.find(req->key);
+  if (it == this->map.end()) return false;
+  res->value = it->second;
+  return true;
+}
+
+bool MapKvStore::Put(const PutRequest* req, PutResponse*) {
+  std::unique_lock lock(this->mtx);
+  this->map[req->key] = req->value;
+  return true;
+}
+
+bool MapKvStore::Append(const AppendRequest* req, AppendResponse*) {
+  std::unique_lock lock(this->mtx);
+  this->map[req->key] += req->value;
+  return true;
+}
+
+bool MapKvStore::Delete(const DeleteRequest* req, DeleteResponse* res) {
+  std::unique_lock lock(this->mtx);
+  auto it = this->map.find(req->key);
+  if (it == this->map.end()) return false;
+  res->value = std::move(it->second);
+  this->map.erase(it);
+  return true;
+}
+
+bool MapKvStore::MultiGet(const MultiGetRequest* req, MultiGetResponse* res) {
+  std::unique_lock lock(this->mtx);
+  res->values.clear();
+  for (auto&& key : req->keys) {
+    auto it = this->map.find(key);
+    if (it == this->map.end()) return false;
+    res->values.push_back(it->second);
+  }
+  return true;
+}
+
+bool MapKvStore::MultiPut(const MultiPutRequest* req, MultiPutResponse*) {
+  if (req->keys.size() != req->values.size()) return false;
+  std::unique_lock lock(this->mtx);
+  for (size_t i = 0; i < req->keys.size(); i++) {
+    this->map[req->keys[i]] = req->values[i];
+  }
+  return true;
+}
+
+std::vector<std::string> MapKvStore::AllKeys() {
+  std::unique_lock lock(this->mtx);
+  std::vector<std::string> keys;
+  for (auto&& [key, value] : this->map) keys.push_back(key);
+  return keys;
+}
+
+bool MapKvStore::Contains(const std::string& key) {
+  std::unique_lock lock(this->mtx);
+  return this->map.contains(key);
+}
+
+bool TestServer::start() {
+  this->listener_fd = open_listener_socket(this->address);
+  if (this->listener_fd < 0) return false;
+  this->listener = std::thread(&TestServer::accept_loop, this);
+  return true;
+}
+
+void TestServer::stop() {
+  if (this->listener_fd < 0) return;
+  ::shutdown(this->listener_fd, SHUT_RDWR);
+  this->listener.join();
+  ::close(this->listener_fd);
+  this->listener_fd = -1;
+
+  std::unique_lock lock(this->mtx);
+  for (auto&& client : this->clients) client->shutdown();
+  for (auto&& worker : this->workers) worker.join();
+  this->clients.clear();
+  this->workers.clear();
+}
+
+void TestServer::accept_loop() {
+  while (auto client = accept_client(this->listener_fd)) {
+    this->n_connections++;
+    std::unique_lock lock(this->mtx);
+    this->clients.push_back(client);
+    this->workers.emplace_back([this, client] {
+      while (auto req = client->recv_request()) {
+        this->n_requests++;
+        if (!client->send_response(this->handler(*req, client.get()))) break;
+      }
+    });
+  }
+}
+
+TestServer::Handler kv_handler(
+    KvStore* store, std::function<bool(const std::string&)> responsible,
+    microseconds lease_duration) {
+  auto leases = std::make_shared<LeaseTable>(lease_duration);
+  auto transactions = std::make_shared<TransactionTable>();
+  return [store, responsible, leases, transactions](
+             const Request& req, ClientConn* client) -> Response {
+    auto owns = [&](const std::vector<std::string>& keys) {
+      if (!responsible) return true;
+      return std::all_of(keys.begin(), keys.end(), responsible);
+    };
+    auto refuse = ErrorResponse{NOT_RESPONSIBLE_ERROR};
+    auto locked = ErrorResponse{KEY_LOCKED_ERROR};
+    if (client->expired()) return ErrorResponse{DEADLINE_EXCEEDED_ERROR};
+    return std::visit(
+        overloaded{
+            [&](const GetRequest& get_req) -> Response {
+              if (!owns({get_req.key})) return refuse;
+              GetResponse res;
+              if (store->Get(&get_req, &res)) {
+                return get_value_response(client, get_req.key,
+                                          std::move(res.value));
+              }
+              return ErrorResponse{"key does not exist in the KVStore"};
+            },
+            [&](const PutRequest& put_req) -> Response {
+              if (!owns({put_req.key})) return refuse;
+              if (transactions->locked(put_req.key)) return locked;
+              PutResponse res;
+              store->Put(&put_req, &res);
+              leases->written(put_req.key);
+              return res;
+            },
+            [&](const AppendRequest& append_req) -> Response {
+              if (!owns({append_req.key})) return refuse;
+              if (transactions->locked(append_req.key)) return locked;
+              AppendResponse res;
+              store->Append(&append_req, &res);
+              leases->written(append_req.key);
+              return res;
+            },
+            [&](const DeleteRequest& delete_req) -> Response {
+              if (!owns({delete_req.key})) return refuse;
+              if (transactions->locked(delete_req.key)) return locked;
+              DeleteResponse res;
+              if (store->Delete(&delete_req, &res)) {
+                leases->written(delete_req.key);
+                return res;
+              }
+              return ErrorResponse{"key does not exist in the KVStore"};
+            },
+            [&](const MultiGetRequest& multiget_req) -> Response {
+              if (!owns(multiget_req.keys)) return refuse;
+              MultiGetResponse res;
+              if (store->MultiGet(&multiget_req, &res)) return res;
+              return ErrorResponse{"key(s) do not exist in the KVStore"};
+            },
+            [&](const MultiPutRequest& multiput_req) -> Response {
+              if (!owns(multiput_req.keys)) return refuse;
+              if (transactions->locked(multiput_req.keys)) return locked;
+              MultiPutResponse res;
+              if (store->MultiPut(&multiput_req, &res)) {
+                for (auto&& key : multiput_req.keys) leases->written(key);
+                return res;
+              }
+              return ErrorResponse{"internal KVStore error"};
+            },
+            [&](const PutChunkRequest& chunk_req) -> Response {
+              if (!owns({chunk_req.key})) return refuse;
+              if (transactions->locked(chunk_req.key)) return locked;
+              leases->written(chunk_req.key);
+              return put_value_chunk(store, client, chunk_req);
+            },
+            [&](const GetChunkRequest& chunk_req) -> Response {
+              if (!owns({chunk_req.key})) return refuse;
+              return get_value_chunk(store, client, chunk_req);
+            },
+            [&](const LeaseGetRequest& lease_req) -> Response {
+              if (!owns({lease_req.key})) return refuse;
+              uint64_t lease_us = leases->grant(lease_req.key).count();
+              GetRequest get_req{lease_req.key};
+              GetResponse res;
+              if (store->Get(&get_req, &res)) {
+                return LeaseGetResponse{std::move(res.value), lease_us};
+              }
+              return ErrorResponse{"key does not exist in the KVStore"};
+            },
+            [&](const MigrateRequest& migrate_req) -> Response {
+              return apply_migration(store, leases.get(), migrate_req);
+            },
+            [&](const PrepareRequest& prepare_req) -> Response {
+              if (!owns(prepare_req.keys)) return refuse;
+              if (!transactions->prepare(prepare_req.txid, prepare_req.keys,
+                                         prepare_req.values)) {
+                return locked;
+              }
+              return PrepareResponse{};
+            },
+            [&](const CommitRequest& commit_req) -> Response {
+              if (!commit_req.commit) {
+                transactions->abort(commit_req.txid);
+                return CommitResponse{};
+              }
+              bool committed = transactions->commit(
+                  commit_req.txid, [&](const MultiPutRequest& multiput_req) {
+                    MultiPutResponse res;
+                    if (!store->MultiPut(&multiput_req, &res)) return false;
+                    for (auto&& key : multiput_req.keys) leases->written(key);
+                    return true;
+                  });
+              if (!committed) return ErrorResponse{TXN_UNKNOWN_ERROR};
+              return CommitResponse{};
+            },
+            [&](const ReplicaGetRequest& replica_req) -> Response {
+              if (!owns({replica_req.key})) return refuse;
+              return replica_get(store, nullptr, nullptr, replica_req);
+            },
+            [](const auto&) -> Response {
+              return ErrorResponse{"unsupported request"};
+            },
+        },
+        req);
+  };
+}
+
+TestServer::Handler backup_handler(Replicas* replicas,
+                                   const std::string& primary) {
+  return [replicas, primary](const Request& req, ClientConn*) -> Response {
+    if (auto* replicate_req = std::get_if<ReplicateRequest>(&req)) {
+      if (replicate_req->primary != primary) {
+        return ErrorResponse{"not a backup of " + replicate_req->primary};
+      }
+      return apply_replication(replicas, *replicate_req);
+    }
+    if (auto* replica_req = std::get_if<ReplicaGetRequest>(&req)) {
+      return replica_get(nullptr, replicas, &primary, *replica_req);
+    }
+    return ErrorResponse{NOT_RESPONSIBLE_ERROR};
+  };
+}
+
+TestServer::Handler query_handler(std::function<ShardmasterConfig()> config) {
+  return [config](const Request& req, ClientConn*) -> Response {
+    if (std::holds_alternative<QueryRequest>(req)) {
+      return QueryResponse{config()};
+    }
+    return ErrorResponse{"unsupported request"};
+  };
+}
+
+TestServer::Handler watch_handler(ConfigHistory* history) {
+  return [history](const Request& req, ClientConn*) -> Response {
+    if (std::holds_alternative<QueryRequest>(req)) {
+      return QueryResponse{history->current()};
+    }
+    if (auto* watch_req = std::get_if<WatchRequest>(&req)) {
+      WatchResponse res;
+      if (history->watch(watch_req->version,
+                         milliseconds(watch_req->timeout_ms), &res)) {
+        return res;
+      }
+      return ErrorResponse{"shardmaster stopped"};
+    }
+    return ErrorResponse{"unsupported request"};
+  };
+}
+
+std::string test_address(int offset) {
+  static std::mutex mtx;
+  static std::map<int, std::string> addresses;
+  std::lock_guard lock(mtx);
+  if (auto it = addresses.find(offset); it != addresses.end()) {
+    return it->second;
+  }
+
+  // Let the kernel pick a free port, and keep the socket bound (but not
+  // listening) for the life of the process, so the port isn't handed out to
+  // anyone else while test servers (which bind with SO_REUSEADDR too) come
+  // and go on it.
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT(fd >= 0);
+  int yes = 1;
+  ASSERT(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  ASSERT(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+  socklen_t len = sizeof(addr);
+  ASSERT(getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) == 0);
+
+  std::string address = "localhost:" + std::to_string(ntohs(addr.sin_port));
+  addresses.emplace(offset, address);
+  return address;
+}
@@ -0,0 +1,119 @@
+#ifndef TEST_SERVERS_HPP
+#define TEST_SERVERS_HPP
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/config.hpp"
+#include "kvstore/kvstore.hpp"
+#include "net/network_conn.hpp"
+#include "net/network_messages.hpp"
+#include "server/leases.hpp"
+#include "server/replication.hpp"
+#include "shardmaster/config_history.hpp"
+
+/*
+ * Stand-ins for KvServers and shardmasters, for tests of the client side.
+ * (KvServer and StaticShardmaster rely on parts of the stencil, like the
+ * synchronized queue, that are left for students to fill in.)
+ */
+
+// A thread-safe KvStore over a std::map, implementing every operation.
+class MapKvStore : public KvStore {
+ public:
+  bool Get(const GetRequest* req, GetResponse* res) override;
+  bool Put(const PutRequest* req, PutResponse*) override;
+  bool Append(const AppendRequest* req, AppendResponse*) override;
+  bool Delete(const DeleteRequest* req, DeleteResponse* res) override;
+  bool MultiGet(const MultiGetRequest* req, MultiGetResponse* res) override;
+  bool MultiPut(const MultiPutRequest* req, MultiPutResponse*) override;
+  std::vector<std::string> AllKeys() override;
+  bool Contains(const std::string& key) override;
+
+ private:
+  std::mutex mtx;
+  std::map<std::string, std::string> map;
+};
+
+/*
+ * Serves each connection on its own thread, answering requests with handler,
+ * until stopped.
+ */
+class TestServer {
+ public:
+  using Handler = std::function<Response(const Request&, ClientConn*)>;
+
+  TestServer(const std::string& address, Handler handler)
+      : address(address), handler(std::move(handler)) {
+  }
+  ~TestServer() {
+    this->stop();
+  }
+
+  bool start();
+  void stop();
+
+  const std::string address;
+  // Requests and connections served so far.
+  std::atomic<size_t> n_requests = 0;
+  std::atomic<size_t> n_connections = 0;
+
+  TestServer(const TestServer&) = delete;
+  TestServer& operator=(const TestServer&) = delete;
+
+ private:
+  Handler handler;
+  int listener_fd = -1;
+  std::thread listener;
+
+  std::mutex mtx;
+  std::vector<std::shared_ptr<ClientConn>> clients;
+  std::vector<std::thread> workers;
+
+  void accept_loop();
+};
+
+/*
+ * A KvServer stand-in: serves store, refusing keys that responsible (if
+ * given) says belong elsewhere, granting read leases of lease_duration,
+ * dropping requests past their deadline, taking in migrated keys, preparing
+ * and committing cross-server MultiPuts, and answering replica reads as the
+ * keys' server, the way a KvServer would.
+ */
+TestServer::Handler kv_handler(
+    KvStore* store,
+    std::function<bool(const std::string&)> responsible = nullptr,
+    microseconds lease_duration = LEASE_DURATION);
+
+/*
+ * A stand-in for a KvServer that's only a backup of primary: takes in its
+ * writes, keeping them (and how current they are) in replicas, and answers
+ * replica reads from there if they're current enough. Other requests are
+ * refused.
+ */
+TestServer::Handler backup_handler(Replicas* replicas,
+                                   const std::string& primary);
+
+/*
+ * A shardmaster stand-in: answers Queries with whatever config() returns.
+ */
+TestServer::Handler query_handler(std::function<ShardmasterConfig()> config);
+
+/*
+ * A shardmaster stand-in that versions its configs: answers Queries with
+ * history's current config, and Watches from history. (Close history before
+ * stopping the server, so it isn't held up by watches.)
+ */
+TestServer::Handler watch_handler(ConfigHistory* history);
+
+// A loopback address with a port the kernel assigned to this process, so it
+// can't collide with other tests. The same offset gives the same address.
+std::string test_address(int offset = 0);
+
+#endif /* end of include guard */
@@ -0,0 +1,166 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "net/network_conn.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Checks that requests round-trip over each transport (TCP loopback, Unix
+// domain sockets, shared-memory rings), including values larger than a shm
+// ring, and reports small-request round-trip throughput for each. Also checks
+// that the shared-memory transport holds up against a misbehaving peer.
+
+constexpr std::size_t kRoundTrips = 20'000;
+constexpr std::size_t kLargeValueSize = 3 * SHM_RING_CAPACITY + 12345;
+
+// Echoes each Get's key back as its value, and each Put's value back as a
+// Delete response, until the client disconnects.
+void serve_one(int listener_fd, bool shm) {
+  auto client =
+      shm ? accept_shm_client(listener_fd) : accept_client(listener_fd);
+  ASSERT(client);
+  while (true) {
+    auto req = client->recv_request();
+    if (!req) break;
+    Response res;
+    if (auto* get_req = std::get_if<GetRequest>(&*req)) {
+      res = GetResponse{get_req->key};
+    } else if (auto* put_req = std::get_if<PutRequest>(&*req)) {
+      res = DeleteResponse{put_req->value};
+    } else {
+      res = ErrorResponse{"unexpected request"};
+    }
+    if (!client->send_response(res)) break;
+  }
+}
+
+void test_transport(const std::string& listen_addr,
+                    const std::string& connect_addr) {
+  bool shm = is_shm_address(listen_addr);
+  int listener_fd = open_listener_socket(
+      shm ? shm_control_address(listen_addr) : listen_addr);
+  ASSERT(listener_fd >= 0);
+  std::thread server(serve_one, listener_fd, shm);
+
+  auto conn = connect_to_server(connect_addr);
+  ASSERT(conn);
+  ASSERT(bool(conn->shm) == shm);
+
+  // Small requests, timed
+  auto start = steady_clock::now();
+  for (std::size_t i = 0; i < kRoundTrips; i++) {
+    std::string key = "key" + std::to_string(i);
+    ASSERT(conn->send_request(GetRequest{key}));
+    auto res = conn->recv_response();
+    ASSERT(res);
+    ASSERT_EQ(std::get<GetResponse>(*res).value, key);
+  }
+  auto elapsed = duration<double>(steady_clock::now() - start).count();
+
+  // A value several times the size of a shm ring, which has to stream through
+  std::string value = make_rand_strs(1, 62)[0];
+  while (value.size() < kLargeValueSize) value += value;
+  ASSERT(conn->send_request(PutRequest{"big", value}));
+  auto res = conn->recv_response();
+  ASSERT(res);
+  ASSERT(std::get<DeleteResponse>(*res).value == value);
+
+  conn->shutdown();
+  server.join();
+  close(listener_fd);
+
+  std::cout << std::left << std::setw(24) << connect_addr << std::right
+            << std::fixed << std::setprecision(0) << std::setw(10)
+            << kRoundTrips / elapsed << " round trips/s\n";
+}
+
+// A segment can't be resized once created, and a server won't map one that
+// could be.
+void test_shm_segment_sealed() {
+  auto ch = ShmChannel::create();
+  ASSERT(ch);
+  struct stat st;
+  ASSERT(fstat(ch->memfd(), &st) == 0);
+  ASSERT(ftruncate(ch->memfd(), st.st_size / 2) < 0);
+  ASSERT(ftruncate(ch->memfd(), st.st_size * 2) < 0);
+
+  // An exact copy of the segment, minus the seals
+  int unsealed = memfd_create("kvstore-test", MFD_CLOEXEC);
+  ASSERT(unsealed >= 0);
+  std::string contents(st.st_size, '\0');
+  ASSERT(pread(ch->memfd(), contents.data(), contents.size(), 0) ==
+         st.st_size);
+  ASSERT(pwrite(unsealed, contents.data(), contents.size(), 0) == st.st_size);
+  ASSERT(!ShmChannel::attach(unsealed));
+
+  int sealed = dup(ch->memfd());
+  ASSERT(ShmChannel::attach(sealed));
+}
+
+// Ring indices the peer has scribbled over fail the call (and close the
+// channel), rather than sending memcpy past the ring.
+void test_shm_corrupt_indices() {
+  auto client = ShmChannel::create(4096);
+  ASSERT(client);
+  auto server = ShmChannel::attach(dup(client->memfd()));
+  ASSERT(server);
+
+  struct stat st;
+  ASSERT(fstat(client->memfd(), &st) == 0);
+  void* base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    client->memfd(), 0);
+  ASSERT(base != MAP_FAILED);
+  // The client-to-server ring follows the segment's magic, capacity and
+  // closed flag, at ShmRing's alignment
+  auto* to_server =
+      reinterpret_cast<ShmRing*>(static_cast<char*>(base) + alignof(ShmRing));
+
+  char buf[64] = {};
+  ASSERT(client->sendall(buf, sizeof(buf)) == int(sizeof(buf)));
+  ASSERT(server->recvall(buf, sizeof(buf)) == int(sizeof(buf)));
+
+  // More unread data than the ring can hold
+  to_server->head.store(to_server->tail.load() + 100 * 4096);
+  errno = 0;
+  ASSERT(server->recvall(buf, sizeof(buf)) == -1);
+  ASSERT(errno == EPROTO);
+  ASSERT(client->sendall(buf, sizeof(buf)) == -1);
+
+  // Same, from the writer's side: the reader claims to be ahead of it
+  auto client2 = ShmChannel::create(4096);
+  ASSERT(client2);
+  void* base2 = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     client2->memfd(), 0);
+  ASSERT(base2 != MAP_FAILED);
+  auto* to_server2 =
+      reinterpret_cast<ShmRing*>(static_cast<char*>(base2) + alignof(ShmRing));
+  to_server2->tail.store(to_server2->head.load() + 1);
+  errno = 0;
+  ASSERT(client2->sendall(buf, sizeof(buf)) == -1);
+  ASSERT(errno == EPROTO);
+
+  munmap(base, st.st_size);
+  munmap(base2, st.st_size);
+}
+
+int main() {
+  std::string suffix = std::to_string(getpid());
+  TEST(test_transport, test_address(), test_address());
+  TEST(test_transport, "unix:@kvstore-test-" + suffix,
+       "unix:@kvstore-test-" + suffix);
+  TEST(test_transport, "unix:/tmp/kvstore-test-" + suffix + ".sock",
+       "unix:/tmp/kvstore-test-" + suffix + ".sock");
+  TEST(test_transport, "shm:kvstore-test-" + suffix,
+       "shm:kvstore-test-" + suffix);
+  unlink(("/tmp/kvstore-test-" + suffix + ".sock").c_str());
+  TEST(test_shm_segment_sealed);
+  TEST(test_shm_corrupt_indices);
+  return 0;
+}
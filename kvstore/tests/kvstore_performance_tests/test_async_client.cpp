@@ -0,0 +1,142 @@
+#include <atomic>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#include "client/async_client.hpp"
+#include "client/simple_client.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Checks that AsyncClient's futures and callbacks see the right results, in
+// order, with many requests in flight on one connection, and that they all
+// fail (rather than hang) when the server goes away. Reports Get throughput
+// for the blocking SimpleClient and for AsyncClient with up to kWindow
+// requests outstanding.
+
+constexpr std::size_t kKeys = 1'000;
+constexpr std::size_t kGets = 20'000;
+constexpr std::size_t kWindow = 64;
+
+void test_futures(const std::string& addr) {
+  AsyncClient client(addr);
+  std::vector<std::string> keys = make_rand_strs(kKeys, 8);
+
+  std::vector<std::future<bool>> puts;
+  for (auto&& key : keys) puts.push_back(client.PutAsync(key, "v" + key));
+  for (auto&& put : puts) ASSERT(put.get());
+
+  std::vector<std::future<std::optional<std::string>>> gets;
+  for (auto&& key : keys) gets.push_back(client.GetAsync(key));
+  for (std::size_t i = 0; i < keys.size(); i++) {
+    auto value = gets[i].get();
+    ASSERT(value.has_value());
+    ASSERT_EQ(*value, "v" + keys[i]);
+  }
+
+  auto values = client.MultiGetAsync({keys[0], keys[1]}).get();
+  ASSERT(values.has_value());
+  ASSERT_EQ((*values)[1], "v" + keys[1]);
+  ASSERT(client.AppendAsync(keys[0], "!").get());
+  ASSERT_EQ(*client.DeleteAsync(keys[0]).get(), "v" + keys[0] + "!");
+
+  // The blocking API is the same thing, waited on
+  ASSERT(!client.Get(keys[0]).has_value());
+  ASSERT(client.Put(keys[0], "again"));
+  ASSERT_EQ(*client.Get(keys[0]), "again");
+}
+
+void test_callbacks_in_order(const std::string& addr) {
+  AsyncClient client(addr);
+  ASSERT(client.Put("first", "1"));
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::vector<std::size_t> order;
+  for (std::size_t i = 0; i < kKeys; i++) {
+    client.GetAsync("first", [&, i](std::optional<std::string> value) {
+      ASSERT(value.has_value());
+      std::unique_lock lock(mtx);
+      order.push_back(i);
+      cv.notify_all();
+    });
+  }
+  std::unique_lock lock(mtx);
+  cv.wait(lock, [&] { return order.size() == kKeys; });
+  for (std::size_t i = 0; i < kKeys; i++) ASSERT_EQ(order[i], i);
+}
+
+void test_server_failure(const std::string& addr) {
+  MapKvStore store;
+  auto server = std::make_unique<TestServer>(addr, kv_handler(&store));
+  ASSERT(server->start());
+
+  AsyncClient client(addr);
+  ASSERT(client.Put("key", "value"));
+  std::vector<std::future<std::optional<std::string>>> gets;
+  for (std::size_t i = 0; i < kKeys; i++) gets.push_back(client.GetAsync("key"));
+  server.reset();
+
+  // Each either got its answer before the server left, or fails
+  for (auto&& get : gets) {
+    auto value = get.get();
+    if (value) ASSERT_EQ(*value, "value");
+  }
+  ASSERT(!client.Get("key").has_value());
+}
+
+void test_throughput(const std::string& addr) {
+  SimpleClient blocking(addr);
+  ASSERT(blocking.Put("key", "value"));
+  auto start = steady_clock::now();
+  for (std::size_t i = 0; i < kGets; i++) ASSERT(blocking.Get("key"));
+  double blocking_rate =
+      kGets / duration<double>(steady_clock::now() - start).count();
+
+  AsyncClient async(addr);
+  ASSERT(async.Get("key"));
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::size_t outstanding = 0, done = 0;
+  start = steady_clock::now();
+  for (std::size_t i = 0; i < kGets; i++) {
+    {
+      std::unique_lock lock(mtx);
+      cv.wait(lock, [&] { return outstanding < kWindow; });
+      outstanding++;
+    }
+    async.GetAsync("key", [&](std::optional<std::string> value) {
+      ASSERT(value.has_value());
+      std::unique_lock lock(mtx);
+      outstanding--;
+      done++;
+      cv.notify_all();
+    });
+  }
+  {
+    std::unique_lock lock(mtx);
+    cv.wait(lock, [&] { return done == kGets; });
+  }
+  double async_rate =
+      kGets / duration<double>(steady_clock::now() - start).count();
+
+  std::cout << std::fixed << std::setprecision(0)
+            << "blocking:            " << std::setw(7) << blocking_rate
+            << " gets/s\n"
+            << "async (" << kWindow << " in flight): " << std::setw(7)
+            << async_rate << " gets/s\n";
+}
+
+int main() {
+  MapKvStore store;
+  TestServer server(test_address(0), kv_handler(&store));
+  ASSERT(server.start());
+
+  TEST(test_futures, server.address);
+  TEST(test_callbacks_in_order, server.address);
+  TEST(test_server_failure, test_address(1));
+  TEST(test_throughput, server.address);
+  return 0;
+}
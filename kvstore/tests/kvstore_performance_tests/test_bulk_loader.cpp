@@ -0,0 +1,204 @@
+#include <unistd.h>
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "client/bulk_loader.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Loads a generated dump into 4 stand-in KvServers with BulkLoader, checking
+// every pair lands on the server that owns it, and compares its throughput
+// with putting the lines one at a time through ShardKvClient (as the REPL
+// would). Then takes a server away partway through a load, and checks that
+// the load stops at a committed offset it can be resumed from.
+
+constexpr std::size_t kServers = 4;
+constexpr std::size_t kRecords = 50'000;
+constexpr std::size_t kLineByLine = 5'000;
+// Small, so the dump is loaded in many segments
+constexpr std::size_t kSegmentSize = 64 << 10;
+
+ShardmasterConfig make_config() {
+  ShardmasterConfig config;
+  std::vector<Shard> shards = split_into(kServers);
+  for (std::size_t i = 0; i < kServers; i++) {
+    config.servers.push_back({test_address(1 + i), {shards[i]}});
+  }
+  return config;
+}
+
+// Keys spread over every shard.
+std::string key_of(std::size_t i) {
+  return VALID_CHARS[i * 7 % VALID_CHARS.size()] + std::string("user_") +
+         std::to_string(i);
+}
+std::string value_of(std::size_t i) {
+  return "name " + std::to_string(i) + " with spaces";
+}
+
+// Writes a dump of kRecords puts to a temporary file, returning its path.
+std::string write_dump() {
+  char path[] = "/tmp/test_bulk_loader_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT(fd >= 0);
+  close(fd);
+  std::ofstream out(path);
+  for (std::size_t i = 0; i < kRecords; i++) {
+    out << "put " << key_of(i) << ' ' << value_of(i) << '\n';
+  }
+  return path;
+}
+
+struct Cluster {
+  std::vector<std::unique_ptr<MapKvStore>> stores;
+  std::vector<std::unique_ptr<TestServer>> servers;
+
+  Cluster() {
+    for (std::size_t i = 0; i < kServers; i++) {
+      stores.push_back(std::make_unique<MapKvStore>());
+      this->start(i);
+    }
+  }
+
+  // (Re)starts server i, refusing keys it doesn't own.
+  void start(std::size_t i) {
+    std::string addr = test_address(1 + i);
+    auto router = std::make_shared<ShardRouter>(make_config());
+    servers.resize(kServers);
+    servers[i] = std::make_unique<TestServer>(
+        addr, kv_handler(stores[i].get(), [addr, router](auto&& key) {
+          return router->get_server(key) == addr;
+        }));
+    ASSERT(servers[i]->start());
+  }
+
+  std::size_t size() {
+    std::size_t n = 0;
+    for (auto&& store : stores) n += store->AllKeys().size();
+    return n;
+  }
+
+  // Whether pair i is stored, where it belongs.
+  bool has(std::size_t i) {
+    GetRequest req{key_of(i)};
+    GetResponse res;
+    for (auto&& store : stores) {
+      if (store->Get(&req, &res)) return res.value == value_of(i);
+    }
+    return false;
+  }
+};
+
+void test_parse() {
+  std::string text =
+      "put a 1\n"
+      "put b two words\r\n"
+      "\n"
+      "get a\n"
+      "put c\n"
+      "put  x\n"
+      "put d last";
+  std::vector<DumpRecord> records;
+  ASSERT_EQ(parse_dump(text, &records), 2);
+  ASSERT_EQ(records.size(), 4);
+  ASSERT(records[0].key == "a" && records[0].value == "1");
+  ASSERT(records[1].key == "b" && records[1].value == "two words");
+  ASSERT(records[2].key == "c" && records[2].value.empty());
+  ASSERT(records[3].key == "d" && records[3].value == "last");
+
+  ASSERT_EQ(next_line(text, 0), 0);
+  ASSERT_EQ(next_line(text, 3), 8);
+  ASSERT_EQ(next_line(text, 8), 8);
+  ASSERT_EQ(next_line(text, text.size() - 1), text.size());
+}
+
+void test_load(const std::string& sm_addr, const std::string& dump_path) {
+  MappedFile dump;
+  ASSERT(dump.open(dump_path));
+
+  // One line at a time, for comparison
+  double line_rate;
+  {
+    Cluster cluster;
+    ShardKvClient client(sm_addr);
+    std::vector<DumpRecord> records;
+    parse_dump(dump.text(), &records);
+    auto start = steady_clock::now();
+    for (std::size_t i = 0; i < kLineByLine; i++) {
+      ASSERT(client.Put(std::string(records[i].key),
+                        std::string(records[i].value)));
+    }
+    line_rate =
+        kLineByLine / duration<double>(steady_clock::now() - start).count();
+  }
+
+  Cluster cluster;
+  BulkLoader loader(sm_addr, "", {.segment_size = kSegmentSize});
+  std::size_t segments = 0;
+  uint64_t last_offset = 0;
+  BulkLoadProgress progress =
+      loader.load(dump.text(), 0, [&](const BulkLoadProgress& progress) {
+        ASSERT(progress.offset > last_offset);
+        last_offset = progress.offset;
+        segments++;
+      });
+  ASSERT(!progress.failed);
+  ASSERT_EQ(progress.offset, dump.text().size());
+  ASSERT_EQ(progress.records, kRecords);
+  ASSERT_EQ(progress.skipped, 0);
+  ASSERT_EQ(cluster.size(), kRecords);
+  for (std::size_t i = 0; i < kRecords; i++) ASSERT(cluster.has(i));
+
+  double bulk_rate = kRecords / progress.elapsed.count();
+  std::cout << std::fixed << std::setprecision(0)
+            << "line by line: " << std::setw(8) << line_rate
+            << " records/s\n"
+            << "bulk loader:  " << std::setw(8) << bulk_rate
+            << " records/s (" << segments << " segments)\n";
+  ASSERT(bulk_rate > 3 * line_rate);
+}
+
+void test_resume(const std::string& sm_addr, const std::string& dump_path) {
+  MappedFile dump;
+  ASSERT(dump.open(dump_path));
+  Cluster cluster;
+
+  // A server goes away after a few segments
+  BulkLoader loader(sm_addr, "", {.segment_size = kSegmentSize});
+  std::size_t segments = 0;
+  BulkLoadProgress progress =
+      loader.load(dump.text(), 0, [&](const BulkLoadProgress&) {
+        if (++segments == 3) cluster.servers[2].reset();
+      });
+  ASSERT(progress.failed);
+  ASSERT(progress.offset > 0 && progress.offset < dump.text().size());
+  // Everything before the offset made it
+  std::vector<DumpRecord> stored;
+  parse_dump(dump.text().substr(0, progress.offset), &stored);
+  ASSERT_EQ(stored.size(), progress.records);
+  for (std::size_t i = 0; i < stored.size(); i++) ASSERT(cluster.has(i));
+
+  // Picking up where it left off (from an offset mid-line, even) gets the
+  // rest
+  cluster.start(2);
+  BulkLoadProgress rest = loader.load(dump.text(), progress.offset - 1);
+  ASSERT(!rest.failed);
+  ASSERT_EQ(progress.records + rest.records, kRecords);
+  ASSERT_EQ(cluster.size(), kRecords);
+  for (std::size_t i = 0; i < kRecords; i++) ASSERT(cluster.has(i));
+}
+
+int main() {
+  TestServer shardmaster(test_address(0), query_handler(make_config));
+  ASSERT(shardmaster.start());
+  std::string dump_path = write_dump();
+
+  TEST(test_parse);
+  TEST(test_load, shardmaster.address, dump_path);
+  TEST(test_resume, shardmaster.address, dump_path);
+  unlink(dump_path.c_str());
+  return 0;
+}
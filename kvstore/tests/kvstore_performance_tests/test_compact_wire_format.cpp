@@ -0,0 +1,136 @@
+#include <sys/socket.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "net/network_conn.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Compares the legacy and compact wire formats: bytes on the wire for a
+// typical Get (10-byte key, 20-byte value), and Get round trips/s over
+// loopback TCP. Also checks that the formats are negotiated per connection, so
+// clients that don't offer the compact format keep getting the legacy one,
+// and that neither format lets a peer's size header force a huge allocation.
+
+constexpr std::size_t kRoundTrips = 20'000;
+
+const std::string kKey = "user_12345";
+const std::string kValue = "some twenty byte val";
+
+// Answers every Get with kValue (or, for a Put, echoes the value back) until
+// the client disconnects.
+void serve(int listener_fd) {
+  auto client = accept_client(listener_fd);
+  ASSERT(client);
+  while (auto req = client->recv_request()) {
+    Response res = GetResponse{kValue};
+    if (auto* put_req = std::get_if<PutRequest>(&*req)) {
+      res = GetResponse{put_req->value};
+    }
+    if (!client->send_response(res)) break;
+  }
+}
+
+std::size_t get_wire_bytes(WireFormat format) {
+  auto req = serialize_request(GetRequest{kKey}, format);
+  auto res = serialize_response(GetResponse{kValue}, format);
+  ASSERT(req && res);
+  return req->size() + res->size();
+}
+
+// Runs Gets over a new connection, returning round trips/s.
+double run_gets(const std::string& addr, bool compact) {
+  int listener_fd = open_listener_socket(addr);
+  ASSERT(listener_fd >= 0);
+  std::thread server(serve, listener_fd);
+
+  auto conn = connect_to_server(addr);
+  ASSERT(conn);
+  conn->compact = compact;
+  conn->compression = true;
+
+  auto start = steady_clock::now();
+  for (std::size_t i = 0; i < kRoundTrips; i++) {
+    ASSERT(conn->send_request(GetRequest{kKey}));
+    auto res = conn->recv_response();
+    ASSERT(res);
+    ASSERT_EQ(std::get<GetResponse>(*res).value, kValue);
+  }
+  auto elapsed = duration<double>(steady_clock::now() - start).count();
+  ASSERT(conn->format ==
+         (compact ? WireFormat::COMPACT : WireFormat::LEGACY));
+
+  // Flags still make it through in the compact format
+  std::string big(100'000, 'x');
+  ASSERT(conn->send_request(PutRequest{kKey, big}));
+  auto res = conn->recv_response();
+  ASSERT(res);
+  ASSERT(std::get<GetResponse>(*res).value == big);
+
+  conn->shutdown();
+  server.join();
+  close(listener_fd);
+  return kRoundTrips / elapsed;
+}
+
+// Sends header over a socket, and checks that a message claiming to be larger
+// than MAX_MESSAGE_SIZE is refused without waiting for (or allocating) it.
+void check_oversized_header(WireFormat format, const std::string& header) {
+  int fds[2];
+  ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  ASSERT(write(fds[0], header.data(), header.size()) ==
+         ssize_t(header.size()));
+
+  Message msg{MessageType::ERROR, 0, 0, {}, format};
+  auto start = steady_clock::now();
+  ASSERT(!recv_message(fds[1], &msg, 5s));
+  ASSERT(steady_clock::now() - start < 1s);
+  ASSERT(msg.buf.capacity() < MAX_MESSAGE_SIZE);
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+int main() {
+  std::string addr = test_address();
+
+  std::size_t legacy_bytes = get_wire_bytes(WireFormat::LEGACY);
+  std::size_t compact_bytes = get_wire_bytes(WireFormat::COMPACT);
+  ASSERT(compact_bytes < legacy_bytes);
+
+  // Both formats decode what they encode
+  for (auto format : {WireFormat::LEGACY, WireFormat::COMPACT}) {
+    auto msg = serialize_request(
+        MultiPutRequest{{"a", std::string(300, 'k')}, {"1", "2"}}, format);
+    ASSERT(msg);
+    auto req = deserialize_request(*msg);
+    ASSERT(req);
+    ASSERT(std::get<MultiPutRequest>(*req).keys[1].size() == 300);
+  }
+
+  // A GET claiming a 2^62-byte (compact) or 4GB (legacy) body
+  check_oversized_header(WireFormat::COMPACT,
+                         std::string("\x00\x80\x80\x80\x80\x80\x80\x80"
+                                     "\x80\x40",
+                                     10));
+  uint32_t type = 0;
+  size_t size = htonl(0xFFFFFFFFu);
+  std::string legacy_header(sizeof(type) + sizeof(size), '\0');
+  memcpy(legacy_header.data(), &type, sizeof(type));
+  memcpy(legacy_header.data() + sizeof(type), &size, sizeof(size));
+  check_oversized_header(WireFormat::LEGACY, legacy_header);
+
+  double legacy_rate = run_gets(addr, false);
+  double compact_rate = run_gets(addr, true);
+
+  std::cout << std::fixed << std::setprecision(0);
+  std::cout << "format  | bytes per Get | round trips/s\n";
+  std::cout << "legacy  | " << std::setw(13) << legacy_bytes << " | "
+            << std::setw(13) << legacy_rate << '\n';
+  std::cout << "compact | " << std::setw(13) << compact_bytes << " | "
+            << std::setw(13) << compact_rate << '\n';
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "common/lz.hpp"
+#include "net/network_messages.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Reports compression ratio and CPU cost of the LZ codec on JSON-like values of
+// various sizes, both on raw values and on the full Put message path
+// (serialize -> compress -> decompress -> deserialize).
+
+constexpr std::size_t kValueSizes[] = {1'000, 10'000, 50'000, 100'000};
+constexpr std::size_t kTotalBytes = 64'000'000;
+
+// Makes a JSON array of records, roughly n bytes long.
+std::string make_json_blob(std::size_t n, std::mt19937& gen) {
+  static const char* names[] = {"alice", "bob", "carol", "dave", "erin"};
+  static const char* tags[] = {"admin", "staff", "guest", "beta", "ops"};
+  std::uniform_int_distribution<int> dist(0, 99999);
+
+  std::string json = "[";
+  while (json.size() < n) {
+    int id = dist(gen);
+    json += "{\"id\":" + std::to_string(id) + ",\"name\":\"" +
+            names[id % 5] + "_" + std::to_string(id % 1000) +
+            "\",\"tags\":[\"" + tags[id % 5] + "\",\"" + tags[(id / 5) % 5] +
+            "\"],\"score\":" + std::to_string(dist(gen) / 100.0) +
+            ",\"active\":" + (id % 2 ? "true" : "false") + "},";
+  }
+  json.back() = ']';
+  return json;
+}
+
+double mb_per_sec(std::size_t bytes, nanoseconds elapsed) {
+  return bytes / 1e6 / duration<double>(elapsed).count();
+}
+
+int main() {
+  std::mt19937 gen(300);
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "value size | ratio | compress MB/s | decompress MB/s | "
+               "put msg bytes (raw -> wire) | msg round trip us\n";
+
+  for (std::size_t size : kValueSizes) {
+    std::string value = make_json_blob(size, gen);
+    std::size_t iters = std::max<std::size_t>(kTotalBytes / value.size(), 10);
+
+    // Raw codec throughput
+    std::string compressed;
+    auto start = steady_clock::now();
+    for (std::size_t i = 0; i < iters; i++) compressed = lz_compress(value);
+    auto compress_time = steady_clock::now() - start;
+
+    std::optional<std::string> decompressed;
+    start = steady_clock::now();
+    for (std::size_t i = 0; i < iters; i++) {
+      decompressed = lz_decompress(compressed);
+    }
+    auto decompress_time = steady_clock::now() - start;
+
+    ASSERT(decompressed.has_value());
+    ASSERT(*decompressed == value);
+    ASSERT(compressed.size() < value.size());
+
+    // Full message path for a Put of the value
+    Request req = PutRequest{"user_1_posts", value};
+    std::size_t raw_bytes = 0, wire_bytes = 0;
+    std::size_t msg_iters = iters / 4 + 1;
+    start = steady_clock::now();
+    for (std::size_t i = 0; i < msg_iters; i++) {
+      auto msg = serialize_request(req);
+      ASSERT(msg.has_value());
+      raw_bytes = msg->size();
+      compress_message(&*msg);
+      ASSERT(msg->flags & FLAG_COMPRESSED);
+      wire_bytes = msg->size();
+      ASSERT(decompress_message(&*msg));
+      auto out = deserialize_request(*msg);
+      ASSERT(out.has_value());
+      ASSERT(std::get<PutRequest>(*out).value == value);
+    }
+    auto msg_time = steady_clock::now() - start;
+
+    std::cout << std::setw(10) << value.size() << " | " << std::setw(5)
+              << double(value.size()) / compressed.size() << " | "
+              << std::setw(13)
+              << mb_per_sec(value.size() * iters, compress_time) << " | "
+              << std::setw(15)
+              << mb_per_sec(value.size() * iters, decompress_time) << " | "
+              << std::setw(11) << raw_bytes << " -> " << std::setw(11)
+              << wire_bytes << " | " << std::setw(17)
+              << duration<double, std::micro>(msg_time).count() / msg_iters
+              << '\n';
+  }
+
+  // Small messages must go out untouched
+  auto small = serialize_request(PutRequest{"key", "value"});
+  ASSERT(small.has_value());
+  compress_message(&*small);
+  ASSERT(!(small->flags & FLAG_COMPRESSED));
+
+  return 0;
+}
@@ -0,0 +1,142 @@
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#include "client/shardkv_client.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Runs a mixed Get/Put workload through ShardKvClient against 4 stand-in
+// KvServers, with the config cache disabled (TTL 0, i.e. a Query before every
+// operation) and enabled, reporting how many Queries hit the shardmaster and
+// the operation throughput. Then moves shards between servers behind the
+// client's back, and checks that it notices, refreshes, and retries.
+
+constexpr std::size_t kServers = 4;
+constexpr std::size_t kOps = 4'000;
+
+std::mutex config_mtx;
+ShardmasterConfig config;
+
+ShardmasterConfig current_config() {
+  std::unique_lock lock(config_mtx);
+  return config;
+}
+
+// Whether server i owns key under the current config.
+bool owns(std::size_t i, const std::string& key) {
+  return current_config().get_server(key) == test_address(1 + i);
+}
+
+// Assigns the shards round-robin, starting at server first.
+void assign_shards(std::size_t first) {
+  std::vector<Shard> shards = split_into(kServers);
+  std::unique_lock lock(config_mtx);
+  config.servers.clear();
+  for (std::size_t i = 0; i < kServers; i++) {
+    config.servers.push_back(
+        {test_address(1 + (first + i) % kServers), {shards[i]}});
+  }
+}
+
+struct Result {
+  std::size_t queries;
+  double ops_per_sec;
+};
+
+Result run_workload(TestServer& shardmaster, milliseconds ttl) {
+  ShardKvClient client(shardmaster.address, false, ttl);
+  std::vector<std::string> keys = make_rand_strs(100, 8);
+  std::size_t before = shardmaster.n_requests;
+
+  auto start = steady_clock::now();
+  for (std::size_t i = 0; i < kOps; i++) {
+    const std::string& key = keys[i % keys.size()];
+    if (i < keys.size() || i % 4 == 0) {
+      ASSERT(client.Put(key, "v" + key));
+    } else {
+      auto value = client.Get(key);
+      ASSERT(value.has_value());
+      ASSERT_EQ(*value, "v" + key);
+    }
+  }
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+  return {shardmaster.n_requests - before, kOps / elapsed};
+}
+
+void test_query_reduction(TestServer& shardmaster) {
+  Result uncached = run_workload(shardmaster, 0ms);
+  Result cached = run_workload(shardmaster, CONFIG_CACHE_TTL);
+
+  ASSERT_EQ(uncached.queries, kOps);
+  ASSERT(cached.queries <= 2);
+
+  std::cout << std::fixed << std::setprecision(0)
+            << "no cache:  " << std::setw(5) << uncached.queries
+            << " shardmaster queries, " << std::setw(6)
+            << uncached.ops_per_sec << " ops/s\n"
+            << "cached:    " << std::setw(5) << cached.queries
+            << " shardmaster queries, " << std::setw(6) << cached.ops_per_sec
+            << " ops/s\n";
+}
+
+void test_refresh_on_misroute(TestServer& shardmaster,
+                              std::vector<std::unique_ptr<MapKvStore>>& stores) {
+  assign_shards(0);
+  ShardKvClient client(shardmaster.address, false, 1h);
+  ASSERT(client.Put("moving", "before"));
+  std::size_t before = shardmaster.n_requests;
+
+  // Hand every shard to the next server, along with its data
+  assign_shards(1);
+  std::vector<std::pair<std::string, std::string>> pairs;
+  for (auto& store : stores) {
+    for (auto&& key : store->AllKeys()) {
+      GetResponse res;
+      GetRequest req{key};
+      store->Get(&req, &res);
+      pairs.push_back({key, res.value});
+    }
+  }
+  for (auto&& [key, value] : pairs) {
+    for (std::size_t i = 0; i < kServers; i++) {
+      if (owns(i, key)) {
+        PutRequest req{key, value};
+        PutResponse res;
+        stores[i]->Put(&req, &res);
+      }
+    }
+  }
+
+  // The cached config still points at the old owner, which refuses the key
+  auto value = client.Get("moving");
+  ASSERT(value.has_value());
+  ASSERT_EQ(*value, "before");
+  ASSERT_EQ(shardmaster.n_requests - before, std::size_t(1));
+
+  // ...and the refreshed config sticks
+  ASSERT(client.Put("moving", "after"));
+  ASSERT_EQ(shardmaster.n_requests - before, std::size_t(1));
+}
+
+int main() {
+  assign_shards(0);
+  TestServer shardmaster(test_address(0), query_handler(current_config));
+  ASSERT(shardmaster.start());
+
+  std::vector<std::unique_ptr<MapKvStore>> stores;
+  std::vector<std::unique_ptr<TestServer>> servers;
+  for (std::size_t i = 0; i < kServers; i++) {
+    stores.push_back(std::make_unique<MapKvStore>());
+    servers.push_back(std::make_unique<TestServer>(
+        test_address(1 + i),
+        kv_handler(stores[i].get(),
+                   [i](const std::string& key) { return owns(i, key); })));
+    ASSERT(servers.back()->start());
+  }
+
+  TEST(test_query_reduction, shardmaster);
+  TEST(test_refresh_on_misroute, shardmaster, stores);
+  return 0;
+}
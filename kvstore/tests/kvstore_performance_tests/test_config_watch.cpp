@@ -0,0 +1,287 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "client/shardkv_client.hpp"
+#include "shardmaster/config_history.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Follows a shardmaster's config from kWatchers KvServer-like watchers, first
+// by polling it with Query every 250ms (as KvServers used to), then with
+// Watch long-polls, while a few changes are made and then the config sits
+// idle. Reports the requests the shardmaster served and how long watchers
+// took to see each change. Also checks config deltas and versions, and that a
+// watching ShardKvClient routes by a change without first being misrouted
+// (and still by its config_ttl, if the shardmaster never publishes configs to
+// watch).
+
+constexpr std::size_t kWatchers = 20;
+constexpr std::size_t kChanges = 3;
+constexpr milliseconds kChangeInterval = 200ms;
+constexpr milliseconds kRunTime = 3s;
+constexpr milliseconds kPollInterval = 250ms;
+
+// Version v of the config: v + 1 servers, splitting the key space.
+ShardmasterConfig make_config(std::size_t v) {
+  ShardmasterConfig config;
+  std::vector<Shard> shards = split_into(v + 1);
+  for (std::size_t i = 0; i <= v; i++) {
+    config.servers.push_back({"server" + std::to_string(i), {shards[i]}});
+  }
+  return config;
+}
+
+void test_delta() {
+  ShardmasterConfig from{{{"a", {{"0", "H"}}},
+                          {"b", {{"I", "Q"}}},
+                          {"c", {{"R", "Z"}}}}};
+  ShardmasterConfig to{
+      {{"a", {{"0", "H"}}}, {"c", {{"I", "Z"}}}, {"d", {{"X", "X"}}}}};
+  ConfigDelta delta = diff_configs(from, to);
+  ASSERT_EQ(delta.changed.size(), 2);
+  ASSERT_EQ(delta.changed[0].server, "c");
+  ASSERT_EQ(delta.changed[1].server, "d");
+  ASSERT_EQ(delta.removed.size(), 1);
+  ASSERT_EQ(delta.removed[0], "b");
+
+  apply_delta(&from, delta);
+  ASSERT_EQ(from.servers.size(), to.servers.size());
+  for (std::size_t i = 0; i < to.servers.size(); i++) {
+    ASSERT_EQ(from.servers[i].server, to.servers[i].server);
+    ASSERT(from.servers[i].shards == to.servers[i].shards);
+  }
+  ASSERT(diff_configs(to, to).changed.empty());
+}
+
+void test_history() {
+  ConfigHistory history;
+  WatchResponse res;
+  // Nothing changes: the watch times out with nothing to report
+  ASSERT(history.watch(0, 10ms, &res));
+  ASSERT_EQ(res.version, 0);
+  ASSERT(res.delta.changed.empty() && res.delta.removed.empty());
+
+  ASSERT_EQ(history.publish(make_config(0)), 1);
+  ASSERT_EQ(history.publish(make_config(0)), 1);
+  ASSERT_EQ(history.publish(make_config(1)), 2);
+
+  // Behind: answered straight away, with just the change
+  ASSERT(history.watch(1, 1s, &res));
+  ASSERT_EQ(res.version, 2);
+  ASSERT(!res.full);
+  ASSERT_EQ(res.delta.changed.size(), 2);
+
+  // Too far behind (or from another shardmaster): the whole config
+  for (std::size_t v = 2; v < CONFIG_HISTORY_LENGTH + 2; v++) {
+    history.publish(make_config(v));
+  }
+  ASSERT(history.watch(1, 1s, &res));
+  ASSERT(res.full);
+  ASSERT_EQ(res.delta.changed.size(), CONFIG_HISTORY_LENGTH + 2);
+  ASSERT(history.watch(1000, 1s, &res));
+  ASSERT(res.full);
+
+  // Up to date: woken by the next change
+  uint64_t version = history.version();
+  std::thread publisher([&] {
+    std::this_thread::sleep_for(50ms);
+    history.publish(make_config(0));
+  });
+  auto start = steady_clock::now();
+  ASSERT(history.watch(version, 5s, &res));
+  ASSERT(steady_clock::now() - start < 1s);
+  ASSERT_EQ(res.version, version + 1);
+  publisher.join();
+
+  history.close();
+  ASSERT(!history.watch(res.version, 5s, &res));
+}
+
+struct Run {
+  std::size_t requests;
+  double mean_staleness_ms;
+  double max_staleness_ms;
+};
+
+// Publishes kChanges changes while kWatchers watchers follow the config (by
+// polling if poll, else by watching), returning what it cost.
+Run follow(const std::string& addr, bool poll) {
+  ConfigHistory history;
+  history.publish(make_config(0));
+  TestServer shardmaster(addr, watch_handler(&history));
+  ASSERT(shardmaster.start());
+
+  // When each change was made, and when each watcher saw it
+  std::vector<steady_clock::time_point> published(kChanges + 1);
+  std::vector<std::vector<steady_clock::time_point>> seen(
+      kWatchers, std::vector<steady_clock::time_point>(kChanges + 1));
+  std::atomic<bool> done = false;
+
+  std::vector<std::thread> watchers;
+  for (std::size_t w = 0; w < kWatchers; w++) {
+    watchers.emplace_back([&, w] {
+      auto conn = connect_to_server(addr);
+      ASSERT(conn);
+      uint64_t version = 0;
+      while (!done) {
+        std::size_t servers;
+        if (poll) {
+          ASSERT(conn->send_request(QueryRequest{}));
+          auto res = conn->recv_response();
+          ASSERT(res);
+          servers = std::get<QueryResponse>(*res).config.servers.size();
+        } else {
+          ASSERT(conn->send_request(WatchRequest{version, 30'000}));
+          auto res = conn->recv_response();
+          if (!res || !std::holds_alternative<WatchResponse>(*res)) break;
+          version = std::get<WatchResponse>(*res).version;
+          servers = version;
+        }
+        // Config v has v + 1 servers, and is version v + 1
+        auto now = steady_clock::now();
+        for (std::size_t v = 1; v < servers && v <= kChanges; v++) {
+          if (seen[w][v] == steady_clock::time_point{}) seen[w][v] = now;
+        }
+        if (poll) std::this_thread::sleep_for(kPollInterval);
+      }
+      conn->shutdown();
+    });
+  }
+
+  auto start = steady_clock::now();
+  std::this_thread::sleep_for(kChangeInterval);
+  for (std::size_t v = 1; v <= kChanges; v++) {
+    published[v] = steady_clock::now();
+    history.publish(make_config(v));
+    std::this_thread::sleep_for(kChangeInterval);
+  }
+  std::this_thread::sleep_until(start + kRunTime);
+  done = true;
+  history.close();
+  for (auto&& watcher : watchers) watcher.join();
+
+  Run run{shardmaster.n_requests, 0, 0};
+  for (std::size_t w = 0; w < kWatchers; w++) {
+    for (std::size_t v = 1; v <= kChanges; v++) {
+      ASSERT(seen[w][v] != steady_clock::time_point{});
+      double ms = duration<double, std::milli>(seen[w][v] - published[v])
+                      .count();
+      run.mean_staleness_ms += ms / (kWatchers * kChanges);
+      run.max_staleness_ms = std::max(run.max_staleness_ms, ms);
+    }
+  }
+  return run;
+}
+
+void test_follow(const std::string& addr) {
+  Run polled = follow(addr, true);
+  Run watched = follow(addr, false);
+
+  std::cout << std::fixed << std::setprecision(1) << kWatchers
+            << " watchers, " << kChanges << " changes in "
+            << kRunTime.count() << "ms\n"
+            << "        | requests | mean staleness | max staleness\n"
+            << "Query   | " << std::setw(8) << polled.requests << " | "
+            << std::setw(12) << polled.mean_staleness_ms << "ms | "
+            << std::setw(11) << polled.max_staleness_ms << "ms\n"
+            << "Watch   | " << std::setw(8) << watched.requests << " | "
+            << std::setw(12) << watched.mean_staleness_ms << "ms | "
+            << std::setw(11) << watched.max_staleness_ms << "ms\n";
+  ASSERT(watched.requests * 2 < polled.requests);
+  ASSERT(watched.mean_staleness_ms * 4 < polled.mean_staleness_ms);
+}
+
+void test_client_watch(const std::string& sm_addr) {
+  ConfigHistory history;
+  std::string a = test_address(11), b = test_address(12);
+  history.publish({{{a, {{"0", "Z"}}}, {b, {}}}});
+  TestServer shardmaster(sm_addr, watch_handler(&history));
+  ASSERT(shardmaster.start());
+
+  MapKvStore store_a, store_b;
+  auto owns = [&](const std::string& addr) {
+    return [&history, addr](const std::string& key) {
+      return history.current().get_server(key) == addr;
+    };
+  };
+  TestServer server_a(a, kv_handler(&store_a, owns(a)));
+  TestServer server_b(b, kv_handler(&store_b, owns(b)));
+  ASSERT(server_a.start() && server_b.start());
+
+  {
+    // The config is cached for good, so only the watch can update it
+    ShardKvClient client(sm_addr, false, 1h);
+    ASSERT(client.enable_config_watch());
+    ASSERT(client.Put("key1", "v"));
+    ASSERT_EQ(store_a.AllKeys().size(), 1);
+
+    history.publish({{{a, {}}, {b, {{"0", "Z"}}}}});
+    std::this_thread::sleep_for(50ms);
+    std::size_t a_requests = server_a.n_requests;
+    ASSERT(client.Put("key2", "v"));
+    ASSERT_EQ(store_b.AllKeys().size(), 1);
+    // Straight to b, without a detour to a
+    ASSERT_EQ(server_a.n_requests.load(), a_requests);
+  }
+  history.close();
+}
+
+void test_unpublished_watch(const std::string& sm_addr) {
+  // A shardmaster whose Query answers with its config, but which never
+  // publishes it to the history its Watch answers from
+  ConfigHistory history;
+  std::string a = test_address(13), b = test_address(14);
+  std::mutex mtx;
+  ShardmasterConfig config{{{a, {{"0", "Z"}}}, {b, {}}}};
+  auto watch = watch_handler(&history);
+  TestServer shardmaster(
+      sm_addr, [&](const Request& req, ClientConn* client) -> Response {
+        if (std::holds_alternative<QueryRequest>(req)) {
+          std::unique_lock lock(mtx);
+          return QueryResponse{config};
+        }
+        return watch(req, client);
+      });
+  ASSERT(shardmaster.start());
+
+  MapKvStore store_a, store_b;
+  auto owns = [&](const std::string& addr) {
+    return [&, addr](const std::string& key) {
+      std::unique_lock lock(mtx);
+      return config.get_server(key) == addr;
+    };
+  };
+  TestServer server_a(a, kv_handler(&store_a, owns(a)));
+  TestServer server_b(b, kv_handler(&store_b, owns(b)));
+  ASSERT(server_a.start() && server_b.start());
+
+  {
+    // The watch never brings in a config, so the cached one still expires
+    ShardKvClient client(sm_addr, false, 50ms);
+    ASSERT(client.enable_config_watch());
+    ASSERT(client.Put("key1", "v"));
+    ASSERT_EQ(store_a.AllKeys().size(), 1);
+
+    {
+      std::unique_lock lock(mtx);
+      config = {{{a, {}}, {b, {{"0", "Z"}}}}};
+    }
+    std::this_thread::sleep_for(100ms);
+    std::size_t a_requests = server_a.n_requests;
+    ASSERT(client.Put("key2", "v"));
+    ASSERT_EQ(store_b.AllKeys().size(), 1);
+    ASSERT_EQ(server_a.n_requests.load(), a_requests);
+  }
+  history.close();
+}
+
+int main() {
+  TEST(test_delta);
+  TEST(test_history);
+  TEST(test_follow, test_address(0));
+  TEST(test_client_watch, test_address(1));
+  TEST(test_unpublished_watch, test_address(2));
+  return 0;
+}
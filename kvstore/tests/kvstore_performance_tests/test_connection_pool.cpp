@@ -0,0 +1,152 @@
+#include <atomic>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "client/simple_client.hpp"
+#include "net/connection_pool.hpp"
+#include "net/idle_connections.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Reports Get throughput over loopback through SimpleClient with a fresh
+// connection per request (a pool that keeps nothing) and with the default
+// connection pool. Also checks that the pool drops connections the server has
+// closed, and that parked idle connections are handed back once a request
+// arrives on them.
+
+constexpr std::size_t kGets = 5'000;
+
+std::atomic<int> n_accepted = 0;
+
+// Answers each Get with the key as the value, a thread per connection.
+void serve(int listener_fd) {
+  while (true) {
+    auto client = accept_client(listener_fd);
+    if (!client) return;
+    n_accepted++;
+    std::thread([client] {
+      while (auto req = client->recv_request()) {
+        Response res = ErrorResponse{"unexpected request"};
+        if (auto* get_req = std::get_if<GetRequest>(&*req)) {
+          res = GetResponse{get_req->key};
+        }
+        if (!client->send_response(res)) break;
+      }
+    }).detach();
+  }
+}
+
+double gets_per_sec(const std::string& addr,
+                    std::shared_ptr<ConnectionPool> pool) {
+  SimpleClient client(addr, false, pool);
+  auto start = steady_clock::now();
+  for (std::size_t i = 0; i < kGets; i++) {
+    std::string key = "key" + std::to_string(i);
+    auto value = client.Get(key);
+    ASSERT(value.has_value());
+    ASSERT_EQ(*value, key);
+  }
+  return kGets / duration<double>(steady_clock::now() - start).count();
+}
+
+void test_throughput(const std::string& addr) {
+  int before = n_accepted;
+  double unpooled = gets_per_sec(addr, std::make_shared<ConnectionPool>(0));
+  int unpooled_conns = n_accepted - before;
+
+  before = n_accepted;
+  double pooled = gets_per_sec(addr, std::make_shared<ConnectionPool>());
+  int pooled_conns = n_accepted - before;
+
+  ASSERT_EQ(unpooled_conns, int(kGets));
+  ASSERT_EQ(pooled_conns, 1);
+
+  std::cout << std::fixed << std::setprecision(0)
+            << "connect per request: " << std::setw(8) << unpooled
+            << " gets/s (" << unpooled_conns << " connections)\n"
+            << "pooled:              " << std::setw(8) << pooled
+            << " gets/s (" << pooled_conns << " connection)\n";
+}
+
+void test_evicts_closed_connections(int listener_fd, const std::string& addr) {
+  // The server hangs up on the first connection as soon as it's idle
+  std::thread server([listener_fd] {
+    auto client = accept_client(listener_fd);
+    ASSERT(client);
+    auto req = client->recv_request();
+    ASSERT(req);
+    ASSERT(client->send_response(GetChunkResponse{"", 0}));
+    client->shutdown();
+  });
+
+  auto pool = std::make_shared<ConnectionPool>();
+  {
+    PooledConn conn = pool->acquire(addr);
+    ASSERT(conn);
+    ASSERT(conn.call(GetChunkRequest{"", 0}));
+  }
+  server.join();
+
+  // Give the FIN a moment to arrive
+  std::this_thread::sleep_for(50ms);
+  std::thread serving(serve, listener_fd);
+  serving.detach();
+
+  SimpleClient client(addr, false, pool);
+  auto value = client.Get("after");
+  ASSERT(value.has_value());
+  ASSERT_EQ(*value, "after");
+  // ...over a new connection, rather than the dead one
+  ASSERT_EQ(n_accepted.load(), 1);
+}
+
+void test_parked_connection_returns(int listener_fd, const std::string& addr) {
+  std::promise<std::shared_ptr<ClientConn>> ready;
+  IdleConnections idle([&](std::shared_ptr<ClientConn> client) {
+    ready.set_value(std::move(client));
+  });
+  ASSERT(idle.start());
+
+  auto conn = connect_to_server(addr);
+  ASSERT(conn);
+  auto client = accept_client(listener_fd);
+  ASSERT(client);
+  ASSERT(idle.park(client));
+
+  // Nothing comes back while the connection is quiet
+  auto future = ready.get_future();
+  ASSERT(future.wait_for(50ms) == std::future_status::timeout);
+
+  ASSERT(conn->send_request(GetChunkRequest{"parked", 0}));
+  ASSERT(future.wait_for(5s) == std::future_status::ready);
+  auto woken = future.get();
+  ASSERT(woken == client);
+  auto req = woken->recv_request();
+  ASSERT(req);
+  ASSERT_EQ(std::get<GetChunkRequest>(*req).key, "parked");
+
+  // Stopping hands back whatever is still parked
+  auto other = connect_to_server(addr);
+  ASSERT(other);
+  auto other_client = accept_client(listener_fd);
+  ASSERT(other_client);
+  ASSERT(idle.park(other_client));
+  auto leftover = idle.stop();
+  ASSERT_EQ(leftover.size(), std::size_t(1));
+  ASSERT(leftover[0] == other_client);
+}
+
+int main() {
+  std::string addr = test_address();
+  int listener_fd = open_listener_socket(addr);
+  ASSERT(listener_fd >= 0);
+
+  TEST(test_parked_connection_returns, listener_fd, addr);
+  TEST(test_evicts_closed_connections, listener_fd, addr);
+  // The serving thread from the previous test stays up for this one
+  TEST(test_throughput, addr);
+  return 0;
+}
@@ -0,0 +1,156 @@
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "client/shardkv_client.hpp"
+#include "shardmaster/consistent_shardmaster.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Simulates servers joining and leaving a cluster, comparing the fraction of
+// keys that move when shards are re-split evenly with split_into (server i
+// gets shard i) against a consistent-hashing HashRing. Then reports how evenly
+// the ring spreads keys over servers for a range of virtual node counts.
+// Finally, runs a ConsistentShardmaster and checks Join/Leave/Move/Query
+// through a client.
+
+constexpr std::size_t kKeys = 200'000;
+
+// Keys spread evenly over the shard alphabet.
+std::vector<std::string> make_keys() {
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<std::size_t> dist(0, VALID_CHARS.size() - 1);
+  std::vector<std::string> keys(kKeys);
+  for (auto&& key : keys) {
+    for (int i = 0; i < 8; i++) key += VALID_CHARS[dist(rng)];
+  }
+  return keys;
+}
+
+std::string server_name(std::size_t i) {
+  return "10.0." + std::to_string(i / 256) + '.' + std::to_string(i % 256) +
+         ":4000";
+}
+
+ShardmasterConfig split_config(std::size_t n) {
+  ShardmasterConfig config;
+  std::vector<Shard> shards = split_into(n);
+  for (std::size_t i = 0; i < n; i++) {
+    config.servers.push_back({server_name(i), {shards[i]}});
+  }
+  return config;
+}
+
+// Fraction of keys that are on a different server under after than before.
+double moved(const std::vector<std::string>& keys,
+             const ShardmasterConfig& before, const ShardmasterConfig& after) {
+  ShardRouter from(before), to(after);
+  std::size_t n = 0;
+  for (auto&& key : keys) {
+    const std::string* a = from.server_for(key);
+    const std::string* b = to.server_for(key);
+    ASSERT(a && b);
+    n += *a != *b;
+  }
+  return double(n) / keys.size();
+}
+
+void test_moved_keys() {
+  std::vector<std::string> keys = make_keys();
+  std::cout << std::fixed << std::setprecision(3)
+            << "change        | ideal | split_into | ring (" << RING_VNODES
+            << " vnodes)\n";
+  for (std::size_t n : {10, 50, 200}) {
+    HashRing ring;
+    for (std::size_t i = 0; i < n; i++) ring.add(server_name(i));
+    ShardmasterConfig before = ring.config();
+
+    // Join
+    ring.add(server_name(n));
+    double ring_join = moved(keys, before, ring.config());
+    double split_join = moved(keys, split_config(n), split_config(n + 1));
+    // Leave, from the middle
+    ring.remove(server_name(n));
+    ring.remove(server_name(n / 2));
+    ShardmasterConfig split_left = split_config(n);
+    split_left.servers.erase(split_left.servers.begin() + n / 2);
+    std::vector<Shard> shards = split_into(n - 1);
+    for (std::size_t i = 0; i < n - 1; i++) {
+      split_left.servers[i].shards = {shards[i]};
+    }
+    double ring_leave = moved(keys, before, ring.config());
+    double split_leave = moved(keys, split_config(n), split_left);
+
+    std::cout << std::setw(4) << n << " -> " << std::setw(4) << n + 1
+              << " | " << 1.0 / (n + 1) << " | " << std::setw(10)
+              << split_join << " | " << ring_join << '\n'
+              << std::setw(4) << n << " -> " << std::setw(4) << n - 1
+              << " | " << 1.0 / n << " | " << std::setw(10) << split_leave
+              << " | " << ring_leave << '\n';
+    ASSERT(ring_join < 2.0 / (n + 1));
+    ASSERT(ring_leave < 2.0 / n);
+    ASSERT(split_join > 5 * ring_join);
+  }
+}
+
+void test_balance() {
+  constexpr std::size_t kServers = 50;
+  std::vector<std::string> keys = make_keys();
+  std::cout << std::fixed << std::setprecision(2) << kServers
+            << " servers: vnodes | max/mean keys | stddev/mean | shards\n";
+  for (std::size_t vnodes : {1, 16, 128, 512}) {
+    HashRing ring(vnodes);
+    for (std::size_t i = 0; i < kServers; i++) ring.add(server_name(i));
+    ShardmasterConfig config = ring.config();
+    ShardRouter router(config);
+
+    std::map<std::string, std::size_t> load;
+    for (auto&& key : keys) load[*router.server_for(key)]++;
+    double mean = double(kKeys) / kServers, max = 0, var = 0;
+    for (auto&& sc : config.servers) {
+      double n = load[sc.server];
+      max = std::max(max, n);
+      var += (n - mean) * (n - mean) / kServers;
+    }
+    std::size_t shards = 0;
+    for (auto&& sc : config.servers) shards += sc.shards.size();
+    std::cout << "            " << std::setw(6) << vnodes << " | "
+              << std::setw(13) << max / mean << " | " << std::setw(11)
+              << std::sqrt(var) / mean << " | " << shards << '\n';
+    if (vnodes == RING_VNODES) ASSERT(max / mean < 1.3);
+  }
+}
+
+void test_shardmaster(const std::string& addr) {
+  ConsistentShardmaster shardmaster(addr);
+  ASSERT(shardmaster.start() == 0);
+  {
+    ShardKvClient client(addr);
+    for (std::size_t i = 0; i < 3; i++) ASSERT(client.Join(server_name(i)));
+    ASSERT(!client.Join(server_name(0)));
+    ASSERT(!client.Move(server_name(0), {{"A", "B"}}));
+
+    auto config = client.Query();
+    ASSERT(config);
+    ASSERT_EQ(config->servers.size(), 3);
+    ShardRouter router(*config);
+    for (auto&& key : {"0000", "hello", "ZZZZZZ", "user1"}) {
+      ASSERT(router.server_for(key));
+    }
+
+    ASSERT(client.Leave(server_name(1)));
+    config = client.Query();
+    ASSERT(config && config->servers.size() == 2);
+    ASSERT(config->servers[1].server == server_name(2));
+  }
+  shardmaster.stop();
+}
+
+int main() {
+  TEST(test_moved_keys);
+  TEST(test_balance);
+  TEST(test_shardmaster, test_address(0));
+  return 0;
+}
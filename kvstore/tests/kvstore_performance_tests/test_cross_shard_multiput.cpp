@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "client/shardkv_client.hpp"
+#include "server/transactions.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Times kBatches MultiPuts of kBatchKeys keys each through ShardKvClient to 4
+// stand-in KvServers, as transactions (MultiPut) and server by server
+// (MultiPutEach): first with each batch's keys spread over the servers, then
+// with them all on one server. Reports each's mean and p99 latency and the
+// requests the servers saw. Then checks that a MultiPut that can't reach one
+// of its servers writes nothing, that overlapping MultiPuts don't interleave,
+// that writes to keys a transaction holds wait for it, and that servers give
+// up on transactions that are never committed.
+
+constexpr std::size_t kServers = 4;
+constexpr std::size_t kBatches = 500;
+constexpr std::size_t kBatchKeys = 8;
+
+ShardmasterConfig make_config() {
+  ShardmasterConfig config;
+  std::vector<Shard> shards = split_into(kServers);
+  for (std::size_t i = 0; i < kServers; i++) {
+    config.servers.push_back({test_address(1 + i), {shards[i]}});
+  }
+  return config;
+}
+
+struct Servers {
+  std::vector<std::unique_ptr<MapKvStore>> stores;
+  std::vector<std::unique_ptr<TestServer>> servers;
+
+  std::size_t n_requests() {
+    std::size_t n = 0;
+    for (auto& server : servers) n += server->n_requests;
+    return n;
+  }
+};
+
+// n distinct keys with prefix (after a leading digit or letter, since shards
+// split the keys by range) that server i owns.
+std::vector<std::string> keys_on(std::size_t i, std::size_t n,
+                                 const std::string& prefix) {
+  ShardRouter router(make_config());
+  std::vector<std::string> keys;
+  for (std::size_t j = 0; keys.size() < n; j++) {
+    std::string key = "0123456789abcdefghijklmnopqrstuvwxyz"[j % 36] + prefix +
+                      std::to_string(j);
+    if (router.get_server(key) == test_address(1 + i)) keys.push_back(key);
+  }
+  return keys;
+}
+
+void run_batches(const std::string& name, Servers& servers,
+                 const std::vector<std::vector<std::string>>& batches,
+                 const std::function<bool(const std::vector<std::string>&,
+                                          const std::vector<std::string>&)>&
+                     multiput) {
+  std::vector<double> latencies_us;
+  std::size_t before = servers.n_requests();
+  for (auto&& keys : batches) {
+    auto issued = steady_clock::now();
+    ASSERT(multiput(keys, keys));
+    latencies_us.push_back(
+        duration<double, std::micro>(steady_clock::now() - issued).count());
+  }
+  std::size_t requests = servers.n_requests() - before;
+
+  std::sort(latencies_us.begin(), latencies_us.end());
+  double mean = 0;
+  for (double latency : latencies_us) mean += latency / latencies_us.size();
+  double p99 = latencies_us[latencies_us.size() * 99 / 100];
+  std::cout << std::left << std::setw(24) << name << std::right << std::fixed
+            << std::setprecision(0) << "latency mean " << std::setw(6) << mean
+            << "us, p99 " << std::setw(6) << p99 << "us   " << std::setw(5)
+            << requests << " requests\n";
+}
+
+void test_overhead(const std::string& sm_addr, Servers& servers) {
+  ShardKvClient client(sm_addr);
+  auto atomic = [&](auto& keys, auto& values) {
+    return client.MultiPut(keys, values);
+  };
+  auto each = [&](auto& keys, auto& values) {
+    return client.MultiPutEach(keys, values);
+  };
+
+  // Each batch spans every server, a round trip to each per phase...
+  std::vector<std::vector<std::string>> spread;
+  std::vector<std::vector<std::string>> per_server(kServers);
+  for (std::size_t i = 0; i < kServers; i++) {
+    per_server[i] = keys_on(i, kBatches * kBatchKeys / kServers, "spread");
+  }
+  for (std::size_t b = 0; b < kBatches; b++) {
+    spread.emplace_back();
+    for (std::size_t k = 0; k < kBatchKeys; k++) {
+      spread.back().push_back(per_server[k % kServers][(b * kBatchKeys + k) /
+                                                        kServers]);
+    }
+  }
+  std::size_t before = servers.n_requests();
+  run_batches("spread, each server", servers, spread, each);
+  std::size_t each_requests = servers.n_requests() - before;
+  before = servers.n_requests();
+  run_batches("spread, transaction", servers, spread, atomic);
+  ASSERT_EQ(servers.n_requests() - before, 2 * each_requests);
+
+  // ...while a batch on one server goes out as a plain MultiPut either way
+  std::vector<std::string> one = keys_on(0, kBatches * kBatchKeys, "one");
+  std::vector<std::vector<std::string>> single;
+  for (std::size_t b = 0; b < kBatches; b++) {
+    single.emplace_back(one.begin() + b * kBatchKeys,
+                        one.begin() + (b + 1) * kBatchKeys);
+  }
+  before = servers.n_requests();
+  run_batches("one server, each server", servers, single, each);
+  ASSERT_EQ(servers.n_requests() - before, kBatches);
+  before = servers.n_requests();
+  run_batches("one server, transaction", servers, single, atomic);
+  ASSERT_EQ(servers.n_requests() - before, kBatches);
+
+  ASSERT_EQ(*client.Get(spread.back().back()), spread.back().back());
+  ASSERT_EQ(*client.Get(single.back().back()), single.back().back());
+}
+
+void test_overlapping_multiputs(const std::string& sm_addr) {
+  // Every thread writes the same keys, one on each server, over and over;
+  // each MultiPut lands whole, so the keys always end up alike
+  std::vector<std::string> keys;
+  for (std::size_t i = 0; i < kServers; i++) {
+    keys.push_back(keys_on(i, 1, "shared")[0]);
+  }
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&, t] {
+      ShardKvClient client(sm_addr);
+      for (int i = 0; i < 50; i++) {
+        std::string value = std::to_string(t) + "-" + std::to_string(i);
+        ASSERT(client.MultiPut(keys, std::vector(keys.size(), value)));
+      }
+    });
+  }
+  for (auto&& thread : threads) thread.join();
+
+  ShardKvClient client(sm_addr);
+  auto values = client.MultiGet(keys);
+  ASSERT(values.has_value());
+  for (auto&& value : *values) ASSERT_EQ(value, values->front());
+}
+
+void test_writes_wait(Servers& servers) {
+  std::string key = keys_on(0, 1, "held")[0];
+  std::string server = servers.servers[0]->address;
+  SimpleClient holder(server), writer(server);
+  ASSERT(holder.Prepare(1, {key}, {"prepared"}));
+
+  // Other transactions are turned down...
+  ASSERT(!writer.Prepare(2, {key}, {"other"}));
+  ASSERT_EQ(writer.last_error(), KEY_LOCKED_ERROR);
+
+  // ...and plain writes wait for the commit, landing after it
+  auto start = steady_clock::now();
+  std::thread put([&] { ASSERT(writer.Put(key, "after")); });
+  std::this_thread::sleep_for(20ms);
+  // (Reads don't wait: neither the prepared value nor the Put is in yet)
+  ASSERT(!holder.Get(key).has_value());
+  ASSERT(holder.Commit(1, true));
+  put.join();
+  ASSERT(steady_clock::now() - start >= 20ms);
+  ASSERT_EQ(*writer.Get(key), "after");
+
+  // Commits can be retried; unknown transactions can't be committed
+  ASSERT(holder.Commit(1, true));
+  ASSERT(!holder.Commit(3, true));
+  ASSERT_EQ(holder.last_error(), TXN_UNKNOWN_ERROR);
+  // Aborted transactions leave no trace
+  ASSERT(holder.Prepare(4, {key}, {"aborted"}));
+  ASSERT(holder.Commit(4, false));
+  ASSERT_EQ(*writer.Get(key), "after");
+  ASSERT(writer.Put(key, "unlocked"));
+}
+
+void test_unreachable_server(const std::string& sm_addr, Servers& servers) {
+  std::string reachable = keys_on(0, 1, "partial")[0];
+  std::string unreachable = keys_on(kServers - 1, 1, "partial")[0];
+  servers.servers.back()->stop();
+
+  // The transaction is called off on the server that could take its pair...
+  ShardKvClient client(sm_addr);
+  ASSERT(!client.MultiPut({reachable, unreachable}, {"a", "b"}));
+  ASSERT(!client.Get(reachable).has_value());
+  ASSERT(client.Put(reachable, "unlocked"));
+
+  // ...while server-by-server MultiPuts leave it half done
+  ASSERT(!client.MultiPutEach({reachable, unreachable}, {"a", "b"}));
+  ASSERT_EQ(*client.Get(reachable), "a");
+}
+
+void test_transaction_expiry() {
+  TransactionTable table(50ms);
+  ASSERT(!table.locked("k1"));
+  ASSERT(table.prepare(1, {"k1", "k2"}, {"v1", "v2"}));
+  ASSERT(table.locked("k1"));
+  ASSERT(table.locked(std::vector<std::string>{"k0", "k2"}));
+  ASSERT(!table.prepare(2, {"k2", "k3"}, {"v2", "v3"}));
+  ASSERT(!table.locked("k3"));
+
+  // Given up on once its time is up, and can't be committed after
+  auto start = steady_clock::now();
+  table.await_released([](const std::string& key) { return key == "k2"; });
+  ASSERT(steady_clock::now() - start >= 40ms);
+  ASSERT(!table.locked(std::vector<std::string>{"k1", "k2"}));
+  bool written = false;
+  ASSERT(!table.commit(1, [&](const MultiPutRequest&) {
+    return written = true;
+  }));
+  ASSERT(!written);
+
+  // Commits hand over the pairs, and unlock them once they're written
+  ASSERT(table.prepare(3, {"k2", "k3"}, {"v2", "v3"}));
+  ASSERT(table.commit(3, [&](const MultiPutRequest& pairs) {
+    ASSERT(table.locked("k3"));
+    ASSERT(pairs.keys == std::vector<std::string>({"k2", "k3"}));
+    ASSERT(pairs.values == std::vector<std::string>({"v2", "v3"}));
+    return true;
+  }));
+  ASSERT(!table.locked("k3"));
+}
+
+int main() {
+  TestServer shardmaster(test_address(0), query_handler(make_config));
+  ASSERT(shardmaster.start());
+
+  Servers servers;
+  for (std::size_t i = 0; i < kServers; i++) {
+    servers.stores.push_back(std::make_unique<MapKvStore>());
+    servers.servers.push_back(std::make_unique<TestServer>(
+        test_address(1 + i), kv_handler(servers.stores.back().get())));
+    ASSERT(servers.servers.back()->start());
+  }
+
+  TEST(test_overhead, shardmaster.address, servers);
+  TEST(test_overlapping_multiputs, shardmaster.address);
+  TEST(test_writes_wait, servers);
+  TEST(test_unreachable_server, shardmaster.address, servers);
+  TEST(test_transaction_expiry);
+  return 0;
+}
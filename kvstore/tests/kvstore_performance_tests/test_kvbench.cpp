@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "bench/histogram.hpp"
+#include "bench/workload.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Checks the pieces kvbench is built from: that its histogram's percentiles
+// are within its stated precision of the exact ones, that its key choosers
+// have the right skew, and that operation mixes come out in proportion.
+
+constexpr std::size_t kSamples = 1'000'000;
+
+void test_histogram_percentiles() {
+  std::mt19937_64 rng(1);
+  // Latencies spanning several orders of magnitude
+  std::lognormal_distribution<double> latency_us(5, 1.5);
+  LatencyHistogram histogram;
+  std::vector<int64_t> exact;
+  for (std::size_t i = 0; i < kSamples; i++) {
+    auto latency = nanoseconds(int64_t(latency_us(rng) * 1000));
+    histogram.record(latency);
+    exact.push_back(latency.count());
+  }
+  std::sort(exact.begin(), exact.end());
+
+  ASSERT_EQ(histogram.count(), kSamples);
+  ASSERT_EQ(histogram.max().count(), exact.back());
+  for (double percentile : {1.0, 50.0, 90.0, 99.0, 99.9, 99.99}) {
+    double want = exact[std::size_t(percentile / 100 * kSamples + 0.5) - 1];
+    double got = histogram.percentile(percentile).count();
+    ASSERT(got >= want);
+    ASSERT(got <= want * 1.01);
+  }
+
+  // Merging is the same as recording everything in one
+  LatencyHistogram a, b;
+  for (std::size_t i = 0; i < exact.size(); i++) {
+    (i % 2 ? a : b).record(nanoseconds(exact[i]));
+  }
+  a.merge(b);
+  ASSERT_EQ(a.count(), histogram.count());
+  ASSERT_EQ(a.percentile(99).count(), histogram.percentile(99).count());
+}
+
+void test_zipfian_skew() {
+  constexpr uint64_t kRecords = 10'000;
+  KeyChooser keys(KeyDistribution::ZIPFIAN, kRecords);
+  std::mt19937_64 rng(2);
+  std::vector<std::size_t> counts(kRecords);
+  for (std::size_t i = 0; i < kSamples; i++) counts[keys.next_existing(rng)]++;
+
+  // The hottest 1% of keys get about half the accesses (it's 53% for theta
+  // 0.99), and key 0 the most of all
+  std::size_t top = 0;
+  for (uint64_t i = 0; i < kRecords / 100; i++) top += counts[i];
+  ASSERT(top > kSamples * 4 / 10);
+  ASSERT(top < kSamples * 7 / 10);
+  ASSERT(std::max_element(counts.begin(), counts.end()) == counts.begin());
+}
+
+void test_uniform_and_latest() {
+  constexpr uint64_t kRecords = 100;
+  std::mt19937_64 rng(3);
+
+  KeyChooser uniform(KeyDistribution::UNIFORM, kRecords);
+  std::vector<std::size_t> counts(kRecords);
+  for (std::size_t i = 0; i < kSamples; i++) {
+    counts[uniform.next_existing(rng)]++;
+  }
+  auto [fewest, most] = std::minmax_element(counts.begin(), counts.end());
+  ASSERT(*most < *fewest * 1.2);
+
+  // Writes insert new records, which then become the hottest
+  KeyChooser latest(KeyDistribution::LATEST, kRecords);
+  uint64_t inserted = latest.next_write(rng);
+  ASSERT_EQ(inserted, kRecords);
+  latest.acknowledge(inserted);
+  counts.assign(kRecords + 1, 0);
+  for (std::size_t i = 0; i < kSamples; i++) {
+    counts[latest.next_existing(rng)]++;
+  }
+  ASSERT(std::max_element(counts.begin(), counts.end()) ==
+         counts.begin() + inserted);
+}
+
+void test_key_names() {
+  KeyChooser keys(KeyDistribution::UNIFORM, 100'000);
+  std::set<std::string> names;
+  for (uint64_t i = 0; i < 100'000; i++) {
+    std::string name = keys.key_name(i);
+    ASSERT(is_valid(name));
+    names.insert(name);
+  }
+  ASSERT_EQ(names.size(), std::size_t(100'000));
+
+  KeyChooser prefixed(KeyDistribution::UNIFORM, 10, "user");
+  ASSERT_EQ(prefixed.key_name(7).rfind("user", 0), std::size_t(0));
+}
+
+void test_mix_proportions() {
+  WorkloadMix mix{.get = 0.7, .put = 0.1, .append = 0.05, .multi_get = 0.15};
+  std::mt19937_64 rng(4);
+  std::vector<std::size_t> counts(std::size_t(OpType::COUNT));
+  for (std::size_t i = 0; i < kSamples; i++) {
+    counts[std::size_t(mix.choose(uniform01(rng)))]++;
+  }
+  auto near = [](std::size_t count, double fraction) {
+    return std::abs(double(count) / kSamples - fraction) < 0.005;
+  };
+  ASSERT(near(counts[std::size_t(OpType::GET)], 0.7));
+  ASSERT(near(counts[std::size_t(OpType::PUT)], 0.1));
+  ASSERT(near(counts[std::size_t(OpType::APPEND)], 0.05));
+  ASSERT(near(counts[std::size_t(OpType::MULTI_GET)], 0.15));
+
+  ASSERT(WorkloadMix::preset('c')->choose(0.999) == OpType::GET);
+  ASSERT(!WorkloadMix::preset('Z'));
+}
+
+int main() {
+  TEST(test_histogram_percentiles);
+  TEST(test_zipfian_skew);
+  TEST(test_uniform_and_latest);
+  TEST(test_key_names);
+  TEST(test_mix_proportions);
+  return 0;
+}
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+
+#include "client/shardkv_client.hpp"
+#include "shardmaster/dynamic_shardmaster.hpp"
+#include "shardmaster/rebalance.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Simulates a skewed workload on a cluster split evenly with split_into: most
+// requests are for user keys, which all start with "u", so nearly all of
+// them land on one server. Each round, the servers' per-shard load goes
+// through rebalance (as their load reports would to a DynamicShardmaster);
+// reports the max/min server load as hot shards are split and moved, and
+// checks that it settles and then stays put. Then runs a DynamicShardmaster
+// and checks that it rebalances only on fresh reports from every server.
+
+constexpr std::size_t kServers = 8;
+constexpr std::size_t kRequests = 100'000;
+constexpr std::size_t kRounds = 10;
+// Fraction of requests for user keys
+constexpr double kSkew = 0.8;
+
+std::string server_name(std::size_t i) {
+  return "server" + std::to_string(i);
+}
+
+// A round's requests: user keys ("u" and an id), and other keys spread over
+// the shard alphabet.
+std::vector<std::string> make_requests(std::mt19937& rng) {
+  std::uniform_int_distribution<std::size_t> chars(0, VALID_CHARS.size() - 1);
+  std::bernoulli_distribution user(kSkew);
+  std::vector<std::string> keys(kRequests);
+  for (auto&& key : keys) {
+    key = user(rng) ? "u" : std::string(1, VALID_CHARS[chars(rng)]);
+    for (int i = 0; i < 7; i++) key += VALID_CHARS[chars(rng)];
+  }
+  return keys;
+}
+
+// What each server would report: requests for each of its shards.
+std::map<std::string, std::vector<ShardLoad>> measure(
+    const ShardmasterConfig& config, const std::vector<std::string>& keys) {
+  std::map<std::string, std::vector<ShardLoad>> loads;
+  for (auto&& sc : config.servers) {
+    for (auto&& shard : sc.shards) loads[sc.server].push_back({shard, 0, 0});
+  }
+  for (auto&& key : keys) {
+    std::string upper = to_upper(key);
+    for (auto&& [server, shards] : loads) {
+      auto it = std::find_if(shards.begin(), shards.end(), [&](auto&& load) {
+        return load.shard.contains(upper);
+      });
+      if (it != shards.end()) {
+        it->rate++;
+        break;
+      }
+    }
+  }
+  return loads;
+}
+
+// Max and min total load on a server.
+std::pair<double, double> extremes(
+    const std::map<std::string, std::vector<ShardLoad>>& loads) {
+  double max = 0, min = kRequests;
+  for (auto&& [server, shards] : loads) {
+    double load = 0;
+    for (auto&& shard : shards) load += shard.rate;
+    max = std::max(max, load);
+    min = std::min(min, load);
+  }
+  return {max, min};
+}
+
+void test_skewed_workload() {
+  ShardmasterConfig config;
+  std::vector<Shard> shards = split_into(kServers);
+  for (std::size_t i = 0; i < kServers; i++) {
+    config.servers.push_back({server_name(i), {shards[i]}});
+  }
+
+  std::mt19937 rng(42);
+  double mean = double(kRequests) / kServers, first_ratio = 0, last_max = 0;
+  std::size_t last_change = 0;
+  std::cout << std::fixed << std::setprecision(2) << kServers
+            << " servers, " << kSkew * 100 << "% of requests for \"u\" keys\n"
+            << "round | max/min load | max/mean | shards | rebalanced\n";
+  for (std::size_t round = 0; round < kRounds; round++) {
+    auto loads = measure(config, make_requests(rng));
+    auto [max, min] = extremes(loads);
+    if (round == 0) first_ratio = max / min;
+    last_max = max;
+
+    bool changed = rebalance(&config, loads);
+    if (changed) last_change = round;
+    std::size_t n_shards = 0;
+    for (auto&& sc : config.servers) n_shards += sc.shards.size();
+    std::cout << std::setw(5) << round << " | " << std::setw(12) << max / min
+              << " | " << std::setw(8) << max / mean << " | " << std::setw(6)
+              << n_shards << " | " << (changed ? "yes" : "no") << '\n';
+  }
+  ASSERT(first_ratio > 10);
+  // Settled under the high water mark, and stayed there through noise
+  ASSERT(last_max / mean <= REBALANCE_HIGH_WATER);
+  ASSERT(last_change < kRounds - 3);
+
+  // Every key still has exactly one server
+  ShardRouter router(config);
+  for (auto&& key : make_requests(rng)) ASSERT(router.server_for(key));
+}
+
+void test_hysteresis() {
+  ShardmasterConfig config{{{"a", {{"0", "H"}}},
+                            {"b", {{"I", "Q"}}},
+                            {"c", {{"R", "Z"}}}}};
+  // Up to the high water mark is left alone
+  std::map<std::string, std::vector<ShardLoad>> loads{
+      {"a", {{{"0", "H"}, 140, 0}}},
+      {"b", {{{"I", "Q"}, 80, 0}}},
+      {"c", {{{"R", "Z"}, 80, 0}}}};
+  ASSERT(!rebalance(&config, loads));
+  // Past it, the hot shard is split, and pieces go to the others
+  loads["a"][0].rate = 200;
+  ASSERT(rebalance(&config, loads));
+  ASSERT(config.servers[1].shards.size() > 1);
+  ASSERT(config.servers[2].shards.size() > 1);
+  ShardRouter router(config);
+  for (char c : VALID_CHARS) ASSERT(router.server_for(std::string(4, c)));
+  // Nothing to go on, nothing to do
+  ASSERT(!rebalance(&config, {}));
+}
+
+void test_shardmaster(const std::string& addr) {
+  DynamicShardmaster shardmaster(addr, 0ms);
+  ASSERT(shardmaster.start() == 0);
+  {
+    ShardKvClient client(addr);
+    ASSERT(client.Join(server_name(0)));
+    ASSERT(client.Join(server_name(1)));
+    ASSERT(!client.Move(server_name(0), {{"A", "B"}}));
+    auto config = client.Query();
+    ASSERT(config && config->servers.size() == 2);
+    Shard first = config->servers[0].shards[0],
+          second = config->servers[1].shards[0];
+
+    auto conn = connect_to_server(addr);
+    ASSERT(conn);
+    auto report = [&](const std::string& server, const Shard& shard,
+                      double rate) {
+      ReportLoadRequest req{server, {{shard, rate, 0}}};
+      ASSERT(conn->send_request(req));
+      auto res = conn->recv_response();
+      return res && std::holds_alternative<ReportLoadResponse>(*res);
+    };
+    // Not until every server has reported
+    ASSERT(report(server_name(0), first, 1000));
+    ASSERT_EQ(client.Query()->servers[0].shards.size(), 1);
+    // Reports on other shards (from before a change) are dropped
+    ASSERT(report(server_name(1), first, 10));
+    ASSERT_EQ(client.Query()->servers[0].shards.size(), 1);
+    ASSERT(!report(server_name(2), first, 10));
+
+    ASSERT(report(server_name(1), second, 10));
+    config = client.Query();
+    ASSERT(config);
+    ASSERT(config->servers[1].shards.size() > 1);
+  }
+  shardmaster.stop();
+}
+
+int main() {
+  TEST(test_skewed_workload);
+  TEST(test_hysteresis);
+  TEST(test_shardmaster, test_address(0));
+  return 0;
+}
@@ -0,0 +1,108 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "client/shardkv_client.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Reports the latency of a 1000-key MultiGet spread over 8 stand-in KvServers,
+// made one server after another (as ShardKvClient used to) and through
+// ShardKvClient, which asks the servers concurrently. Loopback round trips
+// are nearly free, so each server can also be made to wait before answering,
+// to stand in for a network round trip.
+
+constexpr std::size_t kServers = 8;
+constexpr std::size_t kKeys = 1000;
+constexpr std::size_t kIters = 50;
+
+milliseconds server_delay = 0ms;
+
+ShardmasterConfig make_config() {
+  ShardmasterConfig config;
+  std::vector<Shard> shards = split_into(kServers);
+  for (std::size_t i = 0; i < kServers; i++) {
+    config.servers.push_back({test_address(1 + i), {shards[i]}});
+  }
+  return config;
+}
+
+// A MultiGet the way ShardKvClient used to make one: group the keys by server,
+// then ask each server in turn.
+std::optional<std::vector<std::string>> serial_multiget(
+    ShardmasterConfig& config, const std::vector<std::string>& keys) {
+  std::map<std::string, std::vector<std::size_t>> server_positions;
+  for (std::size_t i = 0; i < keys.size(); i++) {
+    server_positions[*config.get_server(keys[i])].push_back(i);
+  }
+  std::vector<std::string> values(keys.size());
+  for (auto&& [server, positions] : server_positions) {
+    std::vector<std::string> group;
+    for (auto i : positions) group.push_back(keys[i]);
+    auto group_values = SimpleClient(server).MultiGet(group);
+    if (!group_values) return std::nullopt;
+    for (std::size_t i = 0; i < positions.size(); i++) {
+      values[positions[i]] = std::move((*group_values)[i]);
+    }
+  }
+  return values;
+}
+
+// Mean latency of get(), in ms.
+template <typename Fn>
+double mean_ms(Fn get) {
+  auto start = steady_clock::now();
+  for (std::size_t i = 0; i < kIters; i++) get();
+  return duration<double, std::milli>(steady_clock::now() - start).count() /
+         kIters;
+}
+
+void test_multiget_latency(const std::string& sm_addr, milliseconds delay) {
+  server_delay = delay;
+  ShardmasterConfig config = make_config();
+  ShardKvClient client(sm_addr);
+
+  std::vector<std::string> keys = make_rand_strs(kKeys, 8);
+  std::vector<std::string> values = make_rand_strs(kKeys, 16);
+  ASSERT(client.MultiPut(keys, values));
+
+  double serial = mean_ms([&] {
+    auto got = serial_multiget(config, keys);
+    ASSERT(got.has_value());
+    ASSERT(*got == values);
+  });
+
+  double parallel = mean_ms([&] {
+    auto got = client.MultiGet(keys);
+    ASSERT(got.has_value());
+    ASSERT(*got == values);
+  });
+
+  std::cout << std::fixed << std::setprecision(2) << "server delay "
+            << delay.count() << "ms: one at a time " << std::setw(6) << serial
+            << " ms, concurrent " << std::setw(6) << parallel << " ms\n";
+  if (delay > 0ms) ASSERT(parallel < serial / 2);
+}
+
+int main() {
+  TestServer shardmaster(test_address(0), query_handler(make_config));
+  ASSERT(shardmaster.start());
+
+  std::vector<std::unique_ptr<MapKvStore>> stores;
+  std::vector<std::unique_ptr<TestServer>> servers;
+  for (std::size_t i = 0; i < kServers; i++) {
+    stores.push_back(std::make_unique<MapKvStore>());
+    auto serve = kv_handler(stores.back().get());
+    servers.push_back(std::make_unique<TestServer>(
+        test_address(1 + i), [serve](const Request& req, ClientConn* client) {
+          std::this_thread::sleep_for(server_delay);
+          return serve(req, client);
+        }));
+    ASSERT(servers.back()->start());
+  }
+
+  TEST(test_multiget_latency, shardmaster.address, 0ms);
+  TEST(test_multiget_latency, shardmaster.address, 2ms);
+  return 0;
+}
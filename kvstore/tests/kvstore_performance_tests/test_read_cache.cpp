@@ -0,0 +1,128 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "client/shardkv_client.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Reads a handful of hot keys (with the odd write mixed in) through
+// ShardKvClient against 2 stand-in KvServers that lease out values, with and
+// without the client's read cache, reporting the cache's hit rate and how many
+// requests reached the servers. Then checks the cache's staleness bounds:
+// other clients' writes show up within a lease, our own writes straight away,
+// and keys being written aren't leased at all.
+
+constexpr std::size_t kServers = 2;
+constexpr std::size_t kKeys = 20;
+constexpr std::size_t kOps = 20'000;
+constexpr microseconds kLease = 200ms;
+
+ShardmasterConfig make_config() {
+  ShardmasterConfig config;
+  std::vector<Shard> shards = split_into(kServers);
+  for (std::size_t i = 0; i < kServers; i++) {
+    config.servers.push_back({test_address(1 + i), {shards[i]}});
+  }
+  return config;
+}
+
+std::vector<std::unique_ptr<TestServer>> servers;
+
+std::size_t server_requests() {
+  std::size_t n = 0;
+  for (auto& server : servers) n += server->n_requests;
+  return n;
+}
+
+void run_workload(const std::string& sm_addr, bool cached) {
+  ShardKvClient client(sm_addr);
+  if (cached) client.enable_read_cache();
+  std::vector<std::string> keys = make_rand_strs(kKeys, 8);
+  for (auto&& key : keys) ASSERT(client.Put(key, "v" + key));
+
+  std::size_t before = server_requests();
+  auto start = steady_clock::now();
+  for (std::size_t i = 0; i < kOps; i++) {
+    const std::string& key = keys[i % kKeys];
+    // 1% writes
+    if (i % 100 == 99) {
+      ASSERT(client.Put(key, "v" + key));
+    } else {
+      auto value = client.Get(key);
+      ASSERT(value.has_value());
+      ASSERT_EQ(*value, "v" + key);
+    }
+  }
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+  std::size_t requests = server_requests() - before;
+
+  std::cout << std::left << std::setw(9) << (cached ? "cached" : "uncached")
+            << std::right << std::fixed << std::setprecision(0)
+            << std::setw(8) << kOps / elapsed << " ops/s " << std::setw(6)
+            << requests << " server requests";
+  if (cached) {
+    std::cout << std::setprecision(1) << ", hit rate "
+              << 100 * client.read_cache()->hit_rate() << "%";
+    ASSERT(requests < kOps / 4);
+  }
+  std::cout << '\n';
+}
+
+void test_hit_rate(const std::string& sm_addr) {
+  run_workload(sm_addr, false);
+  run_workload(sm_addr, true);
+}
+
+void test_staleness(const std::string& sm_addr) {
+  ShardKvClient reader(sm_addr);
+  reader.enable_read_cache();
+  ShardKvClient writer(sm_addr);
+  ASSERT(writer.Put("config", "old"));
+
+  ASSERT_EQ(*reader.Get("config"), "old");
+  ASSERT_EQ(reader.read_cache()->misses(), std::size_t(1));
+  ASSERT_EQ(*reader.Get("config"), "old");
+  ASSERT_EQ(reader.read_cache()->hits(), std::size_t(1));
+
+  // Someone else's write may go unseen, but only until the lease runs out...
+  ASSERT(writer.Put("config", "new"));
+  auto written = steady_clock::now();
+
+  // ...and the server won't lease the key out again for a while, since it's
+  // being written
+  ShardKvClient other(sm_addr);
+  other.enable_read_cache();
+  ASSERT_EQ(*other.Get("config"), "new");
+  ASSERT(writer.Put("config", "newer"));
+  ASSERT_EQ(*other.Get("config"), "newer");
+  ASSERT(steady_clock::now() - written < kLease);
+
+  std::this_thread::sleep_for(kLease);
+  ASSERT_EQ(*reader.Get("config"), "newer");
+
+  // Our own writes are seen immediately
+  ASSERT(reader.Put("config", "mine"));
+  ASSERT_EQ(*reader.Get("config"), "mine");
+  ASSERT(reader.Delete("config"));
+  ASSERT(!reader.Get("config").has_value());
+}
+
+int main() {
+  TestServer shardmaster(test_address(0), query_handler(make_config));
+  ASSERT(shardmaster.start());
+
+  std::vector<std::unique_ptr<MapKvStore>> stores;
+  for (std::size_t i = 0; i < kServers; i++) {
+    stores.push_back(std::make_unique<MapKvStore>());
+    servers.push_back(std::make_unique<TestServer>(
+        test_address(1 + i), kv_handler(stores[i].get(), nullptr, kLease)));
+    ASSERT(servers.back()->start());
+  }
+
+  TEST(test_hit_rate, shardmaster.address);
+  TEST(test_staleness, shardmaster.address);
+  servers.clear();
+  return 0;
+}
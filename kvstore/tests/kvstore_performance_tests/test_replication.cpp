@@ -0,0 +1,257 @@
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "client/shardkv_client.hpp"
+#include "server/replication.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Runs a stand-in primary KvServer that ships its writes to 2 stand-in
+// backups with BackupStreams, and reads through ShardKvClient from many
+// threads: first from the primary alone, then spread over the replicas with
+// bounded staleness, reporting the read throughput and each server's share.
+// Each server is given a fixed capacity (kServiceTime per request), as the
+// stand-ins all share one machine. Then checks the staleness bound: backups
+// that stop hearing from the primary turn reads away once it's passed, and
+// the reads go to the primary. Also checks that a backup keeps each primary's
+// copies apart, and can drop them, and how configs assign backups.
+
+constexpr std::size_t kBackups = 2;
+constexpr std::size_t kKeys = 100;
+constexpr std::size_t kReaders = 12;
+constexpr microseconds kServiceTime = 1ms;
+constexpr milliseconds kRunTime = 1s;
+constexpr microseconds kStaleness = 50ms;
+
+std::string primary_address() {
+  return test_address(1);
+}
+std::string backup_address(std::size_t i) {
+  return test_address(2 + i);
+}
+
+ShardmasterConfig make_config() {
+  ShardmasterConfig config{{{primary_address(), split_into(1)}}};
+  for (std::size_t i = 0; i < kBackups; i++) {
+    config.servers[0].backups.push_back(backup_address(i));
+  }
+  return config;
+}
+
+// Makes handler take kServiceTime per request, one request at a time, as if
+// the server could take 1/kServiceTime requests a second.
+TestServer::Handler with_capacity(TestServer::Handler handler) {
+  auto mtx = std::make_shared<std::mutex>();
+  return [handler, mtx](const Request& req, ClientConn* client) {
+    std::unique_lock lock(*mtx);
+    std::this_thread::sleep_for(kServiceTime);
+    return handler(req, client);
+  };
+}
+
+MapKvStore primary_store;
+std::vector<std::unique_ptr<BackupStream>> streams;
+std::unique_ptr<TestServer> primary;
+std::vector<std::unique_ptr<Replicas>> backup_replicas;
+std::vector<std::unique_ptr<TestServer>> backups;
+
+// The primary: a KvServer stand-in that passes its writes to the streams.
+TestServer::Handler primary_handler() {
+  auto kv = kv_handler(&primary_store);
+  return [kv](const Request& req, ClientConn* client) {
+    Response res = kv(req, client);
+    auto* put_req = std::get_if<PutRequest>(&req);
+    if (put_req && std::holds_alternative<PutResponse>(res)) {
+      for (auto&& stream : streams) stream->written(put_req->key);
+    }
+    return res;
+  };
+}
+
+std::string key_name(std::size_t i) {
+  return "key" + std::to_string(i);
+}
+
+// Waits for every backup to have value for key, and to be caught up.
+bool await_backups(const std::string& key, const std::string& value) {
+  for (auto deadline = steady_clock::now() + 1s;
+       steady_clock::now() < deadline;
+       std::this_thread::sleep_for(1ms)) {
+    bool done = true;
+    for (std::size_t i = 0; i < kBackups; i++) {
+      GetRequest req{key};
+      GetResponse res;
+      auto copies = backup_replicas[i]->find(primary_address());
+      auto staleness = backup_replicas[i]->staleness(primary_address());
+      done = done && copies && copies->Get(&req, &res) &&
+             res.value == value && staleness && *staleness < kStaleness;
+    }
+    if (done) return true;
+  }
+  return false;
+}
+
+double run_readers(const std::string& sm_addr, bool replicas) {
+  std::vector<std::size_t> before;
+  before.push_back(primary->n_requests);
+  for (auto&& backup : backups) before.push_back(backup->n_requests);
+
+  std::atomic<std::size_t> reads = 0;
+  std::atomic<bool> done = false;
+  std::vector<std::thread> readers;
+  for (std::size_t r = 0; r < kReaders; r++) {
+    readers.emplace_back([&, r] {
+      ShardKvClient client(sm_addr);
+      if (replicas) client.enable_replica_reads(kStaleness);
+      for (std::size_t i = r; !done; i++) {
+        std::string key = key_name(i % kKeys);
+        auto value = client.Get(key);
+        ASSERT(value.has_value());
+        ASSERT_EQ(*value, "v" + key);
+        reads++;
+      }
+    });
+  }
+  std::this_thread::sleep_for(kRunTime);
+  done = true;
+  for (auto&& reader : readers) reader.join();
+
+  double rate = reads / duration<double>(kRunTime).count();
+  std::cout << std::setw(8) << (replicas ? "replicas" : "primary") << " | "
+            << std::setw(11) << std::fixed << std::setprecision(0) << rate
+            << " | " << std::setw(7) << primary->n_requests - before[0];
+  for (std::size_t i = 0; i < kBackups; i++) {
+    std::cout << " | " << std::setw(8)
+              << backups[i]->n_requests - before[1 + i];
+  }
+  std::cout << '\n';
+  return rate;
+}
+
+void test_read_scaling(const std::string& sm_addr) {
+  ShardKvClient writer(sm_addr);
+  for (std::size_t i = 0; i < kKeys; i++) {
+    ASSERT(writer.Put(key_name(i), "v" + key_name(i)));
+  }
+  ASSERT(await_backups(key_name(kKeys - 1), "v" + key_name(kKeys - 1)));
+
+  std::cout << kReaders << " readers, "
+            << duration_cast<microseconds>(kServiceTime).count()
+            << "us per request per server\n"
+            << "reads to | reads / sec | primary | backup 1 | backup 2\n";
+  double primary_only = run_readers(sm_addr, false);
+  double spread = run_readers(sm_addr, true);
+  // (Backups also spend some of their time on heartbeats)
+  ASSERT(spread > 2 * primary_only);
+}
+
+void test_bounded_staleness(const std::string& sm_addr) {
+  ShardKvClient writer(sm_addr);
+  ShardKvClient reader(sm_addr);
+  reader.enable_replica_reads(kStaleness);
+  ASSERT(writer.Put("config", "old"));
+  ASSERT(await_backups("config", "old"));
+  for (int i = 0; i < 10; i++) ASSERT_EQ(*reader.Get("config"), "old");
+
+  // Cut the backups off from the primary's writes
+  for (auto&& stream : streams) stream->stop();
+  ASSERT(writer.Put("config", "new"));
+  SimpleClient backup(backup_address(0));
+  // Within the bound, a backup may still answer with the old value...
+  auto value = backup.GetReplica("config", 10s);
+  ASSERT(value.has_value());
+  ASSERT_EQ(*value, "old");
+
+  // ...but not past it, and reads go to the primary instead
+  std::this_thread::sleep_for(kStaleness);
+  ASSERT(!backup.GetReplica("config", kStaleness).has_value());
+  ASSERT_EQ(backup.last_error(), std::string(REPLICA_TOO_STALE_ERROR));
+  for (int i = 0; i < 10; i++) ASSERT_EQ(*reader.Get("config"), "new");
+}
+
+void test_dropped_copies() {
+  Replicas replicas([] { return std::make_unique<MapKvStore>(); });
+  for (std::string primary : {"a", "b"}) {
+    ReplicateRequest req{primary, {"key"}, {primary}, {}, true, 0};
+    ASSERT(std::holds_alternative<ReplicateResponse>(
+        apply_replication(&replicas, req)));
+  }
+  // Each primary's copies are kept apart
+  ReplicaGetRequest get_req{"key", 1'000'000};
+  std::string primary = "a";
+  Response res = replica_get(nullptr, &replicas, &primary, get_req);
+  ASSERT(std::get<ReplicaGetResponse>(res).value == "a");
+
+  // Once dropped, they're gone, and reads are turned away rather than
+  // answered from nothing
+  replicas.keep_only({"b"});
+  ASSERT(!replicas.find("a"));
+  ASSERT(!replicas.staleness("a"));
+  res = replica_get(nullptr, &replicas, &primary, get_req);
+  ASSERT(std::get<ErrorResponse>(res).msg == REPLICA_TOO_STALE_ERROR);
+  primary = "b";
+  res = replica_get(nullptr, &replicas, &primary, get_req);
+  ASSERT(std::get<ReplicaGetResponse>(res).value == "b");
+}
+
+void test_config_backups() {
+  ShardmasterConfig config;
+  std::vector<Shard> shards = split_into(4);
+  for (std::size_t i = 0; i < 4; i++) {
+    config.servers.push_back({"server" + std::to_string(i), {shards[i]}});
+  }
+  ShardmasterConfig before = config;
+  assign_backups(&config, 2);
+  ASSERT(config.servers[0].backups ==
+         std::vector<std::string>({"server1", "server2"}));
+  ASSERT(config.servers[3].backups ==
+         std::vector<std::string>({"server0", "server1"}));
+
+  // New backups show up in deltas, like new shards do
+  ConfigDelta delta = diff_configs(before, config);
+  ASSERT_EQ(delta.changed.size(), std::size_t(4));
+  apply_delta(&before, delta);
+  ASSERT(before.servers[2].backups == config.servers[2].backups);
+
+  ShardRouter router(config);
+  std::string key(4, VALID_CHARS.back());
+  ASSERT(router.backups_for(key) == config.servers[3].backups);
+
+  // A server can't back itself up
+  assign_backups(&config, 10);
+  ASSERT_EQ(config.servers[0].backups.size(), std::size_t(3));
+  assign_backups(&config, 0);
+  ASSERT(config.servers[0].backups.empty());
+}
+
+int main() {
+  TestServer shardmaster(test_address(0), query_handler(make_config));
+  ASSERT(shardmaster.start());
+  primary = std::make_unique<TestServer>(primary_address(),
+                                         with_capacity(primary_handler()));
+  ASSERT(primary->start());
+  for (std::size_t i = 0; i < kBackups; i++) {
+    backup_replicas.push_back(std::make_unique<Replicas>(
+        [] { return std::make_unique<MapKvStore>(); }));
+    backups.push_back(std::make_unique<TestServer>(
+        backup_address(i), with_capacity(backup_handler(
+                               backup_replicas[i].get(), primary_address()))));
+    ASSERT(backups.back()->start());
+    streams.push_back(std::make_unique<BackupStream>(
+        &primary_store, primary_address(), backup_address(i),
+        [](const std::string&) { return true; }));
+    streams.back()->start();
+  }
+
+  TEST(test_read_scaling, shardmaster.address);
+  TEST(test_bounded_staleness, shardmaster.address);
+  TEST(test_dropped_copies);
+  TEST(test_config_backups);
+  streams.clear();
+  backups.clear();
+  primary.reset();
+  return 0;
+}
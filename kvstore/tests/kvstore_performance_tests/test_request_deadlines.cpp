@@ -0,0 +1,169 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "client/simple_client.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Checks that requests carry deadlines (in either wire format, and in a way
+// servers that predate them can ignore), that servers drop requests they only
+// get to after their deadline without touching the store, and that a
+// SimpleClient with a timeout gives up on a slow server in time. Then
+// overloads a slow server with a burst of pipelined Puts, and compares how
+// long it takes to drain with and without deadlines.
+
+constexpr std::size_t kBurst = 30;
+constexpr milliseconds kWork = 10ms;
+constexpr milliseconds kBurstDeadline = 100ms;
+
+// Makes handler take delay over each request it does (but not ones it drops).
+TestServer::Handler slow(TestServer::Handler handler,
+                         std::shared_ptr<std::atomic<milliseconds>> delay) {
+  return [handler, delay](const Request& req, ClientConn* client) {
+    if (!client->expired()) std::this_thread::sleep_for(delay->load());
+    return handler(req, client);
+  };
+}
+
+bool is_expired(const std::optional<Response>& res) {
+  auto* error_res = res ? std::get_if<ErrorResponse>(&*res) : nullptr;
+  return error_res && error_res->msg == DEADLINE_EXCEEDED_ERROR;
+}
+
+void test_wire() {
+  auto deadline = time_point_cast<microseconds>(system_clock::now());
+  for (auto format : {WireFormat::LEGACY, WireFormat::COMPACT}) {
+    auto msg = serialize_request(PutRequest{"key", "value"}, format);
+    ASSERT(msg);
+    attach_deadline(&*msg, deadline);
+    ASSERT(msg->flags & FLAG_DEADLINE);
+
+    // Servers that don't know about deadlines read the request as usual
+    auto req = deserialize_request(*msg);
+    ASSERT(req);
+    ASSERT_EQ(std::get<PutRequest>(*req).value, "value");
+
+    std::optional<system_clock::time_point> got;
+    ASSERT(detach_deadline(&*msg, &got));
+    ASSERT(got == deadline);
+    ASSERT(!(msg->flags & FLAG_DEADLINE));
+    req = deserialize_request(*msg);
+    ASSERT(req);
+    ASSERT_EQ(std::get<PutRequest>(*req).key, "key");
+
+    // No deadline, none read
+    ASSERT(detach_deadline(&*msg, &got));
+    ASSERT(!got);
+  }
+}
+
+void test_dropped(const std::string& addr) {
+  MapKvStore store;
+  TestServer server(addr, kv_handler(&store));
+  ASSERT(server.start());
+  auto conn = connect_to_server(addr);
+  ASSERT(conn);
+
+  // Both before and after the server agrees to deadlines (and to the compact
+  // format)
+  for (std::size_t i = 0; i < 2; i++) {
+    ASSERT(conn->send_request(PutRequest{"late", "v"},
+                              system_clock::now() - 1ms));
+    ASSERT(is_expired(conn->recv_response()));
+    ASSERT_EQ(store.AllKeys().size(), i);
+
+    ASSERT(conn->send_request(PutRequest{"on_time" + std::to_string(i), "v"},
+                              system_clock::now() + 1s));
+    auto res = conn->recv_response();
+    ASSERT(res && std::holds_alternative<PutResponse>(*res));
+    ASSERT_EQ(store.AllKeys().size(), i + 1);
+  }
+  ASSERT(conn->deadlines);
+  ASSERT(conn->format == WireFormat::COMPACT);
+  conn->shutdown();
+}
+
+void test_client_timeout(const std::string& addr) {
+  MapKvStore store;
+  auto delay = std::make_shared<std::atomic<milliseconds>>(0ms);
+  TestServer server(addr, slow(kv_handler(&store), delay));
+  ASSERT(server.start());
+
+  SimpleClient client(addr, false, std::make_shared<ConnectionPool>());
+  client.set_timeout(50ms);
+  ASSERT(client.Put("fast", "v"));
+
+  delay->store(300ms);
+  auto start = steady_clock::now();
+  ASSERT(!client.Put("slow", "v"));
+  ASSERT(steady_clock::now() - start < 200ms);
+  ASSERT_EQ(client.last_error(), DEADLINE_EXCEEDED_ERROR);
+  // The server got to it too late, so it was never stored
+  std::this_thread::sleep_for(400ms);
+  ASSERT_EQ(store.AllKeys().size(), 1);
+
+  delay->store(0ms);
+  ASSERT(client.Put("fast_again", "v"));
+  ASSERT_EQ(store.AllKeys().size(), 2);
+}
+
+// Sends kBurst Puts at once (with deadlines, if given), returning how long
+// they took to drain and setting *done to how many were stored.
+duration<double> burst(const std::string& addr, bool deadlines,
+                       std::size_t* done) {
+  MapKvStore store;
+  auto delay = std::make_shared<std::atomic<milliseconds>>(kWork);
+  TestServer server(addr, slow(kv_handler(&store), delay));
+  ASSERT(server.start());
+  auto conn = connect_to_server(addr);
+  ASSERT(conn);
+  // Settle the wire format first, so the burst can be pipelined
+  ASSERT(conn->send_request(GetRequest{"none"}));
+  ASSERT(conn->recv_response());
+
+  auto start = steady_clock::now();
+  std::optional<system_clock::time_point> deadline;
+  if (deadlines) deadline = system_clock::now() + kBurstDeadline;
+  for (std::size_t i = 0; i < kBurst; i++) {
+    ASSERT(conn->send_request(PutRequest{"key" + std::to_string(i), "v"},
+                              deadline));
+  }
+  std::size_t expired = 0;
+  for (std::size_t i = 0; i < kBurst; i++) {
+    auto res = conn->recv_response();
+    ASSERT(res);
+    expired += is_expired(res);
+  }
+  duration<double> elapsed = steady_clock::now() - start;
+  *done = store.AllKeys().size();
+  ASSERT_EQ(*done + expired, kBurst);
+  conn->shutdown();
+  return elapsed;
+}
+
+void test_overload(const std::string& addr) {
+  std::size_t done_without, done_with;
+  double without = burst(addr, false, &done_without).count();
+  double with = burst(addr, true, &done_with).count();
+
+  std::cout << std::fixed << std::setprecision(0) << kBurst << " Puts, "
+            << kWork.count() << "ms each:\n"
+            << "no deadlines:    " << std::setw(4) << without * 1e3
+            << "ms to drain, " << done_without << " done\n"
+            << kBurstDeadline.count() << "ms deadlines: " << std::setw(4)
+            << with * 1e3 << "ms to drain, " << done_with << " done, "
+            << kBurst - done_with << " dropped\n";
+  ASSERT_EQ(done_without, kBurst);
+  ASSERT(done_with < kBurst / 2);
+  ASSERT(with < without / 2);
+}
+
+int main() {
+  TEST(test_wire);
+  TEST(test_dropped, test_address(0));
+  TEST(test_client_timeout, test_address(1));
+  TEST(test_overload, test_address(2));
+  return 0;
+}
@@ -0,0 +1,254 @@
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "client/shardkv_client.hpp"
+#include "server/forwarding.hpp"
+#include "shardmaster/config_history.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Moves every key from stand-in server A to stand-in server B while kClients
+// clients still route with the config that gives them to A, and times each
+// client's next kOps Gets: first with A refusing them (so each client
+// re-queries the shardmaster and retries at B), then with A forwarding them
+// to B. Every request takes kHop at the stand-ins (shardmaster included), as
+// if each were a round trip away. Reports the mean latency of the clients'
+// first Gets and of all of them, and the requests each server saw. Then
+// checks each kind of forwarded request, and that servers that disagree on
+// a key don't forward it back and forth.
+
+constexpr std::size_t kClients = 8;
+constexpr std::size_t kOps = 20;
+constexpr std::size_t kKeys = 100;
+constexpr milliseconds kHop = 5ms;
+
+std::string a_address() {
+  return test_address(1);
+}
+std::string b_address() {
+  return test_address(2);
+}
+
+// The whole keyspace on server.
+ShardmasterConfig all_on(const std::string& server) {
+  return ShardmasterConfig{{{server, split_into(1)}}};
+}
+
+std::string key_name(std::size_t i) {
+  return "key" + std::to_string(i);
+}
+
+// A KvServer stand-in at self, with view's current config as its own:
+// serves the keys it owns there from store, and if *forward is set, passes
+// requests for the rest on the way a KvServer with options.forward_misrouted
+// does. Each request takes kHop.
+TestServer::Handler server_handler(MapKvStore* store, const std::string& self,
+                                   ConfigHistory* view,
+                                   const std::atomic<bool>* forward) {
+  auto pool = std::make_shared<ConnectionPool>();
+  auto kv = kv_handler(store, [self, view](const std::string& key) {
+    return ShardRouter(view->current()).get_server(key) == self;
+  });
+  return [=](const Request& req, ClientConn* client) -> Response {
+    std::this_thread::sleep_for(kHop);
+    Response res = kv(req, client);
+    auto* refused = std::get_if<ErrorResponse>(&res);
+    if (!*forward || !refused || !is_not_responsible_error(refused->msg) ||
+        !client->accepts_config_hints) {
+      return res;
+    }
+    uint64_t version = view->version();
+    auto forwarded =
+        forward_request(pool.get(), ShardRouter(view->current()), version,
+                        self, req, client);
+    return forwarded ? *forwarded : res;
+  };
+}
+
+// A shardmaster stand-in for history, taking kHop per request.
+TestServer::Handler shardmaster_handler(ConfigHistory* history) {
+  auto watch = watch_handler(history);
+  return [watch](const Request& req, ClientConn* client) {
+    std::this_thread::sleep_for(kHop);
+    return watch(req, client);
+  };
+}
+
+// Runs a round of stale clients against the servers, reporting it; returns
+// the clients' mean latency on their first Gets.
+double run_clients(const std::string& sm_addr, ConfigHistory* history,
+                   TestServer* shardmaster, TestServer* a, TestServer* b,
+                   const char* label) {
+  history->publish(all_on(a_address()));
+  std::vector<std::unique_ptr<ShardKvClient>> clients;
+  for (std::size_t c = 0; c < kClients; c++) {
+    // (Never refreshed for age, only for misroutes)
+    clients.push_back(std::make_unique<ShardKvClient>(sm_addr, false, 1h));
+    ASSERT(clients.back()->Get(key_name(c)).has_value());
+  }
+  history->publish(all_on(b_address()));
+
+  std::size_t before[3] = {a->n_requests, b->n_requests,
+                           shardmaster->n_requests};
+  std::atomic<int64_t> first_us = 0, total_us = 0;
+  std::vector<std::thread> threads;
+  for (std::size_t c = 0; c < kClients; c++) {
+    threads.emplace_back([&, c] {
+      for (std::size_t i = 0; i < kOps; i++) {
+        std::string key = key_name((c * kOps + i) % kKeys);
+        auto start = steady_clock::now();
+        auto value = clients[c]->Get(key);
+        int64_t us =
+            duration_cast<microseconds>(steady_clock::now() - start).count();
+        ASSERT(value.has_value());
+        ASSERT_EQ(*value, "v" + key);
+        if (i == 0) first_us += us;
+        total_us += us;
+      }
+    });
+  }
+  for (auto&& thread : threads) thread.join();
+  clients.clear();
+
+  double first = double(first_us) / kClients / 1000;
+  double mean = double(total_us) / (kClients * kOps) / 1000;
+  std::cout << std::setw(9) << label << " | " << std::fixed
+            << std::setprecision(2) << std::setw(10) << first << " | "
+            << std::setw(9) << mean << " | " << std::setw(3)
+            << a->n_requests - before[0] << " | " << std::setw(3)
+            << b->n_requests - before[1] << " | " << std::setw(11)
+            << shardmaster->n_requests - before[2] << '\n';
+  return first;
+}
+
+void test_stale_clients() {
+  ConfigHistory history;
+  std::atomic<bool> forward = false;
+  MapKvStore a_store, b_store;
+  for (std::size_t i = 0; i < kKeys; i++) {
+    PutRequest req{key_name(i), "v" + key_name(i)};
+    PutResponse res;
+    a_store.Put(&req, &res);
+    b_store.Put(&req, &res);
+  }
+  TestServer shardmaster(test_address(0), shardmaster_handler(&history));
+  TestServer a(a_address(),
+               server_handler(&a_store, a_address(), &history, &forward));
+  TestServer b(b_address(),
+               server_handler(&b_store, b_address(), &history, &forward));
+  ASSERT(shardmaster.start() && a.start() && b.start());
+
+  std::cout << kClients << " clients, " << kOps << " Gets each, "
+            << kHop.count() << "ms per request\n"
+            << "misroutes | first (ms) | mean (ms) | A   | B   | shardmaster\n";
+  double refused =
+      run_clients(shardmaster.address, &history, &shardmaster, &a, &b,
+                  "refused");
+  forward = true;
+  std::size_t a_before = a.n_requests;
+  double forwarded =
+      run_clients(shardmaster.address, &history, &shardmaster, &a, &b,
+                  "forwarded");
+  // One round trip saved (of three)...
+  ASSERT(forwarded < 0.85 * refused);
+  // ...and the clients still catch up with the config (each sends A its
+  // warm-up Get, and a Get or two while the refresh is on its way)
+  ASSERT(a.n_requests - a_before < kClients * kOps / 4);
+
+  history.close();
+  a.stop();
+  b.stop();
+  shardmaster.stop();
+}
+
+void test_forwarded_requests() {
+  ConfigHistory view;
+  view.publish(all_on(b_address()));
+  uint64_t version = view.version();
+  std::atomic<bool> forward = true;
+  MapKvStore a_store, b_store;
+  TestServer a(a_address(),
+               server_handler(&a_store, a_address(), &view, &forward));
+  TestServer b(b_address(),
+               server_handler(&b_store, b_address(), &view, &forward));
+  ASSERT(a.start() && b.start());
+
+  // Each request to A is answered by B, with A's config version
+  SimpleClient client(a_address());
+  ASSERT(client.Put("k1", "v1"));
+  ASSERT_EQ(*client.config_hint(), version);
+  ASSERT(client.Append("k1", "+"));
+  ASSERT(client.MultiPut({"k2", "k3"}, {"v2", "v3"}));
+  ASSERT_EQ(*client.Get("k1"), "v1+");
+  ASSERT_EQ(*client.config_hint(), version);
+  ASSERT(*client.MultiGet({"k2", "k3"}) ==
+         std::vector<std::string>({"v2", "v3"}));
+  ASSERT_EQ(*client.Delete("k3"), "v3");
+  microseconds lease;
+  ASSERT_EQ(*client.GetLeased("k2", &lease), "v2");
+  ASSERT(lease > 0us);
+  ASSERT(a_store.AllKeys().empty());
+  ASSERT(b_store.AllKeys() == std::vector<std::string>({"k1", "k2"}));
+
+  // Values too large for one chunk come from B whole, then a chunk at a time
+  // from A
+  std::string large(STREAM_CHUNK_SIZE * 5 / 2, 'x');
+  PutRequest put_req{"large", large};
+  PutResponse put_res;
+  b_store.Put(&put_req, &put_res);
+  std::size_t b_before = b.n_requests;
+  ASSERT(*client.Get("large") == large);
+  ASSERT_EQ(b.n_requests - b_before, std::size_t(1));
+
+  // Answers are forwarded as they are, but for refusals
+  ASSERT(!client.Get("missing").has_value());
+  ASSERT(!is_not_responsible_error(client.last_error()));
+  ASSERT_EQ(*client.config_hint(), version);
+
+  // Clients that don't take hints are refused, as before
+  std::shared_ptr<ServerConn> conn = connect_to_server(a_address());
+  conn->config_hints = false;
+  ASSERT(conn->send_request(GetRequest{"k1"}));
+  auto res = conn->recv_response();
+  ASSERT(res && std::holds_alternative<ErrorResponse>(*res));
+  ASSERT(!conn->config_hint);
+  conn.reset();
+
+  a.stop();
+  b.stop();
+}
+
+void test_disagreeing_servers() {
+  // Each thinks the other has the keys
+  ConfigHistory a_view, b_view;
+  a_view.publish(all_on(b_address()));
+  b_view.publish(all_on(a_address()));
+  std::atomic<bool> forward = true;
+  MapKvStore a_store, b_store;
+  TestServer a(a_address(),
+               server_handler(&a_store, a_address(), &a_view, &forward));
+  TestServer b(b_address(),
+               server_handler(&b_store, b_address(), &b_view, &forward));
+  ASSERT(a.start() && b.start());
+
+  // B refuses A's forward, rather than forward it back, and so does A
+  SimpleClient client(a_address());
+  ASSERT(!client.Put("k", "v"));
+  ASSERT(is_not_responsible_error(client.last_error()));
+  ASSERT(!client.config_hint());
+  ASSERT_EQ(a.n_requests.load(), std::size_t(1));
+  ASSERT_EQ(b.n_requests.load(), std::size_t(1));
+
+  a.stop();
+  b.stop();
+}
+
+int main() {
+  TEST(test_stale_clients);
+  TEST(test_forwarded_requests);
+  TEST(test_disagreeing_servers);
+  return 0;
+}
@@ -0,0 +1,148 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "common/config.hpp"
+#include "common/shard.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Compares routing keys through a config by scanning every shard of every
+// server (as ShardmasterConfig::get_server does) against a compiled
+// ShardRouter, with 1000 servers of 10 shards each, reporting the time per
+// lookup. Checks that the router answers exactly as the scan does (down to
+// the index of the key's shard), for
+// ordinary keys and odd ones (short, lowercase, characters outside the shard
+// alphabet), and when the config has gaps, overlaps, or shards too fine to
+// index.
+
+constexpr std::size_t kServers = 1'000;
+constexpr std::size_t kShardsPerServer = 10;
+constexpr std::size_t kLookups = 20'000;
+
+// ShardmasterConfig::get_server, minus the logging: a linear scan,
+// upper-casing the key first.
+std::optional<std::string> scan(const ShardmasterConfig& config,
+                                const std::string& key) {
+  std::string key_uppercase = to_upper(key);
+  for (auto&& sc : config.servers) {
+    for (auto&& s : sc.shards) {
+      if (s.contains(key_uppercase)) return sc.server;
+    }
+  }
+  return std::nullopt;
+}
+
+// The same scan, for the index of key's shard (counting each server's in
+// turn, as ShardRouter::route does).
+std::optional<std::size_t> scan_shard(const ShardmasterConfig& config,
+                                      const std::string& key) {
+  std::string key_uppercase = to_upper(key);
+  std::size_t shard = 0;
+  for (auto&& sc : config.servers) {
+    for (auto&& s : sc.shards) {
+      if (s.contains(key_uppercase)) return shard;
+      shard++;
+    }
+  }
+  return std::nullopt;
+}
+
+void check_route(const ShardRouter& router, const ShardmasterConfig& config,
+                 const std::string& key) {
+  ASSERT(router.get_server(key) == scan(config, key));
+  ShardRouter::Route route = router.route(key);
+  std::optional<std::size_t> shard;
+  if (route.server) shard = route.shard;
+  ASSERT(shard == scan_shard(config, key));
+}
+
+// kServers servers, with the shards dealt out round-robin.
+ShardmasterConfig make_config() {
+  std::vector<Shard> shards = split_into(kServers * kShardsPerServer);
+  ShardmasterConfig config;
+  for (std::size_t i = 0; i < kServers; i++) {
+    config.servers.push_back({"server" + std::to_string(i), {}});
+  }
+  for (std::size_t i = 0; i < shards.size(); i++) {
+    config.servers[i % kServers].shards.push_back(shards[i]);
+  }
+  return config;
+}
+
+std::vector<std::string> odd_keys() {
+  return {"",      "a",        "Z",     "zz",    "0",     "_",
+          "a_b",   "~~~~",     "9z",    "\xff",  "hello", "HELLO",
+          "key_1", "AAAAAAAA", "zzzzzzz", "zzzzzzzz", "  ", "A\x01"};
+}
+
+void test_agrees() {
+  ShardmasterConfig config = make_config();
+  ShardRouter router(config);
+  std::vector<std::string> keys = make_rand_strs(kLookups, 6);
+  for (auto&& key : odd_keys()) keys.push_back(key);
+  for (std::size_t len = 1; len <= 9; len++) {
+    for (std::size_t i = 0; i < 100; i++) keys.push_back(random_string(len));
+  }
+  for (auto&& key : keys) check_route(router, config, key);
+}
+
+void test_irregular_configs() {
+  std::vector<std::string> keys = make_rand_strs(1'000, 5);
+  for (auto&& key : odd_keys()) keys.push_back(key);
+
+  // Gaps, where keys have no server
+  ShardmasterConfig gaps{{{"a", {{"0", "9"}}}, {"b", {{"MA", "MZ"}}}}};
+  // Overlaps, where the first server listed wins
+  ShardmasterConfig overlaps{
+      {{"a", {{"D", "M"}}}, {"b", {{"0", "F"}, {"K", "Z"}}}}};
+  // Too fine for the router to index
+  ShardmasterConfig fine{{{"a", {{"00000000", "HHHHHHHH"}}},
+                          {"b", {{"HHHHHHHI", "ZZZZZZZZ"}}}}};
+  for (auto&& config : {gaps, overlaps, fine}) {
+    ShardRouter router(config);
+    for (auto&& key : keys) check_route(router, config, key);
+  }
+  ASSERT_EQ(*ShardRouter(overlaps).get_server("E"), "a");
+  ASSERT(!ShardRouter(gaps).get_server("A"));
+  ASSERT(!ShardRouter().get_server("A"));
+}
+
+template <typename Lookup>
+double ns_per_lookup(const std::vector<std::string>& keys, Lookup lookup) {
+  std::size_t found = 0;
+  auto start = steady_clock::now();
+  for (auto&& key : keys) found += lookup(key).has_value();
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+  ASSERT_EQ(found, keys.size());
+  return elapsed * 1e9 / keys.size();
+}
+
+void test_lookup_time() {
+  ShardmasterConfig config = make_config();
+  std::vector<std::string> keys = make_rand_strs(kLookups, 10);
+
+  auto start = steady_clock::now();
+  ShardRouter router(config);
+  double build_us =
+      duration<double>(steady_clock::now() - start).count() * 1e6;
+
+  double scan_ns =
+      ns_per_lookup(keys, [&](auto&& key) { return scan(config, key); });
+  double router_ns =
+      ns_per_lookup(keys, [&](auto&& key) { return router.get_server(key); });
+
+  std::cout << std::fixed << std::setprecision(0) << kServers << " servers, "
+            << kServers * kShardsPerServer << " shards\n"
+            << "linear scan:          " << std::setw(7) << scan_ns
+            << " ns/lookup\n"
+            << "ShardRouter:          " << std::setw(7) << router_ns
+            << " ns/lookup (built in " << build_us << "us)\n";
+  ASSERT(router_ns < scan_ns);
+}
+
+int main() {
+  TEST(test_agrees);
+  TEST(test_irregular_configs);
+  TEST(test_lookup_time);
+  return 0;
+}
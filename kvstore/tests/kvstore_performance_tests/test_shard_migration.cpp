@@ -0,0 +1,251 @@
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "bench/histogram.hpp"
+#include "server/shard_migration.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Moves kKeys pairs of kValueSize bytes out of a server's store to a server
+// standing in for their new owner with a ShardMigration, while a client goes
+// on reading from the source (as clients do until the handover) and times
+// its requests: first with no migration, then an unpaced one, then one paced
+// to kRate. Reports migration throughput and the reader's p50/p99. Then
+// checks that writes and deletes made during a migration reach the
+// destination, that a handover to a destination that stalls gives up by its
+// deadline, and that batches a destination refuses (not yet expecting them)
+// are sent again.
+
+constexpr std::size_t kKeys = 20'000;
+constexpr std::size_t kValueSize = 1024;
+constexpr uint64_t kRate = 8ull << 20;
+constexpr milliseconds kBaselineTime = 1s;
+
+std::string key_name(std::size_t i) {
+  return "key" + std::to_string(i);
+}
+
+void fill(MapKvStore* store) {
+  for (std::size_t i = 0; i < kKeys; i++) {
+    PutRequest req{key_name(i), std::string(kValueSize, 'a' + i % 26)};
+    PutResponse res;
+    store->Put(&req, &res);
+  }
+}
+
+// Whether the two stores hold exactly the same pairs.
+bool same_pairs(MapKvStore* from, MapKvStore* to) {
+  std::vector<std::string> keys = from->AllKeys();
+  if (keys.size() != to->AllKeys().size()) return false;
+  for (auto&& key : keys) {
+    GetRequest req{key};
+    GetResponse a, b;
+    if (!from->Get(&req, &a) || !to->Get(&req, &b) || a.value != b.value) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reads random keys from addr until done is set, timing each.
+LatencyHistogram read_until(const std::string& addr, std::atomic<bool>* done) {
+  LatencyHistogram latencies;
+  std::shared_ptr<ServerConn> conn = connect_to_server(addr);
+  ASSERT(conn);
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<std::size_t> keys(0, kKeys - 1);
+  while (!done->load()) {
+    auto start = steady_clock::now();
+    ASSERT(conn->send_request(GetRequest{key_name(keys(rng))}));
+    auto res = conn->recv_response();
+    ASSERT(res && std::holds_alternative<GetResponse>(*res));
+    latencies.record(steady_clock::now() - start);
+  }
+  return latencies;
+}
+
+void test_foreground_impact(const std::string& source_addr,
+                            const std::string& dest_addr) {
+  MapKvStore source;
+  fill(&source);
+  TestServer source_server(source_addr, kv_handler(&source));
+  ASSERT(source_server.start());
+
+  std::cout << kKeys << " keys of " << kValueSize << " bytes\n"
+            << "migration | MB/s   | time (ms) | reads | p50 (us) | p99 (us)\n";
+  struct Run {
+    std::string label;
+    bool migrate;
+    uint64_t rate;
+  };
+  for (auto&& [label, migrate, rate] :
+       {Run{"none", false, 0}, Run{"unpaced", true, 0},
+        Run{std::to_string(kRate >> 20) + " MB/s", true, kRate}}) {
+    MapKvStore dest;
+    TestServer dest_server(dest_addr, kv_handler(&dest));
+    ASSERT(dest_server.start());
+
+    std::atomic<bool> done = false;
+    LatencyHistogram latencies;
+    std::thread reader([&] { latencies = read_until(source_addr, &done); });
+    MigrationStats stats;
+    if (!migrate) {
+      std::this_thread::sleep_for(kBaselineTime);
+    } else {
+      ShardMigration migration(
+          &source, source_addr, dest_addr,
+          [](const std::string&) { return true; }, rate);
+      ASSERT(migration.run(source.AllKeys()));
+      migration.seal();
+      ASSERT(migration.finish(system_clock::now() +
+                              MIGRATION_HANDOVER_TIMEOUT));
+      stats = migration.stats();
+      ASSERT_EQ(stats.keys, kKeys);
+      ASSERT(same_pairs(&source, &dest));
+    }
+    done = true;
+    reader.join();
+
+    double seconds = duration<double>(stats.elapsed).count();
+    double mb_per_s = migrate ? stats.bytes / seconds / (1 << 20) : 0;
+    std::cout << std::setw(9) << label << " | " << std::fixed
+              << std::setprecision(1) << std::setw(6) << mb_per_s << " | "
+              << std::setw(9)
+              << duration_cast<milliseconds>(stats.elapsed).count() << " | "
+              << std::setw(5) << latencies.count() << " | " << std::setw(8)
+              << duration_cast<microseconds>(latencies.percentile(50)).count()
+              << " | " << std::setw(8)
+              << duration_cast<microseconds>(latencies.percentile(99)).count()
+              << '\n';
+    // Paced, it keeps to the rate (give or take a batch)
+    if (rate > 0) ASSERT(mb_per_s < 1.1 * (rate >> 20));
+    dest_server.stop();
+  }
+  source_server.stop();
+}
+
+void test_forwarded_writes(const std::string& dest_addr) {
+  MapKvStore source, dest;
+  fill(&source);
+  TestServer dest_server(dest_addr, kv_handler(&dest));
+  ASSERT(dest_server.start());
+
+  // Only the even keys move
+  auto covers = [](const std::string& key) { return key.back() % 2 == 0; };
+  ShardMigration migration(&source, "source", dest_addr, covers, kRate);
+  std::vector<std::string> keys;
+  for (auto&& key : source.AllKeys()) {
+    if (covers(key)) keys.push_back(key);
+  }
+
+  // Writes (including to new keys) and deletes while the keys stream out
+  std::atomic<bool> done = false;
+  std::thread writer([&] {
+    std::mt19937 rng(11);
+    std::uniform_int_distribution<std::size_t> pick(0, 2 * kKeys);
+    while (!done) {
+      std::string key = key_name(pick(rng));
+      if (!covers(key)) continue;
+      if (rng() % 4 == 0) {
+        DeleteRequest req{key};
+        DeleteResponse res;
+        source.Delete(&req, &res);
+      } else {
+        PutRequest req{key, "written " + std::to_string(rng())};
+        PutResponse res;
+        source.Put(&req, &res);
+      }
+      migration.forward(key);
+      std::this_thread::sleep_for(100us);
+    }
+  });
+  ASSERT(migration.run(keys));
+  // (Writes are held off for the handover)
+  done = true;
+  writer.join();
+  migration.seal();
+  ASSERT(migration.finish(system_clock::now() + MIGRATION_HANDOVER_TIMEOUT));
+
+  MapKvStore moved;
+  for (auto&& key : source.AllKeys()) {
+    if (!covers(key)) continue;
+    GetRequest get_req{key};
+    GetResponse get_res;
+    ASSERT(source.Get(&get_req, &get_res));
+    PutRequest put_req{key, get_res.value};
+    PutResponse put_res;
+    moved.Put(&put_req, &put_res);
+  }
+  ASSERT(same_pairs(&moved, &dest));
+  dest_server.stop();
+}
+
+void test_handover_deadline(const std::string& dest_addr) {
+  MapKvStore source;
+  PutRequest put_req{"key", "value"};
+  PutResponse put_res;
+  source.Put(&put_req, &put_res);
+  // Takes far longer to answer than a handover may
+  TestServer dest_server(dest_addr, [](const Request&, ClientConn*) {
+    std::this_thread::sleep_for(1s);
+    return Response{MigrateResponse{}};
+  });
+  ASSERT(dest_server.start());
+
+  ShardMigration migration(
+      &source, "source", dest_addr, [](const std::string&) { return true; },
+      0);
+  ASSERT(migration.run({}));
+  migration.forward("key");
+  migration.seal();
+  auto start = steady_clock::now();
+  ASSERT(!migration.finish(system_clock::now() + 100ms));
+  ASSERT(steady_clock::now() - start < 500ms);
+  dest_server.stop();
+}
+
+void test_refused_until_expected(const std::string& dest_addr) {
+  MapKvStore source;
+  fill(&source);
+  // Refuses the first few batches, as a destination that hasn't caught up
+  // to the config yet does; then takes them, remembering who sent them and
+  // whether it was told the handover was over
+  MapKvStore dest;
+  LeaseTable leases;
+  std::atomic<int> refusals = 3;
+  std::atomic<bool> done = false;
+  std::string sender;
+  TestServer dest_server(dest_addr, [&](const Request& req, ClientConn*) {
+    auto& migrate_req = std::get<MigrateRequest>(req);
+    if (refusals-- > 0) return Response{ErrorResponse{MIGRATION_REFUSED_ERROR}};
+    ASSERT(!done);
+    sender = migrate_req.source;
+    done = migrate_req.done;
+    return apply_migration(&dest, &leases, migrate_req);
+  });
+  ASSERT(dest_server.start());
+
+  ShardMigration migration(
+      &source, "source", dest_addr, [](const std::string&) { return true; },
+      0);
+  ASSERT(migration.run(source.AllKeys()));
+  ASSERT(!done);
+  migration.seal();
+  ASSERT(migration.finish(system_clock::now() + MIGRATION_HANDOVER_TIMEOUT));
+  ASSERT(done);
+  ASSERT(sender == "source");
+  ASSERT(same_pairs(&source, &dest));
+  dest_server.stop();
+}
+
+int main() {
+  TEST(test_foreground_impact, test_address(0), test_address(1));
+  TEST(test_forwarded_writes, test_address(2));
+  TEST(test_handover_deadline, test_address(3));
+  TEST(test_refused_until_expected, test_address(4));
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "bench/shard_sim.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Runs the shard simulator on kKeys made-up keys over kServers servers:
+// checks that a join under consistent hashing moves about 1/N of the keys
+// (where an even split moves most), that Moves carve shards out of their
+// holders' as asked, that load-aware placement evens out a hot key range,
+// and that events a policy's shardmaster would refuse are refused.
+
+constexpr std::size_t kServers = 8;
+constexpr std::size_t kKeys = 20'000;
+
+std::string server_name(std::size_t i) {
+  return "server" + std::to_string(i);
+}
+
+MembershipEvent event(const std::string& line) {
+  auto parsed = parse_event(line);
+  ASSERT(parsed.has_value());
+  return *parsed;
+}
+
+void join_all(ShardSimulator& sim) {
+  for (std::size_t i = 0; i < kServers; i++) {
+    ASSERT(sim.apply(event("join " + server_name(i))));
+  }
+}
+
+void test_keys_moved() {
+  KeyTrace trace = synthetic_trace(KeyDistribution::UNIFORM, kKeys, kKeys);
+  uint64_t moved[2];
+  for (auto policy : {ShardPolicy::STATIC, ShardPolicy::CONSISTENT}) {
+    ShardSimulator sim(policy, &trace);
+    join_all(sim);
+    PlacementStats before = sim.measure();
+    ASSERT_EQ(before.servers, kServers);
+    ASSERT_EQ(before.keys_moved, uint64_t(0));
+    ASSERT_EQ(before.keys_unplaced, uint64_t(0));
+    ASSERT(before.key_imbalance >= 1 && before.key_imbalance < 2);
+
+    ASSERT(sim.apply(event("join newcomer")));
+    PlacementStats after = sim.measure();
+    ASSERT_EQ(after.servers, kServers + 1);
+    moved[policy == ShardPolicy::CONSISTENT] = after.keys_moved;
+    std::cout << policy_name(policy) << ": " << after.keys_moved
+              << " keys moved\n";
+  }
+  // About 1/9 of the keys move to the newcomer, against most of them
+  ASSERT(moved[1] < kKeys / 5);
+  ASSERT(moved[0] > 3 * moved[1]);
+}
+
+void test_moves() {
+  KeyTrace trace = synthetic_trace(KeyDistribution::UNIFORM, kKeys, kKeys);
+  ShardSimulator sim(ShardPolicy::STATIC, &trace);
+  join_all(sim);
+  sim.measure();
+
+  // Whole buckets, and part of one, from their servers
+  ASSERT(sim.apply(event("move server1 0 4 a0 ah")));
+  ASSERT(sim.apply(event("move server2 B C")));
+  PlacementStats stats = sim.measure();
+  ShardRouter router(sim.config());
+  ShardmasterConfig config = sim.config();
+  uint64_t expected = 0;
+  for (auto&& key : trace.keys) {
+    std::string owner = *router.get_server(key);
+    ASSERT_EQ(owner, *config.get_server(key));
+    if (key[0] <= '4' || (key[0] == 'A' && key[1] <= 'H')) {
+      ASSERT_EQ(owner, server_name(1));
+      expected++;
+    } else if (key[0] == 'B' || key[0] == 'C') {
+      ASSERT_EQ(owner, server_name(2));
+      expected++;
+    }
+  }
+  // (Less whatever was there already)
+  ASSERT(stats.keys_moved > 0 && stats.keys_moved < expected);
+  ASSERT_EQ(stats.keys_unplaced, uint64_t(0));
+}
+
+void test_rebalance() {
+  // A uniform spread of keys, and a hot range of them
+  std::ostringstream lines;
+  KeyTrace cold = synthetic_trace(KeyDistribution::UNIFORM, kKeys, kKeys);
+  for (auto&& key : cold.keys) lines << key << '\n';
+  for (int i = 0; i < 2000; i++) {
+    for (int access = 0; access < 10; access++) {
+      lines << "A" << i << "hot\n";
+    }
+  }
+  std::istringstream in(lines.str());
+  KeyTrace trace = read_trace(in);
+  ASSERT_EQ(trace.keys.size(), kKeys + 2000);
+  ASSERT_EQ(trace.accesses.back(), uint64_t(10));
+
+  ShardSimulator sim(ShardPolicy::LOAD_AWARE, &trace);
+  join_all(sim);
+  PlacementStats split = sim.measure();
+  ASSERT(sim.apply(event("rebalance")));
+  PlacementStats balanced = sim.measure();
+  std::cout << "load max/mean " << split.load_imbalance << " -> "
+            << balanced.load_imbalance << " (" << balanced.keys_moved
+            << " keys moved)\n";
+  ASSERT(balanced.shards > split.shards);
+  ASSERT(balanced.load_imbalance < split.load_imbalance);
+  ASSERT(balanced.keys_moved > 0);
+}
+
+void test_refused_events() {
+  ASSERT(!parse_event("join").has_value());
+  ASSERT(!parse_event("move server1 A").has_value());
+  ASSERT(!parse_event("move server1 AB C").has_value());
+  ASSERT(!parse_event("move server1 B A").has_value());
+  ASSERT(!parse_event("explode server1").has_value());
+
+  KeyTrace trace = synthetic_trace(KeyDistribution::UNIFORM, 100, 100);
+  ShardSimulator ring(ShardPolicy::CONSISTENT, &trace);
+  join_all(ring);
+  ASSERT(!ring.apply(event("join server0")));
+  ASSERT(!ring.apply(event("leave stranger")));
+  ASSERT(!ring.apply(event("move server0 A B")));
+  ASSERT(ring.apply(event("leave server0")));
+
+  ShardSimulator split(ShardPolicy::STATIC, &trace);
+  join_all(split);
+  ASSERT(!split.apply(event("join server0")));
+  ASSERT(!split.apply(event("move stranger A B")));
+  ShardmasterConfig before = split.config();
+  ASSERT(split.apply(event("rebalance")));
+  ASSERT(split.config().servers[0].shards == before.servers[0].shards);
+
+  LookupCost cost = measure_lookups(ring.config(), trace.keys);
+  ASSERT(cost.router_ns > 0 && cost.scan_ns > 0);
+}
+
+int main() {
+  TEST(test_keys_moved);
+  TEST(test_moves);
+  TEST(test_rebalance);
+  TEST(test_refused_events);
+  return 0;
+}
@@ -0,0 +1,133 @@
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "client/shardkv_client.hpp"
+#include "shardmaster/consistent_shardmaster.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Holds kConns connections open to a shardmaster, as every KvServer and
+// ShardKvClient of a large deployment would, and reports how many threads
+// the shardmaster runs for them. Then sends Queries round-robin over all of
+// them from kDrivers threads, and reports the throughput: first with every
+// connection idle between Queries, then with kWatchers of them also parked
+// in Watches, which must neither hold up the Queries nor miss the next
+// config change.
+
+constexpr std::size_t kConns = 5'000;
+constexpr std::size_t kWatchers = 1'000;
+constexpr std::size_t kDrivers = 8;
+constexpr std::size_t kServers = 8;
+// Few, so Queries mostly measure the connection handling, not the config
+constexpr std::size_t kVnodes = 8;
+constexpr milliseconds kRunTime = 2s;
+
+// Threads in this process.
+std::size_t thread_count() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("Threads:", 0) == 0) return std::stoul(line.substr(8));
+  }
+  return 0;
+}
+
+// Sends Queries over conns[first], conns[first + kDrivers], ... in turn
+// until done, counting them.
+void drive(const std::vector<std::shared_ptr<ServerConn>>& conns,
+           std::size_t first, std::atomic<bool>* done,
+           std::atomic<std::size_t>* queries) {
+  while (!*done) {
+    for (std::size_t i = first; i < conns.size() && !*done; i += kDrivers) {
+      ASSERT(conns[i]->send_request(QueryRequest{}));
+      auto res = conns[i]->recv_response();
+      ASSERT(res && std::holds_alternative<QueryResponse>(*res));
+      ASSERT_EQ(std::get<QueryResponse>(*res).config.servers.size(),
+                kServers);
+      (*queries)++;
+    }
+  }
+}
+
+double query_throughput(const std::vector<std::shared_ptr<ServerConn>>& conns) {
+  std::atomic<bool> done = false;
+  std::atomic<std::size_t> queries = 0;
+  std::vector<std::thread> drivers;
+  for (std::size_t d = 0; d < kDrivers; d++) {
+    drivers.emplace_back(drive, std::cref(conns), d, &done, &queries);
+  }
+  std::this_thread::sleep_for(kRunTime);
+  done = true;
+  for (auto&& driver : drivers) driver.join();
+  return queries / duration<double>(kRunTime).count();
+}
+
+void test_many_connections(const std::string& addr) {
+  ConsistentShardmaster shardmaster(addr, kVnodes);
+  std::size_t threads_before = thread_count();
+  ASSERT(shardmaster.start() == 0);
+  ShardKvClient admin(addr);
+  for (std::size_t i = 0; i < kServers; i++) {
+    ASSERT(admin.Join("server" + std::to_string(i)));
+  }
+
+  std::vector<std::shared_ptr<ServerConn>> conns;
+  for (std::size_t i = 0; i < kConns; i++) {
+    conns.push_back(connect_to_server(addr));
+    ASSERT(conns.back());
+  }
+  double idle = query_throughput(conns);
+  std::size_t threads = thread_count() - threads_before;
+  std::cout << std::fixed << std::setprecision(0) << kConns
+            << " connections: " << threads << " shardmaster threads\n"
+            << "watchers | queries / sec\n"
+            << std::setw(8) << 0 << " | " << std::setw(13) << idle << '\n';
+  // (A thread per connection would be thousands)
+  ASSERT(threads < 32);
+
+  // Watches that won't return until the config changes
+  std::vector<std::shared_ptr<ServerConn>> watchers(conns.end() - kWatchers,
+                                                    conns.end());
+  conns.resize(conns.size() - kWatchers);
+  uint64_t version = 0;
+  {
+    ASSERT(watchers[0]->send_request(WatchRequest{0, 0}));
+    auto res = watchers[0]->recv_response();
+    ASSERT(res && std::holds_alternative<WatchResponse>(*res));
+    version = std::get<WatchResponse>(*res).version;
+  }
+  for (auto&& watcher : watchers) {
+    ASSERT(watcher->send_request(WatchRequest{version, 60'000}));
+  }
+  double watching = query_throughput(conns);
+  std::cout << std::setw(8) << kWatchers << " | " << std::setw(13) << watching
+            << '\n';
+  ASSERT(watching > idle / 2);
+  ASSERT(thread_count() - threads_before < 32);
+
+  // Every watch hears of the next change
+  auto changed = steady_clock::now();
+  ASSERT(admin.Join("server" + std::to_string(kServers)));
+  for (auto&& watcher : watchers) {
+    auto res = watcher->recv_response();
+    ASSERT(res && std::holds_alternative<WatchResponse>(*res));
+    ASSERT_EQ(std::get<WatchResponse>(*res).version, version + 1);
+  }
+  std::cout << kWatchers << " watches answered in "
+            << duration_cast<milliseconds>(steady_clock::now() - changed)
+                   .count()
+            << "ms\n";
+
+  // (The shardmaster closes the connections first, so it's left with their
+  // TIME_WAITs, rather than our thousands of ephemeral ports)
+  shardmaster.stop();
+}
+
+int main() {
+  TEST(test_many_connections, test_address(0));
+  return 0;
+}
@@ -0,0 +1,175 @@
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "client/simple_client.hpp"
+#include "server/value_streams.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Puts and Gets a multi-MB value through SimpleClient, which streams it in
+// STREAM_CHUNK_SIZE chunks, and Puts it as a single message for comparison,
+// reporting throughput and how much each grows peak memory (client and server
+// together). Also checks that chunks arriving out of order are rejected, and
+// that servers that don't stream values still get whole Gets and Puts.
+
+constexpr std::size_t kValueSize = 64 * 1024 * 1024;
+
+// Serves clients one at a time, the way a KvServer worker would. If streams
+// is false, serves them the way a server that predates streamed values would.
+void serve(int listener_fd, KvStore* store, bool streams = true) {
+  while (true) {
+    auto client = accept_client(listener_fd);
+    if (!client) return;
+    while (auto req = client->recv_request()) {
+      if (!streams) client->accepts_value_streams = false;
+      Response res = ErrorResponse{"unexpected request"};
+      if (auto* chunk_req = std::get_if<PutChunkRequest>(&*req)) {
+        if (streams) res = put_value_chunk(store, client.get(), *chunk_req);
+      } else if (auto* chunk_req = std::get_if<GetChunkRequest>(&*req)) {
+        if (streams) res = get_value_chunk(store, client.get(), *chunk_req);
+      } else if (auto* get_req = std::get_if<GetRequest>(&*req)) {
+        GetResponse get_res;
+        res = ErrorResponse{"key does not exist in the KVStore"};
+        if (store->Get(get_req, &get_res)) {
+          res = get_value_response(client.get(), get_req->key,
+                                   std::move(get_res.value));
+        }
+      } else if (auto* put_req = std::get_if<PutRequest>(&*req)) {
+        PutResponse put_res;
+        store->Put(put_req, &put_res);
+        res = put_res;
+      }
+      if (!client->send_response(res)) break;
+    }
+  }
+}
+
+// Peak resident set size so far, in MB
+double peak_rss_mb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.0;
+}
+
+struct Result {
+  double mb_per_sec;
+  double peak_growth_mb;
+};
+
+// Runs op against a fresh server and store in a child process, so that each
+// operation's peak memory is measured on its own. op returns the number of
+// bytes it moved.
+Result measure(const std::string& addr,
+               const std::function<std::size_t()>& op) {
+  int fds[2];
+  ASSERT(pipe(fds) == 0);
+  pid_t pid = fork();
+  ASSERT(pid >= 0);
+  if (pid == 0) {
+    int listener_fd = open_listener_socket(addr);
+    ASSERT(listener_fd >= 0);
+    MapKvStore store;
+    std::thread server(serve, listener_fd, &store, true);
+
+    double rss_before = peak_rss_mb();
+    auto start = steady_clock::now();
+    std::size_t bytes = op();
+    double secs = duration<double>(steady_clock::now() - start).count();
+    Result result{bytes / 1e6 / secs, peak_rss_mb() - rss_before};
+    ASSERT(write(fds[1], &result, sizeof(result)) == sizeof(result));
+    // The server thread is still blocked in accept; just leave
+    _exit(0);
+  }
+
+  Result result;
+  ASSERT(read(fds[0], &result, sizeof(result)) == sizeof(result));
+  int status;
+  waitpid(pid, &status, 0);
+  ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  close(fds[0]);
+  close(fds[1]);
+  return result;
+}
+
+int main() {
+  std::string addr = test_address(0);
+  std::string old_addr = test_address(1);
+
+  std::string value(kValueSize, 'v');
+  for (std::size_t i = 0; i < value.size(); i += 4096) value[i] = 'a' + i % 26;
+
+  Result streamed_put = measure(addr, [&] {
+    SimpleClient client(addr);
+    // (Values are only streamed once the server has said it takes them)
+    ASSERT(client.Put("small", "v"));
+    ASSERT(client.Put("big", value));
+    return value.size();
+  });
+
+  Result streamed_get = measure(addr, [&] {
+    SimpleClient client(addr);
+    ASSERT(client.Put("big", value));
+    auto got = client.Get("big");
+    ASSERT(got.has_value());
+    ASSERT(*got == value);
+    ASSERT(!client.Get("missing").has_value());
+    return 2 * value.size();
+  });
+
+  Result single_put = measure(addr, [&] {
+    auto conn = connect_to_server(addr);
+    ASSERT(conn);
+    ASSERT(conn->send_request(PutRequest{"big", value}));
+    auto res = conn->recv_response();
+    ASSERT(res && std::holds_alternative<PutResponse>(*res));
+    return value.size();
+  });
+
+  // Chunks have to pick up where the last one left off
+  measure(addr, [&] {
+    auto conn = connect_to_server(addr);
+    ASSERT(conn);
+    ASSERT(conn->send_request(PutChunkRequest{"k", 0, "abc", 6}));
+    auto res = conn->recv_response();
+    ASSERT(res && std::holds_alternative<PutChunkResponse>(*res));
+    ASSERT(conn->send_request(PutChunkRequest{"k", 2, "def", 6}));
+    res = conn->recv_response();
+    ASSERT(res && std::holds_alternative<ErrorResponse>(*res));
+    return 6;
+  });
+
+  // A server that doesn't stream values gets the value whole, both ways
+  measure(addr, [&] {
+    int listener_fd = open_listener_socket(old_addr);
+    ASSERT(listener_fd >= 0);
+    MapKvStore store;
+    std::thread(serve, listener_fd, &store, false).detach();
+    std::string medium = value.substr(0, 3 * STREAM_CHUNK_SIZE);
+    SimpleClient client(old_addr);
+    ASSERT(client.Put("small", "v"));
+    ASSERT(client.Put("medium", medium));
+    auto got = client.Get("medium");
+    ASSERT(got.has_value());
+    ASSERT(*got == medium);
+    return 2 * medium.size();
+  });
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << kValueSize / (1024 * 1024) << " MB value        | MB/s   | "
+            << "peak memory growth (MB)\n";
+  std::cout << "streamed Put        | " << std::setw(6)
+            << streamed_put.mb_per_sec << " | " << streamed_put.peak_growth_mb
+            << '\n';
+  std::cout << "streamed Put + Get  | " << std::setw(6)
+            << streamed_get.mb_per_sec << " | " << streamed_get.peak_growth_mb
+            << '\n';
+  std::cout << "single-message Put  | " << std::setw(6) << single_put.mb_per_sec
+            << " | " << single_put.peak_growth_mb << '\n';
+  return 0;
+}
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#include "client/shardkv_client.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Writes kPuts keys through ShardKvClient to 4 stand-in KvServers, first one
+// blocking Put at a time, then as batched PutAsyncs (up to kWindow
+// outstanding) under a few max_delay/max_keys settings. Reports throughput,
+// the requests the servers saw, and each Put's latency from call to
+// completion (with kWindow Puts in flight, mostly time spent queued behind
+// the others); checks every value landed, and that Puts to one key still land
+// in order.
+
+constexpr std::size_t kServers = 4;
+constexpr std::size_t kPuts = 20'000;
+constexpr std::size_t kWindow = 256;
+
+ShardmasterConfig make_config() {
+  ShardmasterConfig config;
+  std::vector<Shard> shards = split_into(kServers);
+  for (std::size_t i = 0; i < kServers; i++) {
+    config.servers.push_back({test_address(1 + i), {shards[i]}});
+  }
+  return config;
+}
+
+struct Servers {
+  std::vector<std::unique_ptr<MapKvStore>> stores;
+  std::vector<std::unique_ptr<TestServer>> servers;
+
+  std::size_t n_requests() {
+    std::size_t n = 0;
+    for (auto& server : servers) n += server->n_requests;
+    return n;
+  }
+};
+
+void report(const std::string& name, double elapsed, std::size_t requests,
+            std::vector<double> latencies_us) {
+  std::sort(latencies_us.begin(), latencies_us.end());
+  double mean = 0;
+  for (double latency : latencies_us) mean += latency / latencies_us.size();
+  double p99 = latencies_us[latencies_us.size() * 99 / 100];
+  std::cout << std::left << std::setw(24) << name << std::right << std::fixed
+            << std::setprecision(0) << std::setw(7) << kPuts / elapsed
+            << " puts/s " << std::setw(6) << requests << " requests"
+            << "   latency mean " << std::setw(6) << mean << "us, p99 "
+            << std::setw(6) << p99 << "us\n";
+}
+
+void check_written(ShardKvClient& client, const std::vector<std::string>& keys,
+                   const std::string& prefix) {
+  for (std::size_t i = 0; i < keys.size(); i += keys.size() / 100) {
+    auto value = client.Get(keys[i]);
+    ASSERT(value.has_value());
+    ASSERT_EQ(*value, prefix + keys[i]);
+  }
+}
+
+void test_unbatched(const std::string& sm_addr, Servers& servers) {
+  ShardKvClient client(sm_addr);
+  std::vector<std::string> keys = make_rand_strs(kPuts, 8);
+  std::vector<double> latencies(kPuts);
+
+  std::size_t before = servers.n_requests();
+  auto start = steady_clock::now();
+  for (std::size_t i = 0; i < kPuts; i++) {
+    auto issued = steady_clock::now();
+    ASSERT(client.Put(keys[i], "u" + keys[i]));
+    latencies[i] =
+        duration<double, std::micro>(steady_clock::now() - issued).count();
+  }
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+  report("unbatched", elapsed, servers.n_requests() - before, latencies);
+  check_written(client, keys, "u");
+}
+
+void test_batched(const std::string& sm_addr, Servers& servers,
+                  microseconds max_delay, std::size_t max_keys) {
+  ShardKvClient client(sm_addr);
+  client.enable_write_batching(max_delay, max_keys);
+  std::vector<std::string> keys = make_rand_strs(kPuts, 8);
+  std::vector<double> latencies(kPuts);
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::size_t outstanding = 0, done = 0;
+  std::size_t before = servers.n_requests();
+  auto start = steady_clock::now();
+  for (std::size_t i = 0; i < kPuts; i++) {
+    {
+      std::unique_lock lock(mtx);
+      cv.wait(lock, [&] { return outstanding < kWindow; });
+      outstanding++;
+    }
+    auto issued = steady_clock::now();
+    client.PutAsync(keys[i], "b" + keys[i], [&, i, issued](bool ok) {
+      ASSERT(ok);
+      std::unique_lock lock(mtx);
+      latencies[i] =
+          duration<double, std::micro>(steady_clock::now() - issued).count();
+      outstanding--;
+      done++;
+      cv.notify_all();
+    });
+  }
+  {
+    std::unique_lock lock(mtx);
+    cv.wait(lock, [&] { return done == kPuts; });
+  }
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+
+  std::ostringstream name;
+  name << "batched " << max_delay.count() << "us/" << max_keys;
+  std::size_t requests = servers.n_requests() - before;
+  report(name.str(), elapsed, requests, latencies);
+  ASSERT(requests < kPuts / 2);
+  check_written(client, keys, "b");
+}
+
+void test_same_key_in_order(const std::string& sm_addr) {
+  ShardKvClient client(sm_addr);
+  client.enable_write_batching(2ms, 1000);
+  std::vector<std::future<bool>> puts;
+  for (int i = 0; i < 100; i++) {
+    puts.push_back(client.PutAsync("counter", std::to_string(i)));
+  }
+  for (auto&& put : puts) ASSERT(put.get());
+  ASSERT_EQ(*client.Get("counter"), "99");
+
+  // A blocking Put is just a batch that gives up waiting after max_delay
+  ASSERT(client.Put("counter", "done"));
+  ASSERT_EQ(*client.Get("counter"), "done");
+
+  // Buffered Puts are written out when the client goes away
+  {
+    ShardKvClient short_lived(sm_addr);
+    short_lived.enable_write_batching(1s, 1000);
+    short_lived.PutAsync("counter", "flushed", [](bool ok) { ASSERT(ok); });
+  }
+  ASSERT_EQ(*client.Get("counter"), "flushed");
+}
+
+int main() {
+  TestServer shardmaster(test_address(0), query_handler(make_config));
+  ASSERT(shardmaster.start());
+
+  Servers servers;
+  for (std::size_t i = 0; i < kServers; i++) {
+    servers.stores.push_back(std::make_unique<MapKvStore>());
+    servers.servers.push_back(std::make_unique<TestServer>(
+        test_address(1 + i), kv_handler(servers.stores.back().get())));
+    ASSERT(servers.servers.back()->start());
+  }
+
+  TEST(test_unbatched, shardmaster.address, servers);
+  TEST(test_batched, shardmaster.address, servers, 200us, 16);
+  TEST(test_batched, shardmaster.address, servers, 500us, 64);
+  TEST(test_batched, shardmaster.address, servers, 2000us, 256);
+  TEST(test_same_key_in_order, shardmaster.address);
+  return 0;
+}
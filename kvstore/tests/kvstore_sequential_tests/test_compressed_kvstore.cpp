@@ -0,0 +1,185 @@
+#include <iostream>
+#include <string>
+
+#include "kvstore/compressed_kvstore.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Checks that CompressedKvStore hands back exactly what was stored, for values
+// on either side of the threshold and for every operation, and that it
+// refuses (rather than crashes on) stored values that have been corrupted.
+// The inner store is MapKvStore, since it doesn't depend on the stencil.
+
+constexpr std::size_t kThreshold = 64;
+
+// A compressible value of n bytes.
+std::string make_value(std::size_t n) {
+  std::string value;
+  while (value.size() < n) {
+    value += "{\"id\":" + std::to_string(value.size()) + "},";
+  }
+  value.resize(n);
+  return value;
+}
+
+struct Stores {
+  MapKvStore* inner;
+  std::unique_ptr<CompressedKvStore> store;
+};
+
+Stores make_stores() {
+  auto inner = std::make_unique<MapKvStore>();
+  auto* raw = inner.get();
+  return {raw,
+          std::make_unique<CompressedKvStore>(std::move(inner), kThreshold)};
+}
+
+std::string stored_value(MapKvStore* inner, const std::string& key) {
+  GetRequest req{key};
+  GetResponse res;
+  ASSERT(inner->Get(&req, &res));
+  return res.value;
+}
+
+void test_put_get_round_trip() {
+  auto [inner, store] = make_stores();
+  for (std::size_t n : std::initializer_list<std::size_t>{
+           0, 1, kThreshold - 1, kThreshold, 1000, 100'000}) {
+    std::string key = "key" + std::to_string(n);
+    std::string value = make_value(n);
+    PutRequest put_req{key, value};
+    PutResponse put_res;
+    ASSERT(store->Put(&put_req, &put_res));
+
+    GetRequest get_req{key};
+    GetResponse get_res;
+    ASSERT(store->Get(&get_req, &get_res));
+    ASSERT(get_res.value == value);
+
+    // Large values are actually stored compressed
+    if (n >= 1000) ASSERT(stored_value(inner, key).size() < n);
+  }
+}
+
+void test_incompressible_round_trip() {
+  auto [inner, store] = make_stores();
+  std::mt19937 gen(26);
+  std::string value(10'000, '\0');
+  for (auto& c : value) c = static_cast<char>(gen());
+
+  PutRequest put_req{"random", value};
+  PutResponse put_res;
+  ASSERT(store->Put(&put_req, &put_res));
+  // Stored raw (plus the tag), since compressing wouldn't shrink it
+  ASSERT_EQ(stored_value(inner, "random").size(), value.size() + 1);
+
+  GetRequest get_req{"random"};
+  GetResponse get_res;
+  ASSERT(store->Get(&get_req, &get_res));
+  ASSERT(get_res.value == value);
+}
+
+void test_append_across_threshold() {
+  auto [inner, store] = make_stores();
+  std::string expected;
+  // Starts out raw, then crosses the threshold and gets compressed
+  for (int i = 0; i < 200; i++) {
+    std::string part = make_value(10 + i % 7);
+    AppendRequest req{"appended", part};
+    AppendResponse res;
+    ASSERT(store->Append(&req, &res));
+    expected += part;
+  }
+  GetRequest get_req{"appended"};
+  GetResponse get_res;
+  ASSERT(store->Get(&get_req, &get_res));
+  ASSERT(get_res.value == expected);
+  ASSERT(stored_value(inner, "appended").size() < expected.size());
+}
+
+void test_multiput_multiget_delete() {
+  auto [inner, store] = make_stores();
+  MultiPutRequest mput_req{{"a", "b", "c"},
+                           {make_value(5), make_value(500), make_value(5000)}};
+  MultiPutResponse mput_res;
+  ASSERT(store->MultiPut(&mput_req, &mput_res));
+
+  MultiGetRequest mget_req{{"c", "a", "b"}};
+  MultiGetResponse mget_res;
+  ASSERT(store->MultiGet(&mget_req, &mget_res));
+  ASSERT(mget_res.values.size() == 3);
+  ASSERT(mget_res.values[0] == mput_req.values[2]);
+  ASSERT(mget_res.values[1] == mput_req.values[0]);
+  ASSERT(mget_res.values[2] == mput_req.values[1]);
+
+  DeleteRequest del_req{"c"};
+  DeleteResponse del_res;
+  ASSERT(store->Delete(&del_req, &del_res));
+  ASSERT(del_res.value == mput_req.values[2]);
+  ASSERT(check_equality(store->AllKeys(), {"a", "b"}));
+
+  // Mismatched keys and values are still refused
+  MultiPutRequest bad_req{{"x", "y"}, {"1"}};
+  ASSERT(!store->MultiPut(&bad_req, &mput_res));
+}
+
+void test_corrupt_stored_values() {
+  auto [inner, store] = make_stores();
+  PutRequest put_req{"key", make_value(10'000)};
+  PutResponse put_res;
+  ASSERT(store->Put(&put_req, &put_res));
+  std::string good = stored_value(inner, "key");
+
+  std::vector<std::string> corrupt = {
+      // Empty (no tag)
+      "",
+      // Compressed tag, but too short for the length prefix
+      std::string("\1\x10", 2),
+      // Truncated anywhere along the way
+      good.substr(0, good.size() / 2),
+      good.substr(0, good.size() - 1),
+      // Claims to decompress to 4GB
+      std::string("\1\xFF\xFF\xFF\xFF", 5) + good.substr(5),
+  };
+  // Bytes flipped all over the compressed body
+  for (std::size_t i = 5; i < good.size(); i += good.size() / 16) {
+    std::string flipped = good;
+    flipped[i] = static_cast<char>(~flipped[i]);
+    corrupt.push_back(flipped);
+  }
+
+  for (auto&& bad : corrupt) {
+    PutRequest raw_put{"key", bad};
+    ASSERT(inner->Put(&raw_put, &put_res));
+
+    // Corruption that happens to still decode must decode to the right
+    // length; anything else is refused
+    GetRequest get_req{"key"};
+    GetResponse get_res;
+    if (store->Get(&get_req, &get_res)) {
+      ASSERT_EQ(get_res.value.size(), put_req.value.size());
+    }
+
+    MultiGetRequest mget_req{{"key"}};
+    MultiGetResponse mget_res;
+    if (store->MultiGet(&mget_req, &mget_res)) {
+      ASSERT_EQ(mget_res.values[0].size(), put_req.value.size());
+    }
+
+    // Appending to a value we can't read fails without clobbering it
+    AppendRequest app_req{"key", "more"};
+    AppendResponse app_res;
+    if (!store->Append(&app_req, &app_res)) {
+      ASSERT(stored_value(inner, "key") == bad);
+    }
+  }
+}
+
+int main() {
+  TEST(test_put_get_round_trip);
+  TEST(test_incompressible_round_trip);
+  TEST(test_append_across_threshold);
+  TEST(test_multiput_multiget_delete);
+  TEST(test_corrupt_stored_values);
+  return 0;
+}
@@ -0,0 +1,90 @@
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "kvstore/key_counting_kvstore.hpp"
+#include "test_utils/test_servers.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Checks that KeyCountingKvStore reports each key added to or taken out of
+// the store exactly once, whichever operation does it, and nothing for
+// overwrites, appends to existing keys, or failed writes. The inner store is
+// MapKvStore, since it doesn't depend on the stencil.
+
+struct Counted {
+  std::unique_ptr<KeyCountingKvStore> store;
+  // Net change reported per key.
+  std::map<std::string, int> changes;
+  int total = 0;
+};
+
+std::unique_ptr<Counted> make_store() {
+  auto counted = std::make_unique<Counted>();
+  auto* raw = counted.get();
+  counted->store = std::make_unique<KeyCountingKvStore>(
+      std::make_unique<MapKvStore>(),
+      [raw](const std::string& key, int change) {
+        raw->changes[key] += change;
+        raw->total += change;
+      });
+  return counted;
+}
+
+void test_put_append_delete() {
+  auto counted = make_store();
+  auto& store = counted->store;
+
+  PutRequest put_req{"a", "1"};
+  PutResponse put_res;
+  ASSERT(store->Put(&put_req, &put_res));
+  ASSERT(store->Put(&put_req, &put_res));
+  ASSERT_EQ(counted->changes["a"], 1);
+
+  // Appending to a nonexistent key inserts it; to an existing one doesn't
+  AppendRequest append_req{"b", "2"};
+  AppendResponse append_res;
+  ASSERT(store->Append(&append_req, &append_res));
+  ASSERT(store->Append(&append_req, &append_res));
+  ASSERT_EQ(counted->changes["b"], 1);
+  ASSERT_EQ(counted->total, 2);
+
+  DeleteRequest delete_req{"a"};
+  DeleteResponse delete_res;
+  ASSERT(store->Delete(&delete_req, &delete_res));
+  ASSERT(delete_res.value == "1");
+  ASSERT(!store->Delete(&delete_req, &delete_res));
+  ASSERT_EQ(counted->changes["a"], 0);
+  ASSERT_EQ(counted->total, 1);
+  ASSERT(!store->Contains("a"));
+  ASSERT(store->Contains("b"));
+}
+
+void test_multiput() {
+  auto counted = make_store();
+  auto& store = counted->store;
+
+  PutRequest put_req{"a", "1"};
+  PutResponse put_res;
+  ASSERT(store->Put(&put_req, &put_res));
+
+  // "a" is already there, and "c" comes up twice
+  MultiPutRequest multiput_req{{"a", "b", "c", "c"}, {"1", "2", "3", "4"}};
+  MultiPutResponse multiput_res;
+  ASSERT(store->MultiPut(&multiput_req, &multiput_res));
+  ASSERT_EQ(counted->changes["a"], 1);
+  ASSERT_EQ(counted->changes["b"], 1);
+  ASSERT_EQ(counted->changes["c"], 1);
+  ASSERT_EQ(counted->total, 3);
+
+  // Mismatched keys and values are refused, and add nothing
+  MultiPutRequest bad_req{{"x", "y"}, {"1"}};
+  ASSERT(!store->MultiPut(&bad_req, &multiput_res));
+  ASSERT_EQ(counted->total, 3);
+  ASSERT(check_equality(store->AllKeys(), {"a", "b", "c"}));
+}
+
+int main() {
+  TEST(test_put_append_delete);
+  TEST(test_multiput);
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "common/lz.hpp"
+#include "net/network_messages.hpp"
+#include "test_utils/test_utils.hpp"
+
+// Round-trips the LZ codec (and compressed messages) over edge-case inputs,
+// and feeds it malformed, truncated and oversized buffers, which it must
+// refuse without reading or writing out of bounds (run with ASAN=1 to check
+// the latter).
+
+constexpr int kMutations = 20'000;
+
+std::string repeat(const std::string& s, std::size_t n) {
+  std::string out;
+  while (out.size() < n) out += s;
+  out.resize(n);
+  return out;
+}
+
+void check_round_trip(const std::string& value) {
+  std::string compressed = lz_compress(value);
+  ASSERT(compressed.size() <= lz_compress_bound(value.size()));
+  auto decompressed = lz_decompress(compressed);
+  ASSERT(decompressed.has_value());
+  ASSERT(*decompressed == value);
+}
+
+void test_round_trips() {
+  std::mt19937 gen(26);
+  std::string random(100'000, '\0');
+  for (auto& c : random) c = static_cast<char>(gen());
+
+  // Short inputs around the format's minimum match/literal limits
+  for (std::size_t n = 0; n < 40; n++) {
+    check_round_trip(std::string(n, 'a'));
+    check_round_trip(random.substr(0, n));
+  }
+  // Long runs (overlapping matches, long length encodings)
+  check_round_trip(std::string(1'000'000, '\0'));
+  check_round_trip(repeat("ab", 70'000));
+  check_round_trip(repeat("0123456789", 300'000));
+  // Matches further apart than the maximum offset
+  check_round_trip(random.substr(0, 70'000) + random.substr(0, 70'000));
+  // Incompressible
+  check_round_trip(random);
+}
+
+void test_malformed_input() {
+  std::string good = lz_compress(repeat("{\"key\":\"value\"},", 20'000));
+
+  // Too short for the length prefix
+  for (std::size_t n = 0; n < 4; n++) {
+    ASSERT(!lz_decompress(good.substr(0, n)).has_value());
+  }
+  // Truncated anywhere in the body
+  for (std::size_t n = 4; n < good.size(); n += 1 + n / 8) {
+    ASSERT(!lz_decompress(good.substr(0, n)).has_value());
+  }
+  // Trailing garbage
+  ASSERT(!lz_decompress(good + "x").has_value());
+
+  // A match reaching back before the start of the output
+  std::string bad_offset("\x08\x00\x00\x00\x10X\x05\x00", 8);
+  ASSERT(!lz_decompress(bad_offset).has_value());
+  // Offset 0
+  std::string zero_offset("\x08\x00\x00\x00\x10X\x00\x00", 8);
+  ASSERT(!lz_decompress(zero_offset).has_value());
+  // Literals running past the end of the input
+  std::string long_literals("\x10\x00\x00\x00\xF0\x40"
+                            "abc",
+                            9);
+  ASSERT(!lz_decompress(long_literals).has_value());
+
+  // Random byte flips: anything that decodes has the length it claims
+  std::mt19937 gen(26);
+  std::uniform_int_distribution<std::size_t> pos(0, good.size() - 1);
+  for (int i = 0; i < kMutations; i++) {
+    std::string bad = good;
+    for (int j = 0; j < 1 + i % 4; j++) {
+      bad[pos(gen)] = static_cast<char>(gen());
+    }
+    auto out = lz_decompress(bad);
+    if (out) {
+      std::size_t claimed = 0;
+      for (int b = 0; b < 4; b++) {
+        claimed |= std::size_t(static_cast<uint8_t>(bad[b])) << (8 * b);
+      }
+      ASSERT_EQ(out->size(), claimed);
+    }
+  }
+}
+
+void test_oversized_input() {
+  // A length prefix claiming far more than the body could expand to is
+  // refused up front, rather than allocated
+  std::string huge("\xFF\xFF\xFF\xFF\x00", 5);
+  ASSERT(!lz_decompress(huge).has_value());
+  std::string compressed = lz_compress(std::string(1000, 'z'));
+  compressed[3] = '\x7F';
+  ASSERT(!lz_decompress(compressed).has_value());
+
+  // So is anything that would decompress to more than the caller allows
+  std::string zs(16, 'z');
+  auto bytes =
+      lz_compress(reinterpret_cast<const std::byte*>(zs.data()), zs.size());
+  ASSERT(lz_decompress(bytes.data(), bytes.size(), 16).has_value());
+  ASSERT(!lz_decompress(bytes.data(), bytes.size(), 15).has_value());
+
+  // A body that expands to more than its prefix claims is refused too
+  compressed = lz_compress(std::string(1000, 'z'));
+  compressed[0] = '\x10';
+  compressed[1] = '\0';
+  ASSERT(!lz_decompress(compressed).has_value());
+}
+
+void test_compressed_messages() {
+  std::string value = repeat("compress me ", 10'000);
+  auto msg = serialize_request(PutRequest{"key", value});
+  ASSERT(msg.has_value());
+  compress_message(&*msg);
+  ASSERT(msg->flags & FLAG_COMPRESSED);
+
+  // Intact, it decompresses back to the original request
+  Message copy = *msg;
+  ASSERT(decompress_message(&copy));
+  ASSERT(!(copy.flags & FLAG_COMPRESSED));
+  auto req = deserialize_request(copy);
+  ASSERT(req.has_value());
+  ASSERT(std::get<PutRequest>(*req).value == value);
+
+  // Truncated, it's refused
+  Message truncated = *msg;
+  truncated.buf.resize(truncated.buf.size() / 2);
+  truncated.sz = truncated.buf.size();
+  ASSERT(!decompress_message(&truncated));
+
+  // A body that isn't compressed at all, but is flagged as if it were
+  auto plain = serialize_request(PutRequest{"key", value});
+  ASSERT(plain.has_value());
+  plain->flags |= FLAG_COMPRESSED;
+  ASSERT(!decompress_message(&*plain));
+}
+
+int main() {
+  TEST(test_round_trips);
+  TEST(test_malformed_input);
+  TEST(test_oversized_input);
+  TEST(test_compressed_messages);
+  return 0;
+}